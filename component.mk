@@ -5,7 +5,7 @@
 COMPONENT_SRCDIRS := src
 COMPONENT_ADD_INCLUDEDIRS := src/include
 
-COMPONENT_OBJS := src/ps4.o src/ps4_spp.o src/ps4_parser.o src/ps4_l2cap.o
+COMPONENT_OBJS := src/ps4.o src/ps4_spp.o src/ps4_parser.o src/ps4_l2cap.o src/ps4_hid.o src/ps4_sensor.o src/ps4_stick.o src/ps4_storage.o src/ps4_filter.o src/ps4_predict.o src/ps4_resample.o src/ps4_batch.o src/ps4_window.o src/ps4_action.o src/ps4_touch.o src/ps4_gesture.o src/ps4_rumble.o src/ps4_lightbar.o src/ps4_audio.o src/ps4_bond.o src/ps4_reconnect.o src/ps4_allow.o src/ps4_gap.o
 
 COMPONENT_EXTRA_INCLUDES +=     $(IDF_PATH)/components/bt/common/include/                     \
                                 $(IDF_PATH)/components/bt/host/bluedroid/common/include/      \
@@ -20,4 +20,4 @@ COMPONENT_EXTRA_INCLUDES +=     $(IDF_PATH)/components/bt/bluedroid/common/inclu
                                 $(IDF_PATH)/components/bt/bluedroid/stack/l2cap/include         \
 								$(IDF_PATH)/components/bt/bluedroid/osi/include
 
-COMPONENT_DEPENDS := bt
+COMPONENT_DEPENDS := bt nvs_flash
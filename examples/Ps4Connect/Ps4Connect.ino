@@ -11,9 +11,20 @@ void setup() {
 }
 
 void loop() {
-  if (PS4.isConnected()) {
-    Serial.println("Connected!");
+  // Sleeps until the controller connects instead of polling isConnected()
+  if (!PS4.waitForConnection(3000)) {
+    return;
   }
 
-  delay(3000);
+  Serial.println("Connected!");
+
+  // Sleeps until the controller sends its next report. This returns false
+  // once the controller disconnects, or sends nothing for 3 seconds.
+  while (PS4.waitForEvent(3000)) {
+    if (PS4.pressedEdges() != 0) {
+      Serial.println("Button pressed");
+    }
+  }
+
+  Serial.println(PS4.isConnected() ? "No report for 3 seconds" : "Disconnected");
 }
@@ -11,11 +11,28 @@ extern "C" {
   (uint8_t*)addr + 0, (uint8_t*)addr + 1, (uint8_t*)addr + 2, \
   (uint8_t*)addr + 3, (uint8_t*)addr + 4, (uint8_t*)addr + 5
 
+static const EventBits_t _event_bit = BIT0;
+static const EventBits_t _connected_bit = BIT1;
+static const EventBits_t _disconnected_bit = BIT2;
+
 PS4Controller::PS4Controller() {}
 
 bool PS4Controller::begin() {
-  ps4SetEventObjectCallback(this, &PS4Controller::_event_callback);
-  ps4SetConnectionObjectCallback(this, &PS4Controller::_connection_callback);
+  return _begin(&PS4Controller::_event_callback, &PS4Controller::_connection_callback);
+}
+
+bool PS4Controller::begin(const char* mac) {
+  return _setBluetoothMac(mac) && begin();
+}
+
+bool PS4Controller::_begin(ps4_event_object_v2_callback_t eventCallback,
+  ps4_connection_object_callback_t connectionCallback) {
+  if (_events == nullptr) {
+    _events = xEventGroupCreate();
+  }
+
+  ps4SetEventObjectCallbackV2(this, eventCallback);
+  ps4SetConnectionObjectCallback(this, connectionCallback);
 
   if (!btStarted() && !btStart()) {
     log_e("btStart failed");
@@ -41,7 +58,7 @@ bool PS4Controller::begin() {
   return true;
 }
 
-bool PS4Controller::begin(const char* mac) {
+bool PS4Controller::_setBluetoothMac(const char* mac) {
   esp_bd_addr_t addr;
     
   if (sscanf(mac, ESP_BD_ADDR_STR, ESP_BD_ADDR_HEX_PTR(addr)) != ESP_BD_ADDR_LEN) {
@@ -50,8 +67,7 @@ bool PS4Controller::begin(const char* mac) {
   }
 
   ps4SetBluetoothMacAddress(addr);
-
-  return begin();
+  return true;
 }
 
 void PS4Controller::end() {}
@@ -76,22 +92,31 @@ void PS4Controller::setFlashRate(uint8_t onTime, uint8_t offTime) {
 
 void PS4Controller::sendToController() { ps4SetOutput(output); }
 
-void PS4Controller::attach(callback_t callback) { _callback_event = callback; }
+void PS4Controller::setFilter(ps4_channel_t channel, float minCutoff, float beta, float dCutoff) {
+  ps4_filter_params_t params = {minCutoff, beta, dCutoff};
+  ps4SetFilter(channel, &params);
+}
+
+void PS4Controller::attach(function_t callback) { _callback_event = callback; }
 
-void PS4Controller::attachOnConnect(callback_t callback) {
+void PS4Controller::attachOnConnect(function_t callback) {
   _callback_connect = callback;
 }
 
-void PS4Controller::attachOnDisconnect(callback_t callback) {
+void PS4Controller::attachOnDisconnect(function_t callback) {
   _callback_disconnect = callback;
 }
 
 void PS4Controller::_event_callback(
-  void* object, ps4_t data, ps4_event_t event) {
+  void* object, const ps4_t* data, const ps4_event_t* event) {
   PS4Controller* This = (PS4Controller*)object;
 
-  memcpy(&This->data, &data, sizeof(ps4_t));
-  memcpy(&This->event, &event, sizeof(ps4_event_t));
+  // The report record is only valid during the callback, so keep
+  // the snapshot that loop() reads through data and event
+  memcpy(&This->data, data, sizeof(ps4_t));
+  memcpy(&This->event, event, sizeof(ps4_event_t));
+
+  This->_notifyEvent();
 
   if (This->_callback_event) {
     This->_callback_event();
@@ -102,20 +127,195 @@ void PS4Controller::_connection_callback(void* object, uint8_t isConnected) {
   PS4Controller* This = (PS4Controller*)object;
 
   if (isConnected) {
-    delay(250);  // ToDo: figure out how to know when the channel is free again
-                 // so this delay can be removed
+    _waitForChannel();
+    This->_notifyConnection(true);
 
     if (This->_callback_connect) {
       This->_callback_connect();
     }
   }
   else {
+    This->_notifyConnection(false);
+
     if (This->_callback_disconnect) {
       This->_callback_disconnect();
     }
   }
 }
 
+bool PS4Controller::waitForEvent(uint32_t timeoutMs) {
+  if (_events == nullptr) {
+    return false;
+  }
+
+  // Only reports arriving after this call count as the next event. A
+  // disconnect after the check below still sets the bit cleared here.
+  xEventGroupClearBits(_events, _event_bit | _disconnected_bit);
+  if ((xEventGroupGetBits(_events) & _connected_bit) == 0) {
+    return false;
+  }
+
+  TickType_t ticks = timeoutMs == WaitForever ? portMAX_DELAY : pdMS_TO_TICKS(timeoutMs);
+  EventBits_t bits = xEventGroupWaitBits(_events, _event_bit | _disconnected_bit, pdFALSE, pdFALSE, ticks);
+
+  return (bits & _event_bit) != 0;
+}
+
+bool PS4Controller::waitForConnection(uint32_t timeoutMs) {
+  if (_events == nullptr) {
+    return false;
+  }
+
+  TickType_t ticks = timeoutMs == WaitForever ? portMAX_DELAY : pdMS_TO_TICKS(timeoutMs);
+  EventBits_t bits = xEventGroupWaitBits(_events, _connected_bit, pdFALSE, pdFALSE, ticks);
+
+  return (bits & _connected_bit) != 0;
+}
+
+PS4Controller::Edges PS4Controller::consumeEdges() {
+  Edges edges;
+
+  portENTER_CRITICAL(&_edgeLock);
+  edges = _edges;
+  _edges = {};
+  portEXIT_CRITICAL(&_edgeLock);
+
+  return edges;
+}
+
+uint8_t PS4Controller::pressCount(Button button) {
+  uint8_t count;
+
+  portENTER_CRITICAL(&_edgeLock);
+  count = _edges.presses[bitIndex(button)];
+  _edges.presses[bitIndex(button)] = 0;
+  _edges.pressed &= ~mask(button);
+  portEXIT_CRITICAL(&_edgeLock);
+
+  return count;
+}
+
+uint8_t PS4Controller::releaseCount(Button button) {
+  uint8_t count;
+
+  portENTER_CRITICAL(&_edgeLock);
+  count = _edges.releases[bitIndex(button)];
+  _edges.releases[bitIndex(button)] = 0;
+  _edges.released &= ~mask(button);
+  portEXIT_CRITICAL(&_edgeLock);
+
+  return count;
+}
+
+void PS4Controller::_notifyEvent() {
+  if (_events != nullptr) {
+    xEventGroupSetBits(_events, _event_bit);
+  }
+
+  _latchEdges();
+  _resumeAwaiters(true);
+}
+
+// Resumes the coroutines waiting for this report, or all of them with
+// nothing received once the controller disconnected
+void PS4Controller::_resumeAwaiters(bool isConnected) {
+  if (_awaiterCount == 0) {
+    return;
+  }
+
+  // Collect the coroutines to resume under the lock, but resume them
+  // outside of it since they may immediately await again
+  _Awaiter ready[PS4_MAX_AWAITERS];
+  uint8_t readyCount = 0;
+
+  portENTER_CRITICAL(&_awaiterLock);
+  for (uint8_t i = 0; i < PS4_MAX_AWAITERS; i++) {
+    _Awaiter& awaiter = _awaiters[i];
+
+    if (awaiter.handle != nullptr &&
+        (!isConnected || awaiter.buttons == 0 || (event.button_down.mask & awaiter.buttons))) {
+      ready[readyCount++] = awaiter;
+      awaiter.handle = nullptr;
+      _awaiterCount = _awaiterCount - 1;
+    }
+  }
+  portEXIT_CRITICAL(&_awaiterLock);
+
+  for (uint8_t i = 0; i < readyCount; i++) {
+    *ready[i].received = isConnected;
+    ready[i].resume(ready[i].handle);
+  }
+}
+
+void PS4Controller::_latchEdges() {
+  uint32_t pressed = event.button_down.mask;
+  uint32_t released = event.button_up.mask;
+
+  if ((pressed | released) == 0) {
+    return;
+  }
+
+  portENTER_CRITICAL(&_edgeLock);
+  _edges.pressed |= pressed;
+  _edges.released |= released;
+
+  // Visit only the set bits, usually none or one per report
+  for (uint32_t bits = pressed; bits; bits &= bits - 1) {
+    uint8_t& count = _edges.presses[__builtin_ctz(bits)];
+    count += count < UINT8_MAX;
+  }
+  for (uint32_t bits = released; bits; bits &= bits - 1) {
+    uint8_t& count = _edges.releases[__builtin_ctz(bits)];
+    count += count < UINT8_MAX;
+  }
+  portEXIT_CRITICAL(&_edgeLock);
+}
+
+void PS4Controller::_notifyConnection(bool isConnected) {
+  if (!isConnected) {
+    _resumeAwaiters(false);
+  }
+
+  if (_events == nullptr) {
+    return;
+  }
+
+  if (isConnected) {
+    xEventGroupSetBits(_events, _connected_bit);
+  }
+  else {
+    xEventGroupClearBits(_events, _connected_bit);
+    xEventGroupSetBits(_events, _disconnected_bit);
+  }
+}
+
+bool PS4Controller::_addAwaiter(void* handle, void (*resume)(void* handle), uint32_t buttons, bool* received) {
+  bool added = false;
+
+  portENTER_CRITICAL(&_awaiterLock);
+  for (uint8_t i = 0; i < PS4_MAX_AWAITERS; i++) {
+    if (_awaiters[i].handle == nullptr) {
+      _awaiters[i] = {handle, resume, buttons, received};
+      _awaiterCount = _awaiterCount + 1;
+      added = true;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&_awaiterLock);
+
+  if (!added) {
+    log_e("Too many coroutines awaiting the controller, raise PS4_MAX_AWAITERS");
+  }
+
+  // Returning false resumes the coroutine right away
+  return added;
+}
+
+void PS4Controller::_waitForChannel() {
+  delay(250);  // ToDo: figure out how to know when the channel is free again
+               // so this delay can be removed
+}
+
 #if !defined(NO_GLOBAL_INSTANCES)
 PS4Controller PS4;
 #endif
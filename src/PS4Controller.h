@@ -2,6 +2,20 @@
 #define PS4Controller_h
 
 #include "Arduino.h"
+#include "PS4InplaceFunction.h"
+#include "freertos/event_groups.h"
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define PS4_HAS_COROUTINES 1
+#endif
+#endif
+
+/** Number of coroutines that can await controller input at the same time */
+#ifndef PS4_MAX_AWAITERS
+#define PS4_MAX_AWAITERS 4
+#endif
 
 extern "C" {
 #include "ps4.h"
@@ -10,6 +24,53 @@ extern "C" {
 class PS4Controller {
  public:
   typedef void (*callback_t)();
+  typedef PS4InplaceFunction<void()> function_t;
+
+  enum class Button : uint32_t {
+    Right = ps4_button_mask_right,
+    Down = ps4_button_mask_down,
+    Up = ps4_button_mask_up,
+    Left = ps4_button_mask_left,
+
+    Square = ps4_button_mask_square,
+    Cross = ps4_button_mask_cross,
+    Circle = ps4_button_mask_circle,
+    Triangle = ps4_button_mask_triangle,
+
+    UpRight = ps4_button_mask_upright,
+    DownRight = ps4_button_mask_downright,
+    UpLeft = ps4_button_mask_upleft,
+    DownLeft = ps4_button_mask_downleft,
+
+    L1 = ps4_button_mask_l1,
+    R1 = ps4_button_mask_r1,
+    L2 = ps4_button_mask_l2,
+    R2 = ps4_button_mask_r2,
+
+    Share = ps4_button_mask_share,
+    Options = ps4_button_mask_options,
+    L3 = ps4_button_mask_l3,
+    R3 = ps4_button_mask_r3,
+
+    PSButton = ps4_button_mask_ps,
+    Touchpad = ps4_button_mask_touchpad
+  };
+
+  static constexpr uint32_t mask(Button button) { return (uint32_t)button; }
+
+  // Button edges latched by the receive path until the application
+  // consumes them, so polling from a slow loop() misses no taps
+  struct Edges {
+    uint32_t pressed;   // buttons pressed at least once
+    uint32_t released;  // buttons released at least once
+    uint8_t presses[PS4_BUTTON_COUNT];
+    uint8_t releases[PS4_BUTTON_COUNT];
+
+    uint8_t pressCount(Button button) const { return presses[bitIndex(button)]; }
+    uint8_t releaseCount(Button button) const { return releases[bitIndex(button)]; }
+  };
+
+  static constexpr uint8_t bitIndex(Button button) { return __builtin_ctz(mask(button)); }
 
   ps4_t data;
   ps4_event_t event;
@@ -29,40 +90,100 @@ class PS4Controller {
 
   void sendToController();
 
-  void attach(callback_t callback);
-  void attachOnConnect(callback_t callback);
-  void attachOnDisconnect(callback_t callback);
+  // Smooth a channel with a One-Euro filter, see ps4_filter_params_t.
+  // A minCutoff of 0 turns the filter off again.
+  void setFilter(ps4_channel_t channel, float minCutoff, float beta, float dCutoff = 1.0f);
+
+  void attach(function_t callback);
+  void attachOnConnect(function_t callback);
+  void attachOnDisconnect(function_t callback);
+
+  static constexpr uint32_t WaitForever = 0xFFFFFFFF;
+
+  // Sleep the calling task until the next report arrives, instead of
+  // polling in loop(). Returns false at once when no controller is
+  // connected, or when it disconnects or the timeout expires first.
+  bool waitForEvent(uint32_t timeoutMs = WaitForever);
+  bool waitForConnection(uint32_t timeoutMs = WaitForever);
+
+#ifdef PS4_HAS_COROUTINES
+  // Awaitable for the next report, or the next press of one of the given
+  // buttons. The coroutine is resumed on the Bluetooth task, like the
+  // attach() callbacks. co_await yields false if the controller
+  // disconnected instead.
+  class EventAwaiter {
+   public:
+    EventAwaiter(PS4Controller& ps4, uint32_t buttons) : _ps4(ps4), _buttons(buttons) {}
+
+    bool await_ready() const { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) {
+      _received = false;
+      return _ps4._addAwaiter(handle.address(), &_resume, _buttons, &_received);
+    }
+    bool await_resume() const { return _received; }
+
+   private:
+    static void _resume(void* handle) {
+      std::coroutine_handle<>::from_address(handle).resume();
+    }
+
+    PS4Controller& _ps4;
+    uint32_t _buttons;
+    bool _received = false;
+  };
+
+  EventAwaiter nextEvent() { return EventAwaiter(*this, 0); }
+  EventAwaiter buttonDown(Button button) { return EventAwaiter(*this, mask(button)); }
+  EventAwaiter buttonDown(uint32_t buttons) { return EventAwaiter(*this, buttons); }
+#endif
 
   uint8_t* LatestPacket() { return data.latestPacket; }
 
 public:
-  bool Right() { return data.button.right; }
-  bool Down() { return data.button.down; }
-  bool Up() { return data.button.up; }
-  bool Left() { return data.button.left; }
-
-  bool Square() { return data.button.square; }
-  bool Cross() { return data.button.cross; }
-  bool Circle() { return data.button.circle; }
-  bool Triangle() { return data.button.triangle; }
-
-  bool UpRight() { return data.button.upright; }
-  bool DownRight() { return data.button.downright; }
-  bool UpLeft() { return data.button.upleft; }
-  bool DownLeft() { return data.button.downleft; }
-
-  bool L1() { return data.button.l1; }
-  bool R1() { return data.button.r1; }
-  bool L2() { return data.button.l2; }
-  bool R2() { return data.button.r2; }
-
-  bool Share() { return data.button.share; }
-  bool Options() { return data.button.options; }
-  bool L3() { return data.button.l3; }
-  bool R3() { return data.button.r3; }
-
-  bool PSButton() { return data.button.ps; }
-  bool Touchpad() { return data.button.touchpad; }
+  // Packed button state, one bit per PS4Controller::Button
+  uint32_t Buttons() { return data.button.mask; }
+  uint32_t pressedEdges() { return event.button_down.mask; }
+  uint32_t releasedEdges() { return event.button_up.mask; }
+
+  // A chord such as L1 + R1 + Cross is a single mask compare
+  bool anyOf(uint32_t buttons) { return (data.button.mask & buttons) != 0; }
+  bool allOf(uint32_t buttons) { return (data.button.mask & buttons) == buttons; }
+  bool anyOf(Button button) { return anyOf(mask(button)); }
+  bool allOf(Button button) { return allOf(mask(button)); }
+
+  // Take the presses and releases since the last call. The single button
+  // variants only take that button's count and leave the others latched.
+  Edges consumeEdges();
+  uint8_t pressCount(Button button);
+  uint8_t releaseCount(Button button);
+
+  bool Right() { return anyOf(Button::Right); }
+  bool Down() { return anyOf(Button::Down); }
+  bool Up() { return anyOf(Button::Up); }
+  bool Left() { return anyOf(Button::Left); }
+
+  bool Square() { return anyOf(Button::Square); }
+  bool Cross() { return anyOf(Button::Cross); }
+  bool Circle() { return anyOf(Button::Circle); }
+  bool Triangle() { return anyOf(Button::Triangle); }
+
+  bool UpRight() { return anyOf(Button::UpRight); }
+  bool DownRight() { return anyOf(Button::DownRight); }
+  bool UpLeft() { return anyOf(Button::UpLeft); }
+  bool DownLeft() { return anyOf(Button::DownLeft); }
+
+  bool L1() { return anyOf(Button::L1); }
+  bool R1() { return anyOf(Button::R1); }
+  bool L2() { return anyOf(Button::L2); }
+  bool R2() { return anyOf(Button::R2); }
+
+  bool Share() { return anyOf(Button::Share); }
+  bool Options() { return anyOf(Button::Options); }
+  bool L3() { return anyOf(Button::L3); }
+  bool R3() { return anyOf(Button::R3); }
+
+  bool PSButton() { return anyOf(Button::PSButton); }
+  bool Touchpad() { return anyOf(Button::Touchpad); }
 
   uint8_t L2Value() { return data.analog.button.l2; }
   uint8_t R2Value() { return data.analog.button.r2; }
@@ -72,20 +193,123 @@ public:
   int8_t RStickX() { return data.analog.stick.rx; }
   int8_t RStickY() { return data.analog.stick.ry; }
 
+  // Calibrated, see PS4_GYRO_RES_PER_DEG_S and PS4_ACC_RES_PER_G
+  int16_t GyrX() { return data.sensor.gyroscope.x; }
+  int16_t GyrY() { return data.sensor.gyroscope.y; }
+  int16_t GyrZ() { return data.sensor.gyroscope.z; }
+  int16_t AccX() { return data.sensor.accelerometer.x; }
+  int16_t AccY() { return data.sensor.accelerometer.y; }
+  int16_t AccZ() { return data.sensor.accelerometer.z; }
+
+  // Controller clock in microseconds, wraps around
+  uint32_t Timestamp() { return data.timestamp; }
+
   uint8_t Battery() { return data.status.battery; }
   bool Charging() { return data.status.charging; }
   bool Audio() { return data.status.audio; }
   bool Mic() { return data.status.mic; }
 
+ protected:
+  bool _begin(ps4_event_object_v2_callback_t eventCallback,
+    ps4_connection_object_callback_t connectionCallback);
+  static bool _setBluetoothMac(const char* mac);
+  static void _waitForChannel();
+
+  void _notifyEvent();
+  void _notifyConnection(bool isConnected);
+  void _latchEdges();
+  void _resumeAwaiters(bool isConnected);
+
  private:
-  static void _event_callback(void* object, ps4_t data, ps4_event_t event);
+  static void _event_callback(void* object, const ps4_t* data, const ps4_event_t* event);
   static void _connection_callback(void* object, uint8_t isConnected);
 
-  callback_t _callback_event = nullptr;
-  callback_t _callback_connect = nullptr;
-  callback_t _callback_disconnect = nullptr;
+  // Stored as plain pointers so the layout doesn't depend on whether the
+  // including file was compiled with coroutine support
+  struct _Awaiter {
+    void* handle;
+    void (*resume)(void* handle);
+    uint32_t buttons;
+    bool* received;
+  };
+
+  bool _addAwaiter(void* handle, void (*resume)(void* handle), uint32_t buttons, bool* received);
+
+  EventGroupHandle_t _events = nullptr;
+  _Awaiter _awaiters[PS4_MAX_AWAITERS] = {};
+  volatile uint8_t _awaiterCount = 0;
+  portMUX_TYPE _awaiterLock = portMUX_INITIALIZER_UNLOCKED;
+
+  Edges _edges = {};
+  portMUX_TYPE _edgeLock = portMUX_INITIALIZER_UNLOCKED;
+
+  function_t _callback_event;
+  function_t _callback_connect;
+  function_t _callback_disconnect;
 };
 
+/* Empty handler to derive from, so a handler only has to define the
+ * notifications it is interested in */
+struct PS4Handler {
+  void onEvent(PS4Controller& ps4) {}
+  void onConnect(PS4Controller& ps4) {}
+  void onDisconnect(PS4Controller& ps4) {}
+};
+
+/* PS4Controller whose handlers are bound at compile time. The receive path
+ * calls straight into Handler, so the calls can be inlined instead of going
+ * through a second indirect call per report. */
+template <typename Handler>
+class PS4ControllerT : public PS4Controller {
+ public:
+  Handler handler;
+
+  PS4ControllerT() {}
+  explicit PS4ControllerT(const Handler& handler) : handler(handler) {}
+
+  bool begin() { return _begin(&_event_callback, &_connection_callback); }
+  bool begin(const char* mac) { return _setBluetoothMac(mac) && begin(); }
+
+  // The notifications go to Handler, which the receive path calls instead
+  // of the attach() callbacks
+  void attach(function_t callback) = delete;
+  void attachOnConnect(function_t callback) = delete;
+  void attachOnDisconnect(function_t callback) = delete;
+
+ private:
+  static void _event_callback(void* object, const ps4_t* data, const ps4_event_t* event) {
+    PS4ControllerT* This = (PS4ControllerT*)object;
+
+    memcpy(&This->data, data, sizeof(ps4_t));
+    memcpy(&This->event, event, sizeof(ps4_event_t));
+
+    This->_notifyEvent();
+    This->handler.onEvent(*This);
+  }
+
+  static void _connection_callback(void* object, uint8_t isConnected) {
+    PS4ControllerT* This = (PS4ControllerT*)object;
+
+    if (isConnected) {
+      _waitForChannel();
+      This->_notifyConnection(true);
+      This->handler.onConnect(*This);
+    }
+    else {
+      This->_notifyConnection(false);
+      This->handler.onDisconnect(*This);
+    }
+  }
+};
+
+constexpr uint32_t operator|(PS4Controller::Button a, PS4Controller::Button b) {
+  return PS4Controller::mask(a) | PS4Controller::mask(b);
+}
+
+constexpr uint32_t operator|(uint32_t a, PS4Controller::Button b) {
+  return a | PS4Controller::mask(b);
+}
+
 #ifndef NO_GLOBAL_INSTANCES
 extern PS4Controller PS4;
 #endif
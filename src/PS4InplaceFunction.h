@@ -0,0 +1,121 @@
+#ifndef PS4InplaceFunction_h
+#define PS4InplaceFunction_h
+
+#include <stddef.h>
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/** Default number of bytes a callable may capture when it is attached */
+#ifndef PS4_INPLACE_FUNCTION_CAPACITY
+#define PS4_INPLACE_FUNCTION_CAPACITY 16
+#endif
+
+/* A std::function replacement that stores the callable inside the object
+ * instead of on the heap. Callables bigger than the capacity are rejected at
+ * compile time, so attaching a capturing lambda never allocates. */
+template <typename Signature, size_t Capacity = PS4_INPLACE_FUNCTION_CAPACITY>
+class PS4InplaceFunction;
+
+template <typename R, typename... Args, size_t Capacity>
+class PS4InplaceFunction<R(Args...), Capacity> {
+ public:
+  PS4InplaceFunction() {}
+  PS4InplaceFunction(std::nullptr_t) {}
+
+  template <typename F,
+    typename = typename std::enable_if<!std::is_same<
+      typename std::decay<F>::type, PS4InplaceFunction>::value>::type>
+  PS4InplaceFunction(F&& f) {
+    typedef typename std::decay<F>::type Fn;
+
+    static_assert(sizeof(Fn) <= Capacity,
+      "Callable is too large for PS4InplaceFunction, raise its capacity");
+    static_assert(alignof(Fn) <= alignof(std::max_align_t),
+      "Callable is over-aligned for PS4InplaceFunction");
+
+    if (_isNull(f)) {
+      return;
+    }
+
+    new (&_storage) Fn(std::forward<F>(f));
+    _ops = &_Ops<Fn>::ops;
+  }
+
+  PS4InplaceFunction(const PS4InplaceFunction& other) : _ops(other._ops) {
+    if (_ops) {
+      _ops->copy(&_storage, &other._storage);
+    }
+  }
+
+  PS4InplaceFunction& operator=(const PS4InplaceFunction& other) {
+    if (this != &other) {
+      _reset();
+      _ops = other._ops;
+      if (_ops) {
+        _ops->copy(&_storage, &other._storage);
+      }
+    }
+    return *this;
+  }
+
+  PS4InplaceFunction& operator=(std::nullptr_t) {
+    _reset();
+    return *this;
+  }
+
+  ~PS4InplaceFunction() { _reset(); }
+
+  explicit operator bool() const { return _ops != nullptr; }
+
+  R operator()(Args... args) const {
+    return _ops->invoke(&_storage, std::forward<Args>(args)...);
+  }
+
+ private:
+  struct Ops {
+    R (*invoke)(void* storage, Args&&... args);
+    void (*copy)(void* dst, const void* src);
+    void (*destroy)(void* storage);
+  };
+
+  template <typename Fn>
+  struct _Ops {
+    static R invoke(void* storage, Args&&... args) {
+      return (*static_cast<Fn*>(storage))(std::forward<Args>(args)...);
+    }
+    static void copy(void* dst, const void* src) {
+      new (dst) Fn(*static_cast<const Fn*>(src));
+    }
+    static void destroy(void* storage) { static_cast<Fn*>(storage)->~Fn(); }
+
+    static const Ops ops;
+  };
+
+  template <typename T>
+  static bool _isNull(T* f) { return f == nullptr; }
+  template <typename T>
+  static bool _isNull(const T&) { return false; }
+
+  void _reset() {
+    if (_ops) {
+      _ops->destroy(&_storage);
+      _ops = nullptr;
+    }
+  }
+
+  const Ops* _ops = nullptr;
+  alignas(std::max_align_t) mutable unsigned char _storage[Capacity];
+};
+
+template <typename R, typename... Args, size_t Capacity>
+template <typename Fn>
+const typename PS4InplaceFunction<R(Args...), Capacity>::Ops
+  PS4InplaceFunction<R(Args...), Capacity>::_Ops<Fn>::ops = {
+    &PS4InplaceFunction<R(Args...), Capacity>::_Ops<Fn>::invoke,
+    &PS4InplaceFunction<R(Args...), Capacity>::_Ops<Fn>::copy,
+    &PS4InplaceFunction<R(Args...), Capacity>::_Ops<Fn>::destroy};
+
+#endif
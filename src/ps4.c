@@ -3,6 +3,7 @@
 #include <esp_system.h>
 #include <string.h>
 
+#include "freertos/FreeRTOS.h"
 #include "ps4_int.h"
 
 /********************************************************************************/
@@ -23,8 +24,18 @@ static ps4_event_callback_t ps4_event_cb = NULL;
 static ps4_event_object_callback_t ps4_event_object_cb = NULL;
 static void* ps4_event_object = NULL;
 
+static ps4_event_v2_callback_t ps4_event_v2_cb = NULL;
+static ps4_event_object_v2_callback_t ps4_event_object_v2_cb = NULL;
+static void* ps4_event_v2_object = NULL;
+
 static bool is_active = false;
 
+/* Output state last sent, so the effect engines can change their own
+ * fields without overwriting the others */
+static ps4_cmd_t output = {0};
+static uint8_t speaker_volume = 0;
+static portMUX_TYPE output_lock = portMUX_INITIALIZER_UNLOCKED;
+
 /********************************************************************************/
 /*                      P U B L I C    F U N C T I O N S */
 /********************************************************************************/
@@ -41,7 +52,23 @@ static bool is_active = false;
 **
 *******************************************************************************/
 void ps4Init() {
+#if CONFIG_PS4_INIT_GAP_ONLY
+  gapInit();
+#else
   sppInit();
+#endif
+  ps4_stick_init();
+
+  // The timers are created here rather than on first use, which could be
+  // from the application task and the timer task at once
+  ps4_hid_init();
+  ps4_rumble_init();
+#if PS4_AUDIO
+  ps4_audio_init();
+#endif
+  ps4_lightbar_init();
+  ps4_reconnect_init();
+
   ps4_l2cap_init_services();
 }
 
@@ -78,7 +105,7 @@ void ps4Enable() {
 
   memcpy(hidCommand.data, hid_cmd_payload_ps4_enable, length);
 
-  ps4_l2cap_send_hid(&hidCommand, length);
+  ps4_hid_submit(&hidCommand, length, NULL, NULL);
   ps4SetLed(32, 32, 200);
 }
 
@@ -99,6 +126,11 @@ void ps4Cmd(ps4_cmd_t cmd) {
   hidCommand.code = hid_cmd_code_set_report | hid_cmd_code_type_output;
   hidCommand.identifier = hid_cmd_identifier_ps4_control;
 
+  portENTER_CRITICAL(&output_lock);
+  output = cmd;
+  uint8_t volume = speaker_volume;
+  portEXIT_CRITICAL(&output_lock);
+
   hidCommand.data[ps4_control_packet_index_small_rumble] = cmd.smallRumble;  // Small Rumble
   hidCommand.data[ps4_control_packet_index_large_rumble] = cmd.largeRumble;  // Big rumble
 
@@ -111,7 +143,11 @@ void ps4Cmd(ps4_cmd_t cmd) {
   // Time to flash dark (255 = 2.5 seconds)
   hidCommand.data[ps4_control_packet_index_flash_off_time] = cmd.flashOff;
 
-  ps4_l2cap_send_hid(&hidCommand, length);
+  hidCommand.data[ps4_control_packet_index_volume_left] = volume;
+  hidCommand.data[ps4_control_packet_index_volume_right] = volume;
+  hidCommand.data[ps4_control_packet_index_volume_speaker] = volume;
+
+  ps4_hid_submit(&hidCommand, length, NULL, NULL);
 }
 
 /*******************************************************************************
@@ -204,6 +240,35 @@ void ps4SetEventObjectCallback(void* object, ps4_event_object_callback_t cb) {
   ps4_event_object = object;
 }
 
+/*******************************************************************************
+**
+** Function         ps4SetEventCallbackV2
+**
+** Description      Registers a callback for receiving PS4 controller events
+**                  by pointer, avoiding a copy of the report per event
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4SetEventCallbackV2(ps4_event_v2_callback_t cb) { ps4_event_v2_cb = cb; }
+
+/*******************************************************************************
+**
+** Function         ps4SetEventObjectCallbackV2
+**
+** Description      Registers a callback for receiving PS4 controller events
+**                  by pointer, avoiding a copy of the report per event
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4SetEventObjectCallbackV2(void* object, ps4_event_object_v2_callback_t cb) {
+  ps4_event_object_v2_cb = cb;
+  ps4_event_v2_object = object;
+}
+
 /*******************************************************************************
 **
 ** Function         ps4SetBluetoothMacAddress
@@ -224,32 +289,197 @@ void ps4SetBluetoothMacAddress(const uint8_t* mac) {
   esp_base_mac_addr_set(baseMac);
 }
 
+/*******************************************************************************
+**
+** Function         ps4GetControllerAddress
+**
+** Description      Copies the Bluetooth address of the controller that
+**                  connected last into a 6 byte buffer.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4GetControllerAddress(uint8_t* mac) {
+  memcpy(mac, ps4_l2cap_peer_address(), 6);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_output_rumble
+**
+** Description      Changes the rumble motors, keeping the rest of the output
+**                  state as last sent. Nothing is sent if the motors are
+**                  already at these values.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_output_rumble(uint8_t small, uint8_t large) {
+  ps4_cmd_t cmd;
+
+  portENTER_CRITICAL(&output_lock);
+  bool changed = output.smallRumble != small || output.largeRumble != large;
+  output.smallRumble = small;
+  output.largeRumble = large;
+  cmd = output;
+  portEXIT_CRITICAL(&output_lock);
+
+  if (changed) {
+    ps4Cmd(cmd);
+  }
+}
+
+/*******************************************************************************
+**
+** Function         ps4_output_led
+**
+** Description      Changes the lightbar color and flashing, keeping the rest
+**                  of the output state as last sent. Nothing is sent if the
+**                  lightbar is already in this state.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_output_led(uint8_t r, uint8_t g, uint8_t b, uint8_t flash_on, uint8_t flash_off) {
+  ps4_cmd_t cmd;
+
+  portENTER_CRITICAL(&output_lock);
+  bool changed = output.r != r || output.g != g || output.b != b ||
+                 output.flashOn != flash_on || output.flashOff != flash_off;
+  output.r = r;
+  output.g = g;
+  output.b = b;
+  output.flashOn = flash_on;
+  output.flashOff = flash_off;
+  cmd = output;
+  portEXIT_CRITICAL(&output_lock);
+
+  if (changed) {
+    ps4Cmd(cmd);
+  }
+}
+
+/*******************************************************************************
+**
+** Function         ps4_output_volume
+**
+** Description      Changes the speaker volume, keeping the rest of the output
+**                  state as last sent. Nothing is sent if the volume is
+**                  already at this value.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_output_volume(uint8_t volume) {
+  ps4_cmd_t cmd;
+
+  portENTER_CRITICAL(&output_lock);
+  bool changed = speaker_volume != volume;
+  speaker_volume = volume;
+  cmd = output;
+  portEXIT_CRITICAL(&output_lock);
+
+  if (changed && ps4IsConnected()) {
+    ps4Cmd(cmd);
+  }
+}
+
+/*******************************************************************************
+**
+** Function         ps4_output_state
+**
+** Description      Copies the output state last sent.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_output_state(ps4_cmd_t* cmd, uint8_t* volume) {
+  portENTER_CRITICAL(&output_lock);
+  *cmd = output;
+  *volume = speaker_volume;
+  portEXIT_CRITICAL(&output_lock);
+}
+
 /********************************************************************************/
 /*                      L O C A L    F U N C T I O N S */
 /********************************************************************************/
 
 void ps4ConnectEvent(uint8_t is_connected) {
     if (is_connected) {
+        ps4_stick_connect(ps4_l2cap_peer_address());
+        ps4_parser_reset();
+        ps4_filter_reset();
+        ps4_predict_reset();
+        ps4_batch_reset();
+#if PS4_MAX_WINDOWS > 0
+        ps4_window_reset();
+#endif
+        ps4_action_reset();
+        ps4_touch_reset();
+        ps4_gesture_reset();
         ps4Enable();
+        ps4_bond_connect(ps4_l2cap_peer_address());
+        ps4_lightbar_restore();
+        ps4_sensor_request_calibration();
+        ps4_reconnect_connect_event(true);
     } else {
+        bool was_active = is_active;
         is_active = false;
+        ps4_hid_reset(ps4_hid_result_disconnected);
+        ps4_batch_reset();
+        ps4_stick_disconnect();
+        ps4_bond_disconnect(ps4_l2cap_peer_address());
+        ps4_reconnect_connect_event(false);
+
+        // Report the loss of a connection that was reported, once for
+        // both channels closing
+        if (was_active) {
+            if(ps4_connection_cb != NULL) {
+                ps4_connection_cb(is_active);
+            }
+
+            if (ps4_connection_object_cb != NULL && ps4_connection_object != NULL) {
+                ps4_connection_object_cb(ps4_connection_object, is_active);
+            }
+        }
     }
 }
 
 
-void ps4PacketEvent(ps4_t ps4, ps4_event_t event) {
+void ps4PacketEvent(const ps4_t* ps4, const ps4_event_t* event) {
     // Trigger packet event, but if this is the very first packet
     // after connecting, trigger a connection event instead
     if (is_active) {
+        if (ps4_event_v2_cb != NULL) {
+            ps4_event_v2_cb(ps4, event);
+        }
+
+        if (ps4_event_object_v2_cb != NULL && ps4_event_v2_object != NULL) {
+            ps4_event_object_v2_cb(ps4_event_v2_object, ps4, event);
+        }
+
+        // The v1 callbacks take the report by value, so only pay for
+        // the copies when one of them is registered
         if(ps4_event_cb != NULL) {
-            ps4_event_cb(ps4, event);
+            ps4_event_cb(*ps4, *event);
         }
 
         if (ps4_event_object_cb != NULL && ps4_event_object != NULL) {
-            ps4_event_object_cb(ps4_event_object, ps4, event);
+            ps4_event_object_cb(ps4_event_object, *ps4, *event);
         }
+
+        ps4_batch_deliver(ps4, event);
+        ps4_action_evaluate(ps4, event);
+        ps4_touch_deliver(ps4);
+        ps4_lightbar_battery(ps4);
     } else {
         is_active = true;
+        ps4_l2cap_first_report();
 
         if(ps4_connection_cb != NULL) {
             ps4_connection_cb(is_active);
@@ -2,6 +2,7 @@
 #define PS4_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /********************************************************************************/
@@ -29,38 +30,82 @@ typedef struct {
   ps4_analog_button_t button;
 } ps4_analog_t;
 
+/* Raw 0-255 readings of each stick axis, in the order lx, ly, rx, ry */
+typedef struct {
+  uint8_t center[4];
+  uint8_t min[4];
+  uint8_t max[4];
+} ps4_stick_calibration_t;
+
 /*********************/
 /*   B U T T O N S   */
 /*********************/
 
-typedef struct {
-  uint8_t right : 1;
-  uint8_t down : 1;
-  uint8_t up : 1;
-  uint8_t left : 1;
+/* Bit of each button in ps4_button_t.mask, in the same order as the
+ * bitfields below so both views describe the same state */
+typedef enum {
+  ps4_button_mask_right = 1 << 0,
+  ps4_button_mask_down = 1 << 1,
+  ps4_button_mask_up = 1 << 2,
+  ps4_button_mask_left = 1 << 3,
+
+  ps4_button_mask_square = 1 << 4,
+  ps4_button_mask_cross = 1 << 5,
+  ps4_button_mask_circle = 1 << 6,
+  ps4_button_mask_triangle = 1 << 7,
+
+  ps4_button_mask_upright = 1 << 8,
+  ps4_button_mask_downright = 1 << 9,
+  ps4_button_mask_upleft = 1 << 10,
+  ps4_button_mask_downleft = 1 << 11,
+
+  ps4_button_mask_l1 = 1 << 12,
+  ps4_button_mask_r1 = 1 << 13,
+  ps4_button_mask_l2 = 1 << 14,
+  ps4_button_mask_r2 = 1 << 15,
 
-  uint8_t square : 1;
-  uint8_t cross : 1;
-  uint8_t circle : 1;
-  uint8_t triangle : 1;
+  ps4_button_mask_share = 1 << 16,
+  ps4_button_mask_options = 1 << 17,
+  ps4_button_mask_l3 = 1 << 18,
+  ps4_button_mask_r3 = 1 << 19,
 
-  uint8_t upright : 1;
-  uint8_t downright : 1;
-  uint8_t upleft : 1;
-  uint8_t downleft : 1;
+  ps4_button_mask_ps = 1 << 20,
+  ps4_button_mask_touchpad = 1 << 21
+} ps4_button_mask_t;
 
-  uint8_t l1 : 1;
-  uint8_t r1 : 1;
-  uint8_t l2 : 1;
-  uint8_t r2 : 1;
+#define PS4_BUTTON_COUNT 22
 
-  uint8_t share : 1;
-  uint8_t options : 1;
-  uint8_t l3 : 1;
-  uint8_t r3 : 1;
+typedef union {
+  struct {
+    uint8_t right : 1;
+    uint8_t down : 1;
+    uint8_t up : 1;
+    uint8_t left : 1;
 
-  uint8_t ps : 1;
-  uint8_t touchpad : 1;
+    uint8_t square : 1;
+    uint8_t cross : 1;
+    uint8_t circle : 1;
+    uint8_t triangle : 1;
+
+    uint8_t upright : 1;
+    uint8_t downright : 1;
+    uint8_t upleft : 1;
+    uint8_t downleft : 1;
+
+    uint8_t l1 : 1;
+    uint8_t r1 : 1;
+    uint8_t l2 : 1;
+    uint8_t r2 : 1;
+
+    uint8_t share : 1;
+    uint8_t options : 1;
+    uint8_t l3 : 1;
+    uint8_t r3 : 1;
+
+    uint8_t ps : 1;
+    uint8_t touchpad : 1;
+  };
+  uint32_t mask;
 } ps4_button_t;
 
 /*******************************/
@@ -78,7 +123,15 @@ typedef struct {
 /*   S E N S O R S  */
 /********************/
 
+/* Sensor values are calibrated fixed point numbers: the gyroscope counts
+ * PS4_GYRO_RES_PER_DEG_S per degree/second and the accelerometer counts
+ * PS4_ACC_RES_PER_G per g */
+#define PS4_GYRO_RES_PER_DEG_S 16
+#define PS4_ACC_RES_PER_G 8192
+
 typedef struct {
+  int16_t x;
+  int16_t y;
   int16_t z;
 } ps4_sensor_gyroscope_t;
 
@@ -93,6 +146,16 @@ typedef struct {
   ps4_sensor_gyroscope_t gyroscope;
 } ps4_sensor_t;
 
+/* Gyroscope zero rate bias learned while the controller is held still,
+ * already subtracted from ps4_sensor_t.gyroscope */
+typedef struct {
+  int16_t x;
+  int16_t y;
+  int16_t z;
+  uint8_t confidence;  // 0 = no recent still samples, 255 = settled
+  bool settling;
+} ps4_gyro_bias_t;
+
 /*******************/
 /*    O T H E R    */
 /*******************/
@@ -116,9 +179,284 @@ typedef struct {
   ps4_button_t button;
   ps4_status_t status;
   ps4_sensor_t sensor;
+  uint32_t timestamp;  // Controller clock in microseconds, wraps around
   uint8_t* latestPacket;
 } ps4_t;
 
+/***********************/
+/*   C H A N N E L S   */
+/***********************/
+
+/* Every analog value of ps4_t, for stages that treat them alike */
+typedef enum {
+  ps4_channel_lx,
+  ps4_channel_ly,
+  ps4_channel_rx,
+  ps4_channel_ry,
+  ps4_channel_l2,
+  ps4_channel_r2,
+  ps4_channel_gyro_x,
+  ps4_channel_gyro_y,
+  ps4_channel_gyro_z,
+  ps4_channel_accel_x,
+  ps4_channel_accel_y,
+  ps4_channel_accel_z
+} ps4_channel_t;
+
+#define PS4_CHANNEL_COUNT 12
+
+/*******************/
+/*   F I L T E R   */
+/*******************/
+
+/* One-Euro filter settings of a channel. The cutoff frequency is
+ * min_cutoff at rest and rises by beta Hz per unit/second of speed, so slow
+ * movements are smoothed and fast ones follow with little lag. A min_cutoff
+ * of 0 passes the channel through unfiltered. */
+typedef struct {
+  float min_cutoff;  // Hz
+  float beta;        // Hz per channel unit/second
+  float d_cutoff;    // Hz, smoothing of the speed estimate
+} ps4_filter_params_t;
+
+/*********************/
+/*   B A T C H E S   */
+/*********************/
+
+/* Reports aggregated over a window, for subscribers that want fewer
+ * updates. min and max are indexed by ps4_channel_t. */
+typedef struct {
+  ps4_t latest;
+  int16_t min[PS4_CHANNEL_COUNT];
+  int16_t max[PS4_CHANNEL_COUNT];
+  ps4_button_t button_down;  // every press in the window
+  ps4_button_t button_up;    // every release in the window
+  uint16_t reports;          // number of reports in the window
+} ps4_batch_t;
+
+/***************************/
+/*   R E S A M P L I N G   */
+/***************************/
+
+/* Cursor producing evenly spaced samples, owned by the caller */
+typedef struct {
+  int64_t time;       // esp_timer_get_time() microseconds of the next sample
+  uint32_t period;    // microseconds between samples
+  uint32_t delay;     // microseconds the samples lag behind real time
+  uint32_t sequence;  // reports consumed, only moves forward
+  bool is_started;    // between ps4ResamplerInit and ps4ResamplerDeinit
+} ps4_resampler_t;
+
+typedef struct {
+  int64_t time;
+  ps4_t state;                        // interpolated analog values
+  ps4_button_t pressed;               // presses since the previous sample
+  ps4_button_t released;              // releases since the previous sample
+  uint8_t presses[PS4_BUTTON_COUNT];  // press count per ps4_button_mask_t bit
+} ps4_resample_t;
+
+/***********************/
+/*   T O U C H P A D   */
+/***********************/
+
+#define PS4_TOUCHPAD_WIDTH 1920
+#define PS4_TOUCHPAD_HEIGHT 943
+#define PS4_TOUCH_CONTACTS 2
+
+typedef struct {
+  uint8_t id;      // chosen by the controller, new for every touch
+  bool active;     // finger on the touchpad
+  bool began;      // touched down in the latest frames
+  bool ended;      // lifted in the latest frames
+  uint16_t x;      // 0 to PS4_TOUCHPAD_WIDTH - 1
+  uint16_t y;      // 0 to PS4_TOUCHPAD_HEIGHT - 1
+  int32_t vx;      // touchpad units per second
+  int32_t vy;
+} ps4_touch_contact_t;
+
+typedef struct {
+  ps4_touch_contact_t contact[PS4_TOUCH_CONTACTS];
+  uint8_t frames;  // touch frames decoded from the latest report
+} ps4_touchpad_t;
+
+/*********************/
+/*   G E S T U R E S   */
+/*********************/
+
+typedef enum {
+  ps4_gesture_tap,     // one finger lifted quickly without moving
+  ps4_gesture_swipe,   // one finger moving
+  ps4_gesture_scroll,  // two fingers moving together
+  ps4_gesture_pinch    // two fingers moving apart or together
+} ps4_gesture_type_t;
+
+typedef enum {
+  ps4_gesture_phase_start,
+  ps4_gesture_phase_update,
+  ps4_gesture_phase_end
+} ps4_gesture_phase_t;
+
+/* Positions are in touchpad units, for two fingers the middle between them */
+typedef struct {
+  uint8_t type;    // ps4_gesture_type_t
+  uint8_t phase;   // ps4_gesture_phase_t
+  uint16_t x;
+  uint16_t y;
+  int16_t dx;      // movement since the gesture started
+  int16_t dy;
+  int16_t spread;  // pinch: change of the finger distance, positive apart
+  int32_t vx;      // touchpad units per second
+  int32_t vy;
+} ps4_gesture_t;
+
+/* Distances in touchpad units a gesture has to move before it starts */
+typedef struct {
+  uint16_t tap_max_ms;
+  uint16_t tap_max_distance;
+  uint16_t swipe_min_distance;
+  uint16_t scroll_min_distance;
+  uint16_t pinch_min_distance;
+} ps4_gesture_thresholds_t;
+
+/*********************/
+/*   A C T I O N S   */
+/*********************/
+
+typedef enum {
+  ps4_action_chord,      // all buttons held together, fires once they are
+  ps4_action_hold,       // all buttons held for time_ms, 0 fires at once
+  ps4_action_double_tap  // all buttons pressed twice within time_ms, not 0
+} ps4_action_kind_t;
+
+/* Maps a combination of ps4_button_mask_t buttons to an application
+ * defined action, e.g. PS4_HOLD(MENU, ps4_button_mask_options, 800) */
+typedef struct {
+  uint16_t action;
+  uint8_t kind;      // ps4_action_kind_t
+  uint16_t time_ms;  // unused for chords
+  uint32_t buttons;
+} ps4_binding_t;
+
+#define PS4_CHORD(action, buttons) \
+  { (action), ps4_action_chord, 0, (buttons) }
+#define PS4_HOLD(action, buttons, time_ms) \
+  { (action), ps4_action_hold, (time_ms), (buttons) }
+#define PS4_DOUBLE_TAP(action, buttons, time_ms) \
+  { (action), ps4_action_double_tap, (time_ms), (buttons) }
+
+/*****************************************/
+/*   H I D   T R A N S A C T I O N S    */
+/*****************************************/
+
+typedef enum {
+  ps4_report_type_input = 0x01,
+  ps4_report_type_output = 0x02,
+  ps4_report_type_feature = 0x03
+} ps4_report_type_t;
+
+/* The first values are the HANDSHAKE result codes of the HID profile */
+typedef enum {
+  ps4_hid_result_success = 0x00,
+  ps4_hid_result_not_ready = 0x01,
+  ps4_hid_result_invalid_report_id = 0x02,
+  ps4_hid_result_unsupported_request = 0x03,
+  ps4_hid_result_invalid_parameter = 0x04,
+  ps4_hid_result_unknown = 0x0E,
+  ps4_hid_result_fatal = 0x0F,
+
+  ps4_hid_result_timeout = 0x10,
+  ps4_hid_result_disconnected = 0x11
+} ps4_hid_result_t;
+
+/*********************/
+/*   S T O R A G E   */
+/*********************/
+
+/* Backend for persisting per controller data. Each entry is a small blob
+ * under a short key that is unique per controller address. */
+typedef struct {
+  bool (*load)(void* context, const char* key, void* data, size_t length);
+  bool (*store)(void* context, const char* key, const void* data, size_t length);
+  void* context;
+} ps4_storage_t;
+
+/* A controller known to the bonding store, with the settings to restore
+ * when it connects again. Link keys are kept by the Bluetooth stack. */
+typedef struct {
+  uint8_t addr[6];
+  uint8_t r, g, b;
+  uint8_t flash_on, flash_off;
+  uint8_t volume;
+  uint32_t last_used;  // higher is more recent
+} ps4_bond_t;
+
+/*****************/
+/*   L 2 C A P   */
+/*****************/
+
+typedef enum {
+  ps4_hid_channel_control,
+  ps4_hid_channel_interrupt,
+  ps4_hid_channel_count
+} ps4_hid_channel_t;
+
+/* L2CAP options asked for when a HID channel is configured. Fields left at
+ * 0 are not sent, so the Bluetooth defaults apply. The flush timeout limits
+ * how long our own packets are retransmitted; the controller picks its own
+ * for the input reports. */
+typedef struct {
+  uint16_t mtu;               // largest packet we accept, in bytes
+  uint16_t flush_timeout_ms;  // 1 = never retransmit
+  bool qos;                   // send the flow spec below
+  uint8_t service_type;       // 1 = best effort, 2 = guaranteed
+  uint32_t token_rate;        // bytes per second
+  uint32_t peak_bandwidth;    // bytes per second, 0 = unknown
+  uint32_t latency_us;
+} ps4_channel_profile_t;
+
+/*****************/
+/*   S T A T S   */
+/*****************/
+
+typedef struct {
+  uint32_t connections;              // connections that delivered a report
+  uint32_t reconnect_attempts;       // controllers paged by ps4StartReconnect
+  uint32_t reconnects;               // connections we paged
+  uint32_t time_to_first_report_ms;  // of the last connection
+  uint32_t rejected_connections;     // channels refused by the allow list
+
+  /* Negotiated on the last connection */
+  uint16_t mtu[ps4_hid_channel_count];               // largest packet the controller accepts
+  uint16_t flush_timeout_ms[ps4_hid_channel_count];  // the controller's, 0xFFFF = no limit
+  bool profile_refused;  // the controller refused a channel profile
+  bool profile_accepted[ps4_hid_channel_count];  // the controller took the options we asked for
+} ps4_stats_t;
+
+/*******************/
+/*   R U M B L E   */
+/*******************/
+
+/* Motor values at a point of a track; values in between keyframes are
+ * interpolated. Keyframes are in increasing time order. */
+typedef struct {
+  uint16_t time_ms;
+  uint8_t small;
+  uint8_t large;
+} ps4_rumble_keyframe_t;
+
+typedef struct {
+  const ps4_rumble_keyframe_t* keyframes;
+  uint8_t count;
+  bool loop;  // start over after the last keyframe until stopped
+} ps4_rumble_track_t;
+
+/* Built in envelopes */
+extern const ps4_rumble_track_t ps4_rumble_click;
+extern const ps4_rumble_track_t ps4_rumble_pulse;
+extern const ps4_rumble_track_t ps4_rumble_ramp_up;
+extern const ps4_rumble_track_t ps4_rumble_ramp_down;
+extern const ps4_rumble_track_t ps4_rumble_engine;
+
 /***************************/
 /*    C A L L B A C K S    */
 /***************************/
@@ -129,6 +467,23 @@ typedef void (*ps4_connection_object_callback_t)(void* object, uint8_t isConnect
 typedef void (*ps4_event_callback_t)(ps4_t ps4, ps4_event_t event);
 typedef void (*ps4_event_object_callback_t)(void* object, ps4_t ps4, ps4_event_t event);
 
+/* The v2 callbacks receive pointers to the library-owned report record, which
+ * stays valid until the callback returns. Copy anything needed afterwards. */
+typedef void (*ps4_event_v2_callback_t)(const ps4_t* ps4, const ps4_event_t* event);
+typedef void (*ps4_event_object_v2_callback_t)(void* object, const ps4_t* ps4, const ps4_event_t* event);
+
+typedef void (*ps4_batch_callback_t)(void* object, const ps4_batch_t* batch);
+typedef void (*ps4_action_callback_t)(void* object, uint16_t action);
+
+/* The contact table stays valid until the callback returns */
+typedef void (*ps4_touchpad_callback_t)(void* object, const ps4_touchpad_t* touchpad);
+typedef void (*ps4_gesture_callback_t)(void* object, const ps4_gesture_t* gesture);
+
+/* Completion of a GET_REPORT/SET_REPORT transaction. For a successful
+ * GET_REPORT, data starts with the report id. */
+typedef void (*ps4_report_callback_t)(void* object, ps4_hid_result_t result,
+                                      const uint8_t* data, uint16_t length);
+
 /********************************************************************************/
 /*                             F U N C T I O N S */
 /********************************************************************************/
@@ -141,8 +496,68 @@ void ps4SetConnectionCallback(ps4_connection_callback_t cb);
 void ps4SetConnectionObjectCallback(void* object, ps4_connection_object_callback_t cb);
 void ps4SetEventCallback(ps4_event_callback_t cb);
 void ps4SetEventObjectCallback(void* object, ps4_event_object_callback_t cb);
+void ps4SetEventCallbackV2(ps4_event_v2_callback_t cb);
+void ps4SetEventObjectCallbackV2(void* object, ps4_event_object_v2_callback_t cb);
 void ps4SetLed(uint8_t r, uint8_t g, uint8_t b);
 void ps4SetOutput(ps4_cmd_t prev_cmd);
 void ps4SetBluetoothMacAddress(const uint8_t* mac);
+bool ps4IsSensorCalibrated();
+void ps4GetGyroBias(ps4_gyro_bias_t* bias);
+void ps4GetControllerAddress(uint8_t* mac);
+void ps4SetStorage(ps4_storage_t storage);
+ps4_storage_t ps4NvsStorage();
+ps4_storage_t ps4FileStorage(const char* directory);
+uint8_t ps4GetBonds(ps4_bond_t* bonds, uint8_t max);
+bool ps4ForgetBond(const uint8_t* addr);
+bool ps4StartReconnect(const uint8_t* addrs, uint8_t count);
+void ps4StopReconnect();
+void ps4GetStats(ps4_stats_t* stats);
+void ps4SetChannelProfile(ps4_hid_channel_t channel, const ps4_channel_profile_t* profile);
+void ps4GetChannelProfile(ps4_hid_channel_t channel, ps4_channel_profile_t* profile);
+bool ps4AllowController(const uint8_t* addr);
+void ps4DisallowController(const uint8_t* addr);
+void ps4ClearAllowList();
+void ps4SetStickCalibrationLearning(bool enable);
+void ps4GetStickCalibration(ps4_stick_calibration_t* calibration);
+void ps4SetStickCalibration(const ps4_stick_calibration_t* calibration);
+bool ps4SaveStickCalibration();
+void ps4SetFilter(ps4_channel_t channel, const ps4_filter_params_t* params);
+void ps4GetFilter(ps4_channel_t channel, ps4_filter_params_t* params);
+void ps4SetPrediction(bool enable);
+bool ps4Predict(int64_t time, ps4_t* ps4);
+bool ps4AddBatchCallback(uint16_t reports, uint32_t interval_ms, void* object, ps4_batch_callback_t cb);
+void ps4RemoveBatchCallback(void* object, ps4_batch_callback_t cb);
+bool ps4SetWindow(uint8_t window, uint32_t duration_ms);
+uint16_t ps4WindowCount(uint8_t window);
+int16_t ps4WindowAverage(uint8_t window, ps4_channel_t channel);
+int16_t ps4WindowMin(uint8_t window, ps4_channel_t channel);
+int16_t ps4WindowMax(uint8_t window, ps4_channel_t channel);
+uint32_t ps4WindowButtons(uint8_t window);
+void ps4ResamplerInit(ps4_resampler_t* cursor, uint32_t rate, uint32_t delay);
+void ps4ResamplerDeinit(ps4_resampler_t* cursor);
+bool ps4ResamplerNext(ps4_resampler_t* cursor, ps4_resample_t* sample);
+bool ps4SetBindings(const ps4_binding_t* bindings, uint8_t count);
+void ps4SetActionCallback(void* object, ps4_action_callback_t cb);
+void ps4SetTouchpadCallback(void* object, ps4_touchpad_callback_t cb);
+void ps4SetGestureCallback(void* object, ps4_gesture_callback_t cb);
+void ps4SetGestureThresholds(const ps4_gesture_thresholds_t* thresholds);
+void ps4GetGestureThresholds(ps4_gesture_thresholds_t* thresholds);
+int8_t ps4RumblePlay(const ps4_rumble_track_t* track, uint8_t strength);
+void ps4RumbleStop(int8_t voice);
+void ps4RumbleStopAll();
+void ps4LightbarSolid(uint8_t r, uint8_t g, uint8_t b);
+void ps4LightbarBlink(uint8_t r, uint8_t g, uint8_t b, uint16_t on_ms, uint16_t off_ms);
+void ps4LightbarBreathe(uint8_t r, uint8_t g, uint8_t b, uint16_t period_ms);
+void ps4LightbarCycle(uint16_t period_ms);
+void ps4LightbarSetGradient(const uint8_t* from, const uint8_t* to);
+void ps4LightbarLevel(uint8_t level);
+void ps4LightbarBattery();
+void ps4LightbarStop();
+size_t ps4AudioWrite(const int16_t* samples, size_t count);
+size_t ps4AudioQueued();
+void ps4AudioSetVolume(uint8_t volume);
+bool ps4GetReport(ps4_report_type_t type, uint8_t reportId, ps4_report_callback_t cb, void* object);
+bool ps4SetReport(ps4_report_type_t type, uint8_t reportId, const uint8_t* data,
+                  uint16_t length, ps4_report_callback_t cb, void* object);
 
 #endif
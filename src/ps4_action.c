@@ -0,0 +1,351 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+#define PS4_TAG "PS4_ACTION"
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+#if PS4_MAX_BINDINGS > 32
+#error "PS4_MAX_BINDINGS must fit a 32 bit binding mask"
+#endif
+
+/* Hold and double-tap times are counted in ticks of TICK_US on a wheel of
+ * WHEEL_SIZE slots. Timers further out than one turn of the wheel stay in
+ * their slot until the turn in which they are due. */
+#define TICK_US 10000
+#define WHEEL_SIZE 64
+#define NO_TIMER 0xFF
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static void startTimer(uint8_t binding, uint32_t expiry);
+static void stopTimer(uint8_t binding);
+static void advanceWheel(uint32_t tick);
+static void bindingComplete(uint8_t binding, uint32_t tick);
+static void timerExpired(uint8_t binding);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+static ps4_action_callback_t action_cb = NULL;
+static void* action_object = NULL;
+
+/* The compiled table, one array per field */
+static uint8_t binding_count = 0;
+static uint32_t binding_buttons[PS4_MAX_BINDINGS];
+static uint16_t binding_action[PS4_MAX_BINDINGS];
+static uint8_t binding_kind[PS4_MAX_BINDINGS];
+static uint16_t binding_ticks[PS4_MAX_BINDINGS];
+
+/* Bindings to look at when a button changes, as binding masks */
+static uint32_t bindings_by_button[PS4_BUTTON_COUNT];
+
+/* Bindings whose buttons are all held, and those with a running timer */
+static uint32_t complete_bindings = 0;
+static uint32_t pending_timers = 0;
+
+/* Timer wheel, each slot a doubly linked list of bindings */
+static uint8_t wheel[WHEEL_SIZE];
+static uint8_t timer_next[PS4_MAX_BINDINGS];
+static uint8_t timer_prev[PS4_MAX_BINDINGS];
+static uint32_t timer_expiry[PS4_MAX_BINDINGS];
+static uint32_t wheel_tick = 0;
+static bool has_tick = false;
+
+/* Actions fired while evaluating a report, reported after the lock is
+ * released */
+static uint16_t fired[PS4_MAX_BINDINGS];
+static uint8_t fired_count = 0;
+
+static portMUX_TYPE action_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4SetActionCallback
+**
+** Description      Registers the callback receiving the actions fired by
+**                  the bindings set with ps4SetBindings.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4SetActionCallback(void* object, ps4_action_callback_t cb) {
+  portENTER_CRITICAL(&action_lock);
+  action_cb = cb;
+  action_object = object;
+  portEXIT_CRITICAL(&action_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4SetBindings
+**
+** Description      Compiles a list of bindings into the table evaluated on
+**                  every report, replacing the previous bindings. The list
+**                  itself is not referenced afterwards.
+**
+**
+** Returns          bool, false if there are more than PS4_MAX_BINDINGS
+**                  bindings, one has no buttons or a double-tap has no time
+**
+*******************************************************************************/
+bool ps4SetBindings(const ps4_binding_t* bindings, uint8_t count) {
+  if (count > PS4_MAX_BINDINGS) {
+    ESP_LOGE(PS4_TAG, "[%s] %d bindings, at most %d are supported", __func__, count, PS4_MAX_BINDINGS);
+    return false;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    if (bindings[i].buttons == 0) {
+      ESP_LOGE(PS4_TAG, "[%s] binding for action %d has no buttons", __func__, bindings[i].action);
+      return false;
+    }
+    if (bindings[i].kind == ps4_action_double_tap && bindings[i].time_ms == 0) {
+      ESP_LOGE(PS4_TAG, "[%s] double-tap for action %d has no time", __func__, bindings[i].action);
+      return false;
+    }
+  }
+
+  portENTER_CRITICAL(&action_lock);
+
+  memset(bindings_by_button, 0, sizeof(bindings_by_button));
+  memset(wheel, NO_TIMER, sizeof(wheel));
+  complete_bindings = 0;
+  pending_timers = 0;
+
+  for (uint8_t i = 0; i < count; i++) {
+    binding_buttons[i] = bindings[i].buttons;
+    binding_action[i] = bindings[i].action;
+    binding_kind[i] = bindings[i].kind;
+    binding_ticks[i] = (bindings[i].time_ms * 1000 + TICK_US - 1) / TICK_US;
+
+    for (uint32_t bits = bindings[i].buttons; bits; bits &= bits - 1) {
+      bindings_by_button[__builtin_ctz(bits)] |= 1UL << i;
+    }
+  }
+  binding_count = count;
+
+  portEXIT_CRITICAL(&action_lock);
+
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function         ps4_action_reset
+**
+** Description      Cancels running holds and double-taps, e.g. on a new
+**                  connection.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_action_reset() {
+  portENTER_CRITICAL(&action_lock);
+  memset(wheel, NO_TIMER, sizeof(wheel));
+  complete_bindings = 0;
+  pending_timers = 0;
+  has_tick = false;
+  portEXIT_CRITICAL(&action_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_action_evaluate
+**
+** Description      Runs the binding table on a report: expires the timers
+**                  due by the report's time, then looks only at the
+**                  bindings of buttons that changed.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_action_evaluate(const ps4_t* ps4, const ps4_event_t* event) {
+  uint16_t actions[PS4_MAX_BINDINGS];
+  uint8_t action_count;
+  ps4_action_callback_t cb;
+  void* object;
+
+  if (binding_count == 0) {
+    return;
+  }
+
+  uint32_t tick = (uint32_t)(ps4_report_time() / TICK_US);
+
+  portENTER_CRITICAL(&action_lock);
+
+  fired_count = 0;
+  advanceWheel(tick);
+
+  uint32_t changed = event->button_down.mask | event->button_up.mask;
+  uint32_t candidates = 0;
+  for (uint32_t bits = changed; bits; bits &= bits - 1) {
+    candidates |= bindings_by_button[__builtin_ctz(bits)];
+  }
+
+  for (; candidates; candidates &= candidates - 1) {
+    uint8_t binding = __builtin_ctz(candidates);
+    bool isComplete = (ps4->button.mask & binding_buttons[binding]) == binding_buttons[binding];
+    bool wasComplete = complete_bindings & (1UL << binding);
+
+    if (isComplete && !wasComplete) {
+      complete_bindings |= 1UL << binding;
+      bindingComplete(binding, tick);
+    } else if (!isComplete && wasComplete) {
+      complete_bindings &= ~(1UL << binding);
+
+      // Letting go before the time is up cancels a hold
+      if (binding_kind[binding] == ps4_action_hold) {
+        stopTimer(binding);
+      }
+    }
+  }
+
+  action_count = fired_count;
+  memcpy(actions, fired, action_count * sizeof(*actions));
+  cb = action_cb;
+  object = action_object;
+
+  portEXIT_CRITICAL(&action_lock);
+
+  if (cb != NULL) {
+    for (uint8_t i = 0; i < action_count; i++) {
+      cb(object, actions[i]);
+    }
+  }
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+static void bindingComplete(uint8_t binding, uint32_t tick) {
+  switch (binding_kind[binding]) {
+    case ps4_action_chord:
+      fired[fired_count++] = binding_action[binding];
+      break;
+
+    case ps4_action_hold:
+      // A timer of 0 ticks would go into the current slot, which the wheel
+      // only comes back to a turn later
+      if (binding_ticks[binding] == 0) {
+        fired[fired_count++] = binding_action[binding];
+      } else {
+        startTimer(binding, tick + binding_ticks[binding]);
+      }
+      break;
+
+    case ps4_action_double_tap:
+      // The second press within the time fires, the first one waits
+      if (pending_timers & (1UL << binding)) {
+        stopTimer(binding);
+        fired[fired_count++] = binding_action[binding];
+      } else {
+        startTimer(binding, tick + binding_ticks[binding]);
+      }
+      break;
+  }
+}
+
+static void timerExpired(uint8_t binding) {
+  // A hold fires once its time is up, a double-tap simply gives up
+  if (binding_kind[binding] == ps4_action_hold) {
+    fired[fired_count++] = binding_action[binding];
+  }
+}
+
+/*******************************************************************************
+**
+** Function         advanceWheel
+**
+** Description      Turns the timer wheel to the given tick, expiring the
+**                  timers that are due. Each slot is visited once however
+**                  long the gap since the last report was.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void advanceWheel(uint32_t tick) {
+  if (!has_tick) {
+    wheel_tick = tick;
+    has_tick = true;
+    return;
+  }
+
+  if (pending_timers == 0) {
+    wheel_tick = tick;
+    return;
+  }
+
+  uint32_t steps = tick - wheel_tick;
+  if (steps > WHEEL_SIZE) {
+    steps = WHEEL_SIZE;
+  }
+
+  for (uint32_t step = 1; step <= steps; step++) {
+    uint8_t binding = wheel[(wheel_tick + step) % WHEEL_SIZE];
+
+    while (binding != NO_TIMER) {
+      uint8_t next = timer_next[binding];
+
+      if ((int32_t)(tick - timer_expiry[binding]) >= 0) {
+        stopTimer(binding);
+        timerExpired(binding);
+      }
+
+      binding = next;
+    }
+  }
+
+  wheel_tick = tick;
+}
+
+static void startTimer(uint8_t binding, uint32_t expiry) {
+  uint8_t slot = expiry % WHEEL_SIZE;
+
+  stopTimer(binding);
+
+  timer_expiry[binding] = expiry;
+  timer_prev[binding] = NO_TIMER;
+  timer_next[binding] = wheel[slot];
+  if (wheel[slot] != NO_TIMER) {
+    timer_prev[wheel[slot]] = binding;
+  }
+  wheel[slot] = binding;
+
+  pending_timers |= 1UL << binding;
+}
+
+static void stopTimer(uint8_t binding) {
+  if (!(pending_timers & (1UL << binding))) {
+    return;
+  }
+
+  if (timer_prev[binding] != NO_TIMER) {
+    timer_next[timer_prev[binding]] = timer_next[binding];
+  } else {
+    wheel[timer_expiry[binding] % WHEEL_SIZE] = timer_next[binding];
+  }
+  if (timer_next[binding] != NO_TIMER) {
+    timer_prev[timer_next[binding]] = timer_prev[binding];
+  }
+
+  pending_timers &= ~(1UL << binding);
+}
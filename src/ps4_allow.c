@@ -0,0 +1,149 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+/* Linear probing set of addresses, at most half full so a lookup of an
+ * address that is not in it ends after a probe or two */
+#define SET_SIZE (PS4_MAX_ALLOWED <= 8 ? 16 : 32)
+
+#if PS4_MAX_ALLOWED > 16
+#error "PS4_MAX_ALLOWED must be at most 16"
+#endif
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static int8_t findSlot(const uint8_t* addr);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+static uint8_t addresses[SET_SIZE][6];
+static uint32_t occupied = 0;  // one bit per slot
+static uint8_t allowed_count = 0;
+
+static portMUX_TYPE allow_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4AllowController
+**
+** Description      Adds a controller address to the allow list. While the
+**                  list is not empty, connections from other addresses are
+**                  refused as soon as they are requested.
+**
+**
+** Returns          bool, false if PS4_MAX_ALLOWED addresses are allowed
+**
+*******************************************************************************/
+bool ps4AllowController(const uint8_t* addr) {
+  bool added = true;
+
+  portENTER_CRITICAL(&allow_lock);
+  if (findSlot(addr) < 0) {
+    if (allowed_count == PS4_MAX_ALLOWED) {
+      added = false;
+    } else {
+      uint8_t slot = ps4_address_hash(addr, SET_SIZE);
+      while (occupied & (1UL << slot)) {
+        slot = (slot + 1) & (SET_SIZE - 1);
+      }
+      memcpy(addresses[slot], addr, sizeof(addresses[slot]));
+      occupied |= 1UL << slot;
+      allowed_count++;
+    }
+  }
+  portEXIT_CRITICAL(&allow_lock);
+
+  return added;
+}
+
+/*******************************************************************************
+**
+** Function         ps4DisallowController
+**
+** Description      Removes a controller address from the allow list. Once
+**                  the list is empty every controller is accepted again.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4DisallowController(const uint8_t* addr) {
+  portENTER_CRITICAL(&allow_lock);
+
+  int8_t found = findSlot(addr);
+  if (found >= 0) {
+    uint8_t hole = found;
+    occupied &= ~(1UL << hole);
+    allowed_count--;
+
+    // Move back the addresses after the hole that probed past it, so
+    // lookups need no tombstones
+    for (uint8_t slot = (hole + 1) & (SET_SIZE - 1); occupied & (1UL << slot);
+         slot = (slot + 1) & (SET_SIZE - 1)) {
+      uint8_t home = ps4_address_hash(addresses[slot], SET_SIZE);
+      if (((slot - home) & (SET_SIZE - 1)) >= ((slot - hole) & (SET_SIZE - 1))) {
+        memcpy(addresses[hole], addresses[slot], sizeof(addresses[hole]));
+        occupied = (occupied & ~(1UL << slot)) | 1UL << hole;
+        hole = slot;
+      }
+    }
+  }
+
+  portEXIT_CRITICAL(&allow_lock);
+}
+
+void ps4ClearAllowList() {
+  portENTER_CRITICAL(&allow_lock);
+  occupied = 0;
+  allowed_count = 0;
+  portEXIT_CRITICAL(&allow_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_allow_check
+**
+** Description      Checks a connecting address against the allow list.
+**
+**
+** Returns          bool, true if the list is empty or holds the address
+**
+*******************************************************************************/
+bool ps4_allow_check(const uint8_t* addr) {
+  portENTER_CRITICAL(&allow_lock);
+  bool allowed = allowed_count == 0 || findSlot(addr) >= 0;
+  portEXIT_CRITICAL(&allow_lock);
+
+  return allowed;
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+static int8_t findSlot(const uint8_t* addr) {
+  uint8_t slot = ps4_address_hash(addr, SET_SIZE);
+
+  while (occupied & (1UL << slot)) {
+    if (memcmp(addresses[slot], addr, sizeof(addresses[slot])) == 0) {
+      return slot;
+    }
+    slot = (slot + 1) & (SET_SIZE - 1);
+  }
+
+  return -1;
+}
@@ -0,0 +1,537 @@
+#include <esp_timer.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+#define PS4_TAG "PS4_AUDIO"
+
+/* Only built with PS4_AUDIO, as the sample ring and the report buffers
+ * take about 10 KB of static memory */
+#if PS4_AUDIO
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+#if (PS4_AUDIO_RING_SAMPLES & (PS4_AUDIO_RING_SAMPLES - 1)) != 0
+#error "PS4_AUDIO_RING_SAMPLES must be a power of two"
+#endif
+
+/* SBC stream sent to the speaker: 32kHz mono, 8 subbands, 16 blocks and
+ * loudness allocation, so each frame is 128 samples or 4ms */
+#define SBC_SYNCWORD 0x9C
+#define SBC_SUBBANDS 8
+#define SBC_BLOCKS 16
+#define SBC_FRAME_SAMPLES (SBC_SUBBANDS * SBC_BLOCKS)
+#define SBC_FRAME_SIZE (4 + SBC_SUBBANDS / 2 + (SBC_BLOCKS * PS4_AUDIO_BITPOOL + 7) / 8)
+#define SBC_HEADER_32KHZ_16_BLOCKS_MONO_LOUDNESS_8_SUBBANDS 0x71
+
+/* Subband samples are kept with SAMPLE_FRACTION_BITS below the PCM unit */
+#define SAMPLE_FRACTION_BITS 12
+#define WINDOW_SHIFT 16  // window coefficients
+#define MATRIX_SHIFT 14  // cosine modulation matrix
+
+/* Audio output report, as sent on the interrupt channel after the 0xA2
+ * DATA header. The CRC32 at the end covers the header and the report. */
+enum ps4_audio_report_index {
+  audio_report_index_id = 0,
+  audio_report_index_flags = 1,
+  audio_report_index_control = 2,
+  audio_report_index_counter = 3,  // 16 bit little endian, per report
+  audio_report_index_target = 5,
+  audio_report_index_frames = 10,
+  audio_report_crc_size = 4
+};
+
+#define AUDIO_REPORT_ID 0x17
+#define AUDIO_REPORT_FLAGS 0x40
+#define AUDIO_REPORT_CONTROL 0xA0
+#define AUDIO_TARGET_SPEAKER 0x02
+#define AUDIO_REPORT_SIZE \
+  (audio_report_index_frames + PS4_AUDIO_FRAMES_PER_REPORT * SBC_FRAME_SIZE + audio_report_crc_size)
+#define REPORT_SAMPLES (PS4_AUDIO_FRAMES_PER_REPORT * SBC_FRAME_SAMPLES)
+#define REPORT_PERIOD_US (REPORT_SAMPLES * 1000000ULL / 32000)
+
+typedef struct {
+  uint8_t* data;
+  uint16_t bits;
+} ps4_bit_writer_t;
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static void ps4_audio_tick_cback(void* arg);
+static void encodeFrame(const int16_t* pcm, uint8_t* frame);
+static void analyzeBlock(const int16_t* pcm, int32_t* subbands);
+static void allocateBits(const uint8_t* scale_factors, uint8_t* bits);
+static void writeBits(ps4_bit_writer_t* writer, uint32_t value, uint8_t count);
+static uint8_t crc8(const uint8_t* data, uint16_t bits);
+static uint32_t crc32(uint32_t crc, const uint8_t* data, uint16_t length);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+/* Analysis window: the SBC prototype filter of the A2DP specification in
+ * Q16, with the sign of every other 16 taps flipped to fold the cosine
+ * modulation's period into the window */
+static const int32_t window[80] = {
+  0, 10, 22, 36, 54, 75, 97, 117,
+  132, 138, 131, 106, 59, -12, -108, -229,
+  371, 526, 685, 835, 960, 1042, 1063, 1004,
+  848, 580, 192, -322, -959, -1711, -2561, -3486,
+  4456, 5438, 6395, 7287, 8078, 8734, 9224, 9528,
+  9631, 9528, 9224, 8734, 8078, 7287, 6395, 5438,
+  -4456, -3486, -2561, -1711, -959, -322, 192, 580,
+  848, 1004, 1063, 1042, 960, 835, 685, 526,
+  -371, -229, -108, -12, 59, 106, 131, 138,
+  132, 117, 97, 75, 54, 36, 22, 10
+};
+
+/* cos((k + 0.5) * (i - 4) * pi / 8) in Q14 */
+static const int16_t matrix[SBC_SUBBANDS][16] = {
+  {11585, 13623, 15137, 16069, 16384, 16069, 15137, 13623, 11585, 9102, 6270, 3196, 0, -3196, -6270, -9102},
+  {-11585, -3196, 6270, 13623, 16384, 13623, 6270, -3196, -11585, -16069, -15137, -9102, 0, 9102, 15137, 16069},
+  {-11585, -16069, -6270, 9102, 16384, 9102, -6270, -16069, -11585, 3196, 15137, 13623, 0, -13623, -15137, -3196},
+  {11585, -9102, -15137, 3196, 16384, 3196, -15137, -9102, 11585, 13623, -6270, -16069, 0, 16069, 6270, -13623},
+  {11585, 9102, -15137, -3196, 16384, -3196, -15137, 9102, 11585, -13623, -6270, 16069, 0, -16069, 6270, 13623},
+  {-11585, 16069, -6270, -9102, 16384, -9102, -6270, 16069, -11585, -3196, 15137, -13623, 0, 13623, -15137, 3196},
+  {-11585, 3196, 6270, -13623, 16384, -13623, 6270, 3196, -11585, 16069, -15137, 9102, 0, -9102, 15137, -16069},
+  {11585, -13623, 15137, -16069, 16384, -16069, 15137, -13623, 11585, -9102, 6270, -3196, 0, 3196, -6270, 9102}
+};
+
+/* Loudness offsets of the 8 subbands at 32kHz */
+static const int8_t loudness_offset[SBC_SUBBANDS] = {-3, 0, 0, 0, 0, 0, 1, 2};
+
+/* PCM written by the application and not sent yet. The application only
+ * moves ring_written and the timer only moves ring_read. */
+static int16_t ring[PS4_AUDIO_RING_SAMPLES];
+static volatile uint32_t ring_written = 0;
+static volatile uint32_t ring_read = 0;
+
+/* Analysis filter input, newest sample first */
+static int16_t history[80];
+
+static uint8_t report[AUDIO_REPORT_SIZE];
+static int16_t report_pcm[REPORT_SAMPLES];
+static uint16_t report_counter = 0;
+static bool was_short = false;
+
+static esp_timer_handle_t tick_timer = NULL;
+static bool is_ticking = false;
+
+static portMUX_TYPE audio_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4AudioWrite
+**
+** Description      Queues 32kHz mono PCM samples for the controller speaker.
+**                  Never blocks: samples that do not fit in the ring are
+**                  not taken, so the caller can retry them later. The ring
+**                  drains at the rate the controller accepts reports.
+**
+**
+** Returns          size_t, the number of samples queued, 0 if ps4Init could
+**                  not create the timer sending them or without PS4_AUDIO
+**
+*******************************************************************************/
+size_t ps4AudioWrite(const int16_t* samples, size_t count) {
+  uint32_t written = ring_written;
+  uint32_t room = PS4_AUDIO_RING_SAMPLES - (written - ring_read);
+
+  if (tick_timer == NULL) {
+    ESP_LOGE(PS4_TAG, "[%s] no report timer", __func__);
+    return 0;
+  }
+
+  if (count > room) {
+    count = room;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    ring[(written + i) & (PS4_AUDIO_RING_SAMPLES - 1)] = samples[i];
+  }
+
+  portENTER_CRITICAL(&audio_lock);
+  ring_written = written + count;
+  bool start = count > 0 && !is_ticking;
+  is_ticking |= start;
+  portEXIT_CRITICAL(&audio_lock);
+
+  if (start) {
+    esp_timer_start_periodic(tick_timer, REPORT_PERIOD_US);
+  }
+
+  return count;
+}
+
+/*******************************************************************************
+**
+** Function         ps4AudioQueued
+**
+** Description      Returns the number of samples waiting to be sent.
+**
+**
+** Returns          size_t
+**
+*******************************************************************************/
+size_t ps4AudioQueued() { return ring_written - ring_read; }
+
+/*******************************************************************************
+**
+** Function         ps4AudioSetVolume
+**
+** Description      Sets the speaker volume, 0 being silent.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4AudioSetVolume(uint8_t volume) { ps4_output_volume(volume); }
+
+/*******************************************************************************
+**
+** Function         ps4_audio_init
+**
+** Description      Creates the timer sending the queued samples. Called once
+**                  from ps4Init, so ps4AudioWrite never creates it from two
+**                  tasks at once.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_audio_init() {
+  const esp_timer_create_args_t timer_args = {
+    .callback = &ps4_audio_tick_cback,
+    .name = "ps4_audio"
+  };
+
+  if (tick_timer != NULL) {
+    return;
+  }
+
+  if (esp_timer_create(&timer_args, &tick_timer) != ESP_OK) {
+    ESP_LOGE(PS4_TAG, "[%s] creating the report timer failed", __func__);
+    tick_timer = NULL;
+  }
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4_audio_tick_cback
+**
+** Description      Sends one audio report per report period, as long as
+**                  the interrupt channel is not congested. A report's worth
+**                  of samples is awaited for one period before the rest is
+**                  padded with silence, so the end of a sound goes out.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void ps4_audio_tick_cback(void* arg) {
+  uint32_t read = ring_read;
+  uint32_t queued = ring_written - read;
+
+  // A write while stopping finds the timer still ticking, so it is
+  // restarted here rather than by ps4AudioWrite
+  if (queued == 0) {
+    esp_timer_stop(tick_timer);
+
+    portENTER_CRITICAL(&audio_lock);
+    bool restart = ring_written != read;
+    is_ticking = restart;
+    portEXIT_CRITICAL(&audio_lock);
+
+    if (restart) {
+      esp_timer_start_periodic(tick_timer, REPORT_PERIOD_US);
+    }
+    return;
+  }
+
+  if (!ps4IsConnected() || ps4_l2cap_interrupt_congested()) {
+    return;
+  }
+
+  if (queued < REPORT_SAMPLES && !was_short) {
+    was_short = true;
+    return;
+  }
+  was_short = false;
+
+  uint32_t count = queued < REPORT_SAMPLES ? queued : REPORT_SAMPLES;
+  for (uint32_t i = 0; i < REPORT_SAMPLES; i++) {
+    report_pcm[i] = i < count ? ring[(read + i) & (PS4_AUDIO_RING_SAMPLES - 1)] : 0;
+  }
+  ring_read = read + count;
+
+  memset(report, 0, audio_report_index_frames);
+  report[audio_report_index_id] = AUDIO_REPORT_ID;
+  report[audio_report_index_flags] = AUDIO_REPORT_FLAGS;
+  report[audio_report_index_control] = AUDIO_REPORT_CONTROL;
+  report[audio_report_index_counter] = report_counter & 0xFF;
+  report[audio_report_index_counter + 1] = report_counter >> 8;
+  report[audio_report_index_target] = AUDIO_TARGET_SPEAKER;
+  report_counter++;
+
+  for (uint8_t f = 0; f < PS4_AUDIO_FRAMES_PER_REPORT; f++) {
+    encodeFrame(&report_pcm[f * SBC_FRAME_SAMPLES], &report[audio_report_index_frames + f * SBC_FRAME_SIZE]);
+  }
+
+  static const uint8_t data_header = hid_cmd_code_data | hid_cmd_code_type_output;
+  uint32_t crc = crc32(crc32(0xFFFFFFFF, &data_header, 1), report, AUDIO_REPORT_SIZE - audio_report_crc_size);
+  crc = ~crc;
+  for (uint8_t i = 0; i < audio_report_crc_size; i++) {
+    report[AUDIO_REPORT_SIZE - audio_report_crc_size + i] = crc >> (8 * i);
+  }
+
+  ps4_l2cap_send_interrupt(report, AUDIO_REPORT_SIZE);
+}
+
+/*******************************************************************************
+**
+** Function         encodeFrame
+**
+** Description      Encodes 128 samples into one SBC frame, in fixed point.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void encodeFrame(const int16_t* pcm, uint8_t* frame) {
+  int32_t subbands[SBC_BLOCKS][SBC_SUBBANDS];
+  uint8_t scale_factors[SBC_SUBBANDS];
+  uint8_t bits[SBC_SUBBANDS];
+
+  for (uint8_t blk = 0; blk < SBC_BLOCKS; blk++) {
+    analyzeBlock(&pcm[blk * SBC_SUBBANDS], subbands[blk]);
+  }
+
+  // The scale factor is the smallest power of two above every sample of
+  // the subband, 2^(scale_factor + 1)
+  for (uint8_t sb = 0; sb < SBC_SUBBANDS; sb++) {
+    uint32_t peak = 0;
+
+    for (uint8_t blk = 0; blk < SBC_BLOCKS; blk++) {
+      int32_t sample = subbands[blk][sb];
+      uint32_t magnitude = sample < 0 ? -(uint32_t)sample : (uint32_t)sample;
+      peak = magnitude > peak ? magnitude : peak;
+    }
+
+    uint8_t scale_factor = 0;
+    while (scale_factor < 15 && peak >= (2UL << (scale_factor + SAMPLE_FRACTION_BITS))) {
+      scale_factor++;
+    }
+    scale_factors[sb] = scale_factor;
+  }
+
+  allocateBits(scale_factors, bits);
+
+  memset(frame, 0, SBC_FRAME_SIZE);
+  frame[0] = SBC_SYNCWORD;
+  frame[1] = SBC_HEADER_32KHZ_16_BLOCKS_MONO_LOUDNESS_8_SUBBANDS;
+  frame[2] = PS4_AUDIO_BITPOOL;
+
+  ps4_bit_writer_t writer = {&frame[4], 0};
+  for (uint8_t sb = 0; sb < SBC_SUBBANDS; sb++) {
+    writeBits(&writer, scale_factors[sb], 4);
+  }
+
+  // The CRC covers the two header bytes after the syncword and the scale
+  // factors, and sits in between them
+  uint8_t covered[2 + SBC_SUBBANDS / 2];
+  memcpy(covered, &frame[1], 2);
+  memcpy(&covered[2], &frame[4], SBC_SUBBANDS / 2);
+  frame[3] = crc8(covered, 16 + SBC_SUBBANDS * 4);
+
+  // quantized = floor((sample / 2^(scale_factor + 1) + 1) * levels / 2)
+  for (uint8_t blk = 0; blk < SBC_BLOCKS; blk++) {
+    for (uint8_t sb = 0; sb < SBC_SUBBANDS; sb++) {
+      if (bits[sb] == 0) {
+        continue;
+      }
+
+      uint8_t shift = scale_factors[sb] + 1 + SAMPLE_FRACTION_BITS;
+      int64_t levels = (1 << bits[sb]) - 1;
+      int64_t quantized = ((int64_t)subbands[blk][sb] * levels + (levels << shift)) >> (shift + 1);
+
+      quantized = quantized < 0 ? 0 : quantized > levels ? levels : quantized;
+      writeBits(&writer, (uint32_t)quantized, bits[sb]);
+    }
+  }
+}
+
+/*******************************************************************************
+**
+** Function         analyzeBlock
+**
+** Description      Runs 8 new samples through the SBC polyphase analysis
+**                  filter bank, giving one sample of each subband.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void analyzeBlock(const int16_t* pcm, int32_t* subbands) {
+  int32_t folded[16];
+
+  memmove(&history[SBC_SUBBANDS], history, sizeof(history) - SBC_SUBBANDS * sizeof(*history));
+  for (uint8_t i = 0; i < SBC_SUBBANDS; i++) {
+    history[i] = pcm[SBC_SUBBANDS - 1 - i];
+  }
+
+  for (uint8_t i = 0; i < 16; i++) {
+    int32_t sum = 0;
+    for (uint8_t j = 0; j < 5; j++) {
+      sum += window[i + j * 16] * history[i + j * 16];
+    }
+    folded[i] = sum;
+  }
+
+  for (uint8_t k = 0; k < SBC_SUBBANDS; k++) {
+    int64_t sum = 0;
+    for (uint8_t i = 0; i < 16; i++) {
+      sum += (int64_t)matrix[k][i] * folded[i];
+    }
+    subbands[k] = (int32_t)(sum >> (WINDOW_SHIFT + MATRIX_SHIFT - SAMPLE_FRACTION_BITS));
+  }
+}
+
+/*******************************************************************************
+**
+** Function         allocateBits
+**
+** Description      Spreads the bitpool over the subbands by the loudness
+**                  method of the SBC specification.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void allocateBits(const uint8_t* scale_factors, uint8_t* bits) {
+  int8_t bitneed[SBC_SUBBANDS];
+  int8_t max_bitneed = 0;
+
+  for (uint8_t sb = 0; sb < SBC_SUBBANDS; sb++) {
+    if (scale_factors[sb] == 0) {
+      bitneed[sb] = -5;
+    } else {
+      int8_t loudness = scale_factors[sb] - loudness_offset[sb];
+      bitneed[sb] = loudness > 0 ? loudness / 2 : loudness;
+    }
+    max_bitneed = bitneed[sb] > max_bitneed ? bitneed[sb] : max_bitneed;
+  }
+
+  // Lower the slice until the bits above it fill the bitpool
+  int16_t bitcount = 0;
+  int16_t slicecount = 0;
+  int8_t bitslice = max_bitneed + 1;
+  do {
+    bitslice--;
+    bitcount += slicecount;
+    slicecount = 0;
+    for (uint8_t sb = 0; sb < SBC_SUBBANDS; sb++) {
+      if (bitneed[sb] > bitslice + 1 && bitneed[sb] < bitslice + 16) {
+        slicecount++;
+      } else if (bitneed[sb] == bitslice + 1) {
+        slicecount += 2;
+      }
+    }
+  } while (bitcount + slicecount < PS4_AUDIO_BITPOOL);
+
+  if (bitcount + slicecount == PS4_AUDIO_BITPOOL) {
+    bitcount += slicecount;
+    bitslice--;
+  }
+
+  for (uint8_t sb = 0; sb < SBC_SUBBANDS; sb++) {
+    if (bitneed[sb] < bitslice + 2) {
+      bits[sb] = 0;
+    } else {
+      bits[sb] = bitneed[sb] - bitslice < 16 ? bitneed[sb] - bitslice : 16;
+    }
+  }
+
+  // Hand out what is left, first to the subbands already given bits
+  for (uint8_t sb = 0; bitcount < PS4_AUDIO_BITPOOL && sb < SBC_SUBBANDS; sb++) {
+    if (bits[sb] >= 2 && bits[sb] < 16) {
+      bits[sb]++;
+      bitcount++;
+    } else if (bitneed[sb] == bitslice + 1 && PS4_AUDIO_BITPOOL > bitcount + 1) {
+      bits[sb] = 2;
+      bitcount += 2;
+    }
+  }
+
+  for (uint8_t sb = 0; bitcount < PS4_AUDIO_BITPOOL && sb < SBC_SUBBANDS; sb++) {
+    if (bits[sb] < 16) {
+      bits[sb]++;
+      bitcount++;
+    }
+  }
+}
+
+/* Appends bits most significant first */
+static void writeBits(ps4_bit_writer_t* writer, uint32_t value, uint8_t count) {
+  while (count > 0) {
+    count--;
+    if ((value >> count) & 1) {
+      writer->data[writer->bits >> 3] |= 0x80 >> (writer->bits & 7);
+    }
+    writer->bits++;
+  }
+}
+
+/* CRC-8 of the SBC header, polynomial x^8 + x^4 + x^3 + x^2 + 1 */
+static uint8_t crc8(const uint8_t* data, uint16_t bits) {
+  uint8_t crc = 0x0F;
+
+  for (uint16_t i = 0; i < bits; i++) {
+    bool bit = (data[i >> 3] >> (7 - (i & 7))) & 1;
+    bool top = crc & 0x80;
+    crc <<= 1;
+    if (bit != top) {
+      crc ^= 0x1D;
+    }
+  }
+
+  return crc;
+}
+
+/* CRC-32 of the report, as in zlib, a nibble at a time */
+static uint32_t crc32(uint32_t crc, const uint8_t* data, uint16_t length) {
+  static const uint32_t nibble_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+
+  for (uint16_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ nibble_table[crc & 0x0F];
+    crc = (crc >> 4) ^ nibble_table[crc & 0x0F];
+  }
+
+  return crc;
+}
+
+#else  // !PS4_AUDIO
+
+size_t ps4AudioWrite(const int16_t* samples, size_t count) { return 0; }
+size_t ps4AudioQueued() { return 0; }
+void ps4AudioSetVolume(uint8_t volume) { ps4_output_volume(volume); }
+
+#endif  // PS4_AUDIO
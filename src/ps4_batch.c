@@ -0,0 +1,250 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+#define PS4_TAG "PS4_BATCH"
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+typedef struct {
+  ps4_batch_callback_t cb;  // NULL once removed during a delivery
+  void* object;
+  uint16_t reports;   // deliver after this many reports, 0 = no limit
+  int64_t interval;   // deliver after this many microseconds, 0 = no limit
+  int64_t window_start;
+  ps4_batch_t batch;
+} ps4_batch_subscriber_t;
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static void deliver(const int32_t* values, const ps4_t* ps4, const ps4_event_t* event);
+static void aggregate(ps4_batch_t* batch, const int32_t* values, const ps4_t* ps4, const ps4_event_t* event);
+static void compact();
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+static ps4_batch_subscriber_t subscribers[PS4_MAX_BATCH_SUBSCRIBERS];
+static uint8_t subscriber_count = 0;
+static bool is_delivering = false;  // removed entries are compacted after
+
+static portMUX_TYPE subscriber_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4AddBatchCallback
+**
+** Description      Registers a callback that receives reports aggregated
+**                  over a window of a number of reports or milliseconds,
+**                  whichever is reached first (0 disables either limit).
+**                  Button edges are OR-ed over the window, so a slow
+**                  subscriber still sees every tap.
+**
+**
+** Returns          bool, false if all subscriber slots are taken
+**
+*******************************************************************************/
+bool ps4AddBatchCallback(uint16_t reports, uint32_t interval_ms, void* object, ps4_batch_callback_t cb) {
+  bool added = false;
+
+  if (cb == NULL || (reports == 0 && interval_ms == 0)) {
+    return false;
+  }
+
+  portENTER_CRITICAL(&subscriber_lock);
+  if (subscriber_count < PS4_MAX_BATCH_SUBSCRIBERS) {
+    ps4_batch_subscriber_t* subscriber = &subscribers[subscriber_count];
+
+    memset(subscriber, 0, sizeof(*subscriber));
+    subscriber->cb = cb;
+    subscriber->object = object;
+    subscriber->reports = reports;
+    subscriber->interval = interval_ms * 1000LL;
+
+    subscriber_count++;
+    added = true;
+  }
+  portEXIT_CRITICAL(&subscriber_lock);
+
+  if (!added) {
+    ESP_LOGE(PS4_TAG, "[%s] no free subscriber slot", __func__);
+  }
+
+  return added;
+}
+
+/*******************************************************************************
+**
+** Function         ps4RemoveBatchCallback
+**
+** Description      Unregisters a callback added with ps4AddBatchCallback.
+**                  A delivery already in progress may still complete. It
+**                  is safe to call from a batch callback.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4RemoveBatchCallback(void* object, ps4_batch_callback_t cb) {
+  portENTER_CRITICAL(&subscriber_lock);
+  for (uint8_t i = 0; i < subscriber_count; i++) {
+    if (subscribers[i].cb == cb && subscribers[i].object == object) {
+      // Moving the last entry into the slot would make a delivery going
+      // through the slots skip it, so only mark it until that is done
+      subscribers[i].cb = NULL;
+      if (!is_delivering) {
+        compact();
+      }
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&subscriber_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_batch_reset
+**
+** Description      Delivers the partly filled windows and starts new ones,
+**                  on a disconnect or a new connection. Otherwise the last
+**                  reports of a connection, and the taps in them, would only
+**                  be delivered once the next connection fills the window.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_batch_reset() {
+  if (subscriber_count == 0) {
+    return;
+  }
+
+  deliver(NULL, NULL, NULL);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_batch_deliver
+**
+** Description      Adds a report to each subscriber's window, and delivers
+**                  the windows that are complete.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_batch_deliver(const ps4_t* ps4, const ps4_event_t* event) {
+  int32_t values[PS4_CHANNEL_COUNT];
+
+  if (subscriber_count == 0) {
+    return;
+  }
+
+  ps4_channels_read(ps4, values);
+  deliver(values, ps4, event);
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+/* Adds the report to each window and delivers the complete ones, or
+ * without a report delivers every window that is not empty */
+static void deliver(const int32_t* values, const ps4_t* ps4, const ps4_event_t* event) {
+  ps4_batch_t batch;
+  int64_t time = ps4_report_time();
+
+  portENTER_CRITICAL(&subscriber_lock);
+  is_delivering = true;
+  portEXIT_CRITICAL(&subscriber_lock);
+
+  for (uint8_t i = 0; i < PS4_MAX_BATCH_SUBSCRIBERS; i++) {
+    ps4_batch_callback_t cb = NULL;
+    void* object = NULL;
+
+    portENTER_CRITICAL(&subscriber_lock);
+    if (i < subscriber_count && subscribers[i].cb != NULL) {
+      ps4_batch_subscriber_t* subscriber = &subscribers[i];
+      bool is_complete = ps4 == NULL && subscriber->batch.reports > 0;
+
+      if (ps4 != NULL) {
+        if (subscriber->batch.reports == 0) {
+          subscriber->window_start = time;
+        }
+
+        aggregate(&subscriber->batch, values, ps4, event);
+
+        is_complete = (subscriber->reports > 0 && subscriber->batch.reports >= subscriber->reports) ||
+                      (subscriber->interval > 0 && time - subscriber->window_start >= subscriber->interval);
+      }
+
+      if (is_complete) {
+        batch = subscriber->batch;
+        cb = subscriber->cb;
+        object = subscriber->object;
+        subscriber->batch.reports = 0;
+      }
+    }
+    portEXIT_CRITICAL(&subscriber_lock);
+
+    if (cb != NULL) {
+      cb(object, &batch);
+    }
+  }
+
+  portENTER_CRITICAL(&subscriber_lock);
+  is_delivering = false;
+  compact();
+  portEXIT_CRITICAL(&subscriber_lock);
+}
+
+static void aggregate(ps4_batch_t* batch, const int32_t* values, const ps4_t* ps4, const ps4_event_t* event) {
+  if (batch->reports == 0) {
+    // First report of a window
+    for (uint8_t i = 0; i < PS4_CHANNEL_COUNT; i++) {
+      batch->min[i] = values[i];
+      batch->max[i] = values[i];
+    }
+    batch->button_down.mask = 0;
+    batch->button_up.mask = 0;
+  } else {
+    for (uint8_t i = 0; i < PS4_CHANNEL_COUNT; i++) {
+      batch->min[i] = values[i] < batch->min[i] ? values[i] : batch->min[i];
+      batch->max[i] = values[i] > batch->max[i] ? values[i] : batch->max[i];
+    }
+  }
+
+  batch->latest = *ps4;
+  batch->button_down.mask |= event->button_down.mask;
+  batch->button_up.mask |= event->button_up.mask;
+
+  if (batch->reports < UINT16_MAX) {
+    batch->reports++;
+  }
+}
+
+/* Drops the removed entries, keeping the order of the others. Called with
+ * subscriber_lock held */
+static void compact() {
+  uint8_t count = 0;
+
+  for (uint8_t i = 0; i < subscriber_count; i++) {
+    if (subscribers[i].cb != NULL) {
+      subscribers[count++] = subscribers[i];
+    }
+  }
+
+  subscriber_count = count;
+}
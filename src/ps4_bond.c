@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+#define PS4_TAG "PS4_BOND"
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+/* The whole table is written as one snapshot, each time to the next of
+ * PS4_BOND_SLOTS storage entries. Loading takes the valid snapshot with
+ * the highest sequence, so a write cut short by a reset loses only that
+ * write, and no entry is rewritten more than every PS4_BOND_SLOTS saves. */
+typedef struct {
+  uint32_t sequence;
+  uint8_t count;
+  ps4_bond_t bonds[PS4_MAX_BONDS];
+  uint32_t checksum;
+} ps4_bond_snapshot_t;
+
+/* The storage entry kind for bond snapshots */
+#define STORAGE_KIND_BOND 'b'
+
+/* Open addressing index from address to table entry, at most half full */
+#define INDEX_SIZE (PS4_MAX_BONDS <= 4 ? 8 : PS4_MAX_BONDS <= 8 ? 16 : 32)
+#define INDEX_EMPTY 0xFF
+
+#if PS4_MAX_BONDS > 16
+#error "PS4_MAX_BONDS must be at most 16"
+#endif
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static void loadTable();
+static void saveTable();
+static int8_t findBond(const uint8_t* addr);
+static void removeBond(uint8_t entry);
+static void rebuildIndex();
+static uint32_t snapshotChecksum(const ps4_bond_snapshot_t* snapshot);
+static void slotKey(char key[PS4_STORAGE_KEY_SIZE], uint8_t slot);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+static ps4_bond_snapshot_t table;
+static uint8_t bond_index[INDEX_SIZE];
+static uint8_t next_slot = 0;
+static bool is_loaded = false;
+static bool is_dirty = false;  // the table differs from the last snapshot
+
+/* The controller connected, whose settings are kept when it disconnects.
+ * Both channels closing report a disconnect, only the first one counts. */
+static uint8_t connected_addr[6];
+static bool is_connected = false;
+
+static portMUX_TYPE bond_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4GetBonds
+**
+** Description      Copies up to max of the known controllers, the most
+**                  recently connected first.
+**
+**
+** Returns          uint8_t, the number of controllers copied
+**
+*******************************************************************************/
+uint8_t ps4GetBonds(ps4_bond_t* bonds, uint8_t max) {
+  ps4_bond_t sorted[PS4_MAX_BONDS];
+  uint8_t count;
+
+  loadTable();
+
+  portENTER_CRITICAL(&bond_lock);
+  count = table.count;
+  memcpy(sorted, table.bonds, count * sizeof(ps4_bond_t));
+  portEXIT_CRITICAL(&bond_lock);
+
+  // Insertion sort by last use, the table is small
+  for (uint8_t i = 1; i < count; i++) {
+    ps4_bond_t bond = sorted[i];
+    uint8_t at = i;
+    while (at > 0 && sorted[at - 1].last_used < bond.last_used) {
+      sorted[at] = sorted[at - 1];
+      at--;
+    }
+    sorted[at] = bond;
+  }
+
+  count = count < max ? count : max;
+  memcpy(bonds, sorted, count * sizeof(ps4_bond_t));
+
+  return count;
+}
+
+/*******************************************************************************
+**
+** Function         ps4ForgetBond
+**
+** Description      Removes a controller from the bonding store.
+**
+**
+** Returns          bool, false if the controller was not known
+**
+*******************************************************************************/
+bool ps4ForgetBond(const uint8_t* addr) {
+  loadTable();
+
+  portENTER_CRITICAL(&bond_lock);
+  int8_t entry = findBond(addr);
+  if (entry >= 0) {
+    removeBond(entry);
+  }
+  portEXIT_CRITICAL(&bond_lock);
+
+  if (entry < 0) {
+    return false;
+  }
+
+  saveTable();
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function         ps4_bond_reload
+**
+** Description      Reads the table again on its next use, after the storage
+**                  backend changed.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_bond_reload() {
+  portENTER_CRITICAL(&bond_lock);
+  is_loaded = false;
+  portEXIT_CRITICAL(&bond_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_bond_connect
+**
+** Description      Restores the settings last used with the controller that
+**                  connected, and records the connection. A new controller
+**                  takes the place of the one unused for the longest time
+**                  once PS4_MAX_BONDS are known. A known controller is
+**                  only marked as used when that changes the order, so
+**                  reconnecting the same controller writes nothing.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_bond_connect(const uint8_t* addr) {
+  ps4_bond_t bond;
+
+  loadTable();
+
+  portENTER_CRITICAL(&bond_lock);
+
+  int8_t entry = findBond(addr);
+  bool known = entry >= 0;
+
+  if (!known) {
+    if (table.count == PS4_MAX_BONDS) {
+      uint8_t oldest = 0;
+      for (uint8_t i = 1; i < table.count; i++) {
+        if (table.bonds[i].last_used < table.bonds[oldest].last_used) {
+          oldest = i;
+        }
+      }
+      removeBond(oldest);
+    }
+
+    entry = table.count++;
+    memset(&table.bonds[entry], 0, sizeof(ps4_bond_t));
+    memcpy(table.bonds[entry].addr, addr, sizeof(table.bonds[entry].addr));
+    rebuildIndex();
+  }
+
+  bool is_newest = known;
+  for (uint8_t i = 0; i < table.count; i++) {
+    is_newest &= table.bonds[i].last_used <= table.bonds[entry].last_used;
+  }
+  if (!is_newest) {
+    table.bonds[entry].last_used = table.sequence + 1;
+    is_dirty = true;
+  }
+  bond = table.bonds[entry];
+
+  memcpy(connected_addr, addr, sizeof(connected_addr));
+  is_connected = true;
+
+  portEXIT_CRITICAL(&bond_lock);
+
+  if (known) {
+    ps4_cmd_t cmd = {0};
+    cmd.r = bond.r;
+    cmd.g = bond.g;
+    cmd.b = bond.b;
+    cmd.flashOn = bond.flash_on;
+    cmd.flashOff = bond.flash_off;
+
+    ps4_output_volume(bond.volume);
+    ps4Cmd(cmd);
+  } else {
+    saveTable();
+  }
+}
+
+/*******************************************************************************
+**
+** Function         ps4_bond_disconnect
+**
+** Description      Keeps the settings in use as the controller disconnects,
+**                  to restore them on its next connection. The table is
+**                  only written when it changed since the last snapshot,
+**                  and once for both channels closing.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_bond_disconnect(const uint8_t* addr) {
+  ps4_cmd_t cmd;
+  uint8_t volume;
+
+  ps4_output_state(&cmd, &volume);
+
+  portENTER_CRITICAL(&bond_lock);
+  bool was_connected = is_connected && memcmp(connected_addr, addr, sizeof(connected_addr)) == 0;
+  is_connected = false;
+  int8_t entry = was_connected ? findBond(addr) : -1;
+  if (entry >= 0) {
+    ps4_bond_t* bond = &table.bonds[entry];
+    ps4_bond_t previous = *bond;
+    bond->r = cmd.r;
+    bond->g = cmd.g;
+    bond->b = cmd.b;
+    bond->flash_on = cmd.flashOn;
+    bond->flash_off = cmd.flashOff;
+    bond->volume = volume;
+    is_dirty |= memcmp(&previous, bond, sizeof(previous)) != 0;
+  }
+  bool save = is_dirty;
+  portEXIT_CRITICAL(&bond_lock);
+
+  if (save) {
+    saveTable();
+  }
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         loadTable
+**
+** Description      Reads the newest valid snapshot the first time the store
+**                  is used, and continues writing after it.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void loadTable() {
+  static ps4_bond_snapshot_t snapshot;
+  char key[PS4_STORAGE_KEY_SIZE];
+
+  if (is_loaded) {
+    return;
+  }
+
+  memset(&table, 0, sizeof(table));
+  next_slot = 0;
+
+  for (uint8_t slot = 0; slot < PS4_BOND_SLOTS; slot++) {
+    slotKey(key, slot);
+
+    if (!ps4_storage_load(key, &snapshot, sizeof(snapshot)) ||
+        snapshot.checksum != snapshotChecksum(&snapshot) || snapshot.count > PS4_MAX_BONDS) {
+      continue;
+    }
+
+    if (snapshot.sequence > table.sequence) {
+      table = snapshot;
+      next_slot = (slot + 1) % PS4_BOND_SLOTS;
+    }
+  }
+
+  portENTER_CRITICAL(&bond_lock);
+  rebuildIndex();
+  is_loaded = true;
+  is_dirty = false;
+  portEXIT_CRITICAL(&bond_lock);
+
+  ESP_LOGI(PS4_TAG, "[%s] %u controllers known", __func__, table.count);
+}
+
+static void saveTable() {
+  static ps4_bond_snapshot_t snapshot;
+  char key[PS4_STORAGE_KEY_SIZE];
+
+  portENTER_CRITICAL(&bond_lock);
+  table.sequence++;
+  snapshot = table;
+  is_dirty = false;
+  uint8_t slot = next_slot;
+  next_slot = (next_slot + 1) % PS4_BOND_SLOTS;
+  portEXIT_CRITICAL(&bond_lock);
+
+  snapshot.checksum = snapshotChecksum(&snapshot);
+  slotKey(key, slot);
+  ps4_storage_store(key, &snapshot, sizeof(snapshot));
+}
+
+static int8_t findBond(const uint8_t* addr) {
+  uint8_t i = ps4_address_hash(addr, INDEX_SIZE);
+
+  while (bond_index[i] != INDEX_EMPTY) {
+    if (memcmp(table.bonds[bond_index[i]].addr, addr, sizeof(table.bonds[0].addr)) == 0) {
+      return bond_index[i];
+    }
+    i = (i + 1) & (INDEX_SIZE - 1);
+  }
+
+  return -1;
+}
+
+/* The last entry takes the place of the removed one */
+static void removeBond(uint8_t entry) {
+  table.count--;
+  table.bonds[entry] = table.bonds[table.count];
+  rebuildIndex();
+}
+
+static void rebuildIndex() {
+  memset(bond_index, INDEX_EMPTY, sizeof(bond_index));
+
+  for (uint8_t entry = 0; entry < table.count; entry++) {
+    uint8_t i = ps4_address_hash(table.bonds[entry].addr, INDEX_SIZE);
+    while (bond_index[i] != INDEX_EMPTY) {
+      i = (i + 1) & (INDEX_SIZE - 1);
+    }
+    bond_index[i] = entry;
+  }
+}
+
+/* Fletcher-32 over everything but the checksum itself */
+static uint32_t snapshotChecksum(const ps4_bond_snapshot_t* snapshot) {
+  const uint8_t* data = (const uint8_t*)snapshot;
+  uint32_t a = 0xFFFF;
+  uint32_t b = 0xFFFF;
+
+  for (size_t i = 0; i < offsetof(ps4_bond_snapshot_t, checksum); i++) {
+    a = (a + data[i]) % 0xFFFF;
+    b = (b + a) % 0xFFFF;
+  }
+
+  return b << 16 | a;
+}
+
+static void slotKey(char key[PS4_STORAGE_KEY_SIZE], uint8_t slot) {
+  snprintf(key, PS4_STORAGE_KEY_SIZE, "%c%u", STORAGE_KIND_BOND, slot);
+}
@@ -0,0 +1,252 @@
+#include <math.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+/* Filtered values are kept with VALUE_FRACTION_BITS, and the smoothing
+ * factors are fractions of ALPHA_ONE */
+#define VALUE_FRACTION_BITS 8
+#define ALPHA_SHIFT 16
+#define ALPHA_ONE (1 << ALPHA_SHIFT)
+
+/* Cutoff frequencies are stored as angular frequency per microsecond:
+ * OMEGA_SHIFT fraction bits for the cutoffs themselves, BETA_SHIFT for the
+ * speed dependent part, so both small and large settings stay precise */
+#define OMEGA_SHIFT 32
+#define BETA_SHIFT 40
+
+/* Report gaps longer than this are treated as this long, so a stall does not
+ * make the filter jump straight to the next reading */
+#define MAX_INTERVAL_US 100000
+
+/* Limits that keep the 64 bit intermediate products from overflowing */
+#define MAX_SPEED ((int32_t)1 << 25)
+#define MAX_BETA_OMEGA ((uint64_t)1 << 38)
+#define MAX_OMEGA ((uint64_t)1 << 40)
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static int32_t smoothingFactor(uint64_t omega, uint32_t interval);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+/* Settings, as given and converted for the filter */
+static ps4_filter_params_t params[PS4_CHANNEL_COUNT];
+static uint32_t min_omega[PS4_CHANNEL_COUNT];
+static uint32_t d_omega[PS4_CHANNEL_COUNT];
+static uint64_t beta_omega[PS4_CHANNEL_COUNT];
+static uint16_t enabled_channels = 0;
+
+static bool is_reset_pending = false;
+
+static portMUX_TYPE filter_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Filter state, one array per quantity so all channels run in one pass.
+ * Only the parser uses it, so it is not under filter_lock. */
+static int32_t value_estimate[PS4_CHANNEL_COUNT];  // with VALUE_FRACTION_BITS
+static int32_t speed_estimate[PS4_CHANNEL_COUNT];  // units per second
+static uint32_t last_timestamp = 0;
+static bool has_estimate = false;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4SetFilter
+**
+** Description      Sets the One-Euro filter applied to a channel of every
+**                  report. Can be changed at any time, also while connected.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4SetFilter(ps4_channel_t channel, const ps4_filter_params_t* filter_params) {
+  if (channel >= PS4_CHANNEL_COUNT) {
+    return;
+  }
+
+  // Convert to radians per microsecond once here, so the filter itself
+  // needs no floating point
+  const double per_us = 2.0 * M_PI / 1e6;
+  double min_cutoff = filter_params->min_cutoff > 0 ? filter_params->min_cutoff : 0;
+  double d_cutoff = filter_params->d_cutoff > 0 ? filter_params->d_cutoff : 1.0;
+  double beta = filter_params->beta > 0 ? filter_params->beta : 0;
+
+  uint32_t min = (uint32_t)fmin(min_cutoff * per_us * ((uint64_t)1 << OMEGA_SHIFT), UINT32_MAX);
+  uint32_t d = (uint32_t)fmin(d_cutoff * per_us * ((uint64_t)1 << OMEGA_SHIFT), UINT32_MAX);
+  uint64_t b = (uint64_t)fmin(beta * per_us * ((uint64_t)1 << BETA_SHIFT), (double)MAX_BETA_OMEGA);
+
+  portENTER_CRITICAL(&filter_lock);
+  params[channel] = *filter_params;
+  min_omega[channel] = min;
+  d_omega[channel] = d;
+  beta_omega[channel] = b;
+
+  if (min > 0) {
+    enabled_channels |= 1 << channel;
+  } else {
+    enabled_channels &= ~(1 << channel);
+  }
+  portEXIT_CRITICAL(&filter_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4GetFilter
+**
+** Description      Returns the filter settings of a channel.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4GetFilter(ps4_channel_t channel, ps4_filter_params_t* filter_params) {
+  if (channel >= PS4_CHANNEL_COUNT) {
+    memset(filter_params, 0, sizeof(*filter_params));
+    return;
+  }
+
+  portENTER_CRITICAL(&filter_lock);
+  *filter_params = params[channel];
+  portEXIT_CRITICAL(&filter_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_filter_reset
+**
+** Description      Forgets the filter state, so the first report of a new
+**                  connection is passed through as is.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_filter_reset() {
+  portENTER_CRITICAL(&filter_lock);
+  is_reset_pending = true;
+  portEXIT_CRITICAL(&filter_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_filter_apply
+**
+** Description      Replaces the analog values of a report with their
+**                  filtered values, for the channels that have a filter set.
+**                  Uses the controller's timestamps, so delivery jitter of
+**                  the reports does not affect the result.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_filter_apply(ps4_t* ps4) {
+  int32_t values[PS4_CHANNEL_COUNT];
+  uint32_t min[PS4_CHANNEL_COUNT];
+  uint32_t d[PS4_CHANNEL_COUNT];
+  uint64_t b[PS4_CHANNEL_COUNT];
+
+  // Filter on a copy of the settings, so the lock is not held for the
+  // divisions of all channels
+  portENTER_CRITICAL(&filter_lock);
+  uint16_t enabled = enabled_channels;
+  if (enabled != 0) {
+    memcpy(min, min_omega, sizeof(min));
+    memcpy(d, d_omega, sizeof(d));
+    memcpy(b, beta_omega, sizeof(b));
+  }
+  bool reset = is_reset_pending;
+  is_reset_pending = false;
+  portEXIT_CRITICAL(&filter_lock);
+
+  if (reset || enabled == 0) {
+    has_estimate = false;
+  }
+
+  if (enabled == 0) {
+    return;
+  }
+
+  ps4_channels_read(ps4, values);
+
+  uint32_t interval = ps4->timestamp - last_timestamp;
+  last_timestamp = ps4->timestamp;
+
+  if (!has_estimate) {
+    // Nothing to measure a speed against yet
+    for (uint8_t i = 0; i < PS4_CHANNEL_COUNT; i++) {
+      value_estimate[i] = values[i] * (1 << VALUE_FRACTION_BITS);
+      speed_estimate[i] = 0;
+    }
+    has_estimate = true;
+    return;
+  }
+
+  if (interval == 0) {
+    interval = 1;
+  } else if (interval > MAX_INTERVAL_US) {
+    interval = MAX_INTERVAL_US;
+  }
+
+  for (uint8_t i = 0; i < PS4_CHANNEL_COUNT; i++) {
+    int32_t value = values[i] * (1 << VALUE_FRACTION_BITS);
+
+    if (!(enabled & (1 << i))) {
+      value_estimate[i] = value;
+      speed_estimate[i] = 0;
+      continue;
+    }
+
+    // Speed since the last estimate, smoothed with the fixed d_cutoff
+    int64_t speed = ((int64_t)(value - value_estimate[i]) * 1000000 / interval) >> VALUE_FRACTION_BITS;
+    speed = speed < -MAX_SPEED ? -MAX_SPEED : speed > MAX_SPEED ? MAX_SPEED : speed;
+    int32_t alpha = smoothingFactor(d[i], interval);
+    speed_estimate[i] += (int32_t)(((int64_t)(speed - speed_estimate[i]) * alpha + (ALPHA_ONE >> 1)) >> ALPHA_SHIFT);
+
+    // The cutoff rises with the speed, trading smoothing for lag
+    uint32_t absSpeed = speed_estimate[i] < 0 ? -speed_estimate[i] : speed_estimate[i];
+    uint64_t omega = min[i] + ((b[i] * absSpeed) >> (BETA_SHIFT - OMEGA_SHIFT));
+    omega = omega < MAX_OMEGA ? omega : MAX_OMEGA;
+    alpha = smoothingFactor(omega, interval);
+    value_estimate[i] += (int32_t)(((int64_t)(value - value_estimate[i]) * alpha + (ALPHA_ONE >> 1)) >> ALPHA_SHIFT);
+
+    values[i] = (value_estimate[i] + (1 << (VALUE_FRACTION_BITS - 1))) >> VALUE_FRACTION_BITS;
+  }
+
+  ps4_channels_write(ps4, values);
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         smoothingFactor
+**
+** Description      Computes the exponential smoothing factor of a low-pass
+**                  filter with the given cutoff for one sample interval,
+**                  alpha = w / (w + 1) with w = 2 * pi * cutoff * interval.
+**
+**
+** Returns          int32_t, as a fraction of ALPHA_ONE
+**
+*******************************************************************************/
+static int32_t smoothingFactor(uint64_t omega, uint32_t interval) {
+  uint64_t w = (omega * interval) >> (OMEGA_SHIFT - ALPHA_SHIFT);
+  return (int32_t)((w << ALPHA_SHIFT) / (w + ALPHA_ONE));
+}
@@ -0,0 +1,118 @@
+#include <esp_timer.h>
+
+#include "esp_bt.h"
+#include "esp_bt_device.h"
+#include "esp_bt_main.h"
+#include "esp_gap_bt_api.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+#define PS4_TAG "PS4_GAP"
+
+/* What the connectable log measures from. The Arduino core starts the
+ * controller and Bluedroid before ps4Init, so there the log only covers
+ * what follows: the SPP server of sppInit, or the scan mode of gapInit. */
+#ifdef ARDUINO_ARCH_ESP32
+#define PS4_GAP_MEASURED_FROM "ps4Init, Bluetooth already started"
+#else
+#define PS4_GAP_MEASURED_FROM "starting Bluetooth"
+#endif
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S                       */
+/********************************************************************************/
+
+/* Start of the bring-up, to log how long it took to become connectable */
+static int64_t init_start = 0;
+static uint32_t init_free_heap = 0;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S                        */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         gapInit
+**
+** Description      Makes this device connectable through GAP alone, without
+**                  the SPP server sppInit starts for that. Used with
+**                  CONFIG_PS4_INIT_GAP_ONLY, which is experimental.
+**
+** Returns          void
+**
+*******************************************************************************/
+void gapInit() {
+  if (!ps4_gap_bluetooth_start()) {
+    return;
+  }
+
+  ps4_gap_connectable();
+}
+
+/*******************************************************************************
+**
+** Function         ps4_gap_bluetooth_start
+**
+** Description      Starts the Bluetooth controller and Bluedroid, which the
+**                  Arduino core does before ps4Init.
+**
+** Returns          bool, false if any step failed
+**
+*******************************************************************************/
+bool ps4_gap_bluetooth_start() {
+  init_start = esp_timer_get_time();
+  init_free_heap = esp_get_free_heap_size();
+
+#ifndef ARDUINO_ARCH_ESP32
+  esp_err_t ret;
+
+  esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
+  if ((ret = esp_bt_controller_init(&bt_cfg)) != ESP_OK) {
+    ESP_LOGE(PS4_TAG, "%s initialize controller failed: %s\n", __func__, esp_err_to_name(ret));
+    return false;
+  }
+
+  if ((ret = esp_bt_controller_enable(BT_MODE)) != ESP_OK) {
+    ESP_LOGE(PS4_TAG, "%s enable controller failed: %s\n", __func__, esp_err_to_name(ret));
+    return false;
+  }
+
+  if ((ret = esp_bluedroid_init()) != ESP_OK) {
+    ESP_LOGE(PS4_TAG, "%s initialize bluedroid failed: %s\n", __func__, esp_err_to_name(ret));
+    return false;
+  }
+
+  if ((ret = esp_bluedroid_enable()) != ESP_OK) {
+    ESP_LOGE(PS4_TAG, "%s enable bluedroid failed: %s\n", __func__, esp_err_to_name(ret));
+    return false;
+  }
+#endif
+
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function         ps4_gap_connectable
+**
+** Description      Sets the device name and makes this device connectable
+**                  but not discoverable, so paired controllers can connect.
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_gap_connectable() {
+  esp_bt_dev_set_device_name("ESP Host");
+
+#if CONFIG_IDF_COMPATIBILITY >= IDF_COMPATIBILITY_MASTER_D9CE0BB
+  esp_bt_gap_set_scan_mode(ESP_BT_CONNECTABLE, ESP_BT_NON_DISCOVERABLE);
+#elif CONFIG_IDF_COMPATIBILITY >= IDF_COMPATIBILITY_MASTER_21AF1D7
+  esp_bt_gap_set_scan_mode(ESP_BT_SCAN_MODE_CONNECTABLE);
+#endif
+
+  ESP_LOGI(PS4_TAG, "[%s] connectable %u ms and %d bytes of heap after %s", __func__,
+           (unsigned)((esp_timer_get_time() - init_start) / 1000),
+           (int)(init_free_heap - esp_get_free_heap_size()), PS4_GAP_MEASURED_FROM);
+}
@@ -0,0 +1,392 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+/* Each finger is down until it moves further than a tap allows */
+typedef enum {
+  contact_up,
+  contact_down,
+  contact_moved
+} ps4_contact_state_t;
+
+/* What the fingers on the touchpad are doing together. A finger left over
+ * from a two finger gesture is spent and starts nothing until every finger
+ * is lifted. */
+typedef enum {
+  group_none,
+  group_one,
+  group_swipe,
+  group_two,
+  group_scroll,
+  group_pinch,
+  group_spent
+} ps4_gesture_group_t;
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static void trackContacts(const ps4_touchpad_t* touchpad, int64_t time);
+static void startTwoFingers(const ps4_touchpad_t* touchpad);
+static void measureTwoFingers(const ps4_touchpad_t* touchpad, ps4_gesture_t* gesture);
+static void emit(ps4_gesture_type_t type, ps4_gesture_phase_t phase);
+static uint32_t distance(int32_t dx, int32_t dy);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+static ps4_gesture_callback_t gesture_cb = NULL;
+static void* gesture_object = NULL;
+
+static ps4_gesture_thresholds_t thresholds = {
+  .tap_max_ms = 200,
+  .tap_max_distance = 40,
+  .swipe_min_distance = 80,
+  .scroll_min_distance = 60,
+  .pinch_min_distance = 60
+};
+
+/* Per contact state, indexed by contact table slot */
+static uint8_t contact_state[PS4_TOUCH_CONTACTS];
+static uint16_t start_x[PS4_TOUCH_CONTACTS];
+static uint16_t start_y[PS4_TOUCH_CONTACTS];
+static int64_t start_time[PS4_TOUCH_CONTACTS];
+
+static uint8_t group = group_none;
+static uint8_t primary = 0;  // slot of the finger of a one finger gesture
+
+/* Start of a two finger gesture */
+static uint16_t start_center_x = 0;
+static uint16_t start_center_y = 0;
+static uint32_t start_distance = 0;
+
+/* Gesture being reported, and the one handed to the callback */
+static ps4_gesture_t current;
+static ps4_gesture_t reported;
+
+static portMUX_TYPE gesture_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4SetGestureCallback
+**
+** Description      Registers the callback receiving touchpad gestures. The
+**                  touchpad is decoded while this or the touchpad callback
+**                  is set.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4SetGestureCallback(void* object, ps4_gesture_callback_t cb) {
+  portENTER_CRITICAL(&gesture_lock);
+  gesture_cb = cb;
+  gesture_object = object;
+  portEXIT_CRITICAL(&gesture_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4SetGestureThresholds
+**
+** Description      Sets how far and how long fingers move before a gesture
+**                  is recognized, in touchpad units and milliseconds.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4SetGestureThresholds(const ps4_gesture_thresholds_t* gesture_thresholds) {
+  portENTER_CRITICAL(&gesture_lock);
+  thresholds = *gesture_thresholds;
+  portEXIT_CRITICAL(&gesture_lock);
+}
+
+void ps4GetGestureThresholds(ps4_gesture_thresholds_t* gesture_thresholds) {
+  portENTER_CRITICAL(&gesture_lock);
+  *gesture_thresholds = thresholds;
+  portEXIT_CRITICAL(&gesture_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_gesture_enabled
+**
+** Description      Returns whether gestures are being recognized, so the
+**                  touchpad has to be decoded.
+**
+**
+** Returns          bool
+**
+*******************************************************************************/
+bool ps4_gesture_enabled() { return gesture_cb != NULL; }
+
+/*******************************************************************************
+**
+** Function         ps4_gesture_reset
+**
+** Description      Drops a gesture in progress without ending it, e.g. on a
+**                  new connection.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_gesture_reset() {
+  portENTER_CRITICAL(&gesture_lock);
+  memset(contact_state, contact_up, sizeof(contact_state));
+  group = group_none;
+  portEXIT_CRITICAL(&gesture_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_gesture_update
+**
+** Description      Advances the recognizer by the touch frames of a report.
+**                  A one finger touch is a tap if it is lifted quickly
+**                  without moving, and a swipe once it moves far enough. Two
+**                  fingers scroll when they move together and pinch when
+**                  their distance changes, whichever passes its threshold
+**                  first. Only the start, update and end of a gesture are
+**                  reported.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_gesture_update(const ps4_touchpad_t* touchpad) {
+  ps4_gesture_t events[3];
+  uint8_t event_count = 0;
+  ps4_gesture_callback_t cb;
+  void* object;
+
+  if (gesture_cb == NULL) {
+    return;
+  }
+
+  int64_t time = ps4_report_time();
+
+  portENTER_CRITICAL(&gesture_lock);
+
+  trackContacts(touchpad, time);
+
+  uint8_t fingers = 0;
+  for (uint8_t i = 0; i < PS4_TOUCH_CONTACTS; i++) {
+    fingers += touchpad->contact[i].active;
+  }
+
+  const ps4_touch_contact_t* contact = &touchpad->contact[primary];
+
+  // A gesture can end and another start in the same frames, so the events
+  // are collected as they are emitted
+#define EMIT(type, phase)                  \
+  do {                                     \
+    emit((type), (phase));                 \
+    events[event_count++] = reported;      \
+  } while (0)
+
+  switch (group) {
+    case group_none:
+    case group_one:
+      if (fingers == 2) {
+        startTwoFingers(touchpad);
+      } else if (group == group_none) {
+        for (uint8_t i = 0; i < PS4_TOUCH_CONTACTS; i++) {
+          if (touchpad->contact[i].active) {
+            primary = i;
+            group = group_one;
+          }
+        }
+      } else if (!contact->active) {
+        bool quick = time - start_time[primary] <= thresholds.tap_max_ms * 1000LL;
+
+        group = group_none;
+        if (contact_state[primary] == contact_down && quick) {
+          current.x = contact->x;
+          current.y = contact->y;
+          current.dx = current.dy = current.spread = 0;
+          current.vx = current.vy = 0;
+          EMIT(ps4_gesture_tap, ps4_gesture_phase_start);
+          EMIT(ps4_gesture_tap, ps4_gesture_phase_end);
+        }
+      } else if (distance(contact->x - start_x[primary], contact->y - start_y[primary]) >=
+                 thresholds.swipe_min_distance) {
+        group = group_swipe;
+        current.spread = 0;
+        current.x = contact->x;
+        current.y = contact->y;
+        current.dx = contact->x - start_x[primary];
+        current.dy = contact->y - start_y[primary];
+        current.vx = contact->vx;
+        current.vy = contact->vy;
+        EMIT(ps4_gesture_swipe, ps4_gesture_phase_start);
+      }
+      break;
+
+    case group_swipe:
+      // A lifted contact keeps its last position and velocity
+      current.x = contact->x;
+      current.y = contact->y;
+      current.dx = contact->x - start_x[primary];
+      current.dy = contact->y - start_y[primary];
+      current.vx = contact->vx;
+      current.vy = contact->vy;
+
+      if (fingers == 2) {
+        EMIT(ps4_gesture_swipe, ps4_gesture_phase_end);
+        startTwoFingers(touchpad);
+      } else if (!contact->active) {
+        EMIT(ps4_gesture_swipe, ps4_gesture_phase_end);
+        group = group_none;
+      } else if (current.dx != reported.dx || current.dy != reported.dy) {
+        EMIT(ps4_gesture_swipe, ps4_gesture_phase_update);
+      }
+      break;
+
+    case group_two:
+      if (fingers < 2) {
+        group = fingers == 0 ? group_none : group_spent;
+        break;
+      }
+
+      measureTwoFingers(touchpad, &current);
+      if ((uint32_t)abs(current.spread) >= thresholds.pinch_min_distance) {
+        group = group_pinch;
+        EMIT(ps4_gesture_pinch, ps4_gesture_phase_start);
+      } else if (distance(current.dx, current.dy) >= thresholds.scroll_min_distance) {
+        group = group_scroll;
+        EMIT(ps4_gesture_scroll, ps4_gesture_phase_start);
+      }
+      break;
+
+    case group_scroll:
+    case group_pinch: {
+      ps4_gesture_type_t type = group == group_scroll ? ps4_gesture_scroll : ps4_gesture_pinch;
+
+      if (fingers < 2) {
+        EMIT(type, ps4_gesture_phase_end);
+        group = fingers == 0 ? group_none : group_spent;
+        break;
+      }
+
+      measureTwoFingers(touchpad, &current);
+      if (current.dx != reported.dx || current.dy != reported.dy || current.spread != reported.spread) {
+        EMIT(type, ps4_gesture_phase_update);
+      }
+      break;
+    }
+
+    case group_spent:
+      if (fingers == 0) {
+        group = group_none;
+      }
+      break;
+  }
+
+#undef EMIT
+
+  cb = gesture_cb;
+  object = gesture_object;
+
+  portEXIT_CRITICAL(&gesture_lock);
+
+  if (cb != NULL) {
+    for (uint8_t i = 0; i < event_count; i++) {
+      cb(object, &events[i]);
+    }
+  }
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+static void trackContacts(const ps4_touchpad_t* touchpad, int64_t time) {
+  for (uint8_t i = 0; i < PS4_TOUCH_CONTACTS; i++) {
+    const ps4_touch_contact_t* contact = &touchpad->contact[i];
+
+    if (contact->began) {
+      contact_state[i] = contact_down;
+      start_x[i] = contact->x;
+      start_y[i] = contact->y;
+      start_time[i] = time;
+    }
+
+    if (contact_state[i] == contact_down &&
+        distance(contact->x - start_x[i], contact->y - start_y[i]) > thresholds.tap_max_distance) {
+      contact_state[i] = contact_moved;
+    }
+
+    // Lifted contacts are looked at once more by the gesture they end
+    if (!contact->active && !contact->ended) {
+      contact_state[i] = contact_up;
+    }
+  }
+}
+
+static void startTwoFingers(const ps4_touchpad_t* touchpad) {
+  const ps4_touch_contact_t* a = &touchpad->contact[0];
+  const ps4_touch_contact_t* b = &touchpad->contact[1];
+
+  group = group_two;
+  start_center_x = (a->x + b->x) / 2;
+  start_center_y = (a->y + b->y) / 2;
+  start_distance = distance(a->x - b->x, a->y - b->y);
+}
+
+/* Position of a two finger gesture: the middle between the fingers, how far
+ * that has moved and how much the fingers have spread since the start */
+static void measureTwoFingers(const ps4_touchpad_t* touchpad, ps4_gesture_t* gesture) {
+  const ps4_touch_contact_t* a = &touchpad->contact[0];
+  const ps4_touch_contact_t* b = &touchpad->contact[1];
+
+  gesture->x = (a->x + b->x) / 2;
+  gesture->y = (a->y + b->y) / 2;
+  gesture->dx = gesture->x - start_center_x;
+  gesture->dy = gesture->y - start_center_y;
+  gesture->spread = (int32_t)distance(a->x - b->x, a->y - b->y) - (int32_t)start_distance;
+  gesture->vx = (a->vx + b->vx) / 2;
+  gesture->vy = (a->vy + b->vy) / 2;
+}
+
+static void emit(ps4_gesture_type_t type, ps4_gesture_phase_t phase) {
+  current.type = type;
+  current.phase = phase;
+  reported = current;
+}
+
+/* Euclidean distance by integer square root, exact to the unit below */
+static uint32_t distance(int32_t dx, int32_t dy) {
+  uint32_t square = (uint32_t)(dx * dx + dy * dy);
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+
+  while (bit > square) {
+    bit >>= 2;
+  }
+
+  while (bit != 0) {
+    if (square >= root + bit) {
+      square -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+
+  return root;
+}
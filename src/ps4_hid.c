@@ -0,0 +1,345 @@
+#include <esp_timer.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+#define PS4_TAG "PS4_HID"
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+typedef struct {
+  hid_cmd_t cmd;
+  uint8_t len;
+  ps4_report_callback_t cb;
+  void* object;
+} ps4_hid_transaction_t;
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static void ps4_hid_start_next();
+static void ps4_hid_complete(ps4_hid_result_t result, const uint8_t* data, uint16_t len);
+static void ps4_hid_timeout_cback(void* arg);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+/* Transactions waiting to be sent. The head is the one in flight when
+ * in_flight is set, since the HID profile allows only one at a time. */
+static ps4_hid_transaction_t queue[PS4_HID_QUEUE_SIZE];
+static uint8_t queue_head = 0;
+static uint8_t queue_count = 0;
+static bool in_flight = false;
+static int64_t in_flight_deadline = 0;
+
+static esp_timer_handle_t timeout_timer = NULL;
+static portMUX_TYPE queue_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4GetReport
+**
+** Description      Requests a report from the PS4 controller. The callback
+**                  receives the report once the controller replies, so the
+**                  calling task is never blocked.
+**
+**
+** Returns          bool, false if the transaction queue is full
+**
+*******************************************************************************/
+bool ps4GetReport(ps4_report_type_t type, uint8_t reportId, ps4_report_callback_t cb, void* object) {
+  hid_cmd_t hidCommand;
+
+  hidCommand.code = hid_cmd_code_get_report | type;
+  hidCommand.identifier = reportId;
+
+  return ps4_hid_submit(&hidCommand, 0, cb, object);
+}
+
+/*******************************************************************************
+**
+** Function         ps4SetReport
+**
+** Description      Sends a report to the PS4 controller. The callback
+**                  receives the result of the controller's handshake.
+**
+**
+** Returns          bool, false if the transaction queue is full or the
+**                  report is too large
+**
+*******************************************************************************/
+bool ps4SetReport(ps4_report_type_t type, uint8_t reportId, const uint8_t* data,
+                  uint16_t length, ps4_report_callback_t cb, void* object) {
+  hid_cmd_t hidCommand;
+
+  if (length > sizeof(hidCommand.data)) {
+    ESP_LOGE(PS4_TAG, "[%s] report 0x%02x is too large: %d", __func__, reportId, length);
+    return false;
+  }
+
+  hidCommand.code = hid_cmd_code_set_report | type;
+  hidCommand.identifier = reportId;
+  memcpy(hidCommand.data, data, length);
+
+  return ps4_hid_submit(&hidCommand, length, cb, object);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_hid_init
+**
+** Description      Creates the timer failing a transaction the controller
+**                  does not answer. Called once from ps4Init, before the
+**                  application task or the timer task can submit one.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_hid_init() {
+  const esp_timer_create_args_t timer_args = {
+    .callback = &ps4_hid_timeout_cback,
+    .name = "ps4_hid"
+  };
+
+  if (timeout_timer != NULL) {
+    return;
+  }
+
+  if (esp_timer_create(&timer_args, &timeout_timer) != ESP_OK) {
+    ESP_LOGE(PS4_TAG, "[%s] creating the timeout timer failed", __func__);
+    timeout_timer = NULL;
+  }
+}
+
+/*******************************************************************************
+**
+** Function         ps4_hid_submit
+**
+** Description      Queues a HID control transaction. A fire-and-forget
+**                  report replaces an identical one that is still waiting,
+**                  so only the latest output state is sent.
+**
+**
+** Returns          bool, false if the transaction queue is full or there
+**                  is no timeout timer
+**
+*******************************************************************************/
+bool ps4_hid_submit(const hid_cmd_t* hid_cmd, uint8_t len, ps4_report_callback_t cb, void* object) {
+  ps4_hid_transaction_t* transaction = NULL;
+
+  // Without the timer a lost reply would stall the queue for good
+  if (timeout_timer == NULL) {
+    ESP_LOGE(PS4_TAG, "[%s] no timeout timer, dropping 0x%02x", __func__, hid_cmd->identifier);
+    return false;
+  }
+
+  portENTER_CRITICAL(&queue_lock);
+
+  if (cb == NULL) {
+    for (uint8_t i = in_flight ? 1 : 0; i < queue_count; i++) {
+      ps4_hid_transaction_t* queued = &queue[(queue_head + i) % PS4_HID_QUEUE_SIZE];
+
+      if (queued->cb == NULL && queued->cmd.code == hid_cmd->code &&
+          queued->cmd.identifier == hid_cmd->identifier) {
+        transaction = queued;
+        break;
+      }
+    }
+  }
+
+  if (transaction == NULL && queue_count < PS4_HID_QUEUE_SIZE) {
+    transaction = &queue[(queue_head + queue_count) % PS4_HID_QUEUE_SIZE];
+    queue_count++;
+  }
+
+  if (transaction != NULL) {
+    memcpy(&transaction->cmd, hid_cmd, sizeof(*hid_cmd) - sizeof(hid_cmd->data) + len);
+    transaction->len = len;
+    transaction->cb = cb;
+    transaction->object = object;
+  }
+
+  portEXIT_CRITICAL(&queue_lock);
+
+  if (transaction == NULL) {
+    ESP_LOGW(PS4_TAG, "[%s] transaction queue full, dropping 0x%02x", __func__, hid_cmd->identifier);
+    return false;
+  }
+
+  ps4_hid_start_next();
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function         ps4_hid_control_data
+**
+** Description      Handles a message received on the HID control channel,
+**                  matching it to the transaction in flight.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_hid_control_data(const uint8_t* data, uint16_t len) {
+  if (len == 0) {
+    return;
+  }
+
+  switch (data[0] & hid_cmd_code_mask) {
+    case hid_cmd_code_handshake:
+      ps4_hid_complete(data[0] & hid_cmd_code_param_mask, NULL, 0);
+      break;
+
+    case hid_cmd_code_data:
+      ps4_hid_complete(ps4_hid_result_success, data + 1, len - 1);
+      break;
+
+    default:
+      ESP_LOGD(PS4_TAG, "[%s] ignoring control message 0x%02x", __func__, data[0]);
+      break;
+  }
+}
+
+/*******************************************************************************
+**
+** Function         ps4_hid_reset
+**
+** Description      Fails every queued transaction with the given result,
+**                  used when the controller disconnects.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_hid_reset(ps4_hid_result_t result) {
+  ps4_hid_transaction_t transaction;
+
+  if (timeout_timer != NULL) {
+    esp_timer_stop(timeout_timer);
+  }
+
+  for (;;) {
+    portENTER_CRITICAL(&queue_lock);
+    if (queue_count == 0) {
+      in_flight = false;
+      portEXIT_CRITICAL(&queue_lock);
+      break;
+    }
+    transaction = queue[queue_head];
+    queue_head = (queue_head + 1) % PS4_HID_QUEUE_SIZE;
+    queue_count--;
+    portEXIT_CRITICAL(&queue_lock);
+
+    if (transaction.cb != NULL) {
+      transaction.cb(transaction.object, result, NULL, 0);
+    }
+  }
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4_hid_start_next
+**
+** Description      Sends the transaction at the head of the queue if none
+**                  is in flight.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void ps4_hid_start_next() {
+  ps4_hid_transaction_t transaction;
+
+  portENTER_CRITICAL(&queue_lock);
+  if (in_flight || queue_count == 0) {
+    portEXIT_CRITICAL(&queue_lock);
+    return;
+  }
+  in_flight = true;
+  in_flight_deadline = esp_timer_get_time() + PS4_HID_TRANSACTION_TIMEOUT_MS * 1000LL;
+  transaction = queue[queue_head];
+  portEXIT_CRITICAL(&queue_lock);
+
+  ps4_l2cap_send_hid(&transaction.cmd, transaction.len);
+  esp_timer_stop(timeout_timer);
+  esp_timer_start_once(timeout_timer, PS4_HID_TRANSACTION_TIMEOUT_MS * 1000ULL);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_hid_complete
+**
+** Description      Finishes the transaction in flight, reports its result
+**                  and starts the next one.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void ps4_hid_complete(ps4_hid_result_t result, const uint8_t* data, uint16_t len) {
+  ps4_hid_transaction_t transaction;
+
+  portENTER_CRITICAL(&queue_lock);
+  if (!in_flight) {
+    portEXIT_CRITICAL(&queue_lock);
+    ESP_LOGD(PS4_TAG, "[%s] unexpected reply, result: %d", __func__, result);
+    return;
+  }
+  transaction = queue[queue_head];
+  queue_head = (queue_head + 1) % PS4_HID_QUEUE_SIZE;
+  queue_count--;
+  in_flight = false;
+  portEXIT_CRITICAL(&queue_lock);
+
+  esp_timer_stop(timeout_timer);
+
+  if (result != ps4_hid_result_success) {
+    ESP_LOGW(PS4_TAG, "[%s] report 0x%02x failed: %d", __func__, transaction.cmd.identifier, result);
+  }
+
+  if (transaction.cb != NULL) {
+    transaction.cb(transaction.object, result, data, len);
+  }
+
+  ps4_hid_start_next();
+}
+
+/*******************************************************************************
+**
+** Function         ps4_hid_timeout_cback
+**
+** Description      Fails the transaction in flight when the controller
+**                  did not reply in time.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void ps4_hid_timeout_cback(void* arg) {
+  // A reply may have completed the transaction while this timer fired,
+  // in which case the next transaction's deadline is still ahead
+  portENTER_CRITICAL(&queue_lock);
+  bool expired = in_flight && esp_timer_get_time() >= in_flight_deadline;
+  portEXIT_CRITICAL(&queue_lock);
+
+  if (expired) {
+    ps4_hid_complete(ps4_hid_result_timeout, NULL, 0);
+  }
+}
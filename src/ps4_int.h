@@ -27,6 +27,13 @@
 #define CONFIG_IDF_COMPATIBILITY IDF_COMPATIBILITY_MASTER_21165ED
 #endif
 
+/** Make the device connectable through GAP alone instead of starting an SPP
+ * server for it, so SPP can be disabled. Experimental: the savings are not
+ * measured on a device yet */
+#ifndef CONFIG_PS4_INIT_GAP_ONLY
+#define CONFIG_PS4_INIT_GAP_ONLY 0
+#endif
+
 /** Size of the output report buffer for the Dualshock and Navigation
  * controllers */
 #define PS4_SEND_BUFFER_SIZE 77
@@ -36,15 +43,155 @@
 /*                         S H A R E D   T Y P E S */
 /********************************************************************************/
 
+/** Time to wait for the reply to a HID control transaction */
+#ifndef PS4_HID_TRANSACTION_TIMEOUT_MS
+#define PS4_HID_TRANSACTION_TIMEOUT_MS 500
+#endif
+
+/** Number of HID control transactions that can be waiting to be sent */
+#ifndef PS4_HID_QUEUE_SIZE
+#define PS4_HID_QUEUE_SIZE 8
+#endif
+
+/** Furthest ahead of the newest report a prediction reaches */
+#ifndef PS4_PREDICT_MAX_HORIZON_US
+#define PS4_PREDICT_MAX_HORIZON_US 20000
+#endif
+
+/** Number of reports kept for resampling, about 40ms at the usual rate */
+#ifndef PS4_RESAMPLE_HISTORY
+#define PS4_RESAMPLE_HISTORY 32
+#endif
+
+/** Number of batch callbacks that can be registered */
+#ifndef PS4_MAX_BATCH_SUBSCRIBERS
+#define PS4_MAX_BATCH_SUBSCRIBERS 4
+#endif
+
+/** Number of reports the sliding windows can span, about 320ms at the
+ * usual report rate, and the number of windows. The windows are opt-in:
+ * with none, the default, ps4_window.c is left out and the reports are not
+ * recorded. */
+#ifndef PS4_WINDOW_LENGTH
+#define PS4_WINDOW_LENGTH 256
+#endif
+
+#ifndef CONFIG_PS4_MAX_WINDOWS
+#define CONFIG_PS4_MAX_WINDOWS 0
+#endif
+
+#ifndef PS4_MAX_WINDOWS
+#define PS4_MAX_WINDOWS CONFIG_PS4_MAX_WINDOWS
+#endif
+
+/** Static memory taken by the sliding windows, in bytes: 28 per report
+ * kept, and 48 per report per window for the min/max deques */
+#define PS4_WINDOW_MEMORY \
+  (PS4_MAX_WINDOWS > 0 ? (28 + 48 * PS4_MAX_WINDOWS) * PS4_WINDOW_LENGTH + 256 * PS4_MAX_WINDOWS : 0)
+
+/** Number of action bindings, at most 32 */
+#ifndef PS4_MAX_BINDINGS
+#define PS4_MAX_BINDINGS 16
+#endif
+
+/** Rumble effect mixing: voices playing at once, the mixing tick, and the
+ * low bits dropped from the motor values before deciding to send them */
+#ifndef PS4_RUMBLE_VOICES
+#define PS4_RUMBLE_VOICES 4
+#endif
+
+#ifndef PS4_RUMBLE_TICK_MS
+#define PS4_RUMBLE_TICK_MS 10
+#endif
+
+#ifndef PS4_RUMBLE_QUANTIZE_BITS
+#define PS4_RUMBLE_QUANTIZE_BITS 2
+#endif
+
+/** Step of the timed lightbar animations */
+#ifndef PS4_LIGHTBAR_TICK_MS
+#define PS4_LIGHTBAR_TICK_MS 20
+#endif
+
+/** Controllers the bonding store remembers, and the storage entries its
+ * snapshots rotate over */
+#ifndef PS4_MAX_BONDS
+#define PS4_MAX_BONDS 4
+#endif
+
+#ifndef PS4_BOND_SLOTS
+#define PS4_BOND_SLOTS 4
+#endif
+
+/** Reconnecting: controllers paged in a round, and the wait after a round
+ * without a connection, doubling up to the maximum */
+#ifndef PS4_MAX_RECONNECT_ADDRESSES
+#define PS4_MAX_RECONNECT_ADDRESSES 4
+#endif
+
+#ifndef PS4_RECONNECT_BACKOFF_MS
+#define PS4_RECONNECT_BACKOFF_MS 1000
+#endif
+
+#ifndef PS4_RECONNECT_BACKOFF_MAX_MS
+#define PS4_RECONNECT_BACKOFF_MAX_MS 30000
+#endif
+
+/** Flush timeout asked for on the interrupt channel, 0 to not ask for one.
+ * It also applies to the control channel of the same link if the stack
+ * passes it on to the controller, so it is off by default. */
+#ifndef PS4_INTERRUPT_FLUSH_TIMEOUT_MS
+#define PS4_INTERRUPT_FLUSH_TIMEOUT_MS 0
+#endif
+
+/** Controller addresses the allow list holds */
+#ifndef PS4_MAX_ALLOWED
+#define PS4_MAX_ALLOWED 8
+#endif
+
+/** Speaker audio, opt-in as its buffers take about 10 KB: without it
+ * ps4_audio.c is left out and ps4AudioWrite takes no samples */
+#ifndef CONFIG_PS4_AUDIO
+#define CONFIG_PS4_AUDIO 0
+#endif
+
+#ifndef PS4_AUDIO
+#define PS4_AUDIO CONFIG_PS4_AUDIO
+#endif
+
+/** PCM samples buffered ahead of the encoder (a power of two, 4096 is
+ * 128ms at 32kHz), SBC frames per audio report, and the SBC bitpool,
+ * which sets the frame size to 8 + 2 * bitpool bytes */
+#ifndef PS4_AUDIO_RING_SAMPLES
+#define PS4_AUDIO_RING_SAMPLES 4096
+#endif
+
+#ifndef PS4_AUDIO_FRAMES_PER_REPORT
+#define PS4_AUDIO_FRAMES_PER_REPORT 4
+#endif
+
+#ifndef PS4_AUDIO_BITPOOL
+#define PS4_AUDIO_BITPOOL 52
+#endif
+
 enum hid_cmd_code {
+  hid_cmd_code_handshake = 0x00,
+  hid_cmd_code_control = 0x10,
+  hid_cmd_code_get_report = 0x40,
   hid_cmd_code_set_report = 0x50,
+  hid_cmd_code_data = 0xA0,
+  hid_cmd_code_type_input = 0x01,
   hid_cmd_code_type_output = 0x02,
-  hid_cmd_code_type_feature = 0x03
+  hid_cmd_code_type_feature = 0x03,
+
+  hid_cmd_code_mask = 0xF0,
+  hid_cmd_code_param_mask = 0x0F
 };
 
 enum hid_cmd_identifier {
   hid_cmd_identifier_ps4_enable = 0xF4,
-  hid_cmd_identifier_ps4_control = 0x11
+  hid_cmd_identifier_ps4_control = 0x11,
+  hid_cmd_identifier_ps4_calibration = 0x05
 };
 
 typedef struct {
@@ -62,7 +209,12 @@ enum ps4_control_packet_index {
   ps4_control_packet_index_blue = 9,
 
   ps4_control_packet_index_flash_on_time = 10,
-  ps4_control_packet_index_flash_off_time = 11
+  ps4_control_packet_index_flash_off_time = 11,
+
+  ps4_control_packet_index_volume_left = 20,
+  ps4_control_packet_index_volume_right = 21,
+  ps4_control_packet_index_volume_mic = 22,
+  ps4_control_packet_index_volume_speaker = 23
 };
 
 /********************************************************************************/
@@ -70,13 +222,175 @@ enum ps4_control_packet_index {
 /********************************************************************************/
 
 void ps4ConnectEvent(uint8_t isConnected);
-void ps4PacketEvent(ps4_t ps4, ps4_event_t event);
+void ps4PacketEvent(const ps4_t* ps4, const ps4_event_t* event);
+
+/********************************************************************************/
+/*                       O U T P U T   F U N C T I O N S */
+/********************************************************************************/
+
+void ps4_output_rumble(uint8_t small, uint8_t large);
+void ps4_output_led(uint8_t r, uint8_t g, uint8_t b, uint8_t flash_on, uint8_t flash_off);
+void ps4_output_volume(uint8_t volume);
+void ps4_output_state(ps4_cmd_t* cmd, uint8_t* volume);
 
 /********************************************************************************/
 /*                      P A R S E R   F U N C T I O N S */
 /********************************************************************************/
 
 void parsePacket(uint8_t* packet);
+void ps4_parser_reset();
+int64_t ps4_report_time();
+void ps4_channels_read(const ps4_t* ps4, int32_t* values);
+void ps4_channels_write(ps4_t* ps4, const int32_t* values);
+
+/********************************************************************************/
+/*                       S E N S O R   F U N C T I O N S */
+/********************************************************************************/
+
+void ps4_sensor_request_calibration();
+void ps4_sensor_calibrate(ps4_sensor_t* sensor);
+
+/********************************************************************************/
+/*                        S T I C K   F U N C T I O N S */
+/********************************************************************************/
+
+/* Raw stick reading to signed value, per axis. Regenerated whenever the
+ * calibration changes so the conversion itself stays a table lookup. A new
+ * table is built aside and swapped in whole, so read the pointer once per
+ * report. */
+extern int8_t (*volatile ps4_stick_lut)[256];
+extern bool ps4_stick_learning;
+
+void ps4_stick_init();
+void ps4_stick_learn(const uint8_t* raw);
+void ps4_stick_connect(const uint8_t* addr);
+void ps4_stick_disconnect();
+
+/********************************************************************************/
+/*                       F I L T E R   F U N C T I O N S */
+/********************************************************************************/
+
+void ps4_filter_reset();
+void ps4_filter_apply(ps4_t* ps4);
+
+/********************************************************************************/
+/*                   P R E D I C T O R   F U N C T I O N S */
+/********************************************************************************/
+
+void ps4_predict_reset();
+void ps4_predict_update(const ps4_t* ps4);
+
+/********************************************************************************/
+/*                       B A T C H   F U N C T I O N S */
+/********************************************************************************/
+
+void ps4_batch_reset();
+void ps4_batch_deliver(const ps4_t* ps4, const ps4_event_t* event);
+
+/********************************************************************************/
+/*                   R E S A M P L E R   F U N C T I O N S */
+/********************************************************************************/
+
+void ps4_resample_record(const ps4_t* ps4, const ps4_event_t* event);
+
+/********************************************************************************/
+/*                      W I N D O W   F U N C T I O N S */
+/********************************************************************************/
+
+void ps4_window_reset();
+void ps4_window_record(const ps4_t* ps4);
+
+/********************************************************************************/
+/*                      A C T I O N   F U N C T I O N S */
+/********************************************************************************/
+
+void ps4_action_reset();
+void ps4_action_evaluate(const ps4_t* ps4, const ps4_event_t* event);
+
+/********************************************************************************/
+/*                    T O U C H P A D   F U N C T I O N S */
+/********************************************************************************/
+
+void ps4_touch_reset();
+void ps4_touch_deliver(const ps4_t* ps4);
+
+/********************************************************************************/
+/*                     G E S T U R E   F U N C T I O N S */
+/********************************************************************************/
+
+bool ps4_gesture_enabled();
+void ps4_gesture_reset();
+void ps4_gesture_update(const ps4_touchpad_t* touchpad);
+
+/********************************************************************************/
+/*                      R U M B L E   F U N C T I O N S */
+/********************************************************************************/
+
+void ps4_rumble_init();
+
+/********************************************************************************/
+/*                       A U D I O   F U N C T I O N S */
+/********************************************************************************/
+
+void ps4_audio_init();
+
+/********************************************************************************/
+/*                    L I G H T B A R   F U N C T I O N S */
+/********************************************************************************/
+
+void ps4_lightbar_init();
+void ps4_lightbar_restore();
+void ps4_lightbar_battery(const ps4_t* ps4);
+
+/********************************************************************************/
+/*                      S T O R A G E   F U N C T I O N S */
+/********************************************************************************/
+
+/* One character for the kind of entry and the controller address in hex */
+#define PS4_STORAGE_KEY_SIZE 14
+
+void ps4_storage_key(char key[PS4_STORAGE_KEY_SIZE], char kind, const uint8_t* addr);
+bool ps4_storage_load(const char* key, void* data, size_t length);
+bool ps4_storage_store(const char* key, const void* data, size_t length);
+
+/* The low address bytes are assigned per device, so they are mixed in
+ * with a multiplicative hash, for tables of a power of two size of at most
+ * 256 entries */
+static inline uint8_t ps4_address_hash(const uint8_t* addr, uint16_t size) {
+  uint32_t value = (uint32_t)addr[2] << 24 | addr[3] << 16 | addr[4] << 8 | addr[5];
+  return (uint32_t)(value * 2654435761UL) >> 24 & (size - 1);
+}
+
+/********************************************************************************/
+/*                         B O N D   F U N C T I O N S */
+/********************************************************************************/
+
+void ps4_bond_reload();
+void ps4_bond_connect(const uint8_t* addr);
+void ps4_bond_disconnect(const uint8_t* addr);
+
+/********************************************************************************/
+/*                    R E C O N N E C T   F U N C T I O N S */
+/********************************************************************************/
+
+void ps4_reconnect_init();
+void ps4_reconnect_connect_event(bool is_connected);
+void ps4_reconnect_page_failed();
+
+/********************************************************************************/
+/*                    A L L O W   L I S T   F U N C T I O N S */
+/********************************************************************************/
+
+bool ps4_allow_check(const uint8_t* addr);
+
+/********************************************************************************/
+/*                          H I D   F U N C T I O N S */
+/********************************************************************************/
+
+void ps4_hid_init();
+bool ps4_hid_submit(const hid_cmd_t* hid_cmd, uint8_t len, ps4_report_callback_t cb, void* object);
+void ps4_hid_control_data(const uint8_t* data, uint16_t len);
+void ps4_hid_reset(ps4_hid_result_t result);
 
 /********************************************************************************/
 /*                          S P P   F U N C T I O N S */
@@ -88,8 +402,17 @@ void sppInit();
 /*                          G A P   F U N C T I O N S */
 /********************************************************************************/
 
+void gapInit();
+bool ps4_gap_bluetooth_start();
+void ps4_gap_connectable();
+
 void ps4_l2cap_init_services();
 void ps4_l2cap_deinit_services();
 void ps4_l2cap_send_hid(hid_cmd_t *hid_cmd, uint8_t len);
+bool ps4_l2cap_send_interrupt(const uint8_t* report, uint16_t len);
+bool ps4_l2cap_interrupt_congested();
+bool ps4_l2cap_connect(const uint8_t* addr);
+void ps4_l2cap_first_report();
+const uint8_t* ps4_l2cap_peer_address();
 
 #endif
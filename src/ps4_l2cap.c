@@ -4,6 +4,7 @@
 #include "ps4.h"
 #include "ps4_int.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_bt.h"
 #include "esp_bt_main.h"
 #include "esp_gap_bt_api.h"
@@ -30,6 +31,8 @@ static void ps4_l2cap_disconnect_ind_cback(uint16_t l2cap_cid, bool ack_needed);
 static void ps4_l2cap_disconnect_cfm_cback(uint16_t l2cap_cid, uint16_t result);
 static void ps4_l2cap_data_ind_cback(uint16_t l2cap_cid, BT_HDR *p_msg);
 static void ps4_l2cap_congest_cback(uint16_t cid, bool congested);
+static void ps4_l2cap_send_config(uint16_t l2cap_cid);
+static ps4_hid_channel_t ps4_l2cap_channel(uint16_t l2cap_cid);
 
 
 /********************************************************************************/
@@ -50,12 +53,25 @@ static const tL2CAP_APPL_INFO dyn_info = {
     NULL
 };
 
-static tL2CAP_CFG_INFO ps4_cfg_info;
+/* Options asked for when configuring each HID channel, and whether the
+ * controller refused them on the current connection */
+static ps4_channel_profile_t channel_profile[ps4_hid_channel_count] = {
+    {0},
+    {.flush_timeout_ms = PS4_INTERRUPT_FLUSH_TIMEOUT_MS}
+};
+static bool is_profile_refused[ps4_hid_channel_count];
 
 bool is_connected = false;
 uint16_t l2cap_control_channel = 0;
 uint16_t l2cap_interrupt_channel = 0;
 
+static BD_ADDR peer_addr = {0};
+static bool is_interrupt_congested = false;
+static bool is_outgoing = false;
+static int64_t connect_start = 0;
+
+static ps4_stats_t stats = {0};
+
 
 /********************************************************************************/
 /*                      P U B L I C    F U N C T I O N S                        */
@@ -75,6 +91,20 @@ void ps4_l2cap_init_services() {
     ps4_l2cap_init_service("PS4-HIDI", BT_PSM_HID_INTERRUPT, BTM_SEC_SERVICE_FIRST_EMPTY + 1);
 }
 
+/*******************************************************************************
+**
+** Function         ps4_l2cap_peer_address
+**
+** Description      This function returns the address of the controller that
+**                  last connected.
+**
+** Returns          const uint8_t*
+**
+*******************************************************************************/
+const uint8_t* ps4_l2cap_peer_address() {
+    return peer_addr;
+}
+
 /*******************************************************************************
 **
 ** Function         ps4_l2cap_deinit_services
@@ -130,6 +160,155 @@ void ps4_l2cap_send_hid( hid_cmd_t *hid_cmd, uint8_t len ) {
 }
 
 
+/*******************************************************************************
+**
+** Function         ps4_l2cap_connect
+**
+** Description      This function starts opening the HID channels to a
+**                  controller, the control channel first. The interrupt
+**                  channel is opened once the control channel is, and a
+**                  failure of either is reported to the reconnect module.
+**
+** Returns          bool, false if the connection could not be started
+**
+*******************************************************************************/
+bool ps4_l2cap_connect(const uint8_t* addr) {
+    uint16_t l2cap_cid;
+
+    if (is_connected) {
+        return false;
+    }
+
+    memcpy(peer_addr, addr, sizeof(BD_ADDR));
+    is_outgoing = true;
+    connect_start = esp_timer_get_time();
+    memset(is_profile_refused, 0, sizeof(is_profile_refused));
+    stats.reconnect_attempts++;
+
+    l2cap_cid = L2CA_CONNECT_REQ(BT_PSM_HID_CONTROL, peer_addr, NULL, NULL);
+    if (l2cap_cid == 0) {
+        ESP_LOGE(PS4_TAG, "[%s] starting the control channel failed", __func__);
+        return false;
+    }
+
+    l2cap_control_channel = l2cap_cid;
+    l2cap_interrupt_channel = 0;
+    return true;
+}
+
+/*******************************************************************************
+**
+** Function         ps4_l2cap_first_report
+**
+** Description      This function records the time from the start of a
+**                  connection to its first input report.
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_l2cap_first_report() {
+    stats.connections++;
+    stats.reconnects += is_outgoing;
+    stats.time_to_first_report_ms = (uint32_t)((esp_timer_get_time() - connect_start) / 1000);
+
+    ESP_LOGI(PS4_TAG, "[%s] first report %u ms after %s", __func__, (unsigned)stats.time_to_first_report_ms,
+             is_outgoing ? "paging" : "being paged");
+}
+
+/*******************************************************************************
+**
+** Function         ps4SetChannelProfile
+**
+** Description      This function sets the L2CAP options asked for when a HID
+**                  channel is configured, from the next connection on. A
+**                  controller refusing them gets the configuration again
+**                  without them.
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4SetChannelProfile(ps4_hid_channel_t channel, const ps4_channel_profile_t* profile) {
+    if (channel < ps4_hid_channel_count) {
+        channel_profile[channel] = *profile;
+    }
+}
+
+void ps4GetChannelProfile(ps4_hid_channel_t channel, ps4_channel_profile_t* profile) {
+    if (channel < ps4_hid_channel_count) {
+        *profile = channel_profile[channel];
+    }
+}
+
+/*******************************************************************************
+**
+** Function         ps4GetStats
+**
+** Description      This function copies the connection statistics.
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4GetStats(ps4_stats_t* connection_stats) {
+    *connection_stats = stats;
+}
+
+/*******************************************************************************
+**
+** Function         ps4_l2cap_send_interrupt
+**
+** Description      This function sends an output report on the interrupt
+**                  channel, as a DATA transaction without a reply.
+**
+** Returns          bool, whether L2CAP took the report
+**
+*******************************************************************************/
+bool ps4_l2cap_send_interrupt(const uint8_t* report, uint16_t len) {
+    uint8_t result;
+    BT_HDR *p_buf;
+
+    if (l2cap_interrupt_channel == 0) {
+        return false;
+    }
+
+    p_buf = (BT_HDR *)osi_malloc(sizeof(BT_HDR) + L2CAP_MIN_OFFSET + 1 + len);
+
+    if (!p_buf) {
+        ESP_LOGE(PS4_TAG, "[%s] allocating buffer for sending the report failed", __func__);
+        return false;
+    }
+
+    p_buf->length = len + 1;
+    p_buf->offset = L2CAP_MIN_OFFSET;
+
+    uint8_t *p_data = (uint8_t *)(p_buf + 1) + p_buf->offset;
+    p_data[0] = hid_cmd_code_data | hid_cmd_code_type_output;
+    memcpy(p_data + 1, report, len);
+
+    /* The buffer belongs to L2CAP whatever the result */
+    result = L2CA_DataWrite(l2cap_interrupt_channel, p_buf);
+
+    if (result == L2CAP_DW_CONGESTED) {
+        is_interrupt_congested = true;
+    }
+
+    return result != L2CAP_DW_FAILED;
+}
+
+/*******************************************************************************
+**
+** Function         ps4_l2cap_interrupt_congested
+**
+** Description      This function returns whether the interrupt channel is
+**                  congested, so streams should hold back their reports.
+**
+** Returns          bool
+**
+*******************************************************************************/
+bool ps4_l2cap_interrupt_congested() {
+    return is_interrupt_congested;
+}
+
+
 /********************************************************************************/
 /*                      L O C A L    F U N C T I O N S                          */
 /********************************************************************************/
@@ -158,6 +337,12 @@ static void ps4_l2cap_init_service(const char *name, uint16_t psm, uint8_t secur
         return;
     }
 
+    /* Again for connections we open to reconnect a controller */
+    if (!BTM_SetSecurityLevel (true, name, security_id, 0, psm, 0, 0)) {
+        ESP_LOGE (PS4_TAG, "%s Registering outgoing security service %s failed", __func__, name);
+        return;
+    }
+
     ESP_LOGI(PS4_TAG, "[%s] Service %s Initialized", __func__, name);
 }
 
@@ -189,20 +374,36 @@ static void ps4_l2cap_deinit_service(const char *name, uint16_t psm ) {
 static void ps4_l2cap_connect_ind_cback (BD_ADDR  bd_addr, uint16_t l2cap_cid, uint16_t psm, uint8_t l2cap_id) {
     ESP_LOGI(PS4_TAG, "[%s] bd_addr: %s\n  l2cap_cid: 0x%02x\n  psm: %d\n  id: %d", __func__, bd_addr, l2cap_cid, psm, l2cap_id );
 
+    /* Refuse controllers that are not allowed before spending anything on them */
+    if (!ps4_allow_check(bd_addr)) {
+        ESP_LOGW(PS4_TAG, "[%s] refusing a controller that is not allowed", __func__);
+        L2CA_CONNECT_RSP(bd_addr, l2cap_id, l2cap_cid, L2CAP_CONN_SECURITY_BLOCK, L2CAP_CONN_OK, NULL, NULL);
+        stats.rejected_connections++;
+        return;
+    }
+
+    memcpy(peer_addr, bd_addr, sizeof(BD_ADDR));
+    if (psm == BT_PSM_HID_CONTROL) {
+        is_outgoing = false;
+        connect_start = esp_timer_get_time();
+        memset(is_profile_refused, 0, sizeof(is_profile_refused));
+    }
+
     /* Send connection pending response to the L2CAP layer. */
     L2CA_CONNECT_RSP(bd_addr, l2cap_id, l2cap_cid, L2CAP_CONN_PENDING, L2CAP_CONN_PENDING, NULL, NULL);
 
     /* Send response to the L2CAP layer. */
     L2CA_CONNECT_RSP(bd_addr, l2cap_id, l2cap_cid, L2CAP_CONN_OK, L2CAP_CONN_OK, NULL, NULL);
 
-    /* Send a Configuration Request. */
-    L2CA_CONFIG_REQ(l2cap_cid, &ps4_cfg_info);
-
     if (psm == BT_PSM_HID_CONTROL) {
         l2cap_control_channel = l2cap_cid;
     } else if (psm == BT_PSM_HID_INTERRUPT) {
         l2cap_interrupt_channel = l2cap_cid;
+        is_interrupt_congested = false;
     }
+
+    /* Send a Configuration Request. */
+    ps4_l2cap_send_config(l2cap_cid);
 }
 
 
@@ -218,6 +419,34 @@ static void ps4_l2cap_connect_ind_cback (BD_ADDR  bd_addr, uint16_t l2cap_cid, u
 *******************************************************************************/
 static void ps4_l2cap_connect_cfm_cback(uint16_t l2cap_cid, uint16_t result) {
     ESP_LOGI(PS4_TAG, "[%s] l2cap_cid: 0x%02x\n  result: %d", __func__, l2cap_cid, result );
+
+    /* Only the channels we opened are confirmed */
+    if (!is_outgoing || (l2cap_cid != l2cap_control_channel && l2cap_cid != l2cap_interrupt_channel)) {
+        return;
+    }
+
+    if (result == L2CAP_CONN_OK) {
+        ps4_l2cap_send_config(l2cap_cid);
+
+        if (l2cap_cid == l2cap_interrupt_channel) {
+            return;
+        }
+
+        /* The interrupt channel follows the control channel */
+        l2cap_interrupt_channel = L2CA_CONNECT_REQ(BT_PSM_HID_INTERRUPT, peer_addr, NULL, NULL);
+        is_interrupt_congested = false;
+        if (l2cap_interrupt_channel != 0) {
+            return;
+        }
+    }
+
+    /* Close the control channel if it opened, and let the reconnect module move on */
+    if (l2cap_cid != l2cap_control_channel || result == L2CAP_CONN_OK) {
+        L2CA_DisconnectReq(l2cap_control_channel);
+    }
+    l2cap_control_channel = 0;
+    l2cap_interrupt_channel = 0;
+    ps4_reconnect_page_failed();
 }
 
 
@@ -234,6 +463,22 @@ static void ps4_l2cap_connect_cfm_cback(uint16_t l2cap_cid, uint16_t result) {
 void ps4_l2cap_config_cfm_cback(uint16_t l2cap_cid, tL2CAP_CFG_INFO *p_cfg) {
     ESP_LOGI(PS4_TAG, "[%s] l2cap_cid: 0x%02x\n  p_cfg->result: %d", __func__, l2cap_cid, p_cfg->result );
 
+    /* Ask again with the stack defaults if the controller refused our options */
+    ps4_hid_channel_t channel = ps4_l2cap_channel(l2cap_cid);
+    if (p_cfg->result != L2CAP_CFG_OK && p_cfg->result != L2CAP_CFG_PENDING && !is_profile_refused[channel]) {
+        ESP_LOGW(PS4_TAG, "[%s] channel profile refused, using the defaults", __func__);
+        is_profile_refused[channel] = true;
+        stats.profile_refused = true;
+        stats.profile_accepted[channel] = false;
+        ps4_l2cap_send_config(l2cap_cid);
+        return;
+    }
+
+    /* Our options hold only if they were sent and taken */
+    if (p_cfg->result != L2CAP_CFG_PENDING) {
+        stats.profile_accepted[channel] = p_cfg->result == L2CAP_CFG_OK && !is_profile_refused[channel];
+    }
+
     /* The PS4 controller is connected after    */
     /* receiving the second config confirmation */
     bool prev_is_connected = is_connected;
@@ -257,6 +502,11 @@ void ps4_l2cap_config_cfm_cback(uint16_t l2cap_cid, tL2CAP_CFG_INFO *p_cfg) {
 void ps4_l2cap_config_ind_cback(uint16_t l2cap_cid, tL2CAP_CFG_INFO *p_cfg) {
     ESP_LOGI(PS4_TAG, "[%s] l2cap_cid: 0x%02x\n  p_cfg->result: %d\n  p_cfg->mtu_present: %d\n  p_cfg->mtu: %d", __func__, l2cap_cid, p_cfg->result, p_cfg->mtu_present, p_cfg->mtu );
 
+    /* Keep what the controller asked for, with the defaults of the options it left out */
+    ps4_hid_channel_t channel = ps4_l2cap_channel(l2cap_cid);
+    stats.mtu[channel] = p_cfg->mtu_present ? p_cfg->mtu : L2CAP_DEFAULT_MTU;
+    stats.flush_timeout_ms[channel] = p_cfg->flush_to_present ? p_cfg->flush_to : L2CAP_NO_AUTOMATIC_FLUSH;
+
     p_cfg->result = L2CAP_CFG_OK;
 
     L2CA_ConfigRsp(l2cap_cid, p_cfg);
@@ -309,7 +559,10 @@ static void ps4_l2cap_disconnect_cfm_cback(uint16_t l2cap_cid, uint16_t result)
 **
 *******************************************************************************/
 static void ps4_l2cap_data_ind_cback(uint16_t l2cap_cid, BT_HDR *p_buf) {
-    if (p_buf->length > 2) {
+    if (l2cap_cid == l2cap_control_channel) {
+        /* Replies to GET_REPORT/SET_REPORT transactions */
+        ps4_hid_control_data(p_buf->data + p_buf->offset, p_buf->length);
+    } else if (p_buf->length > 2) {
         parsePacket(p_buf->data);
     }
 
@@ -328,4 +581,59 @@ static void ps4_l2cap_data_ind_cback(uint16_t l2cap_cid, BT_HDR *p_buf) {
 *******************************************************************************/
 static void ps4_l2cap_congest_cback (uint16_t l2cap_cid, bool congested) {
     ESP_LOGI(PS4_TAG, "[%s] l2cap_cid: 0x%02x\n  congested: %d", __func__, l2cap_cid, congested );
-}
\ No newline at end of file
+
+    if (l2cap_cid == l2cap_interrupt_channel) {
+        is_interrupt_congested = congested;
+    }
+}
+
+
+/*******************************************************************************
+**
+** Function         ps4_l2cap_send_config
+**
+** Description      This function sends the configuration request of a HID
+**                  channel, with the options of its profile unless the
+**                  controller refused them.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void ps4_l2cap_send_config(uint16_t l2cap_cid) {
+    ps4_hid_channel_t channel = ps4_l2cap_channel(l2cap_cid);
+    const ps4_channel_profile_t *profile = &channel_profile[channel];
+    tL2CAP_CFG_INFO cfg;
+
+    memset(&cfg, 0, sizeof(cfg));
+
+    if (!is_profile_refused[channel]) {
+        cfg.mtu_present = profile->mtu != 0;
+        cfg.mtu = profile->mtu;
+
+        cfg.flush_to_present = profile->flush_timeout_ms != 0;
+        cfg.flush_to = profile->flush_timeout_ms;
+
+        cfg.qos_present = profile->qos;
+        cfg.qos.service_type = profile->service_type;
+        cfg.qos.token_rate = profile->token_rate;
+        cfg.qos.peak_bandwidth = profile->peak_bandwidth;
+        cfg.qos.latency = profile->latency_us;
+        cfg.qos.delay_variation = L2CAP_DEFAULT_DELAY;
+    }
+
+    L2CA_CONFIG_REQ(l2cap_cid, &cfg);
+}
+
+
+/*******************************************************************************
+**
+** Function         ps4_l2cap_channel
+**
+** Description      This function tells which HID channel a channel id is.
+**
+** Returns          ps4_hid_channel_t
+**
+*******************************************************************************/
+static ps4_hid_channel_t ps4_l2cap_channel(uint16_t l2cap_cid) {
+    return l2cap_cid == l2cap_interrupt_channel ? ps4_hid_channel_interrupt : ps4_hid_channel_control;
+}
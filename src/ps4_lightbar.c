@@ -0,0 +1,455 @@
+#include <esp_timer.h>
+#include <math.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+#define PS4_TAG "PS4_LIGHTBAR"
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+typedef enum {
+  lightbar_none,      // the application drives the lightbar itself
+  lightbar_solid,
+  lightbar_blink,     // in software, for times the controller cannot flash
+  lightbar_breathe,
+  lightbar_cycle,
+  lightbar_level,
+  lightbar_battery
+} ps4_lightbar_mode_t;
+
+#define GAMMA 2.2
+
+/* The controller flashes the lightbar itself for on and off times of up to
+ * 255 steps of FLASH_STEP_MS */
+#define FLASH_STEP_MS 10
+#define FLASH_MAX_STEPS 255
+
+/* Battery levels the status reports, to spread over the gradient */
+#define BATTERY_FULL 10
+#define BATTERY_UNKNOWN 0xFF
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static void ps4_lightbar_tick_cback(void* arg);
+static void prepareTables();
+static void startMode(ps4_lightbar_mode_t new_mode, bool ticking);
+static void stopMode();
+static void fillGradient(const uint8_t* from, const uint8_t* to);
+static void fillHueWheel();
+static void emitColor(const uint8_t* rgb, uint8_t flash_on, uint8_t flash_off);
+static void emitScaled(uint8_t intensity);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+/* Tables computed once at setup, so a tick is only lookups:
+ * gamma_table maps a linear intensity to the LED value, wave_table is one
+ * period of a raised cosine, and gradient and hue_wheel hold the gamma
+ * corrected colors of the level gradient and the color cycle. They are
+ * kept apart, as cycling must not lose the gradient. */
+static uint8_t gamma_table[256];
+static uint8_t wave_table[256];
+static uint8_t gradient[256][3];
+static uint8_t hue_wheel[256][3];
+static bool has_tables = false;
+
+static uint8_t mode = lightbar_none;
+static uint8_t color[3];         // linear, gamma is applied when emitting
+static uint8_t hardware_flash[2];
+static uint32_t period_us = 0;   // breathe and cycle period, blink on + off
+static uint32_t on_us = 0;       // software blink
+static int64_t start_time = 0;
+static uint8_t battery = BATTERY_UNKNOWN;
+
+static esp_timer_handle_t tick_timer = NULL;
+
+static portMUX_TYPE lightbar_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4LightbarSolid
+**
+** Description      Sets the lightbar to a steady color, given in linear
+**                  intensity and gamma corrected by the engine.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4LightbarSolid(uint8_t r, uint8_t g, uint8_t b) {
+  ps4LightbarBlink(r, g, b, 0, 0);
+}
+
+/*******************************************************************************
+**
+** Function         ps4LightbarBlink
+**
+** Description      Blinks the lightbar, on_ms lit and off_ms dark. Times the
+**                  controller can flash by itself are handed to it, so no
+**                  reports are sent while blinking; others are timed by the
+**                  engine.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4LightbarBlink(uint8_t r, uint8_t g, uint8_t b, uint16_t on_ms, uint16_t off_ms) {
+  uint32_t on_steps = (on_ms + FLASH_STEP_MS / 2) / FLASH_STEP_MS;
+  uint32_t off_steps = (off_ms + FLASH_STEP_MS / 2) / FLASH_STEP_MS;
+  bool hardware = on_steps <= FLASH_MAX_STEPS && off_steps <= FLASH_MAX_STEPS;
+
+  stopMode();
+
+  color[0] = r;
+  color[1] = g;
+  color[2] = b;
+  on_us = on_ms * 1000;
+  period_us = on_us + off_ms * 1000;
+
+  if (off_ms == 0 || hardware) {
+    hardware_flash[0] = off_ms == 0 ? 0 : on_steps;
+    hardware_flash[1] = off_ms == 0 ? 0 : off_steps;
+    startMode(lightbar_solid, false);
+  } else {
+    startMode(lightbar_blink, true);
+  }
+}
+
+/*******************************************************************************
+**
+** Function         ps4LightbarBreathe
+**
+** Description      Fades the lightbar in and out of a color over a period.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4LightbarBreathe(uint8_t r, uint8_t g, uint8_t b, uint16_t period_ms) {
+  stopMode();
+
+  color[0] = r;
+  color[1] = g;
+  color[2] = b;
+  period_us = period_ms > 0 ? period_ms * 1000 : 1000;
+
+  startMode(lightbar_breathe, true);
+}
+
+/*******************************************************************************
+**
+** Function         ps4LightbarCycle
+**
+** Description      Runs the lightbar around the color wheel once per period.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4LightbarCycle(uint16_t period_ms) {
+  stopMode();
+
+  period_us = period_ms > 0 ? period_ms * 1000 : 1000;
+
+  startMode(lightbar_cycle, true);
+}
+
+/*******************************************************************************
+**
+** Function         ps4LightbarSetGradient
+**
+** Description      Sets the colors ps4LightbarLevel and ps4LightbarBattery
+**                  blend between, given as {r, g, b}. Takes effect with the
+**                  next of those calls.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4LightbarSetGradient(const uint8_t* from, const uint8_t* to) {
+  stopMode();
+  fillGradient(from, to);
+}
+
+/*******************************************************************************
+**
+** Function         ps4LightbarLevel
+**
+** Description      Shows a level from 0 to 255 as a color of the gradient.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4LightbarLevel(uint8_t level) {
+  prepareTables();
+
+  if (mode == lightbar_level) {
+    // Only the level changes, the gradient stays
+    memcpy(color, gradient[level], sizeof(color));
+    emitColor(color, 0, 0);
+    return;
+  }
+
+  stopMode();
+  memcpy(color, gradient[level], sizeof(color));
+  startMode(lightbar_level, false);
+}
+
+/*******************************************************************************
+**
+** Function         ps4LightbarBattery
+**
+** Description      Shows the battery level of the controller on the
+**                  gradient, following it as the reports come in.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4LightbarBattery() {
+  stopMode();
+  startMode(lightbar_battery, false);
+}
+
+/*******************************************************************************
+**
+** Function         ps4LightbarStop
+**
+** Description      Stops the engine, leaving the lightbar as it is for the
+**                  application to set.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4LightbarStop() { stopMode(); }
+
+/*******************************************************************************
+**
+** Function         ps4_lightbar_restore
+**
+** Description      Shows the current animation again, e.g. after a new
+**                  connection reset the lightbar.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_lightbar_restore() {
+  switch (mode) {
+    case lightbar_solid:
+      emitScaled(255);
+      break;
+
+    case lightbar_level:
+      emitColor(color, 0, 0);
+      break;
+
+    case lightbar_battery:
+      // Shown with the next report
+      battery = BATTERY_UNKNOWN;
+      break;
+
+    default:
+      // The animations are shown again on their next tick
+      break;
+  }
+}
+
+/*******************************************************************************
+**
+** Function         ps4_lightbar_battery
+**
+** Description      Follows the battery level of the reports while the
+**                  battery is shown.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_lightbar_battery(const ps4_t* ps4) {
+  if (mode != lightbar_battery || ps4->status.battery == battery) {
+    return;
+  }
+
+  battery = ps4->status.battery;
+
+  uint32_t level = battery >= BATTERY_FULL ? 255 : battery * 255 / BATTERY_FULL;
+  emitColor(gradient[level], 0, 0);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_lightbar_init
+**
+** Description      Computes the tables and creates the animation timer.
+**                  Called once from ps4Init, so a tick never finds them
+**                  half done and the timer is never created twice.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_lightbar_init() {
+  const esp_timer_create_args_t timer_args = {
+    .callback = &ps4_lightbar_tick_cback,
+    .name = "ps4_lightbar"
+  };
+
+  prepareTables();
+
+  if (tick_timer != NULL) {
+    return;
+  }
+
+  if (esp_timer_create(&timer_args, &tick_timer) != ESP_OK) {
+    ESP_LOGE(PS4_TAG, "[%s] creating the animation timer failed", __func__);
+    tick_timer = NULL;
+  }
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4_lightbar_tick_cback
+**
+** Description      Steps the timed animations every PS4_LIGHTBAR_TICK_MS.
+**                  Reports are only sent when the color changed.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void ps4_lightbar_tick_cback(void* arg) {
+  uint32_t phase = (uint32_t)((esp_timer_get_time() - start_time) % period_us);
+
+  switch (mode) {
+    case lightbar_blink:
+      emitScaled(phase < on_us ? 255 : 0);
+      break;
+
+    case lightbar_breathe:
+      emitScaled(wave_table[(uint64_t)phase * 256 / period_us]);
+      break;
+
+    case lightbar_cycle:
+      emitColor(hue_wheel[(uint64_t)phase * 256 / period_us], 0, 0);
+      break;
+
+    default:
+      break;
+  }
+}
+
+static void prepareTables() {
+  if (has_tables) {
+    return;
+  }
+
+  // A lit input stays lit, however dim, so slow fades do not flicker off
+  for (uint16_t i = 0; i < 256; i++) {
+    uint8_t value = (uint8_t)lround(pow(i / 255.0, GAMMA) * 255.0);
+    gamma_table[i] = value == 0 && i > 0 ? 1 : value;
+  }
+
+  for (uint16_t i = 0; i < 256; i++) {
+    wave_table[i] = (uint8_t)lround((1.0 - cos(2.0 * M_PI * i / 256.0)) * 127.5);
+  }
+
+  has_tables = true;
+  fillGradient((const uint8_t[]){255, 0, 0}, (const uint8_t[]){0, 255, 0});
+  fillHueWheel();
+}
+
+static void startMode(ps4_lightbar_mode_t new_mode, bool ticking) {
+  prepareTables();
+
+  if (ticking && tick_timer == NULL) {
+    ESP_LOGE(PS4_TAG, "[%s] no animation timer", __func__);
+    return;
+  }
+
+  portENTER_CRITICAL(&lightbar_lock);
+  mode = new_mode;
+  start_time = esp_timer_get_time();
+  portEXIT_CRITICAL(&lightbar_lock);
+
+  if (ticking) {
+    ps4_lightbar_tick_cback(NULL);
+    esp_timer_start_periodic(tick_timer, PS4_LIGHTBAR_TICK_MS * 1000ULL);
+  } else {
+    ps4_lightbar_restore();
+  }
+}
+
+static void stopMode() {
+  if (tick_timer != NULL) {
+    esp_timer_stop(tick_timer);
+  }
+
+  portENTER_CRITICAL(&lightbar_lock);
+  mode = lightbar_none;
+  hardware_flash[0] = hardware_flash[1] = 0;
+  portEXIT_CRITICAL(&lightbar_lock);
+}
+
+/* Blends in linear intensity and stores the gamma corrected colors */
+static void fillGradient(const uint8_t* from, const uint8_t* to) {
+  prepareTables();
+
+  for (uint16_t i = 0; i < 256; i++) {
+    for (uint8_t c = 0; c < 3; c++) {
+      gradient[i][c] = gamma_table[(from[c] * (255 - i) + to[c] * i + 127) / 255];
+    }
+  }
+}
+
+/* Fully saturated hues, red to green to blue and back to red */
+static void fillHueWheel() {
+  for (uint16_t i = 0; i < 256; i++) {
+    uint16_t sector = i * 3 / 256;
+    uint16_t rise = i * 3 - sector * 256;
+    uint8_t linear[3] = {0, 0, 0};
+
+    linear[sector] = 255 - rise;
+    linear[(sector + 1) % 3] = rise;
+
+    for (uint8_t c = 0; c < 3; c++) {
+      hue_wheel[i][c] = gamma_table[linear[c]];
+    }
+  }
+}
+
+/* The current color at an intensity, gamma corrected */
+static void emitScaled(uint8_t intensity) {
+  uint8_t rgb[3];
+
+  for (uint8_t c = 0; c < 3; c++) {
+    rgb[c] = gamma_table[(color[c] * intensity + 127) / 255];
+  }
+
+  emitColor(rgb, hardware_flash[0], hardware_flash[1]);
+}
+
+static void emitColor(const uint8_t* rgb, uint8_t flash_on, uint8_t flash_off) {
+  if (ps4IsConnected()) {
+    ps4_output_led(rgb[0], rgb[1], rgb[2], flash_on, flash_off);
+  }
+}
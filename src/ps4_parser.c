@@ -1,4 +1,5 @@
 #include <esp_system.h>
+#include <esp_timer.h>
 
 #include "ps4.h"
 #include "ps4_int.h"
@@ -20,6 +21,15 @@ enum ps4_packet_index {
   packet_index_analog_l2 = 20,
   packet_index_analog_r2 = 21,
 
+  packet_index_timestamp = 22,
+
+  packet_index_sensor_gyroscope_x = 25,
+  packet_index_sensor_gyroscope_y = 27,
+  packet_index_sensor_gyroscope_z = 29,
+  packet_index_sensor_accelerometer_x = 31,
+  packet_index_sensor_accelerometer_y = 33,
+  packet_index_sensor_accelerometer_z = 35,
+
   packet_index_status = 42
 };
 
@@ -63,42 +73,178 @@ enum ps4_status_mask {
   ps4_status_mask_mic = 0b01000000,
 };
 
+/* ps4_button_mask_t bits for each value of the direction pad nibble */
+static const uint32_t direction_masks[] = {
+  [button_mask_up] = ps4_button_mask_up,
+  [button_mask_upright] = ps4_button_mask_upright,
+  [button_mask_right] = ps4_button_mask_right,
+  [button_mask_downright] = ps4_button_mask_downright,
+  [button_mask_down] = ps4_button_mask_down,
+  [button_mask_downleft] = ps4_button_mask_downleft,
+  [button_mask_left] = ps4_button_mask_left,
+  [button_mask_upleft] = ps4_button_mask_upleft
+};
+
+/* The controller to host clock offset is the smallest delay seen, which is
+ * let go by one microsecond every 2^CLOCK_CREEP_SHIFT reports so a stale
+ * minimum does not stick around when the clocks drift */
+#define CLOCK_CREEP_SHIFT 4
+
+/* Value range of each ps4_channel_t */
+static const int32_t channel_min[PS4_CHANNEL_COUNT] = {
+  INT8_MIN, INT8_MIN, INT8_MIN, INT8_MIN, 0, 0,
+  INT16_MIN, INT16_MIN, INT16_MIN, INT16_MIN, INT16_MIN, INT16_MIN
+};
+
+static const int32_t channel_max[PS4_CHANNEL_COUNT] = {
+  INT8_MAX, INT8_MAX, INT8_MAX, INT8_MAX, UINT8_MAX, UINT8_MAX,
+  INT16_MAX, INT16_MAX, INT16_MAX, INT16_MAX, INT16_MAX, INT16_MAX
+};
+
 /********************************************************************************/
 /*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
 /********************************************************************************/
 
 ps4_sensor_t parsePacketSensor(uint8_t* packet);
+static int16_t readInt16(uint8_t* packet, uint8_t index);
 ps4_status_t parsePacketStatus(uint8_t* packet);
+uint32_t parsePacketTimestamp(uint8_t* packet);
+static void syncReportTime(uint32_t timestamp);
 ps4_analog_stick_t parsePacketAnalogStick(uint8_t* packet);
 ps4_analog_button_t parsePacketAnalogButton(uint8_t* packet);
 ps4_button_t parsePacketButtons(uint8_t* packet);
-ps4_event_t parseEvent(ps4_t prev, ps4_t cur);
+void parseEvent(const ps4_button_t* prev, const ps4_t* cur, ps4_event_t* event);
 
 /********************************************************************************/
 /*                         L O C A L    V A R I A B L E S */
 /********************************************************************************/
 
+/* Library-owned report record handed out by pointer to the v2 callbacks */
 static ps4_t ps4;
+static ps4_event_t ps4_event;
 static ps4_event_callback_t ps4_event_cb = NULL;
 
+/* Host time at which the current report was sampled */
+static int64_t report_time = 0;
+static int64_t controller_time = 0;  // timestamp extended to 64 bits
+static int64_t clock_offset = 0;     // host time - controller time
+static uint32_t last_timestamp = 0;
+static uint8_t creep_count = 0;
+static bool has_clock = false;
+
 /********************************************************************************/
 /*                      P U B L I C    F U N C T I O N S */
 /********************************************************************************/
 void parserSetEventCb(ps4_event_callback_t cb) { ps4_event_cb = cb; }
 
 void parsePacket(uint8_t* packet) {
-  ps4_t prev_ps4 = ps4;
+  ps4_button_t prev_button = ps4.button;
 
   ps4.button = parsePacketButtons(packet);
   ps4.analog.stick = parsePacketAnalogStick(packet);
   ps4.analog.button = parsePacketAnalogButton(packet);
-  // ps4.sensor = parsePacketSensor(packet);
+  ps4.sensor = parsePacketSensor(packet);
   ps4.status = parsePacketStatus(packet);
+  ps4.timestamp = parsePacketTimestamp(packet);
   ps4.latestPacket = packet;
 
-  ps4_event_t ps4Event = parseEvent(prev_ps4, ps4);
+  syncReportTime(ps4.timestamp);
+
+  ps4_filter_apply(&ps4);
+  ps4_predict_update(&ps4);
+
+  parseEvent(&prev_button, &ps4, &ps4_event);
+  ps4_resample_record(&ps4, &ps4_event);
+#if PS4_MAX_WINDOWS > 0
+  ps4_window_record(&ps4);
+#endif
+
+  ps4PacketEvent(&ps4, &ps4_event);
+}
 
-  ps4PacketEvent(ps4, ps4Event);
+/*******************************************************************************
+**
+** Function         ps4_parser_reset
+**
+** Description      Restarts the clock synchronization, as the controller
+**                  clock starts over on a new connection.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_parser_reset() { has_clock = false; }
+
+/*******************************************************************************
+**
+** Function         ps4_report_time
+**
+** Description      Returns when the current report was sampled by the
+**                  controller, in esp_timer_get_time() microseconds. Unlike
+**                  the arrival time this is free of delivery jitter.
+**
+**
+** Returns          int64_t
+**
+*******************************************************************************/
+int64_t ps4_report_time() { return report_time; }
+
+/*******************************************************************************
+**
+** Function         ps4_channels_read
+**
+** Description      Copies the analog values of a report into an array
+**                  indexed by ps4_channel_t.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_channels_read(const ps4_t* ps4, int32_t* values) {
+  values[ps4_channel_lx] = ps4->analog.stick.lx;
+  values[ps4_channel_ly] = ps4->analog.stick.ly;
+  values[ps4_channel_rx] = ps4->analog.stick.rx;
+  values[ps4_channel_ry] = ps4->analog.stick.ry;
+  values[ps4_channel_l2] = ps4->analog.button.l2;
+  values[ps4_channel_r2] = ps4->analog.button.r2;
+  values[ps4_channel_gyro_x] = ps4->sensor.gyroscope.x;
+  values[ps4_channel_gyro_y] = ps4->sensor.gyroscope.y;
+  values[ps4_channel_gyro_z] = ps4->sensor.gyroscope.z;
+  values[ps4_channel_accel_x] = ps4->sensor.accelerometer.x;
+  values[ps4_channel_accel_y] = ps4->sensor.accelerometer.y;
+  values[ps4_channel_accel_z] = ps4->sensor.accelerometer.z;
+}
+
+/*******************************************************************************
+**
+** Function         ps4_channels_write
+**
+** Description      Stores an array indexed by ps4_channel_t into the analog
+**                  values of a report, limited to the range of each field.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_channels_write(ps4_t* ps4, const int32_t* values) {
+  int32_t clamped[PS4_CHANNEL_COUNT];
+
+  for (uint8_t i = 0; i < PS4_CHANNEL_COUNT; i++) {
+    clamped[i] = values[i] < channel_min[i] ? channel_min[i] : values[i] > channel_max[i] ? channel_max[i] : values[i];
+  }
+
+  ps4->analog.stick.lx = clamped[ps4_channel_lx];
+  ps4->analog.stick.ly = clamped[ps4_channel_ly];
+  ps4->analog.stick.rx = clamped[ps4_channel_rx];
+  ps4->analog.stick.ry = clamped[ps4_channel_ry];
+  ps4->analog.button.l2 = clamped[ps4_channel_l2];
+  ps4->analog.button.r2 = clamped[ps4_channel_r2];
+  ps4->sensor.gyroscope.x = clamped[ps4_channel_gyro_x];
+  ps4->sensor.gyroscope.y = clamped[ps4_channel_gyro_y];
+  ps4->sensor.gyroscope.z = clamped[ps4_channel_gyro_z];
+  ps4->sensor.accelerometer.x = clamped[ps4_channel_accel_x];
+  ps4->sensor.accelerometer.y = clamped[ps4_channel_accel_y];
+  ps4->sensor.accelerometer.z = clamped[ps4_channel_accel_z];
 }
 
 /********************************************************************************/
@@ -108,73 +254,14 @@ void parsePacket(uint8_t* packet) {
 /******************/
 /*    E V E N T   */
 /******************/
-ps4_event_t parseEvent(ps4_t prev, ps4_t cur) {
-  ps4_event_t ps4Event;
-
-  /* Button down events */
-  ps4Event.button_down.right = !prev.button.right && cur.button.right;
-  ps4Event.button_down.down = !prev.button.down && cur.button.down;
-  ps4Event.button_down.up = !prev.button.up && cur.button.up;
-  ps4Event.button_down.left = !prev.button.left && cur.button.left;
-
-  ps4Event.button_down.square = !prev.button.square && cur.button.square;
-  ps4Event.button_down.cross = !prev.button.cross && cur.button.cross;
-  ps4Event.button_down.circle = !prev.button.circle && cur.button.circle;
-  ps4Event.button_down.triangle = !prev.button.triangle && cur.button.triangle;
-
-  ps4Event.button_down.upright = !prev.button.upright && cur.button.upright;
-  ps4Event.button_down.downright = !prev.button.downright && cur.button.downright;
-  ps4Event.button_down.upleft = !prev.button.upleft && cur.button.upleft;
-  ps4Event.button_down.downleft = !prev.button.downleft && cur.button.downleft;
-
-  ps4Event.button_down.l1 = !prev.button.l1 && cur.button.l1;
-  ps4Event.button_down.r1 = !prev.button.r1 && cur.button.r1;
-  ps4Event.button_down.l2 = !prev.button.l2 && cur.button.l2;
-  ps4Event.button_down.r2 = !prev.button.r2 && cur.button.r2;
-
-  ps4Event.button_down.share = !prev.button.share && cur.button.share;
-  ps4Event.button_down.options = !prev.button.options && cur.button.options;
-  ps4Event.button_down.l3 = !prev.button.l3 && cur.button.l3;
-  ps4Event.button_down.r3 = !prev.button.r3 && cur.button.r3;
-
-  ps4Event.button_down.ps = !prev.button.ps && cur.button.ps;
-  ps4Event.button_down.touchpad = !prev.button.touchpad && cur.button.touchpad;
-
-  /* Button up events */
-  ps4Event.button_down.right = prev.button.right && !cur.button.right;
-  ps4Event.button_down.down = prev.button.down && !cur.button.down;
-  ps4Event.button_down.up = prev.button.up && !cur.button.up;
-  ps4Event.button_down.left = prev.button.left && !cur.button.left;
-
-  ps4Event.button_down.square = prev.button.square && !cur.button.square;
-  ps4Event.button_down.cross = prev.button.cross && !cur.button.cross;
-  ps4Event.button_down.circle = prev.button.circle && !cur.button.circle;
-  ps4Event.button_down.triangle = prev.button.triangle && !cur.button.triangle;
-
-  ps4Event.button_down.upright = prev.button.upright && !cur.button.upright;
-  ps4Event.button_down.downright = prev.button.downright && !cur.button.downright;
-  ps4Event.button_down.upleft = prev.button.upleft && !cur.button.upleft;
-  ps4Event.button_down.downleft = prev.button.downleft && !cur.button.downleft;
-
-  ps4Event.button_down.l1 = prev.button.l1 && !cur.button.l1;
-  ps4Event.button_down.r1 = prev.button.r1 && !cur.button.r1;
-  ps4Event.button_down.l2 = prev.button.l2 && !cur.button.l2;
-  ps4Event.button_down.r2 = prev.button.r2 && !cur.button.r2;
-
-  ps4Event.button_down.share = prev.button.share && !cur.button.share;
-  ps4Event.button_down.options = prev.button.options && !cur.button.options;
-  ps4Event.button_down.l3 = prev.button.l3 && !cur.button.l3;
-  ps4Event.button_down.r3 = prev.button.r3 && !cur.button.r3;
-
-  ps4Event.button_down.ps = prev.button.ps && !cur.button.ps;
-  ps4Event.button_down.touchpad = prev.button.touchpad && !cur.button.touchpad;
-
-  ps4Event.analog_move.stick.lx = cur.analog.stick.lx != 0;
-  ps4Event.analog_move.stick.ly = cur.analog.stick.ly != 0;
-  ps4Event.analog_move.stick.rx = cur.analog.stick.rx != 0;
-  ps4Event.analog_move.stick.ry = cur.analog.stick.ry != 0;
-
-  return ps4Event;
+void parseEvent(const ps4_button_t* prev, const ps4_t* cur, ps4_event_t* ps4Event) {
+  ps4Event->button_down.mask = cur->button.mask & ~prev->mask;
+  ps4Event->button_up.mask = prev->mask & ~cur->button.mask;
+
+  ps4Event->analog_move.stick.lx = cur->analog.stick.lx != 0;
+  ps4Event->analog_move.stick.ly = cur->analog.stick.ly != 0;
+  ps4Event->analog_move.stick.rx = cur->analog.stick.rx != 0;
+  ps4Event->analog_move.stick.ry = cur->analog.stick.ry != 0;
 }
 
 /********************/
@@ -183,12 +270,16 @@ ps4_event_t parseEvent(ps4_t prev, ps4_t cur) {
 ps4_analog_stick_t parsePacketAnalogStick(uint8_t* packet) {
   ps4_analog_stick_t ps4AnalogStick;
 
-  const uint8_t offset = 128;
+  if (ps4_stick_learning) {
+    ps4_stick_learn(&packet[packet_index_analog_stick_lx]);
+  }
 
-  ps4AnalogStick.lx = packet[packet_index_analog_stick_lx] - offset;
-  ps4AnalogStick.ly = -packet[packet_index_analog_stick_ly] + offset - 1;
-  ps4AnalogStick.rx = packet[packet_index_analog_stick_rx] - offset;
-  ps4AnalogStick.ry = -packet[packet_index_analog_stick_ry] + offset - 1;
+  int8_t (*lut)[256] = ps4_stick_lut;
+
+  ps4AnalogStick.lx = lut[0][packet[packet_index_analog_stick_lx]];
+  ps4AnalogStick.ly = lut[1][packet[packet_index_analog_stick_ly]];
+  ps4AnalogStick.rx = lut[2][packet[packet_index_analog_stick_rx]];
+  ps4AnalogStick.ry = lut[3][packet[packet_index_analog_stick_ry]];
 
   return ps4AnalogStick;
 }
@@ -213,33 +304,15 @@ ps4_button_t parsePacketButtons(uint8_t* packet) {
   uint8_t psBtnData = packet[packet_index_button_ps];
   uint8_t directionBtnsOnly = button_mask_direction & frontBtnData;
 
-  ps4_button.up = directionBtnsOnly == button_mask_up;
-  ps4_button.right = directionBtnsOnly == button_mask_right;
-  ps4_button.down = directionBtnsOnly == button_mask_down;
-  ps4_button.left = directionBtnsOnly == button_mask_left;
-
-  ps4_button.upright = directionBtnsOnly == button_mask_upright;
-  ps4_button.upleft = directionBtnsOnly == button_mask_upleft;
-  ps4_button.downright = directionBtnsOnly == button_mask_downright;
-  ps4_button.downleft = directionBtnsOnly == button_mask_downleft;
-
-  ps4_button.triangle = (frontBtnData & button_mask_triangle) ? true : false;
-  ps4_button.circle = (frontBtnData & button_mask_circle) ? true : false;
-  ps4_button.cross = (frontBtnData & button_mask_cross) ? true : false;
-  ps4_button.square = (frontBtnData & button_mask_square) ? true : false;
-
-  ps4_button.l1 = (extraBtnData & button_mask_l1) ? true : false;
-  ps4_button.r1 = (extraBtnData & button_mask_r1) ? true : false;
-  ps4_button.l2 = (extraBtnData & button_mask_l2) ? true : false;
-  ps4_button.r2 = (extraBtnData & button_mask_r2) ? true : false;
-
-  ps4_button.share = (extraBtnData & button_mask_share) ? true : false;
-  ps4_button.options = (extraBtnData & button_mask_options) ? true : false;
-  ps4_button.l3 = (extraBtnData & button_mask_l3) ? true : false;
-  ps4_button.r3 = (extraBtnData & button_mask_r3) ? true : false;
-
-  ps4_button.ps = (psBtnData & button_mask_ps) ? true : false;
-  ps4_button.touchpad = (psBtnData & button_mask_touchpad) ? true : false;
+  /* The face, shoulder and PS buttons are laid out in the packet in the
+   * same order as ps4_button_mask_t, so they can be shifted into place */
+  ps4_button.mask =
+    (directionBtnsOnly < sizeof(direction_masks) / sizeof(*direction_masks)
+      ? direction_masks[directionBtnsOnly] : 0) |
+    (frontBtnData & (button_mask_square | button_mask_cross |
+                     button_mask_circle | button_mask_triangle)) |
+    ((uint32_t)extraBtnData << 12) |
+    ((uint32_t)(psBtnData & (button_mask_ps | button_mask_touchpad)) << 20);
 
   return ps4_button;
 }
@@ -263,17 +336,67 @@ ps4_status_t parsePacketStatus(uint8_t* packet) {
 /********************/
 ps4_sensor_t parsePacketSensor(uint8_t* packet) {
   ps4_sensor_t ps4Sensor;
-  /*
-      const uint16_t offset = 0x200;
-
-      ps4Sensor.accelerometer.x = (packet[packet_index_sensor_accelerometer_x] << 8) +
-     packet[packet_index_sensor_accelerometer_x+1] - offset;
-      ps4Sensor.accelerometer.y = (packet[packet_index_sensor_accelerometer_y] << 8) +
-     packet[packet_index_sensor_accelerometer_y+1] - offset;
-      ps4Sensor.accelerometer.z = (packet[packet_index_sensor_accelerometer_z] << 8) +
-     packet[packet_index_sensor_accelerometer_z+1] - offset;
-      ps4Sensor.gyroscope.z     = (packet[packet_index_sensor_gyroscope_z]
-     << 8) + packet[packet_index_sensor_gyroscope_z+1]     - offset;
-  */
+
+  ps4Sensor.gyroscope.x = readInt16(packet, packet_index_sensor_gyroscope_x);
+  ps4Sensor.gyroscope.y = readInt16(packet, packet_index_sensor_gyroscope_y);
+  ps4Sensor.gyroscope.z = readInt16(packet, packet_index_sensor_gyroscope_z);
+
+  ps4Sensor.accelerometer.x = readInt16(packet, packet_index_sensor_accelerometer_x);
+  ps4Sensor.accelerometer.y = readInt16(packet, packet_index_sensor_accelerometer_y);
+  ps4Sensor.accelerometer.z = readInt16(packet, packet_index_sensor_accelerometer_z);
+
+  ps4_sensor_calibrate(&ps4Sensor);
+
   return ps4Sensor;
 }
+
+/*************************/
+/*   T I M E S T A M P   */
+/*************************/
+
+/* The controller counts in units of 16/3 microseconds and wraps around after
+ * about 350ms, so the elapsed ticks are accumulated into microseconds */
+uint32_t parsePacketTimestamp(uint8_t* packet) {
+  static uint16_t last_ticks = 0;
+  static uint32_t microseconds = 0;
+  static uint8_t remainder = 0;
+
+  uint16_t ticks = (uint16_t)readInt16(packet, packet_index_timestamp);
+  uint32_t elapsed = (uint16_t)(ticks - last_ticks) * 16 + remainder;
+
+  last_ticks = ticks;
+  microseconds += elapsed / 3;
+  remainder = elapsed % 3;
+
+  return microseconds;
+}
+
+/* Maps the controller clock to the host clock. A report is never early,
+ * so the smallest delay seen is the best estimate of the clock offset and
+ * anything above it is delivery latency */
+static void syncReportTime(uint32_t timestamp) {
+  int64_t now = esp_timer_get_time();
+
+  if (!has_clock) {
+    controller_time = timestamp;
+    clock_offset = now - controller_time;
+    has_clock = true;
+  } else {
+    controller_time += (uint32_t)(timestamp - last_timestamp);
+
+    if ((++creep_count & ((1 << CLOCK_CREEP_SHIFT) - 1)) == 0) {
+      clock_offset++;
+    }
+    if (now - controller_time < clock_offset) {
+      clock_offset = now - controller_time;
+    }
+  }
+
+  last_timestamp = timestamp;
+  report_time = controller_time + clock_offset;
+}
+
+/* The sensors are little endian 16 bit values */
+static int16_t readInt16(uint8_t* packet, uint8_t index) {
+  return (int16_t)(packet[index] | (packet[index + 1] << 8));
+}
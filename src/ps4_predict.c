@@ -0,0 +1,204 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+/* Alpha-beta gains as fractions of GAIN_ONE. Lower gains smooth more but
+ * react later; these keep the step response free of ringing */
+#define GAIN_SHIFT 8
+#define GAIN_ONE (1 << GAIN_SHIFT)
+#define ALPHA_GAIN 154  // 0.6
+#define BETA_GAIN 51    // 0.2
+
+/* Positions are kept with VALUE_FRACTION_BITS, speeds in units per second */
+#define VALUE_FRACTION_BITS 8
+#define MAX_SPEED ((int32_t)1 << 25)
+#define MAX_INTERVAL_US 100000
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static int32_t clampSpeed(int64_t speed);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+static bool is_enabled = false;
+static bool has_estimate = false;
+
+/* Alpha-beta state, one array per quantity */
+static int32_t position[PS4_CHANNEL_COUNT];  // with VALUE_FRACTION_BITS
+static int32_t speed[PS4_CHANNEL_COUNT];     // units per second
+
+static ps4_t latest;
+static int64_t latest_time = 0;
+static uint32_t last_timestamp = 0;
+
+static portMUX_TYPE predict_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4SetPrediction
+**
+** Description      Enables tracking the analog channels for ps4Predict.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4SetPrediction(bool enable) {
+  portENTER_CRITICAL(&predict_lock);
+  is_enabled = enable;
+  has_estimate = false;
+  portEXIT_CRITICAL(&predict_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4Predict
+**
+** Description      Estimates the controller state at a given time, in
+**                  microseconds of esp_timer_get_time(). The analog channels
+**                  are extrapolated from their recent speed, with the
+**                  extrapolation easing off towards the maximum horizon, so
+**                  a prediction never overshoots by more than half the
+**                  distance travelled at that speed in the horizon. Buttons
+**                  and status are those of the newest report.
+**
+**
+** Returns          bool, false if prediction is disabled or no report
+**                  has been received yet
+**
+*******************************************************************************/
+bool ps4Predict(int64_t time, ps4_t* ps4) {
+  int32_t positions[PS4_CHANNEL_COUNT];
+  int32_t speeds[PS4_CHANNEL_COUNT];
+  int32_t values[PS4_CHANNEL_COUNT];
+
+  // Only the state is copied under the lock, the parser task must not
+  // wait for the divisions below
+  portENTER_CRITICAL(&predict_lock);
+  if (!is_enabled || !has_estimate) {
+    portEXIT_CRITICAL(&predict_lock);
+    return false;
+  }
+  memcpy(positions, position, sizeof(positions));
+  memcpy(speeds, speed, sizeof(speeds));
+  int64_t horizon = time - latest_time;
+  *ps4 = latest;
+  portEXIT_CRITICAL(&predict_lock);
+
+  horizon = horizon < 0 ? 0 : horizon > PS4_PREDICT_MAX_HORIZON_US ? PS4_PREDICT_MAX_HORIZON_US : horizon;
+
+  // Damped constant velocity: the displacement v * h * (1 - h / 2H) stops
+  // growing at the horizon H instead of running away with a noisy speed
+  int64_t damping = 2 * PS4_PREDICT_MAX_HORIZON_US - horizon;
+  int64_t divisor = (2LL * PS4_PREDICT_MAX_HORIZON_US * 1000000) >> VALUE_FRACTION_BITS;
+
+  for (uint8_t i = 0; i < PS4_CHANNEL_COUNT; i++) {
+    int64_t displacement = (int64_t)speeds[i] * horizon * damping / divisor;
+    int64_t predicted = positions[i] + displacement;
+    values[i] = (int32_t)((predicted + (1 << (VALUE_FRACTION_BITS - 1))) >> VALUE_FRACTION_BITS);
+  }
+
+  ps4->latestPacket = NULL;
+  ps4_channels_write(ps4, values);
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function         ps4_predict_reset
+**
+** Description      Forgets the tracked state, e.g. on a new connection.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_predict_reset() {
+  portENTER_CRITICAL(&predict_lock);
+  has_estimate = false;
+  portEXIT_CRITICAL(&predict_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_predict_update
+**
+** Description      Corrects the tracked position and speed of each channel
+**                  with a new report, spaced by the controller's timestamps.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_predict_update(const ps4_t* ps4) {
+  int32_t values[PS4_CHANNEL_COUNT];
+  int32_t positions[PS4_CHANNEL_COUNT];
+  int32_t speeds[PS4_CHANNEL_COUNT];
+  if (!is_enabled) {
+    return;
+  }
+
+  ps4_channels_read(ps4, values);
+
+  portENTER_CRITICAL(&predict_lock);
+  bool had_estimate = has_estimate;
+  portEXIT_CRITICAL(&predict_lock);
+
+  uint32_t interval = ps4->timestamp - last_timestamp;
+  last_timestamp = ps4->timestamp;
+
+  if (interval == 0) {
+    interval = 1;
+  } else if (interval > MAX_INTERVAL_US) {
+    interval = MAX_INTERVAL_US;
+  }
+
+  // The new estimate is computed outside the lock and only published under
+  // it. Only this function writes the state, so it reads it without.
+  for (uint8_t i = 0; i < PS4_CHANNEL_COUNT; i++) {
+    if (!had_estimate) {
+      positions[i] = values[i] * (1 << VALUE_FRACTION_BITS);
+      speeds[i] = 0;
+      continue;
+    }
+
+    int64_t expected = position[i] + (int64_t)speed[i] * interval * (1 << VALUE_FRACTION_BITS) / 1000000;
+    int64_t residual = values[i] * (1 << VALUE_FRACTION_BITS) - expected;
+
+    positions[i] = (int32_t)(expected + ((residual * ALPHA_GAIN) >> GAIN_SHIFT));
+    speeds[i] = clampSpeed(speed[i] + ((residual * BETA_GAIN * 1000000 / interval) >> (GAIN_SHIFT + VALUE_FRACTION_BITS)));
+  }
+
+  portENTER_CRITICAL(&predict_lock);
+  // A reset while computing drops the estimate, the next report starts over
+  if (!had_estimate || has_estimate) {
+    memcpy(position, positions, sizeof(position));
+    memcpy(speed, speeds, sizeof(speed));
+    latest = *ps4;
+    latest_time = ps4_report_time();
+    has_estimate = true;
+  }
+  portEXIT_CRITICAL(&predict_lock);
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+static int32_t clampSpeed(int64_t value) {
+  return value < -MAX_SPEED ? -MAX_SPEED : value > MAX_SPEED ? MAX_SPEED : (int32_t)value;
+}
@@ -0,0 +1,250 @@
+#include <esp_timer.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+#define PS4_TAG "PS4_RECONNECT"
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static void ps4_reconnect_tick_cback(void* arg);
+static void schedule(uint32_t delay_ms);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+/* Controllers to page, in priority order. Without a configured list the
+ * bonding store is paged, most recently used first. */
+static uint8_t addresses[PS4_MAX_RECONNECT_ADDRESSES][6];
+static uint8_t address_count = 0;
+static bool use_bonds = false;
+
+static uint8_t next_address = 0;
+static uint32_t backoff_ms = PS4_RECONNECT_BACKOFF_MS;
+static bool is_enabled = false;
+static bool is_paging = false;
+
+static esp_timer_handle_t tick_timer = NULL;
+
+static portMUX_TYPE reconnect_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4StartReconnect
+**
+** Description      Pages known controllers from this side whenever none is
+**                  connected, instead of waiting for one to page us. The
+**                  count addresses of 6 bytes each are tried in order, or
+**                  the controllers of the bonding store if there are none.
+**                  After each round without a connection the next round
+**                  waits twice as long, up to PS4_RECONNECT_BACKOFF_MAX_MS.
+**                  The controllers must have been paired with this host.
+**
+**
+** Returns          false if ps4Init could not create the paging timer
+**
+*******************************************************************************/
+bool ps4StartReconnect(const uint8_t* addrs, uint8_t count) {
+  if (count > PS4_MAX_RECONNECT_ADDRESSES) {
+    count = PS4_MAX_RECONNECT_ADDRESSES;
+  }
+
+  if (tick_timer == NULL) {
+    ESP_LOGE(PS4_TAG, "[%s] no paging timer", __func__);
+    return false;
+  }
+
+  portENTER_CRITICAL(&reconnect_lock);
+  if (addrs != NULL) {
+    memcpy(addresses, addrs, count * sizeof(addresses[0]));
+  }
+  address_count = addrs != NULL ? count : 0;
+  use_bonds = address_count == 0;
+  next_address = 0;
+  backoff_ms = PS4_RECONNECT_BACKOFF_MS;
+  is_enabled = true;
+  portEXIT_CRITICAL(&reconnect_lock);
+
+  schedule(0);
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function         ps4StopReconnect
+**
+** Description      Stops paging controllers. A page already under way still
+**                  completes.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4StopReconnect() {
+  portENTER_CRITICAL(&reconnect_lock);
+  is_enabled = false;
+  portEXIT_CRITICAL(&reconnect_lock);
+
+  if (tick_timer != NULL) {
+    esp_timer_stop(tick_timer);
+  }
+}
+
+/*******************************************************************************
+**
+** Function         ps4_reconnect_connect_event
+**
+** Description      Stops paging once a controller is connected, whichever
+**                  side paged, and starts again when it disconnects.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_reconnect_connect_event(bool is_connected) {
+  portENTER_CRITICAL(&reconnect_lock);
+  is_paging = false;
+  next_address = 0;
+  backoff_ms = PS4_RECONNECT_BACKOFF_MS;
+  bool enabled = is_enabled;
+  portEXIT_CRITICAL(&reconnect_lock);
+
+  if (!enabled) {
+    return;
+  }
+
+  if (is_connected) {
+    esp_timer_stop(tick_timer);
+  } else {
+    schedule(PS4_RECONNECT_BACKOFF_MS);
+  }
+}
+
+/*******************************************************************************
+**
+** Function         ps4_reconnect_page_failed
+**
+** Description      Moves on to the next controller after a page that did
+**                  not lead to a connection, or backs off after the last.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_reconnect_page_failed() {
+  uint32_t delay_ms = 0;
+
+  portENTER_CRITICAL(&reconnect_lock);
+  is_paging = false;
+  if (next_address >= address_count) {
+    next_address = 0;
+    delay_ms = backoff_ms;
+    backoff_ms = backoff_ms * 2 < PS4_RECONNECT_BACKOFF_MAX_MS ? backoff_ms * 2 : PS4_RECONNECT_BACKOFF_MAX_MS;
+  }
+  bool enabled = is_enabled;
+  portEXIT_CRITICAL(&reconnect_lock);
+
+  if (enabled) {
+    schedule(delay_ms);
+  }
+}
+
+/*******************************************************************************
+**
+** Function         ps4_reconnect_init
+**
+** Description      Creates the timer paging the controllers. Called once
+**                  from ps4Init, so the paging timer exists before any task
+**                  can start or stop paging.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_reconnect_init() {
+  const esp_timer_create_args_t timer_args = {
+    .callback = &ps4_reconnect_tick_cback,
+    .name = "ps4_reconnect"
+  };
+
+  if (tick_timer != NULL) {
+    return;
+  }
+
+  if (esp_timer_create(&timer_args, &tick_timer) != ESP_OK) {
+    ESP_LOGE(PS4_TAG, "[%s] creating the paging timer failed", __func__);
+    tick_timer = NULL;
+  }
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4_reconnect_tick_cback
+**
+** Description      Pages the next controller of the round. A round of the
+**                  bonding store starts from its current contents.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void ps4_reconnect_tick_cback(void* arg) {
+  static ps4_bond_t bonds[PS4_MAX_RECONNECT_ADDRESSES];
+  uint8_t addr[6];
+
+  if (use_bonds && next_address == 0) {
+    uint8_t count = ps4GetBonds(bonds, PS4_MAX_RECONNECT_ADDRESSES);
+
+    portENTER_CRITICAL(&reconnect_lock);
+    for (uint8_t i = 0; i < count; i++) {
+      memcpy(addresses[i], bonds[i].addr, sizeof(addresses[i]));
+    }
+    address_count = count;
+    portEXIT_CRITICAL(&reconnect_lock);
+  }
+
+  portENTER_CRITICAL(&reconnect_lock);
+  bool page = is_enabled && !is_paging && next_address < address_count && !ps4IsConnected();
+  if (page) {
+    memcpy(addr, addresses[next_address++], sizeof(addr));
+    is_paging = true;
+  }
+  bool idle = is_enabled && !is_paging && address_count == 0;
+  portEXIT_CRITICAL(&reconnect_lock);
+
+  if (idle) {
+    // Nothing to page yet, look again after a while
+    schedule(PS4_RECONNECT_BACKOFF_MAX_MS);
+    return;
+  }
+
+  if (!page) {
+    return;
+  }
+
+  ESP_LOGI(PS4_TAG, "[%s] paging %02x:%02x:%02x:%02x:%02x:%02x", __func__,
+           addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+
+  if (!ps4_l2cap_connect(addr)) {
+    ps4_reconnect_page_failed();
+  }
+}
+
+static void schedule(uint32_t delay_ms) {
+  esp_timer_stop(tick_timer);
+  esp_timer_start_once(tick_timer, delay_ms * 1000ULL);
+}
@@ -0,0 +1,254 @@
+#include <esp_timer.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+typedef struct {
+  int64_t time;
+  int16_t values[PS4_CHANNEL_COUNT];
+  uint32_t buttons;
+  uint32_t pressed;
+  uint32_t released;
+} ps4_resample_entry_t;
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static void countPresses(uint32_t pressed, uint8_t* presses);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+static uint8_t cursor_count = 0;  // the history is kept while not 0
+
+static ps4_resample_entry_t history[PS4_RESAMPLE_HISTORY];
+static uint32_t history_count = 0;  // entries ever written, the next sequence
+static ps4_t latest;
+
+static portMUX_TYPE history_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4ResamplerInit
+**
+** Description      Starts a cursor producing samples at a fixed rate. Each
+**                  sample is interpolated at a time `delay` microseconds in
+**                  the past, so the reports on both sides of it have usually
+**                  arrived; a larger delay hides larger delivery gaps.
+**                  Reports are only kept while a cursor is started, so each
+**                  cursor must be stopped with ps4ResamplerDeinit.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4ResamplerInit(ps4_resampler_t* cursor, uint32_t rate, uint32_t delay) {
+  int64_t time = esp_timer_get_time() - delay;
+
+  portENTER_CRITICAL(&history_lock);
+  cursor_count++;
+  cursor->is_started = true;
+
+  // Start after the last report at or before the first sample time, so
+  // only presses after that are reported
+  uint32_t oldest = history_count > PS4_RESAMPLE_HISTORY ? history_count - PS4_RESAMPLE_HISTORY : 0;
+  uint32_t sequence = history_count;
+  while (sequence > oldest && history[(sequence - 1) % PS4_RESAMPLE_HISTORY].time > time) {
+    sequence--;
+  }
+  cursor->sequence = sequence;
+  portEXIT_CRITICAL(&history_lock);
+
+  cursor->period = rate > 0 ? 1000000 / rate : 1000000;
+  cursor->delay = delay;
+  cursor->time = time;
+}
+
+/*******************************************************************************
+**
+** Function         ps4ResamplerDeinit
+**
+** Description      Stops a cursor. Once no cursor is left, reports are no
+**                  longer recorded for resampling. Stopping a cursor that
+**                  is not started does nothing.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4ResamplerDeinit(ps4_resampler_t* cursor) {
+  portENTER_CRITICAL(&history_lock);
+  if (cursor->is_started) {
+    cursor->is_started = false;
+    if (--cursor_count == 0) {
+      history_count = 0;
+    }
+  }
+  portEXIT_CRITICAL(&history_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4ResamplerNext
+**
+** Description      Produces the cursor's next sample if its time has come,
+**                  and advances the cursor by one period. Call it until it
+**                  returns false to catch up after a late tick. Sample times
+**                  before the oldest report kept are skipped. Button
+**                  presses and releases of every report since the previous
+**                  sample are accumulated, so none are lost between samples.
+**
+**
+** Returns          bool, false if the next sample is not due yet, no
+**                  report has been received or the cursor is stopped
+**
+*******************************************************************************/
+bool ps4ResamplerNext(ps4_resampler_t* cursor, ps4_resample_t* sample) {
+  int32_t values[PS4_CHANNEL_COUNT];
+  ps4_resample_entry_t before, after;
+  int64_t now = esp_timer_get_time();
+  int64_t time = cursor->time;
+
+  if (!cursor->is_started || time + cursor->delay > now) {
+    return false;
+  }
+
+  memset(sample, 0, sizeof(*sample));
+
+  portENTER_CRITICAL(&history_lock);
+
+  if (history_count == 0) {
+    portEXIT_CRITICAL(&history_lock);
+    return false;
+  }
+
+  // Entries older than the history are gone, along with their presses
+  uint32_t oldest = history_count > PS4_RESAMPLE_HISTORY ? history_count - PS4_RESAMPLE_HISTORY : 0;
+  if (cursor->sequence < oldest) {
+    cursor->sequence = oldest;
+  }
+
+  // Skip ahead to the oldest entry rather than catch up one period at a
+  // time through samples there is nothing to interpolate for, after a
+  // stall or before the first report
+  int64_t oldest_time = history[oldest % PS4_RESAMPLE_HISTORY].time;
+  if (time < oldest_time) {
+    time += (oldest_time - time + cursor->period - 1) / cursor->period * cursor->period;
+    cursor->time = time;
+
+    if (time + cursor->delay > now) {
+      portEXIT_CRITICAL(&history_lock);
+      return false;
+    }
+  }
+
+  // Pass the entries up to the sample time. The cursor only moves forward,
+  // so each report is passed over once across all ticks
+  while (cursor->sequence < history_count &&
+         history[cursor->sequence % PS4_RESAMPLE_HISTORY].time <= time) {
+    ps4_resample_entry_t* passed = &history[cursor->sequence++ % PS4_RESAMPLE_HISTORY];
+
+    sample->pressed.mask |= passed->pressed;
+    sample->released.mask |= passed->released;
+    if (passed->pressed) {
+      countPresses(passed->pressed, sample->presses);
+    }
+  }
+
+  // The last entry at or before the sample time, which the skip ahead
+  // guarantees, and the first one still ahead
+  before = history[(cursor->sequence - 1) % PS4_RESAMPLE_HISTORY];
+  if (cursor->sequence < history_count) {
+    after = history[cursor->sequence % PS4_RESAMPLE_HISTORY];
+  } else {
+    after = before;
+  }
+  sample->state = latest;
+
+  portEXIT_CRITICAL(&history_lock);
+
+  // Linear interpolation between the reports around the sample time, or
+  // the newest report when the time is past the history
+  int64_t span = after.time - before.time;
+  int64_t offset = time - before.time;
+  if (span <= 0) {
+    offset = 0;
+    span = 1;
+  } else if (offset > span) {
+    offset = span;
+  }
+
+  for (uint8_t i = 0; i < PS4_CHANNEL_COUNT; i++) {
+    values[i] = before.values[i] + (int32_t)((after.values[i] - before.values[i]) * offset / span);
+  }
+
+  sample->time = time;
+  sample->state.button.mask = before.buttons;
+  sample->state.latestPacket = NULL;
+  ps4_channels_write(&sample->state, values);
+
+  cursor->time += cursor->period;
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function         ps4_resample_record
+**
+** Description      Adds a report to the resampling history, stamped with
+**                  the host time at which the controller sampled it.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_resample_record(const ps4_t* ps4, const ps4_event_t* event) {
+  int32_t values[PS4_CHANNEL_COUNT];
+
+  if (cursor_count == 0) {
+    return;
+  }
+
+  ps4_channels_read(ps4, values);
+
+  portENTER_CRITICAL(&history_lock);
+
+  ps4_resample_entry_t* entry = &history[history_count % PS4_RESAMPLE_HISTORY];
+  entry->time = ps4_report_time();
+  for (uint8_t i = 0; i < PS4_CHANNEL_COUNT; i++) {
+    entry->values[i] = values[i];
+  }
+  entry->buttons = ps4->button.mask;
+  entry->pressed = event->button_down.mask;
+  entry->released = event->button_up.mask;
+  latest = *ps4;
+  history_count++;
+
+  portEXIT_CRITICAL(&history_lock);
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+static void countPresses(uint32_t pressed, uint8_t* presses) {
+  while (pressed) {
+    uint8_t bit = __builtin_ctz(pressed);
+    if (presses[bit] < UINT8_MAX) {
+      presses[bit]++;
+    }
+    pressed &= pressed - 1;
+  }
+}
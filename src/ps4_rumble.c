@@ -0,0 +1,284 @@
+#include <esp_timer.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+#define PS4_TAG "PS4_RUMBLE"
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+typedef struct {
+  const ps4_rumble_track_t* track;  // NULL = free
+  int64_t start;                    // esp_timer_get_time() microseconds
+  uint8_t strength;
+} ps4_rumble_voice_t;
+
+/* Motor values are sent with this many low bits cleared, so a slow ramp
+ * does not send a report for every single step */
+#define QUANTIZE_MASK ((uint8_t)(0xFF << PS4_RUMBLE_QUANTIZE_BITS))
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static void ps4_rumble_tick_cback(void* arg);
+static void sampleTrack(const ps4_rumble_track_t* track, uint32_t time_ms, uint8_t* small, uint8_t* large);
+static uint8_t quantize(uint32_t value);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+/* Built in envelopes */
+static const ps4_rumble_keyframe_t click_keyframes[] = {
+  {0, 0, 255}, {30, 0, 255}
+};
+static const ps4_rumble_keyframe_t pulse_keyframes[] = {
+  {0, 200, 0}, {100, 200, 0}, {101, 0, 0}, {200, 0, 0}
+};
+static const ps4_rumble_keyframe_t ramp_up_keyframes[] = {
+  {0, 0, 0}, {1000, 255, 255}
+};
+static const ps4_rumble_keyframe_t ramp_down_keyframes[] = {
+  {0, 255, 255}, {1000, 0, 0}
+};
+static const ps4_rumble_keyframe_t engine_keyframes[] = {
+  {0, 90, 40}, {40, 120, 60}, {80, 90, 40}
+};
+
+const ps4_rumble_track_t ps4_rumble_click = {click_keyframes, 2, false};
+const ps4_rumble_track_t ps4_rumble_pulse = {pulse_keyframes, 4, true};
+const ps4_rumble_track_t ps4_rumble_ramp_up = {ramp_up_keyframes, 2, false};
+const ps4_rumble_track_t ps4_rumble_ramp_down = {ramp_down_keyframes, 2, false};
+const ps4_rumble_track_t ps4_rumble_engine = {engine_keyframes, 3, true};
+
+static ps4_rumble_voice_t voices[PS4_RUMBLE_VOICES];
+static uint8_t voice_count = 0;
+
+static esp_timer_handle_t tick_timer = NULL;
+static bool is_ticking = false;
+
+static portMUX_TYPE rumble_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4RumblePlay
+**
+** Description      Starts playing a keyframe track on the rumble motors,
+**                  scaled by strength (255 = as written). Tracks playing at
+**                  the same time are added up. The track is not copied and
+**                  has to stay valid while it plays.
+**
+**
+** Returns          int8_t, the voice playing the track, or -1 if all
+**                  PS4_RUMBLE_VOICES voices are busy or ps4Init could not
+**                  create the mixing timer
+**
+*******************************************************************************/
+int8_t ps4RumblePlay(const ps4_rumble_track_t* track, uint8_t strength) {
+  int8_t voice = -1;
+
+  if (track == NULL || track->count == 0) {
+    return -1;
+  }
+
+  if (tick_timer == NULL) {
+    ESP_LOGE(PS4_TAG, "[%s] no mixing timer", __func__);
+    return -1;
+  }
+
+  portENTER_CRITICAL(&rumble_lock);
+  for (uint8_t i = 0; i < PS4_RUMBLE_VOICES; i++) {
+    if (voices[i].track == NULL) {
+      voices[i].track = track;
+      voices[i].start = esp_timer_get_time();
+      voices[i].strength = strength;
+      voice_count++;
+      voice = i;
+      break;
+    }
+  }
+  bool start = voice >= 0 && !is_ticking;
+  is_ticking |= start;
+  portEXIT_CRITICAL(&rumble_lock);
+
+  if (start) {
+    esp_timer_start_periodic(tick_timer, PS4_RUMBLE_TICK_MS * 1000ULL);
+  }
+
+  return voice;
+}
+
+/*******************************************************************************
+**
+** Function         ps4RumbleStop
+**
+** Description      Stops a voice started with ps4RumblePlay. The motors
+**                  follow on the next tick.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4RumbleStop(int8_t voice) {
+  if (voice < 0 || voice >= PS4_RUMBLE_VOICES) {
+    return;
+  }
+
+  portENTER_CRITICAL(&rumble_lock);
+  if (voices[voice].track != NULL) {
+    voices[voice].track = NULL;
+    voice_count--;
+  }
+  portEXIT_CRITICAL(&rumble_lock);
+}
+
+void ps4RumbleStopAll() {
+  for (int8_t i = 0; i < PS4_RUMBLE_VOICES; i++) {
+    ps4RumbleStop(i);
+  }
+}
+
+/*******************************************************************************
+**
+** Function         ps4_rumble_init
+**
+** Description      Creates the timer mixing the playing tracks. Called once
+**                  from ps4Init, so ps4RumblePlay never creates it from
+**                  two tasks at once.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_rumble_init() {
+  const esp_timer_create_args_t timer_args = {
+    .callback = &ps4_rumble_tick_cback,
+    .name = "ps4_rumble"
+  };
+
+  if (tick_timer != NULL) {
+    return;
+  }
+
+  if (esp_timer_create(&timer_args, &tick_timer) != ESP_OK) {
+    ESP_LOGE(PS4_TAG, "[%s] creating the mixing timer failed", __func__);
+    tick_timer = NULL;
+  }
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4_rumble_tick_cback
+**
+** Description      Mixes the playing voices every PS4_RUMBLE_TICK_MS and
+**                  sends the motor values when their quantized value
+**                  changed. The timer stops once the last voice has ended
+**                  and the motors are off.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void ps4_rumble_tick_cback(void* arg) {
+  uint32_t small = 0;
+  uint32_t large = 0;
+  int64_t now = esp_timer_get_time();
+
+  portENTER_CRITICAL(&rumble_lock);
+
+  for (uint8_t i = 0; i < PS4_RUMBLE_VOICES; i++) {
+    ps4_rumble_voice_t* voice = &voices[i];
+    const ps4_rumble_track_t* track = voice->track;
+    uint8_t voice_small, voice_large;
+
+    if (track == NULL) {
+      continue;
+    }
+
+    uint32_t time_ms = (uint32_t)((now - voice->start) / 1000);
+    uint16_t duration = track->keyframes[track->count - 1].time_ms;
+
+    if (time_ms > duration) {
+      if (!track->loop || duration == 0) {
+        voice->track = NULL;
+        voice_count--;
+        continue;
+      }
+      time_ms %= duration + 1;
+    }
+
+    sampleTrack(track, time_ms, &voice_small, &voice_large);
+    small += voice_small * (voice->strength + 1) >> 8;
+    large += voice_large * (voice->strength + 1) >> 8;
+  }
+
+  bool stop = voice_count == 0;
+
+  portEXIT_CRITICAL(&rumble_lock);
+
+  // A voice started while stopping finds the timer still ticking, so it
+  // is restarted here rather than by ps4RumblePlay
+  if (stop) {
+    esp_timer_stop(tick_timer);
+
+    portENTER_CRITICAL(&rumble_lock);
+    bool restart = voice_count > 0;
+    is_ticking = restart;
+    portEXIT_CRITICAL(&rumble_lock);
+
+    if (restart) {
+      esp_timer_start_periodic(tick_timer, PS4_RUMBLE_TICK_MS * 1000ULL);
+    }
+  }
+
+  if (ps4IsConnected()) {
+    ps4_output_rumble(quantize(small), quantize(large));
+  }
+}
+
+/* Linear interpolation between the keyframes around a time */
+static void sampleTrack(const ps4_rumble_track_t* track, uint32_t time_ms, uint8_t* small, uint8_t* large) {
+  const ps4_rumble_keyframe_t* keyframes = track->keyframes;
+  uint8_t next = 0;
+
+  while (next < track->count && keyframes[next].time_ms <= time_ms) {
+    next++;
+  }
+
+  if (next == 0 || next == track->count) {
+    const ps4_rumble_keyframe_t* nearest = &keyframes[next == 0 ? 0 : track->count - 1];
+    *small = nearest->small;
+    *large = nearest->large;
+    return;
+  }
+
+  const ps4_rumble_keyframe_t* a = &keyframes[next - 1];
+  const ps4_rumble_keyframe_t* b = &keyframes[next];
+  int32_t span = b->time_ms - a->time_ms;
+  int32_t offset = time_ms - a->time_ms;
+
+  *small = a->small + (b->small - a->small) * offset / span;
+  *large = a->large + (b->large - a->large) * offset / span;
+}
+
+/* Saturates the mix, and rounds to the nearest quantization step */
+static uint8_t quantize(uint32_t value) {
+  uint32_t half = (1 << PS4_RUMBLE_QUANTIZE_BITS) >> 1;
+
+  value = value + half > 255 ? 255 : value + half;
+  return value == 255 ? 255 : value & QUANTIZE_MASK;
+}
@@ -0,0 +1,413 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+#define PS4_TAG "PS4_SENSOR"
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+/* Scale factors are fixed point with this many fractional bits, small
+ * enough that the raw range times the scale fits in 32 bits */
+#define SENSOR_SCALE_SHIFT 12
+#define SENSOR_SCALE_ONE (1 << SENSOR_SCALE_SHIFT)
+
+/* Calibration data outside of this range is treated as corrupt */
+#define SENSOR_SCALE_MIN (SENSOR_SCALE_ONE / 8)
+#define SENSOR_SCALE_MAX (SENSOR_SCALE_ONE * 8)
+
+/* The stillness detector keeps an exponential moving mean and variance per
+ * axis over roughly 2^STILL_WINDOW_SHIFT reports. Values are kept with
+ * STILL_FRACTION_BITS extra bits so small changes are not lost. */
+#define STILL_WINDOW_SHIFT 5
+#define STILL_FRACTION_BITS 8
+#define STILL_ROUND(value) (((value) + (1 << (STILL_FRACTION_BITS - 1))) >> STILL_FRACTION_BITS)
+
+/** Variance below which the controller counts as still, in squared
+ * calibrated units: about 0.25 deg/s and 4 mg standard deviation */
+#ifndef PS4_GYRO_STILL_VARIANCE
+#define PS4_GYRO_STILL_VARIANCE 16
+#endif
+
+#ifndef PS4_ACC_STILL_VARIANCE
+#define PS4_ACC_STILL_VARIANCE 1024
+#endif
+
+/** Time constant of the bias low-pass filter, in still reports */
+#define BIAS_FILTER_SHIFT 7
+
+/* The estimate is settled after four time constants of stillness. While
+ * moving the bias can drift with temperature unseen, so one still report
+ * is taken back every 2^BIAS_DECAY_SHIFT moving reports. */
+#define BIAS_SETTLED_SAMPLES (4 << BIAS_FILTER_SHIFT)
+#define BIAS_DECAY_SHIFT 3
+
+/* Deviations are clamped before squaring so the variance fits 32 bits,
+ * anything this large is movement anyway */
+#define STILL_DEVIATION_MAX 1024
+
+/* Offsets into feature report 0x05, starting with the report id. The
+ * Bluetooth variant lists all plus values before the minus values. */
+enum ps4_calibration_index {
+  calibration_index_gyro_pitch_bias = 1,
+  calibration_index_gyro_yaw_bias = 3,
+  calibration_index_gyro_roll_bias = 5,
+  calibration_index_gyro_pitch_plus = 7,
+  calibration_index_gyro_yaw_plus = 9,
+  calibration_index_gyro_roll_plus = 11,
+  calibration_index_gyro_pitch_minus = 13,
+  calibration_index_gyro_yaw_minus = 15,
+  calibration_index_gyro_roll_minus = 17,
+  calibration_index_gyro_speed_plus = 19,
+  calibration_index_gyro_speed_minus = 21,
+  calibration_index_acc_x_plus = 23,
+  calibration_index_acc_x_minus = 25,
+  calibration_index_acc_y_plus = 27,
+  calibration_index_acc_y_minus = 29,
+  calibration_index_acc_z_plus = 31,
+  calibration_index_acc_z_minus = 33,
+
+  calibration_report_min_length = 35
+};
+
+enum ps4_sensor_axis {
+  sensor_axis_gyro_x,
+  sensor_axis_gyro_y,
+  sensor_axis_gyro_z,
+  sensor_axis_acc_x,
+  sensor_axis_acc_y,
+  sensor_axis_acc_z,
+
+  sensor_axis_count
+};
+
+typedef struct {
+  int16_t bias;
+  int32_t scale;
+} ps4_sensor_axis_calibration_t;
+
+typedef struct {
+  int32_t mean;      // with STILL_FRACTION_BITS
+  int32_t variance;  // squared calibrated units, with STILL_FRACTION_BITS
+} ps4_sensor_axis_stats_t;
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static void calibrationReportCallback(void* object, ps4_hid_result_t result,
+                                      const uint8_t* data, uint16_t length);
+static void setGyroCalibration(uint8_t axis, int16_t bias, int16_t plus, int16_t minus, int32_t speed2x);
+static void setAccCalibration(uint8_t axis, int16_t plus, int16_t minus);
+static int16_t applyCalibration(uint8_t axis, int16_t raw);
+static int32_t updateVariance(uint8_t axis, int16_t value);
+static void updateGyroBias(ps4_sensor_t* sensor);
+static void resetGyroBias();
+static int16_t readInt16(const uint8_t* data, uint8_t index);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+/* Until the controller's calibration arrives the raw counts are used as is */
+static ps4_sensor_axis_calibration_t calibration[sensor_axis_count] = {
+  {0, SENSOR_SCALE_ONE}, {0, SENSOR_SCALE_ONE}, {0, SENSOR_SCALE_ONE},
+  {0, SENSOR_SCALE_ONE}, {0, SENSOR_SCALE_ONE}, {0, SENSOR_SCALE_ONE}
+};
+
+static bool is_calibrated = false;
+
+static ps4_sensor_axis_stats_t stats[sensor_axis_count];
+static int32_t gyro_bias[3];  // with STILL_FRACTION_BITS
+static uint16_t still_samples = 0;
+static uint8_t moving_samples = 0;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4IsSensorCalibrated
+**
+** Description      This returns whether the gyroscope and accelerometer
+**                  values are scaled with the connected controller's own
+**                  calibration data.
+**
+**
+** Returns          bool
+**
+*******************************************************************************/
+bool ps4IsSensorCalibrated() { return is_calibrated; }
+
+/*******************************************************************************
+**
+** Function         ps4_sensor_request_calibration
+**
+** Description      Requests the IMU calibration feature report from the
+**                  PS4 controller.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_sensor_request_calibration() {
+  // A newly connected controller starts from its own calibration and bias
+  for (uint8_t axis = 0; axis < sensor_axis_count; axis++) {
+    calibration[axis].bias = 0;
+    calibration[axis].scale = SENSOR_SCALE_ONE;
+  }
+  is_calibrated = false;
+  resetGyroBias();
+
+  ps4GetReport(ps4_report_type_feature, hid_cmd_identifier_ps4_calibration,
+               &calibrationReportCallback, NULL);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_sensor_calibrate
+**
+** Description      Converts raw sensor counts into calibrated units with a
+**                  single multiply and shift per axis.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_sensor_calibrate(ps4_sensor_t* sensor) {
+  sensor->gyroscope.x = applyCalibration(sensor_axis_gyro_x, sensor->gyroscope.x);
+  sensor->gyroscope.y = applyCalibration(sensor_axis_gyro_y, sensor->gyroscope.y);
+  sensor->gyroscope.z = applyCalibration(sensor_axis_gyro_z, sensor->gyroscope.z);
+
+  sensor->accelerometer.x = applyCalibration(sensor_axis_acc_x, sensor->accelerometer.x);
+  sensor->accelerometer.y = applyCalibration(sensor_axis_acc_y, sensor->accelerometer.y);
+  sensor->accelerometer.z = applyCalibration(sensor_axis_acc_z, sensor->accelerometer.z);
+
+  updateGyroBias(sensor);
+}
+
+/*******************************************************************************
+**
+** Function         ps4GetGyroBias
+**
+** Description      Returns the gyroscope bias estimate and how confident
+**                  the estimate is.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4GetGyroBias(ps4_gyro_bias_t* bias) {
+  uint16_t samples = still_samples;
+
+  bias->x = STILL_ROUND(gyro_bias[0]);
+  bias->y = STILL_ROUND(gyro_bias[1]);
+  bias->z = STILL_ROUND(gyro_bias[2]);
+
+  bias->confidence = samples >= BIAS_SETTLED_SAMPLES ? 255 : samples * 255 / BIAS_SETTLED_SAMPLES;
+  bias->settling = bias->confidence < 255;
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         calibrationReportCallback
+**
+** Description      Computes the per axis bias and scale factors from the
+**                  calibration feature report.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void calibrationReportCallback(void* object, ps4_hid_result_t result,
+                                      const uint8_t* data, uint16_t length) {
+  if (result != ps4_hid_result_success || length < calibration_report_min_length) {
+    ESP_LOGW(PS4_TAG, "[%s] calibration unavailable, result: %d length: %d", __func__, result, length);
+    return;
+  }
+
+  int32_t speed2x = readInt16(data, calibration_index_gyro_speed_plus) +
+                    readInt16(data, calibration_index_gyro_speed_minus);
+
+  setGyroCalibration(sensor_axis_gyro_x,
+                     readInt16(data, calibration_index_gyro_pitch_bias),
+                     readInt16(data, calibration_index_gyro_pitch_plus),
+                     readInt16(data, calibration_index_gyro_pitch_minus), speed2x);
+  setGyroCalibration(sensor_axis_gyro_y,
+                     readInt16(data, calibration_index_gyro_yaw_bias),
+                     readInt16(data, calibration_index_gyro_yaw_plus),
+                     readInt16(data, calibration_index_gyro_yaw_minus), speed2x);
+  setGyroCalibration(sensor_axis_gyro_z,
+                     readInt16(data, calibration_index_gyro_roll_bias),
+                     readInt16(data, calibration_index_gyro_roll_plus),
+                     readInt16(data, calibration_index_gyro_roll_minus), speed2x);
+
+  setAccCalibration(sensor_axis_acc_x,
+                    readInt16(data, calibration_index_acc_x_plus),
+                    readInt16(data, calibration_index_acc_x_minus));
+  setAccCalibration(sensor_axis_acc_y,
+                    readInt16(data, calibration_index_acc_y_plus),
+                    readInt16(data, calibration_index_acc_y_minus));
+  setAccCalibration(sensor_axis_acc_z,
+                    readInt16(data, calibration_index_acc_z_plus),
+                    readInt16(data, calibration_index_acc_z_minus));
+
+  is_calibrated = true;
+  ESP_LOGI(PS4_TAG, "[%s] sensor calibration loaded", __func__);
+}
+
+/*******************************************************************************
+**
+** Function         setGyroCalibration
+**
+** Description      The controller reports the raw counts measured at plus
+**                  and minus a known rate. The zero rate bias is already
+**                  removed by the controller, so only the scale is kept.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void setGyroCalibration(uint8_t axis, int16_t bias, int16_t plus, int16_t minus, int32_t speed2x) {
+  int32_t range = abs(plus - bias) + abs(minus - bias);
+
+  if (range == 0 || speed2x <= 0) {
+    return;
+  }
+
+  // Corrupt data can take the product past 32 bits
+  int64_t scale = ((int64_t)speed2x * PS4_GYRO_RES_PER_DEG_S * SENSOR_SCALE_ONE) / range;
+  if (scale < SENSOR_SCALE_MIN || scale > SENSOR_SCALE_MAX) {
+    return;
+  }
+
+  calibration[axis].bias = 0;
+  calibration[axis].scale = scale;
+}
+
+/*******************************************************************************
+**
+** Function         setAccCalibration
+**
+** Description      The controller reports the raw counts measured at plus
+**                  and minus 1g, which give both the bias and the scale.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void setAccCalibration(uint8_t axis, int16_t plus, int16_t minus) {
+  int32_t range = plus - minus;
+
+  if (range <= 0) {
+    return;
+  }
+
+  int32_t scale = (2 * PS4_ACC_RES_PER_G * SENSOR_SCALE_ONE) / range;
+  if (scale < SENSOR_SCALE_MIN || scale > SENSOR_SCALE_MAX) {
+    return;
+  }
+
+  calibration[axis].bias = plus - range / 2;
+  calibration[axis].scale = scale;
+}
+
+static int16_t applyCalibration(uint8_t axis, int16_t raw) {
+  int32_t value = ((raw - calibration[axis].bias) * calibration[axis].scale) >> SENSOR_SCALE_SHIFT;
+
+  if (value > INT16_MAX) return INT16_MAX;
+  if (value < INT16_MIN) return INT16_MIN;
+  return value;
+}
+
+/*******************************************************************************
+**
+** Function         updateGyroBias
+**
+** Description      Updates the stillness detector with the calibrated
+**                  sample, moves the bias estimate towards the gyroscope
+**                  reading while still, and subtracts the estimate.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void updateGyroBias(ps4_sensor_t* sensor) {
+  int16_t* gyro[3] = {&sensor->gyroscope.x, &sensor->gyroscope.y, &sensor->gyroscope.z};
+  int32_t gyroVariance = updateVariance(sensor_axis_gyro_x, sensor->gyroscope.x) +
+                         updateVariance(sensor_axis_gyro_y, sensor->gyroscope.y) +
+                         updateVariance(sensor_axis_gyro_z, sensor->gyroscope.z);
+  int32_t accVariance = updateVariance(sensor_axis_acc_x, sensor->accelerometer.x) +
+                        updateVariance(sensor_axis_acc_y, sensor->accelerometer.y) +
+                        updateVariance(sensor_axis_acc_z, sensor->accelerometer.z);
+  bool isStill = gyroVariance < PS4_GYRO_STILL_VARIANCE && accVariance < PS4_ACC_STILL_VARIANCE;
+
+  if (isStill) {
+    if (still_samples < BIAS_SETTLED_SAMPLES) {
+      still_samples++;
+    }
+  } else if (still_samples > 0 && (++moving_samples & ((1 << BIAS_DECAY_SHIFT) - 1)) == 0) {
+    still_samples--;
+  }
+
+  for (uint8_t i = 0; i < 3; i++) {
+    if (isStill) {
+      int32_t sample = (int32_t)*gyro[i] << STILL_FRACTION_BITS;
+      gyro_bias[i] += (sample - gyro_bias[i]) >> BIAS_FILTER_SHIFT;
+    }
+
+    int32_t value = *gyro[i] - STILL_ROUND(gyro_bias[i]);
+    *gyro[i] = value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : value;
+  }
+}
+
+/*******************************************************************************
+**
+** Function         updateVariance
+**
+** Description      Updates the moving mean and variance of one axis.
+**
+**
+** Returns          int32_t, the variance
+**
+*******************************************************************************/
+static int32_t updateVariance(uint8_t axis, int16_t value) {
+  ps4_sensor_axis_stats_t* axisStats = &stats[axis];
+  int32_t sample = (int32_t)value << STILL_FRACTION_BITS;
+
+  axisStats->mean += (sample - axisStats->mean) >> STILL_WINDOW_SHIFT;
+
+  int32_t deviation = (sample - axisStats->mean) >> STILL_FRACTION_BITS;
+  if (deviation > STILL_DEVIATION_MAX) deviation = STILL_DEVIATION_MAX;
+  if (deviation < -STILL_DEVIATION_MAX) deviation = -STILL_DEVIATION_MAX;
+
+  int32_t squared = (deviation * deviation) << STILL_FRACTION_BITS;
+  axisStats->variance += (squared - axisStats->variance) >> STILL_WINDOW_SHIFT;
+
+  return axisStats->variance >> STILL_FRACTION_BITS;
+}
+
+static void resetGyroBias() {
+  memset(stats, 0, sizeof(stats));
+  memset(gyro_bias, 0, sizeof(gyro_bias));
+  still_samples = 0;
+  moving_samples = 0;
+
+  // Start out moving so a single quiet report can't count as still
+  for (uint8_t axis = 0; axis < sensor_axis_count; axis++) {
+    stats[axis].variance = (STILL_DEVIATION_MAX * STILL_DEVIATION_MAX) << STILL_FRACTION_BITS;
+  }
+}
+
+static int16_t readInt16(const uint8_t* data, uint8_t index) {
+  return (int16_t)(data[index] | (data[index + 1] << 8));
+}
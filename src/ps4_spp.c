@@ -1,11 +1,16 @@
+#include "ps4.h"
+#include "ps4_int.h"
+
+/* Not built with CONFIG_PS4_INIT_GAP_ONLY, so nothing references the
+ * esp_spp_* API and SPP can be disabled */
+#if !CONFIG_PS4_INIT_GAP_ONLY
+
 #include "esp_bt.h"
 #include "esp_bt_device.h"
 #include "esp_bt_main.h"
 #include "esp_gap_bt_api.h"
 #include "esp_log.h"
 #include "esp_spp_api.h"
-#include "ps4.h"
-#include "ps4_int.h"
 
 #define PS4_TAG "PS4_SPP"
 
@@ -30,29 +35,10 @@ static void sppCallback(esp_spp_cb_event_t event, esp_spp_cb_param_t* param);
 void sppInit() {
   esp_err_t ret;
 
-#ifndef ARDUINO_ARCH_ESP32
-  esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
-  if ((ret = esp_bt_controller_init(&bt_cfg)) != ESP_OK) {
-    ESP_LOGE(PS4_TAG, "%s initialize controller failed: %s\n", __func__, esp_err_to_name(ret));
-    return;
-  }
-
-  if ((ret = esp_bt_controller_enable(BT_MODE)) != ESP_OK) {
-    ESP_LOGE(PS4_TAG, "%s enable controller failed: %s\n", __func__, esp_err_to_name(ret));
+  if (!ps4_gap_bluetooth_start()) {
     return;
   }
 
-  if ((ret = esp_bluedroid_init()) != ESP_OK) {
-    ESP_LOGE(PS4_TAG, "%s initialize bluedroid failed: %s\n", __func__, esp_err_to_name(ret));
-    return;
-  }
-
-  if ((ret = esp_bluedroid_enable()) != ESP_OK) {
-    ESP_LOGE(PS4_TAG, "%s enable bluedroid failed: %s\n", __func__, esp_err_to_name(ret));
-    return;
-  }
-#endif
-
   if ((ret = esp_spp_register_callback(sppCallback)) != ESP_OK) {
     ESP_LOGE(PS4_TAG, "%s spp register failed: %s\n", __func__, esp_err_to_name(ret));
     return;
@@ -81,14 +67,10 @@ void sppInit() {
 static void sppCallback(esp_spp_cb_event_t event, esp_spp_cb_param_t* param) {
   if (event == ESP_SPP_INIT_EVT) {
     ESP_LOGI(PS4_TAG, "ESP_SPP_INIT_EVT");
-    esp_bt_dev_set_device_name("ESP Host");
-
-#if CONFIG_IDF_COMPATIBILITY >= IDF_COMPATIBILITY_MASTER_D9CE0BB
-    esp_bt_gap_set_scan_mode(ESP_BT_CONNECTABLE, ESP_BT_NON_DISCOVERABLE);
-#elif CONFIG_IDF_COMPATIBILITY >= IDF_COMPATIBILITY_MASTER_21AF1D7
-    esp_bt_gap_set_scan_mode(ESP_BT_SCAN_MODE_CONNECTABLE);
-#endif
+    ps4_gap_connectable();
 
     esp_spp_start_srv(ESP_SPP_SEC_NONE, ESP_SPP_ROLE_SLAVE, 0, "ESP SERVER");
   }
 }
+
+#endif  // !CONFIG_PS4_INIT_GAP_ONLY
@@ -0,0 +1,382 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+#define PS4_TAG "PS4_STICK"
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+enum ps4_stick_axis {
+  stick_axis_lx,
+  stick_axis_ly,
+  stick_axis_rx,
+  stick_axis_ry,
+
+  stick_axis_count
+};
+
+/** Distance from the learned center within which a stick counts as resting */
+#ifndef PS4_STICK_REST_WINDOW
+#define PS4_STICK_REST_WINDOW 16
+#endif
+
+/* The center follows resting readings with a time constant of
+ * 2^CENTER_FILTER_SHIFT reports, kept with CENTER_FRACTION_BITS */
+#define CENTER_FILTER_SHIFT 6
+#define CENTER_FRACTION_BITS 8
+
+/* While learning, the table is rebuilt at most once per this many reports */
+#define LUT_REBUILD_INTERVAL 32
+
+/* The storage entry kind for stick calibrations */
+#define STORAGE_KIND_STICK 's'
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static void buildLut();
+static int8_t calibratedValue(const ps4_stick_calibration_t* c, uint8_t axis, uint8_t raw);
+static bool isDefault(const ps4_stick_calibration_t* stick_calibration);
+static void learnStick(uint8_t axisX, uint8_t axisY, const uint8_t* raw);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+/* The parser reads one table while the next one is built in the other */
+static int8_t luts[2][stick_axis_count][256];
+int8_t (*volatile ps4_stick_lut)[256] = luts[0];
+bool ps4_stick_learning = false;
+
+static const ps4_stick_calibration_t default_calibration = {
+  .center = {128, 127, 128, 127},
+  .min = {0, 0, 0, 0},
+  .max = {255, 255, 255, 255}
+};
+
+static ps4_stick_calibration_t calibration;
+static int32_t learned_center[stick_axis_count];  // with CENTER_FRACTION_BITS
+static uint8_t reports_since_rebuild = 0;
+static bool is_dirty = false;
+static bool is_building = false;
+static bool is_modified = false;
+static char storage_key[PS4_STORAGE_KEY_SIZE] = "";
+
+static portMUX_TYPE calibration_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4SetStickCalibrationLearning
+**
+** Description      Starts or stops learning the stick centers and ranges.
+**                  Move both sticks around their full range while learning.
+**                  Stopping saves the result for the connected controller.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4SetStickCalibrationLearning(bool enable) {
+  if (enable == ps4_stick_learning) {
+    return;
+  }
+
+  if (enable) {
+    portENTER_CRITICAL(&calibration_lock);
+    // Start with a small envelope around the center, the sticks' real
+    // reach is what gets learned
+    for (uint8_t axis = 0; axis < stick_axis_count; axis++) {
+      uint8_t center = calibration.center[axis];
+      calibration.min[axis] = center > PS4_STICK_REST_WINDOW ? center - PS4_STICK_REST_WINDOW : 0;
+      calibration.max[axis] = center < 255 - PS4_STICK_REST_WINDOW ? center + PS4_STICK_REST_WINDOW : 255;
+      learned_center[axis] = (int32_t)center << CENTER_FRACTION_BITS;
+    }
+    is_dirty = true;
+    portEXIT_CRITICAL(&calibration_lock);
+
+    ps4_stick_learning = true;
+  } else {
+    ps4_stick_learning = false;
+    buildLut();
+    ps4SaveStickCalibration();
+  }
+}
+
+/*******************************************************************************
+**
+** Function         ps4GetStickCalibration
+**
+** Description      Returns the stick calibration currently in use.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4GetStickCalibration(ps4_stick_calibration_t* stick_calibration) {
+  portENTER_CRITICAL(&calibration_lock);
+  *stick_calibration = calibration;
+  portEXIT_CRITICAL(&calibration_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4SetStickCalibration
+**
+** Description      Replaces the stick calibration, e.g. with one stored
+**                  by the application itself.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4SetStickCalibration(const ps4_stick_calibration_t* stick_calibration) {
+  portENTER_CRITICAL(&calibration_lock);
+  calibration = *stick_calibration;
+  is_dirty = true;
+  is_modified = true;
+  portEXIT_CRITICAL(&calibration_lock);
+
+  buildLut();
+}
+
+/*******************************************************************************
+**
+** Function         ps4SaveStickCalibration
+**
+** Description      Persists the stick calibration for the connected
+**                  controller with the storage backend set by ps4SetStorage.
+**
+**
+** Returns          bool, false if nothing could be stored
+**
+*******************************************************************************/
+bool ps4SaveStickCalibration() {
+  ps4_stick_calibration_t stick_calibration;
+
+  if (storage_key[0] == '\0') {
+    return false;
+  }
+
+  ps4GetStickCalibration(&stick_calibration);
+
+  if (!ps4_storage_store(storage_key, &stick_calibration, sizeof(stick_calibration))) {
+    return false;
+  }
+
+  is_modified = false;
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function         ps4_stick_init
+**
+** Description      Fills the conversion table with the uncalibrated mapping.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_stick_init() {
+  calibration = default_calibration;
+  is_dirty = true;
+  buildLut();
+}
+
+/*******************************************************************************
+**
+** Function         ps4_stick_connect
+**
+** Description      Loads the stored calibration of the controller that
+**                  connected, or falls back to the uncalibrated mapping.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_stick_connect(const uint8_t* addr) {
+  ps4_stick_calibration_t stick_calibration;
+
+  ps4_storage_key(storage_key, STORAGE_KIND_STICK, addr);
+
+  if (ps4_storage_load(storage_key, &stick_calibration, sizeof(stick_calibration))) {
+    ESP_LOGI(PS4_TAG, "[%s] loaded stick calibration %s", __func__, storage_key);
+  } else {
+    stick_calibration = default_calibration;
+  }
+
+  ps4SetStickCalibration(&stick_calibration);
+  is_modified = false;
+}
+
+/*******************************************************************************
+**
+** Function         ps4_stick_disconnect
+**
+** Description      Saves a calibration learned during the connection.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_stick_disconnect() {
+  if (is_modified) {
+    ps4SaveStickCalibration();
+  }
+}
+
+/*******************************************************************************
+**
+** Function         ps4_stick_learn
+**
+** Description      Widens the range envelopes and follows the resting
+**                  center with the raw readings of one report. Only
+**                  called while learning is enabled.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_stick_learn(const uint8_t* raw) {
+  portENTER_CRITICAL(&calibration_lock);
+  learnStick(stick_axis_lx, stick_axis_ly, raw);
+  learnStick(stick_axis_rx, stick_axis_ry, raw);
+  portEXIT_CRITICAL(&calibration_lock);
+
+  if (++reports_since_rebuild >= LUT_REBUILD_INTERVAL) {
+    reports_since_rebuild = 0;
+    buildLut();
+  }
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+static void learnStick(uint8_t axisX, uint8_t axisY, const uint8_t* raw) {
+  uint8_t axes[2] = {axisX, axisY};
+  bool isResting = true;
+
+  for (uint8_t i = 0; i < 2; i++) {
+    uint8_t axis = axes[i];
+
+    if (raw[axis] < calibration.min[axis]) {
+      calibration.min[axis] = raw[axis];
+      is_dirty = true;
+    }
+    if (raw[axis] > calibration.max[axis]) {
+      calibration.max[axis] = raw[axis];
+      is_dirty = true;
+    }
+
+    int16_t offset = raw[axis] - calibration.center[axis];
+    isResting = isResting && offset >= -PS4_STICK_REST_WINDOW && offset <= PS4_STICK_REST_WINDOW;
+  }
+
+  // The center only follows while both axes of the stick are near it, so
+  // sweeping the stick across the middle barely moves it
+  if (!isResting) {
+    return;
+  }
+
+  for (uint8_t i = 0; i < 2; i++) {
+    uint8_t axis = axes[i];
+    int32_t sample = (int32_t)raw[axis] << CENTER_FRACTION_BITS;
+
+    learned_center[axis] += (sample - learned_center[axis]) >> CENTER_FILTER_SHIFT;
+
+    uint8_t center = (learned_center[axis] + (1 << (CENTER_FRACTION_BITS - 1))) >> CENTER_FRACTION_BITS;
+    if (center != calibration.center[axis]) {
+      calibration.center[axis] = center;
+      is_dirty = true;
+    }
+  }
+}
+
+/*******************************************************************************
+**
+** Function         buildLut
+**
+** Description      Regenerates the conversion table from the calibration,
+**                  if it changed since the last time. The table is built
+**                  in the one the parser is not reading and then swapped
+**                  in. Only one task builds at a time; a change made
+**                  meanwhile is picked up by that task once it is done.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void buildLut() {
+  ps4_stick_calibration_t stick_calibration;
+
+  for (;;) {
+    portENTER_CRITICAL(&calibration_lock);
+    bool rebuild = is_dirty && !is_building;
+    if (rebuild) {
+      stick_calibration = calibration;
+      is_dirty = false;
+      is_building = true;
+      is_modified = true;
+    }
+    portEXIT_CRITICAL(&calibration_lock);
+
+    if (!rebuild) {
+      return;
+    }
+
+    int8_t (*lut)[256] = ps4_stick_lut == luts[0] ? luts[1] : luts[0];
+    bool useDefault = isDefault(&stick_calibration);
+
+    for (uint8_t axis = 0; axis < stick_axis_count; axis++) {
+      bool isY = axis == stick_axis_ly || axis == stick_axis_ry;
+
+      for (uint16_t raw = 0; raw < 256; raw++) {
+        if (useDefault) {
+          // The mapping the parser always used: X is offset, Y is flipped
+          lut[axis][raw] = isY ? 127 - raw : raw - 128;
+        } else {
+          int16_t value = calibratedValue(&stick_calibration, axis, raw);
+          value = isY ? -value : value;
+          lut[axis][raw] = value > 127 ? 127 : value < -128 ? -128 : value;
+        }
+      }
+    }
+
+    portENTER_CRITICAL(&calibration_lock);
+    ps4_stick_lut = lut;
+    is_building = false;
+    portEXIT_CRITICAL(&calibration_lock);
+  }
+}
+
+/* Scales each side of the center to the learned reach of that side */
+static int8_t calibratedValue(const ps4_stick_calibration_t* c, uint8_t axis, uint8_t raw) {
+  int16_t center = c->center[axis];
+
+  if (raw >= center) {
+    int16_t range = c->max[axis] - center;
+    if (range <= 0) return 127;
+    int16_t value = ((raw - center) * 127) / range;
+    return value > 127 ? 127 : value;
+  } else {
+    int16_t range = center - c->min[axis];
+    if (range <= 0) return -128;
+    int16_t value = -(((center - raw) * 128) / range);
+    return value < -128 ? -128 : value;
+  }
+}
+
+static bool isDefault(const ps4_stick_calibration_t* stick_calibration) {
+  return memcmp(stick_calibration, &default_calibration, sizeof(default_calibration)) == 0;
+}
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+#define PS4_TAG "PS4_STORAGE"
+
+/********************************************************************************/
+/*                              C O N S T A N T S */
+/********************************************************************************/
+
+static const char nvs_namespace[] = "ps4";
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static bool nvsLoad(void* context, const char* key, void* data, size_t length);
+static bool nvsStore(void* context, const char* key, const void* data, size_t length);
+static bool fileLoad(void* context, const char* key, void* data, size_t length);
+static bool fileStore(void* context, const char* key, const void* data, size_t length);
+static bool filePath(char* path, size_t size, const char* directory, const char* key);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+static ps4_storage_t storage = {NULL, NULL, NULL};
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4SetStorage
+**
+** Description      Sets where per controller data such as the stick
+**                  calibration is persisted. Nothing is persisted until a
+**                  storage backend is set. The bonding store is read again
+**                  from the new backend.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4SetStorage(ps4_storage_t backend) {
+  storage = backend;
+  ps4_bond_reload();
+}
+
+/*******************************************************************************
+**
+** Function         ps4NvsStorage
+**
+** Description      Returns a storage backend that keeps each entry as a blob
+**                  in the "ps4" NVS namespace. NVS must be initialized by
+**                  the application, which the Bluetooth stack requires anyway.
+**
+**
+** Returns          ps4_storage_t
+**
+*******************************************************************************/
+ps4_storage_t ps4NvsStorage() {
+  ps4_storage_t backend = {&nvsLoad, &nvsStore, NULL};
+  return backend;
+}
+
+/*******************************************************************************
+**
+** Function         ps4FileStorage
+**
+** Description      Returns a storage backend that keeps each entry as a file
+**                  in the given directory, e.g. on a mounted SPIFFS or FAT
+**                  partition. The directory string must stay valid.
+**
+**
+** Returns          ps4_storage_t
+**
+*******************************************************************************/
+ps4_storage_t ps4FileStorage(const char* directory) {
+  ps4_storage_t backend = {&fileLoad, &fileStore, (void*)directory};
+  return backend;
+}
+
+/*******************************************************************************
+**
+** Function         ps4_storage_key
+**
+** Description      Builds the storage key for a kind of entry and a
+**                  controller address, short enough for an NVS key.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_storage_key(char key[PS4_STORAGE_KEY_SIZE], char kind, const uint8_t* addr) {
+  snprintf(key, PS4_STORAGE_KEY_SIZE, "%c%02x%02x%02x%02x%02x%02x", kind,
+           addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_storage_load
+**
+** Description      Loads an entry from the configured storage backend.
+**
+**
+** Returns          bool, false if there is no backend or no such entry
+**
+*******************************************************************************/
+bool ps4_storage_load(const char* key, void* data, size_t length) {
+  if (storage.load == NULL) {
+    return false;
+  }
+
+  return storage.load(storage.context, key, data, length);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_storage_store
+**
+** Description      Stores an entry with the configured storage backend.
+**
+**
+** Returns          bool, false if there is no backend or writing failed
+**
+*******************************************************************************/
+bool ps4_storage_store(const char* key, const void* data, size_t length) {
+  if (storage.store == NULL) {
+    return false;
+  }
+
+  if (!storage.store(storage.context, key, data, length)) {
+    ESP_LOGE(PS4_TAG, "[%s] storing %s failed", __func__, key);
+    return false;
+  }
+
+  return true;
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+static bool nvsLoad(void* context, const char* key, void* data, size_t length) {
+  nvs_handle_t handle;
+  size_t storedLength = length;
+
+  if (nvs_open(nvs_namespace, NVS_READONLY, &handle) != ESP_OK) {
+    return false;
+  }
+
+  esp_err_t ret = nvs_get_blob(handle, key, data, &storedLength);
+  nvs_close(handle);
+
+  return ret == ESP_OK && storedLength == length;
+}
+
+static bool nvsStore(void* context, const char* key, const void* data, size_t length) {
+  nvs_handle_t handle;
+  esp_err_t ret;
+
+  if ((ret = nvs_open(nvs_namespace, NVS_READWRITE, &handle)) != ESP_OK) {
+    return false;
+  }
+
+  if ((ret = nvs_set_blob(handle, key, data, length)) == ESP_OK) {
+    ret = nvs_commit(handle);
+  }
+  nvs_close(handle);
+
+  return ret == ESP_OK;
+}
+
+static bool fileLoad(void* context, const char* key, void* data, size_t length) {
+  char path[128];
+  FILE* file;
+
+  if (!filePath(path, sizeof(path), (const char*)context, key) || (file = fopen(path, "rb")) == NULL) {
+    return false;
+  }
+
+  bool loaded = fread(data, 1, length, file) == length;
+  fclose(file);
+
+  return loaded;
+}
+
+static bool fileStore(void* context, const char* key, const void* data, size_t length) {
+  char path[128];
+  FILE* file;
+
+  if (!filePath(path, sizeof(path), (const char*)context, key) || (file = fopen(path, "wb")) == NULL) {
+    return false;
+  }
+
+  bool stored = fwrite(data, 1, length, file) == length;
+  stored = fclose(file) == 0 && stored;
+
+  return stored;
+}
+
+static bool filePath(char* path, size_t size, const char* directory, const char* key) {
+  int written = snprintf(path, size, "%s/%s", directory, key);
+  return written > 0 && (size_t)written < size;
+}
@@ -0,0 +1,274 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+/* The touch frames follow the status byte: a count, then up to MAX_FRAMES
+ * frames of a counter and two fingers. Each finger is an id byte whose top
+ * bit is set when the finger is lifted, and 12 bit X and Y packed into
+ * three bytes. */
+enum ps4_touch_index {
+  packet_index_touch_count = 45,
+  packet_index_touch_frames = 46,
+
+  frame_index_counter = 0,
+  frame_index_fingers = 1,
+  frame_size = 9,
+
+  finger_index_id = 0,
+  finger_index_position = 1,
+  finger_size = 4
+};
+
+#define MAX_FRAMES 4
+#define FINGER_LIFTED 0x80
+#define FINGER_ID 0x7F
+
+/* Frame times are only known through the reports carrying them, so a long
+ * gap (e.g. the first touch) is not taken as a slow movement */
+#define MAX_FRAME_INTERVAL_US 50000
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static void decodeFrame(const uint8_t* frame, int64_t time);
+static void moveContact(ps4_touch_contact_t* contact, uint16_t x, uint16_t y, int64_t time, uint8_t slot);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+static ps4_touchpad_callback_t touchpad_cb = NULL;
+static void* touchpad_object = NULL;
+
+/* Contact table handed out to the callback, with the time of each contact's
+ * last position */
+static ps4_touchpad_t touchpad;
+static int64_t contact_time[PS4_TOUCH_CONTACTS];
+
+static uint8_t last_counter = 0;
+static int64_t last_time = 0;
+static bool has_frame = false;
+
+static portMUX_TYPE touchpad_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4SetTouchpadCallback
+**
+** Description      Registers the callback receiving the touchpad contacts
+**                  whenever the controller sends new touch frames. The
+**                  touch frames are not decoded while neither this nor the
+**                  gesture callback is set.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4SetTouchpadCallback(void* object, ps4_touchpad_callback_t cb) {
+  portENTER_CRITICAL(&touchpad_lock);
+  touchpad_cb = cb;
+  touchpad_object = object;
+  portEXIT_CRITICAL(&touchpad_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_touch_reset
+**
+** Description      Lifts every contact, e.g. on a new connection.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_touch_reset() {
+  portENTER_CRITICAL(&touchpad_lock);
+  memset(&touchpad, 0, sizeof(touchpad));
+  has_frame = false;
+  portEXIT_CRITICAL(&touchpad_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_touch_deliver
+**
+** Description      Decodes the touch frames of a report that were not seen
+**                  in an earlier report into the contact table, and hands
+**                  the table to the touchpad callback. The controller
+**                  samples the touchpad more slowly than it sends reports,
+**                  so most reports repeat the previous frame and are
+**                  skipped.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_touch_deliver(const ps4_t* ps4) {
+  ps4_touchpad_callback_t cb;
+  void* object;
+  uint8_t fresh = 0;
+
+  if ((touchpad_cb == NULL && !ps4_gesture_enabled()) || ps4->latestPacket == NULL) {
+    return;
+  }
+
+  const uint8_t* packet = ps4->latestPacket;
+  uint8_t count = packet[packet_index_touch_count];
+  if (count > MAX_FRAMES) {
+    count = MAX_FRAMES;
+  }
+
+  int64_t time = ps4_report_time();
+
+  portENTER_CRITICAL(&touchpad_lock);
+
+  // Frames are in the order they were sampled, find the first new one
+  uint8_t first = 0;
+  if (has_frame) {
+    for (uint8_t i = count; i > 0; i--) {
+      if (packet[packet_index_touch_frames + (i - 1) * frame_size + frame_index_counter] == last_counter) {
+        first = i;
+        break;
+      }
+    }
+  }
+  fresh = count - first;
+
+  if (fresh > 0) {
+    for (uint8_t slot = 0; slot < PS4_TOUCH_CONTACTS; slot++) {
+      touchpad.contact[slot].began = false;
+      touchpad.contact[slot].ended = false;
+    }
+  }
+
+  // Spread the new frames evenly between the previous report and this one
+  int64_t interval = has_frame ? time - last_time : 0;
+  for (uint8_t i = first; i < count; i++) {
+    const uint8_t* frame = &packet[packet_index_touch_frames + i * frame_size];
+    decodeFrame(frame, time - interval * (count - 1 - i) / fresh);
+    last_counter = frame[frame_index_counter];
+    has_frame = true;
+  }
+  last_time = time;
+  touchpad.frames = fresh;
+
+  cb = touchpad_cb;
+  object = touchpad_object;
+
+  portEXIT_CRITICAL(&touchpad_lock);
+
+  if (fresh > 0) {
+    if (cb != NULL) {
+      cb(object, &touchpad);
+    }
+    ps4_gesture_update(&touchpad);
+  }
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         decodeFrame
+**
+** Description      Updates the contact table with a touch frame. A contact
+**                  keeps its slot for as long as the controller reports its
+**                  id, and a new id takes a free slot. A lifted contact
+**                  keeps its last position and velocity.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void decodeFrame(const uint8_t* frame, int64_t time) {
+  uint8_t seen = 0;
+
+  for (uint8_t f = 0; f < 2; f++) {
+    const uint8_t* finger = &frame[frame_index_fingers + f * finger_size];
+    const uint8_t* position = &finger[finger_index_position];
+
+    if (finger[finger_index_id] & FINGER_LIFTED) {
+      continue;
+    }
+
+    uint8_t id = finger[finger_index_id] & FINGER_ID;
+    uint16_t x = position[0] | ((position[1] & 0x0F) << 8);
+    uint16_t y = (position[1] >> 4) | (position[2] << 4);
+
+    uint8_t slot = PS4_TOUCH_CONTACTS;
+    for (uint8_t i = 0; i < PS4_TOUCH_CONTACTS; i++) {
+      if (touchpad.contact[i].active && touchpad.contact[i].id == id) {
+        slot = i;
+        break;
+      }
+    }
+
+    if (slot == PS4_TOUCH_CONTACTS) {
+      for (uint8_t i = 0; i < PS4_TOUCH_CONTACTS; i++) {
+        if (!touchpad.contact[i].active && !(seen & (1 << i))) {
+          slot = i;
+          break;
+        }
+      }
+      if (slot == PS4_TOUCH_CONTACTS) {
+        continue;
+      }
+
+      ps4_touch_contact_t* contact = &touchpad.contact[slot];
+      contact->id = id;
+      contact->active = true;
+      contact->began = true;
+      contact->x = x;
+      contact->y = y;
+      contact->vx = 0;
+      contact->vy = 0;
+      contact_time[slot] = time;
+    } else {
+      moveContact(&touchpad.contact[slot], x, y, time, slot);
+    }
+
+    seen |= 1 << slot;
+  }
+
+  // Contacts the frame no longer reports have been lifted
+  for (uint8_t slot = 0; slot < PS4_TOUCH_CONTACTS; slot++) {
+    ps4_touch_contact_t* contact = &touchpad.contact[slot];
+
+    if (contact->active && !(seen & (1 << slot))) {
+      contact->active = false;
+      contact->ended = true;
+    }
+  }
+}
+
+/* The velocity is the average of the previous estimate and the movement
+ * since the contact's last frame, which takes the edge off the 12 bit
+ * position steps */
+static void moveContact(ps4_touch_contact_t* contact, uint16_t x, uint16_t y, int64_t time, uint8_t slot) {
+  int64_t interval = time - contact_time[slot];
+
+  if (interval > 0 && interval <= MAX_FRAME_INTERVAL_US) {
+    int32_t vx = (int32_t)(((int32_t)x - contact->x) * 1000000LL / interval);
+    int32_t vy = (int32_t)(((int32_t)y - contact->y) * 1000000LL / interval);
+
+    contact->vx = (contact->vx + vx) / 2;
+    contact->vy = (contact->vy + vy) / 2;
+  }
+
+  contact->x = x;
+  contact->y = y;
+  contact_time[slot] = time;
+}
@@ -0,0 +1,415 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "ps4.h"
+#include "ps4_int.h"
+
+/* Only built with PS4_MAX_WINDOWS above 0, as the record ring and the
+ * deques take PS4_WINDOW_MEMORY of static memory */
+#if PS4_MAX_WINDOWS > 0
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+#if PS4_WINDOW_LENGTH < 2 || PS4_WINDOW_LENGTH > 65535
+#error "PS4_WINDOW_LENGTH must be between 2 and 65535 reports"
+#endif
+
+/* A compact copy of one report */
+typedef struct {
+  uint32_t time;  // low bits of the report time in microseconds
+  int16_t values[PS4_CHANNEL_COUNT];
+} ps4_window_record_t;
+
+/* Positions in the record ring of the reports that can still become the
+ * minimum or maximum of a window, in the order they arrived. The values
+ * they point to are increasing for the minimum and decreasing for the
+ * maximum, so the extreme is always at the front. */
+typedef struct {
+  uint16_t head;
+  uint16_t size;
+  uint16_t index[PS4_WINDOW_LENGTH];
+} ps4_window_deque_t;
+
+typedef struct {
+  uint32_t duration;  // microseconds, 0 = unused
+  uint32_t first;     // sequence of the oldest report in the window
+  uint16_t count;
+  int64_t sum[PS4_CHANNEL_COUNT];
+  ps4_window_deque_t min[PS4_CHANNEL_COUNT];
+  ps4_window_deque_t max[PS4_CHANNEL_COUNT];
+} ps4_window_t;
+
+/********************************************************************************/
+/*              L O C A L    F U N C T I O N     P R O T O T Y P E S */
+/********************************************************************************/
+
+static void pushRecord(ps4_window_t* window, uint16_t index);
+static void expireRecord(ps4_window_t* window);
+static void clearWindow(ps4_window_t* window);
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+static ps4_window_record_t records[PS4_WINDOW_LENGTH];
+static uint32_t record_count = 0;  // reports ever recorded, the next sequence
+
+static ps4_window_t windows[PS4_MAX_WINDOWS];
+static uint8_t active_windows = 0;
+
+/* Last report time each button was held, for "held within" queries */
+static uint32_t button_time[PS4_BUTTON_COUNT];
+static uint32_t button_seen = 0;
+
+static portMUX_TYPE window_lock = portMUX_INITIALIZER_UNLOCKED;
+
+_Static_assert(sizeof(records) + sizeof(windows) <= PS4_WINDOW_MEMORY,
+               "PS4_WINDOW_MEMORY does not cover the window buffers");
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         ps4SetWindow
+**
+** Description      Sets the duration of a sliding window over the most
+**                  recent reports, or removes it with a duration of 0. A
+**                  window never holds more than PS4_WINDOW_LENGTH reports,
+**                  whatever its duration.
+**
+**
+** Returns          bool, false if the window number is out of range, which
+**                  every number is without PS4_MAX_WINDOWS
+**
+*******************************************************************************/
+bool ps4SetWindow(uint8_t window, uint32_t duration_ms) {
+  if (window >= PS4_MAX_WINDOWS) {
+    return false;
+  }
+
+  portENTER_CRITICAL(&window_lock);
+  clearWindow(&windows[window]);
+  windows[window].duration = duration_ms * 1000;
+
+  active_windows = 0;
+  for (uint8_t i = 0; i < PS4_MAX_WINDOWS; i++) {
+    active_windows += windows[i].duration > 0;
+  }
+  portEXIT_CRITICAL(&window_lock);
+
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function         ps4WindowCount
+**
+** Description      Returns the number of reports in a window.
+**
+**
+** Returns          uint16_t
+**
+*******************************************************************************/
+uint16_t ps4WindowCount(uint8_t window) {
+  return window < PS4_MAX_WINDOWS ? windows[window].count : 0;
+}
+
+/*******************************************************************************
+**
+** Function         ps4WindowAverage
+**
+** Description      Returns the average of a channel over a window, from a
+**                  running sum.
+**
+**
+** Returns          int16_t, 0 if the window is empty
+**
+*******************************************************************************/
+int16_t ps4WindowAverage(uint8_t window, ps4_channel_t channel) {
+  int64_t sum;
+  uint16_t count;
+
+  if (window >= PS4_MAX_WINDOWS || channel >= PS4_CHANNEL_COUNT) {
+    return 0;
+  }
+
+  portENTER_CRITICAL(&window_lock);
+  sum = windows[window].sum[channel];
+  count = windows[window].count;
+  portEXIT_CRITICAL(&window_lock);
+
+  return count > 0 ? (int16_t)(sum / count) : 0;
+}
+
+/*******************************************************************************
+**
+** Function         ps4WindowMin
+**
+** Description      Returns the lowest value of a channel over a window.
+**
+**
+** Returns          int16_t, 0 if the window is empty
+**
+*******************************************************************************/
+int16_t ps4WindowMin(uint8_t window, ps4_channel_t channel) {
+  int16_t value = 0;
+
+  if (window >= PS4_MAX_WINDOWS || channel >= PS4_CHANNEL_COUNT) {
+    return 0;
+  }
+
+  portENTER_CRITICAL(&window_lock);
+  ps4_window_deque_t* deque = &windows[window].min[channel];
+  if (deque->size > 0) {
+    value = records[deque->index[deque->head]].values[channel];
+  }
+  portEXIT_CRITICAL(&window_lock);
+
+  return value;
+}
+
+/*******************************************************************************
+**
+** Function         ps4WindowMax
+**
+** Description      Returns the highest value of a channel over a window.
+**
+**
+** Returns          int16_t, 0 if the window is empty
+**
+*******************************************************************************/
+int16_t ps4WindowMax(uint8_t window, ps4_channel_t channel) {
+  int16_t value = 0;
+
+  if (window >= PS4_MAX_WINDOWS || channel >= PS4_CHANNEL_COUNT) {
+    return 0;
+  }
+
+  portENTER_CRITICAL(&window_lock);
+  ps4_window_deque_t* deque = &windows[window].max[channel];
+  if (deque->size > 0) {
+    value = records[deque->index[deque->head]].values[channel];
+  }
+  portEXIT_CRITICAL(&window_lock);
+
+  return value;
+}
+
+/*******************************************************************************
+**
+** Function         ps4WindowButtons
+**
+** Description      Returns the buttons held at any time during a window,
+**                  as a ps4_button_mask_t mask.
+**
+**
+** Returns          uint32_t
+**
+*******************************************************************************/
+uint32_t ps4WindowButtons(uint8_t window) {
+  uint32_t buttons = 0;
+
+  if (window >= PS4_MAX_WINDOWS) {
+    return 0;
+  }
+
+  portENTER_CRITICAL(&window_lock);
+  if (record_count > 0) {
+    uint32_t newest = records[(record_count - 1) % PS4_WINDOW_LENGTH].time;
+
+    for (uint8_t i = 0; i < PS4_BUTTON_COUNT; i++) {
+      if ((button_seen & (1 << i)) && newest - button_time[i] < windows[window].duration) {
+        buttons |= 1 << i;
+      }
+    }
+  }
+  portEXIT_CRITICAL(&window_lock);
+
+  return buttons;
+}
+
+/*******************************************************************************
+**
+** Function         ps4_window_reset
+**
+** Description      Empties all windows, e.g. on a new connection.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_window_reset() {
+  portENTER_CRITICAL(&window_lock);
+  for (uint8_t i = 0; i < PS4_MAX_WINDOWS; i++) {
+    clearWindow(&windows[i]);
+  }
+  button_seen = 0;
+  portEXIT_CRITICAL(&window_lock);
+}
+
+/*******************************************************************************
+**
+** Function         ps4_window_record
+**
+** Description      Adds a report to every window and drops the reports
+**                  that have fallen out of them.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void ps4_window_record(const ps4_t* ps4) {
+  int32_t values[PS4_CHANNEL_COUNT];
+
+  if (active_windows == 0) {
+    return;
+  }
+
+  ps4_channels_read(ps4, values);
+
+  portENTER_CRITICAL(&window_lock);
+
+  uint32_t sequence = record_count;
+  uint16_t index = sequence % PS4_WINDOW_LENGTH;
+  uint32_t time = (uint32_t)ps4_report_time();
+
+  // The record about to be overwritten has to leave every window first
+  for (uint8_t w = 0; w < PS4_MAX_WINDOWS; w++) {
+    ps4_window_t* window = &windows[w];
+    while (window->count > 0 && sequence - window->first >= PS4_WINDOW_LENGTH) {
+      expireRecord(window);
+    }
+  }
+
+  records[index].time = time;
+  for (uint8_t i = 0; i < PS4_CHANNEL_COUNT; i++) {
+    records[index].values[i] = values[i];
+  }
+  record_count++;
+
+  for (uint32_t bits = ps4->button.mask; bits; bits &= bits - 1) {
+    button_time[__builtin_ctz(bits)] = time;
+  }
+  button_seen |= ps4->button.mask;
+
+  for (uint8_t w = 0; w < PS4_MAX_WINDOWS; w++) {
+    ps4_window_t* window = &windows[w];
+
+    if (window->duration == 0) {
+      continue;
+    }
+
+    pushRecord(window, index);
+
+    while (window->count > 1 && time - records[window->first % PS4_WINDOW_LENGTH].time >= window->duration) {
+      expireRecord(window);
+    }
+  }
+
+  portEXIT_CRITICAL(&window_lock);
+}
+
+/********************************************************************************/
+/*                      L O C A L    F U N C T I O N S */
+/********************************************************************************/
+
+/*******************************************************************************
+**
+** Function         pushRecord
+**
+** Description      Adds the newest record to a window. Older records that
+**                  can no longer be the minimum or maximum are dropped from
+**                  the back of the deques, so each record enters and leaves
+**                  each deque once and the cost per report is constant on
+**                  average.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void pushRecord(ps4_window_t* window, uint16_t index) {
+  const int16_t* values = records[index].values;
+
+  if (window->count == 0) {
+    window->first = record_count - 1;
+  }
+  window->count++;
+
+  for (uint8_t i = 0; i < PS4_CHANNEL_COUNT; i++) {
+    ps4_window_deque_t* min = &window->min[i];
+    ps4_window_deque_t* max = &window->max[i];
+
+    window->sum[i] += values[i];
+
+    while (min->size > 0 &&
+           records[min->index[(min->head + min->size - 1) % PS4_WINDOW_LENGTH]].values[i] >= values[i]) {
+      min->size--;
+    }
+    min->index[(min->head + min->size++) % PS4_WINDOW_LENGTH] = index;
+
+    while (max->size > 0 &&
+           records[max->index[(max->head + max->size - 1) % PS4_WINDOW_LENGTH]].values[i] <= values[i]) {
+      max->size--;
+    }
+    max->index[(max->head + max->size++) % PS4_WINDOW_LENGTH] = index;
+  }
+}
+
+/*******************************************************************************
+**
+** Function         expireRecord
+**
+** Description      Removes the oldest record from a window.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+static void expireRecord(ps4_window_t* window) {
+  uint16_t index = window->first % PS4_WINDOW_LENGTH;
+  const int16_t* values = records[index].values;
+
+  for (uint8_t i = 0; i < PS4_CHANNEL_COUNT; i++) {
+    ps4_window_deque_t* min = &window->min[i];
+    ps4_window_deque_t* max = &window->max[i];
+
+    window->sum[i] -= values[i];
+
+    if (min->size > 0 && min->index[min->head] == index) {
+      min->head = (min->head + 1) % PS4_WINDOW_LENGTH;
+      min->size--;
+    }
+    if (max->size > 0 && max->index[max->head] == index) {
+      max->head = (max->head + 1) % PS4_WINDOW_LENGTH;
+      max->size--;
+    }
+  }
+
+  window->first++;
+  window->count--;
+}
+
+static void clearWindow(ps4_window_t* window) {
+  window->count = 0;
+  memset(window->sum, 0, sizeof(window->sum));
+
+  for (uint8_t i = 0; i < PS4_CHANNEL_COUNT; i++) {
+    window->min[i].head = window->min[i].size = 0;
+    window->max[i].head = window->max[i].size = 0;
+  }
+}
+
+#else  // PS4_MAX_WINDOWS == 0
+
+bool ps4SetWindow(uint8_t window, uint32_t duration_ms) { return false; }
+uint16_t ps4WindowCount(uint8_t window) { return 0; }
+int16_t ps4WindowAverage(uint8_t window, ps4_channel_t channel) { return 0; }
+int16_t ps4WindowMin(uint8_t window, ps4_channel_t channel) { return 0; }
+int16_t ps4WindowMax(uint8_t window, ps4_channel_t channel) { return 0; }
+uint32_t ps4WindowButtons(uint8_t window) { return 0; }
+
+#endif  // PS4_MAX_WINDOWS > 0
@@ -42,4 +42,10 @@
 #define L2CAP_CFG_PENDING               4
 #define L2CAP_CFG_FLOW_SPEC_REJECTED    5
 
+/* Default values for the configuration options
+*/
+#define L2CAP_DEFAULT_MTU               (672)
+#define L2CAP_NO_AUTOMATIC_FLUSH        (0xFFFF)
+#define L2CAP_DEFAULT_DELAY             (0xFFFFFFFF)
+
 #endif
\ No newline at end of file
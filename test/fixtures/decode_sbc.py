@@ -0,0 +1,47 @@
+#!/usr/bin/env python3
+"""Decodes an SBC stream with the SBC decoder of FFmpeg, through PyAV, into
+16 bit PCM. test_audio compares its stream with audio.sbc and
+the input signal with audio.pcm. When the encoder changes on purpose,
+test_audio writes its new stream to audio.sbc in its working directory:
+
+    pip install av
+    python3 decode_sbc.py <build>/audio.sbc audio.sbc audio.pcm
+
+The PCM is written in the byte order of the host, as test_audio reads it.
+"""
+
+import shutil
+import sys
+
+import av
+
+
+def decode(stream_path):
+    codec = av.CodecContext.create("sbc", "r")
+    with open(stream_path, "rb") as stream:
+        data = stream.read()
+
+    pcm = bytearray()
+    for packet in codec.parse(data) + codec.parse(None):
+        for frame in codec.decode(packet):
+            if frame.format.name not in ("s16", "s16p") or len(frame.layout.channels) != 1:
+                raise SystemExit("expected mono s16 output, got %s" % frame.format.name)
+            pcm += bytes(frame.planes[0])[: frame.samples * 2]
+    return bytes(pcm)
+
+
+def main():
+    if len(sys.argv) != 4:
+        raise SystemExit(__doc__)
+
+    stream_path, sbc_path, pcm_path = sys.argv[1:]
+    pcm = decode(stream_path)
+    if stream_path != sbc_path:
+        shutil.copyfile(stream_path, sbc_path)
+    with open(pcm_path, "wb") as out:
+        out.write(pcm)
+    print("%d samples, FFmpeg %s" % (len(pcm) // 2, av.library_versions["libavcodec"]))
+
+
+if __name__ == "__main__":
+    main()
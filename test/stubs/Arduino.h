@@ -0,0 +1,24 @@
+/* Host stand-in for the parts of the Arduino core PS4Controller uses */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#define log_e(format, ...) printf("E " format "\n", ##__VA_ARGS__)
+#define log_i(format, ...) ((void)0)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void delay(uint32_t ms);
+bool btStarted();
+bool btStart();
+
+#ifdef __cplusplus
+}
+#endif
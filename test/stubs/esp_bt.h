@@ -0,0 +1,23 @@
+/* Host stand-in for esp_bt.h */
+#pragma once
+
+#include "esp_system.h"
+
+typedef enum { ESP_BT_MODE_BLE = 1, ESP_BT_MODE_CLASSIC_BT = 2, ESP_BT_MODE_BTDM = 3 } esp_bt_mode_t;
+
+typedef struct {
+  int unused;
+} esp_bt_controller_config_t;
+
+#define BT_CONTROLLER_INIT_CONFIG_DEFAULT() {0}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t* cfg);
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode);
+
+#ifdef __cplusplus
+}
+#endif
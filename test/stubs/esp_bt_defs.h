@@ -0,0 +1,9 @@
+/* Host stand-in for esp_bt_defs.h */
+#pragma once
+
+#include <stdint.h>
+
+#define ESP_BD_ADDR_LEN 6
+#define ESP_BD_ADDR_STR "%02x:%02x:%02x:%02x:%02x:%02x"
+
+typedef uint8_t esp_bd_addr_t[ESP_BD_ADDR_LEN];
@@ -0,0 +1,14 @@
+/* Host stand-in for esp_bt_device.h */
+#pragma once
+
+#include "esp_system.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t esp_bt_dev_set_device_name(const char* name);
+
+#ifdef __cplusplus
+}
+#endif
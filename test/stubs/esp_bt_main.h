@@ -0,0 +1,22 @@
+/* Host stand-in for esp_bt_main.h */
+#pragma once
+
+#include "esp_system.h"
+
+typedef enum {
+  ESP_BLUEDROID_STATUS_UNINITIALIZED,
+  ESP_BLUEDROID_STATUS_INITIALIZED,
+  ESP_BLUEDROID_STATUS_ENABLED
+} esp_bluedroid_status_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_bluedroid_status_t esp_bluedroid_get_status(void);
+esp_err_t esp_bluedroid_init(void);
+esp_err_t esp_bluedroid_enable(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,21 @@
+/* Host stand-in for esp_gap_bt_api.h */
+#pragma once
+
+#include "esp_system.h"
+
+typedef enum { ESP_BT_NON_CONNECTABLE, ESP_BT_CONNECTABLE } esp_bt_connection_mode_t;
+typedef enum {
+  ESP_BT_NON_DISCOVERABLE,
+  ESP_BT_LIMITED_DISCOVERABLE,
+  ESP_BT_GENERAL_DISCOVERABLE
+} esp_bt_discovery_mode_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t esp_bt_gap_set_scan_mode(esp_bt_connection_mode_t c_mode, esp_bt_discovery_mode_t d_mode);
+
+#ifdef __cplusplus
+}
+#endif
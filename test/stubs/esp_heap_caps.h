@@ -0,0 +1,3 @@
+/* Host stand-in for esp_heap_caps.h, which the code built for the host tests
+ * includes without using */
+#pragma once
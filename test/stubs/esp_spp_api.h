@@ -0,0 +1,34 @@
+/* Host stand-in for esp_spp_api.h */
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_system.h"
+
+typedef enum { ESP_SPP_MODE_CB, ESP_SPP_MODE_VFS } esp_spp_mode_t;
+typedef enum { ESP_SPP_ROLE_MASTER, ESP_SPP_ROLE_SLAVE } esp_spp_role_t;
+typedef enum { ESP_SPP_INIT_EVT, ESP_SPP_START_EVT = 28 } esp_spp_cb_event_t;
+
+#define ESP_SPP_SEC_NONE 0x0000
+
+typedef uint16_t esp_spp_sec_t;
+
+typedef union {
+  struct {
+    int status;
+  } init;
+} esp_spp_cb_param_t;
+
+typedef void (*esp_spp_cb_t)(esp_spp_cb_event_t event, esp_spp_cb_param_t* param);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t esp_spp_register_callback(esp_spp_cb_t callback);
+esp_err_t esp_spp_init(esp_spp_mode_t mode);
+esp_err_t esp_spp_start_srv(esp_spp_sec_t sec_mask, esp_spp_role_t role, uint8_t local_scn, const char* name);
+
+#ifdef __cplusplus
+}
+#endif
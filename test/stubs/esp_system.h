@@ -0,0 +1,15 @@
+/* Host stand-in for esp_system.h */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_STATE 0x103
+
+esp_err_t esp_base_mac_addr_set(const uint8_t* mac);
+uint32_t esp_get_free_heap_size(void);
+const char* esp_err_to_name(esp_err_t code);
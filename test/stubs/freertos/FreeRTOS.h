@@ -0,0 +1,21 @@
+/* Host stand-in for the FreeRTOS declarations the library uses. The tests
+ * run on a single thread, so critical sections do nothing. */
+#pragma once
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdMS_TO_TICKS(x) (x)
+#define portMAX_DELAY 0xffffffff
+
+typedef struct {
+  int count;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) ((mux)->count++)
+#define portEXIT_CRITICAL(mux) ((mux)->count--)
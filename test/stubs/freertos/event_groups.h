@@ -0,0 +1,29 @@
+/* Host stand-in for FreeRTOS event groups, on pthreads so tests can wait
+ * on one thread and set bits from another. Ticks are milliseconds. */
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#define BIT0 0x00000001
+#define BIT1 0x00000002
+#define BIT2 0x00000004
+#define BIT3 0x00000008
+
+typedef uint32_t EventBits_t;
+typedef struct EventGroupDef_t* EventGroupHandle_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+EventGroupHandle_t xEventGroupCreate(void);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define xEventGroupGetBits(group) xEventGroupClearBits(group, 0)
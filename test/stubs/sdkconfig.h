@@ -0,0 +1,4 @@
+/* Host stand-in for the generated sdkconfig.h */
+#pragma once
+
+#define CONFIG_BTDM_CONTROLLER_MODE_BR_EDR_ONLY 1
@@ -0,0 +1,77 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+/* The report path from before the v2 callbacks, for test_parser to time
+ * the library against: the parser of baseline/, which holds unchanged
+ * copies of the pre-series sources, and the ps4PacketEvent of the
+ * pre-series ps4.c. Renamed so they link next to the library. */
+
+#define parsePacket baseline_parse_packet
+#define ps4PacketEvent baseline_packet_event
+#define parserSetEventCb baseline_parser_set_event_cb
+#define parsePacketSensor baseline_parse_packet_sensor
+#define parsePacketStatus baseline_parse_packet_status
+#define parsePacketAnalogStick baseline_parse_packet_analog_stick
+#define parsePacketAnalogButton baseline_parse_packet_analog_button
+#define parsePacketButtons baseline_parse_packet_buttons
+#define parseEvent baseline_parse_event
+#define ps4_event_cb baseline_parser_event_cb
+
+#include "../baseline/ps4_parser.c"
+
+#undef ps4_event_cb
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+static ps4_connection_callback_t ps4_connection_cb = NULL;
+static ps4_connection_object_callback_t ps4_connection_object_cb = NULL;
+static void* ps4_connection_object = NULL;
+
+static ps4_event_callback_t ps4_event_cb = NULL;
+static ps4_event_object_callback_t ps4_event_object_cb = NULL;
+static void* ps4_event_object = NULL;
+
+static bool is_active = false;
+
+static volatile int32_t* sink = NULL;
+
+static void baselineEvent(ps4_t ps4, ps4_event_t event) { *sink += ps4.analog.stick.lx; }
+
+/********************************************************************************/
+/*                      P U B L I C    F U N C T I O N S */
+/********************************************************************************/
+
+/* Connects and registers a by-value callback doing the same work as the
+ * ones test_parser times the library with */
+void baseline_init(volatile int32_t* callback_sink) {
+  sink = callback_sink;
+  is_active = true;
+  ps4_event_cb = &baselineEvent;
+}
+
+/* As in the pre-series ps4.c */
+void ps4PacketEvent(ps4_t ps4, ps4_event_t event) {
+    // Trigger packet event, but if this is the very first packet
+    // after connecting, trigger a connection event instead
+    if (is_active) {
+        if(ps4_event_cb != NULL) {
+            ps4_event_cb(ps4, event);
+        }
+
+        if (ps4_event_object_cb != NULL && ps4_event_object != NULL) {
+            ps4_event_object_cb(ps4_event_object, ps4, event);
+        }
+    } else {
+        is_active = true;
+
+        if(ps4_connection_cb != NULL) {
+            ps4_connection_cb(is_active);
+        }
+
+        if (ps4_connection_object_cb != NULL && ps4_connection_object != NULL) {
+            ps4_connection_object_cb(ps4_connection_object, is_active);
+        }
+    }
+}
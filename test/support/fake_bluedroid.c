@@ -0,0 +1,77 @@
+#include <string.h>
+
+#include "esp_bt_main.h"
+#include "fake_bluedroid.h"
+
+/* Stands in for the Bluetooth controller, Bluedroid and SPP API calls of
+ * ps4_gap.c and ps4_spp.c, recording them instead of bringing anything
+ * up */
+
+fake_bluedroid_t fake_bluedroid;
+
+void fake_bluedroid_reset() { memset(&fake_bluedroid, 0, sizeof(fake_bluedroid)); }
+
+uint32_t fake_bluedroid_run() {
+  uint32_t delivered = fake_bluedroid.pending_events;
+  esp_spp_cb_param_t param = {.init = {.status = 0}};
+
+  // esp_spp_init posts ESP_SPP_INIT_EVT only
+  for (; fake_bluedroid.pending_events > 0; fake_bluedroid.pending_events--) {
+    fake_bluedroid.spp_cb(ESP_SPP_INIT_EVT, &param);
+  }
+
+  return delivered;
+}
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t* cfg) {
+  fake_bluedroid.controller_inits++;
+  fake_bluedroid.calls++;
+  return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode) {
+  fake_bluedroid.calls++;
+  return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_init(void) {
+  fake_bluedroid.calls++;
+  return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_enable(void) {
+  fake_bluedroid.bluedroid_enables++;
+  fake_bluedroid.calls++;
+  return ESP_OK;
+}
+
+esp_err_t esp_bt_dev_set_device_name(const char* name) {
+  fake_bluedroid.device_name = name;
+  fake_bluedroid.calls++;
+  return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_set_scan_mode(esp_bt_connection_mode_t c_mode, esp_bt_discovery_mode_t d_mode) {
+  fake_bluedroid.is_connectable = c_mode == ESP_BT_CONNECTABLE;
+  fake_bluedroid.calls++;
+  return ESP_OK;
+}
+
+esp_err_t esp_spp_register_callback(esp_spp_cb_t callback) {
+  fake_bluedroid.spp_cb = callback;
+  fake_bluedroid.calls++;
+  return ESP_OK;
+}
+
+esp_err_t esp_spp_init(esp_spp_mode_t mode) {
+  fake_bluedroid.spp_inits++;
+  fake_bluedroid.pending_events++;
+  fake_bluedroid.calls++;
+  return ESP_OK;
+}
+
+esp_err_t esp_spp_start_srv(esp_spp_sec_t sec_mask, esp_spp_role_t role, uint8_t local_scn, const char* name) {
+  fake_bluedroid.spp_servers++;
+  fake_bluedroid.calls++;
+  return ESP_OK;
+}
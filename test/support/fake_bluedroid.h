@@ -0,0 +1,31 @@
+/* The Bluetooth controller, Bluedroid and SPP calls under ps4_gap.c and
+ * ps4_spp.c, for test_init. The SPP events Bluedroid posts to its task are
+ * held until fake_bluedroid_run delivers them. */
+#pragma once
+
+#include "esp_bt.h"
+#include "esp_bt_device.h"
+#include "esp_gap_bt_api.h"
+#include "esp_spp_api.h"
+#include "ps4_test.h"
+
+typedef struct {
+  uint32_t controller_inits;     // esp_bt_controller_init calls
+  uint32_t bluedroid_enables;    // esp_bluedroid_enable calls
+  uint32_t calls;                // Bluedroid calls of any kind
+
+  const char* device_name;       // set by esp_bt_dev_set_device_name
+  bool is_connectable;           // set by esp_bt_gap_set_scan_mode
+
+  esp_spp_cb_t spp_cb;           // passed to esp_spp_register_callback
+  uint32_t spp_inits;            // esp_spp_init calls
+  uint32_t spp_servers;          // esp_spp_start_srv calls
+  uint32_t pending_events;       // posted and not yet delivered
+} fake_bluedroid_t;
+
+extern fake_bluedroid_t fake_bluedroid;
+void fake_bluedroid_reset();
+
+/* Delivers the events posted so far, as the Bluedroid task would, and
+ * returns how many there were */
+uint32_t fake_bluedroid_run();
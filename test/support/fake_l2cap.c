@@ -0,0 +1,53 @@
+#include <string.h>
+
+#include "ps4_test.h"
+
+/* Stands in for ps4_l2cap.c and ps4_spp.c, recording what the library
+ * sends instead of handing it to the Bluetooth stack */
+
+fake_l2cap_t fake_l2cap;
+
+void fake_l2cap_reset() { memset(&fake_l2cap, 0, sizeof(fake_l2cap)); }
+
+void sppInit() {}
+
+void ps4_l2cap_init_services() {}
+
+void ps4_l2cap_deinit_services() {}
+
+void ps4_l2cap_send_hid(hid_cmd_t* hid_cmd, uint8_t len) {
+  fake_l2cap.hid_sends++;
+  fake_l2cap.last_hid = *hid_cmd;
+  fake_l2cap.last_hid_len = len;
+}
+
+bool ps4_l2cap_send_interrupt(const uint8_t* report, uint16_t len) {
+  if (len > FAKE_INTERRUPT_SIZE) {
+    return false;
+  }
+
+  fake_l2cap.interrupt_sends++;
+  memcpy(fake_l2cap.last_interrupt, report, len);
+  fake_l2cap.last_interrupt_len = len;
+  return true;
+}
+
+bool ps4_l2cap_interrupt_congested() { return fake_l2cap.congested; }
+
+bool ps4_l2cap_connect(const uint8_t* addr) {
+  fake_l2cap.pages++;
+  memcpy(fake_l2cap.last_page, addr, sizeof(fake_l2cap.last_page));
+  return true;
+}
+
+void ps4_l2cap_first_report() {}
+
+const uint8_t* ps4_l2cap_peer_address() { return fake_l2cap.peer; }
+
+void fake_report(uint8_t packet[FAKE_REPORT_SIZE]) {
+  memset(packet, 0, FAKE_REPORT_SIZE);
+
+  // Sticks centered, direction pad released
+  packet[13] = packet[14] = packet[15] = packet[16] = 0x80;
+  packet[17] = 0x08;
+}
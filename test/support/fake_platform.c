@@ -0,0 +1,231 @@
+#include <string.h>
+#include <time.h>
+
+#include "esp_timer.h"
+#include "nvs.h"
+#include "ps4_test.h"
+
+/********************************************************************************/
+/*                            L O C A L    T Y P E S */
+/********************************************************************************/
+
+#define MAX_TIMERS 32
+#define MAX_ENTRIES 16
+#define MAX_ENTRY_SIZE 512
+
+struct esp_timer {
+  esp_timer_cb_t callback;
+  void* arg;
+  const char* name;
+  int64_t due;
+  uint64_t period;  // 0 for a one-shot timer
+  bool is_active;
+};
+
+typedef struct {
+  char key[PS4_STORAGE_KEY_SIZE];
+  uint8_t data[MAX_ENTRY_SIZE];
+  size_t length;
+} fake_entry_t;
+
+/********************************************************************************/
+/*                         L O C A L    V A R I A B L E S */
+/********************************************************************************/
+
+static struct esp_timer timers[MAX_TIMERS];
+static uint8_t timer_count = 0;
+
+static fake_entry_t entries[MAX_ENTRIES];
+static uint8_t entry_count = 0;
+static fake_entry_t* last_written = NULL;
+static uint32_t writes[128];  // by the kind of entry, the first key character
+
+int64_t fake_now = 0;
+void (*fake_timer_stop_hook)(const char* name) = NULL;
+int ps4_test_failures = 0;
+
+/********************************************************************************/
+/*                              E S P    T I M E R */
+/********************************************************************************/
+
+/* Starting a timer that is already running fails, as on the target */
+esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer_handle_t* out_handle) {
+  if (timer_count == MAX_TIMERS) {
+    return ESP_FAIL;
+  }
+
+  struct esp_timer* timer = &timers[timer_count++];
+  timer->callback = create_args->callback;
+  timer->arg = create_args->arg;
+  timer->name = create_args->name;
+  timer->is_active = false;
+
+  *out_handle = timer;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+  if (timer->is_active) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  timer->due = fake_now + (int64_t)timeout_us;
+  timer->period = 0;
+  timer->is_active = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+  if (timer->is_active) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  timer->due = fake_now + (int64_t)period;
+  timer->period = period;
+  timer->is_active = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  if (fake_timer_stop_hook != NULL) {
+    fake_timer_stop_hook(timer->name);
+  }
+
+  if (!timer->is_active) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  timer->is_active = false;
+  return ESP_OK;
+}
+
+int64_t esp_timer_get_time(void) { return fake_now; }
+
+/* Runs the timers that come due within us microseconds, earliest first */
+void fake_time_advance(int64_t us) {
+  int64_t end = fake_now + us;
+
+  for (;;) {
+    struct esp_timer* next = NULL;
+
+    for (uint8_t i = 0; i < timer_count; i++) {
+      if (timers[i].is_active && timers[i].due <= end && (next == NULL || timers[i].due < next->due)) {
+        next = &timers[i];
+      }
+    }
+
+    if (next == NULL) {
+      break;
+    }
+
+    fake_now = next->due;
+    if (next->period != 0) {
+      next->due += next->period;
+    } else {
+      next->is_active = false;
+    }
+    next->callback(next->arg);
+  }
+
+  fake_now = end;
+}
+
+bool fake_timer_active(const char* name) {
+  for (uint8_t i = 0; i < timer_count; i++) {
+    if (strcmp(timers[i].name, name) == 0) {
+      return timers[i].is_active;
+    }
+  }
+
+  return false;
+}
+
+int64_t fake_wall_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/********************************************************************************/
+/*                                S T O R A G E */
+/********************************************************************************/
+
+static fake_entry_t* findEntry(const char* key) {
+  for (uint8_t i = 0; i < entry_count; i++) {
+    if (strcmp(entries[i].key, key) == 0) {
+      return &entries[i];
+    }
+  }
+
+  return NULL;
+}
+
+static bool fakeLoad(void* context, const char* key, void* data, size_t length) {
+  fake_entry_t* entry = findEntry(key);
+
+  if (entry == NULL || entry->length != length) {
+    return false;
+  }
+
+  memcpy(data, entry->data, length);
+  return true;
+}
+
+static bool fakeStore(void* context, const char* key, const void* data, size_t length) {
+  fake_entry_t* entry = findEntry(key);
+
+  if (length > MAX_ENTRY_SIZE) {
+    return false;
+  }
+
+  if (entry == NULL) {
+    if (entry_count == MAX_ENTRIES) {
+      return false;
+    }
+    entry = &entries[entry_count++];
+    snprintf(entry->key, sizeof(entry->key), "%s", key);
+  }
+
+  memcpy(entry->data, data, length);
+  entry->length = length;
+  last_written = entry;
+  writes[key[0] & 0x7F]++;
+  return true;
+}
+
+ps4_storage_t fake_storage() {
+  ps4_storage_t backend = {&fakeLoad, &fakeStore, NULL};
+  return backend;
+}
+
+void fake_storage_clear() {
+  entry_count = 0;
+  last_written = NULL;
+  memset(writes, 0, sizeof(writes));
+}
+
+uint32_t fake_storage_writes(char kind) { return writes[kind & 0x7F]; }
+
+void fake_storage_tear_last() {
+  if (last_written != NULL) {
+    memset(&last_written->data[last_written->length / 2], 0, last_written->length - last_written->length / 2);
+  }
+}
+
+/* NVS is not used on the host, the tests store through fake_storage */
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle) { return ESP_FAIL; }
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length) { return ESP_FAIL; }
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length) { return ESP_FAIL; }
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) { return ESP_FAIL; }
+esp_err_t nvs_commit(nvs_handle_t handle) { return ESP_FAIL; }
+void nvs_close(nvs_handle_t handle) {}
+
+/********************************************************************************/
+/*                                 S Y S T E M */
+/********************************************************************************/
+
+esp_err_t esp_base_mac_addr_set(const uint8_t* mac) { return ESP_OK; }
+
+uint32_t esp_get_free_heap_size(void) { return 0; }
+
+const char* esp_err_to_name(esp_err_t code) { return code == ESP_OK ? "ESP_OK" : "ESP_FAIL"; }
@@ -0,0 +1,101 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "Arduino.h"
+#include "esp_bt_main.h"
+#include "freertos/event_groups.h"
+
+/* FreeRTOS event groups on pthreads, and the Arduino and Bluedroid calls
+ * of PS4Controller::begin, for the tests of the C++ wrapper */
+
+struct EventGroupDef_t {
+  pthread_mutex_t mutex;
+  pthread_cond_t changed;
+  EventBits_t bits;
+};
+
+/********************************************************************************/
+/*                           E V E N T    G R O U P S */
+/********************************************************************************/
+
+EventGroupHandle_t xEventGroupCreate(void) {
+  EventGroupHandle_t group = calloc(1, sizeof(*group));
+
+  pthread_mutex_init(&group->mutex, NULL);
+  pthread_cond_init(&group->changed, NULL);
+  return group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+  pthread_mutex_lock(&group->mutex);
+  group->bits |= bits;
+  EventBits_t result = group->bits;
+  pthread_cond_broadcast(&group->changed);
+  pthread_mutex_unlock(&group->mutex);
+
+  return result;
+}
+
+/* Returns the bits before clearing, as FreeRTOS does */
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+  pthread_mutex_lock(&group->mutex);
+  EventBits_t result = group->bits;
+  group->bits &= ~bits;
+  pthread_mutex_unlock(&group->mutex);
+
+  return result;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks) {
+  struct timespec deadline;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += ticks / 1000;
+  deadline.tv_nsec += (long)(ticks % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&group->mutex);
+  for (;;) {
+    EventBits_t set = group->bits & bits;
+    if (wait_for_all ? set == bits : set != 0) {
+      break;
+    }
+
+    int result = ticks == portMAX_DELAY ? pthread_cond_wait(&group->changed, &group->mutex)
+                                        : pthread_cond_timedwait(&group->changed, &group->mutex, &deadline);
+    if (result == ETIMEDOUT) {
+      break;
+    }
+  }
+
+  EventBits_t result = group->bits;
+  if (clear_on_exit) {
+    group->bits &= ~bits;
+  }
+  pthread_mutex_unlock(&group->mutex);
+
+  return result;
+}
+
+/********************************************************************************/
+/*                          A R D U I N O    C O R E */
+/********************************************************************************/
+
+/* Does not sleep, the tests only wait on the event groups */
+void delay(uint32_t ms) {}
+
+bool btStarted() { return true; }
+
+bool btStart() { return true; }
+
+esp_bluedroid_status_t esp_bluedroid_get_status(void) { return ESP_BLUEDROID_STATUS_ENABLED; }
+
+esp_err_t esp_bluedroid_init(void) { return ESP_OK; }
+
+esp_err_t esp_bluedroid_enable(void) { return ESP_OK; }
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fake_stack.h"
+#include "stack/btm_api.h"
+
+/* Stands in for the Bluedroid L2CAP and security manager calls of
+ * ps4_l2cap.c, and for ps4_spp.c, recording the requests instead of
+ * sending them */
+
+#define FIRST_CID 0x40
+
+fake_stack_t fake_stack = {.next_cid = FIRST_CID};
+
+void fake_stack_reset() {
+  const tL2CAP_APPL_INFO* appl = fake_stack.appl;
+
+  memset(&fake_stack, 0, sizeof(fake_stack));
+  fake_stack.appl = appl;
+  fake_stack.next_cid = FIRST_CID;
+}
+
+const fake_connect_req_t* fake_stack_last_request() {
+  static const fake_connect_req_t none = {0};
+
+  return fake_stack.request_count > 0 ? &fake_stack.requests[fake_stack.request_count - 1] : &none;
+}
+
+void sppInit() {}
+
+uint16_t L2CA_Register(uint16_t psm, tL2CAP_APPL_INFO* p_cb_info) {
+  fake_stack.appl = p_cb_info;
+  return psm;
+}
+
+void L2CA_Deregister(uint16_t psm) {}
+
+uint16_t L2CA_ErtmConnectReq(uint16_t psm, BD_ADDR p_bd_addr, tL2CAP_ERTM_INFO* p_ertm_info) {
+  if (fake_stack.refuse_requests || fake_stack.request_count == FAKE_MAX_REQUESTS) {
+    return 0;
+  }
+
+  fake_connect_req_t* request = &fake_stack.requests[fake_stack.request_count++];
+  request->psm = psm;
+  request->cid = fake_stack.next_cid++;
+  memcpy(request->addr, p_bd_addr, sizeof(request->addr));
+  return request->cid;
+}
+
+bool L2CA_ErtmConnectRsp(BD_ADDR p_bd_addr, uint8_t id, uint16_t lcid, uint16_t result, uint16_t status,
+                         tL2CAP_ERTM_INFO* p_ertm_info) {
+  fake_stack.connect_rsps++;
+  fake_stack.last_connect_rsp_result = result;
+  return true;
+}
+
+bool L2CA_ConfigReq(uint16_t cid, tL2CAP_CFG_INFO* p_cfg) {
+  fake_stack.config_reqs++;
+  fake_stack.last_config_cid = cid;
+  fake_stack.last_config = *p_cfg;
+  return true;
+}
+
+bool L2CA_ConfigRsp(uint16_t cid, tL2CAP_CFG_INFO* p_cfg) {
+  fake_stack.config_rsps++;
+  fake_stack.last_config_rsp = *p_cfg;
+  return true;
+}
+
+bool L2CA_DisconnectReq(uint16_t cid) {
+  fake_stack.disconnect_reqs++;
+  fake_stack.last_disconnect_cid = cid;
+  return true;
+}
+
+bool L2CA_DisconnectRsp(uint16_t cid) {
+  fake_stack.disconnect_rsps++;
+  return true;
+}
+
+/* The buffer belongs to L2CAP once written */
+uint8_t L2CA_DataWrite(uint16_t cid, BT_HDR* p_data) {
+  fake_stack.data_writes++;
+  free(p_data);
+  return L2CAP_DW_SUCCESS;
+}
+
+bool BTM_SetSecurityLevel(bool is_originator, const char* p_name, uint8_t service_id, uint16_t sec_level,
+                          uint16_t psm, uint32_t mx_proto_id, uint32_t mx_chan_id) {
+  return true;
+}
@@ -0,0 +1,44 @@
+/* The Bluetooth stack under ps4_l2cap.c, for the tests running the real
+ * L2CAP glue instead of fake_l2cap.c. The stack events are raised by
+ * calling the callbacks ps4_l2cap_init_services registered. */
+#pragma once
+
+#include "ps4_test.h"
+#include "stack/bt_types.h"
+#include "stack/l2c_api.h"
+
+#define FAKE_MAX_REQUESTS 32
+
+typedef struct {
+  uint16_t psm;
+  uint16_t cid;
+  uint8_t addr[6];
+} fake_connect_req_t;
+
+typedef struct {
+  const tL2CAP_APPL_INFO* appl;   // passed to L2CA_Register
+  uint16_t next_cid;              // given to the next connection request
+
+  fake_connect_req_t requests[FAKE_MAX_REQUESTS];  // L2CA_ErtmConnectReq calls
+  uint8_t request_count;
+  bool refuse_requests;           // L2CA_ErtmConnectReq fails
+  uint32_t connect_rsps;          // L2CA_ErtmConnectRsp calls
+  uint16_t last_connect_rsp_result;
+
+  uint32_t config_reqs;           // L2CA_ConfigReq calls
+  uint16_t last_config_cid;
+  tL2CAP_CFG_INFO last_config;
+  uint32_t config_rsps;           // L2CA_ConfigRsp calls
+  tL2CAP_CFG_INFO last_config_rsp;
+
+  uint32_t disconnect_reqs;       // L2CA_DisconnectReq calls
+  uint16_t last_disconnect_cid;
+  uint32_t disconnect_rsps;       // L2CA_DisconnectRsp calls
+  uint32_t data_writes;           // L2CA_DataWrite calls
+} fake_stack_t;
+
+extern fake_stack_t fake_stack;
+void fake_stack_reset();
+
+/* The last connection request, or one of zeros if there was none */
+const fake_connect_req_t* fake_stack_last_request();
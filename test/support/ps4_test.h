@@ -0,0 +1,97 @@
+/* Shared helpers of the host tests. Each test is a small program that
+ * exits non-zero when a CHECK failed. */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ps4.h"
+#include "ps4_int.h"
+
+extern int ps4_test_failures;
+
+#define CHECK(cond)                                                    \
+  do {                                                                 \
+    if (!(cond)) {                                                     \
+      printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);  \
+      ps4_test_failures++;                                             \
+    }                                                                  \
+  } while (0)
+
+#define CHECK_EQ(actual, expected)                                     \
+  do {                                                                 \
+    long long a_ = (long long)(actual);                                \
+    long long e_ = (long long)(expected);                              \
+    if (a_ != e_) {                                                    \
+      printf("%s:%d: CHECK failed: %s == %s (%lld != %lld)\n",         \
+             __FILE__, __LINE__, #actual, #expected, a_, e_);          \
+      ps4_test_failures++;                                             \
+    }                                                                  \
+  } while (0)
+
+#define TEST_RESULT() (ps4_test_failures == 0 ? 0 : 1)
+
+/********************************************************************************/
+/*                       F A K E    P L A T F O R M */
+/********************************************************************************/
+
+/* Simulated esp_timer clock, in microseconds. fake_time_advance runs the
+ * timers that come due on the way, in order. */
+extern int64_t fake_now;
+void fake_time_advance(int64_t us);
+bool fake_timer_active(const char* name);
+
+/* Called as a timer is being stopped, to run what another task could do
+ * at that moment */
+extern void (*fake_timer_stop_hook)(const char* name);
+
+/* Wall clock for the benchmarks, in nanoseconds */
+int64_t fake_wall_ns();
+
+/* Storage backend that keeps the entries in memory */
+ps4_storage_t fake_storage();
+void fake_storage_clear();
+
+/* Entries stored of a kind, by the first character of the key */
+uint32_t fake_storage_writes(char kind);
+
+/* Zeroes the second half of the entry stored last, as a reset in the
+ * middle of writing it would leave it */
+void fake_storage_tear_last();
+
+/********************************************************************************/
+/*                          F A K E    L 2 C A P */
+/********************************************************************************/
+
+#define FAKE_REPORT_SIZE 96
+#define FAKE_INTERRUPT_SIZE 1024
+
+typedef struct {
+  uint32_t hid_sends;          // ps4_l2cap_send_hid calls
+  hid_cmd_t last_hid;
+  uint8_t last_hid_len;
+  uint32_t interrupt_sends;    // ps4_l2cap_send_interrupt calls
+  uint8_t last_interrupt[FAKE_INTERRUPT_SIZE];
+  uint16_t last_interrupt_len;
+  bool congested;              // returned by ps4_l2cap_interrupt_congested
+  uint8_t peer[6];             // returned by ps4_l2cap_peer_address
+  uint32_t pages;              // ps4_l2cap_connect calls
+  uint8_t last_page[6];
+} fake_l2cap_t;
+
+extern fake_l2cap_t fake_l2cap;
+void fake_l2cap_reset();
+
+/* Builds an input report with centered sticks and nothing pressed, laid
+ * out as parsePacket reads it */
+void fake_report(uint8_t packet[FAKE_REPORT_SIZE]);
+
+/********************************************************************************/
+/*                             B A S E L I N E */
+/********************************************************************************/
+
+/* parsePacket and ps4PacketEvent from before the v2 callbacks, delivering
+ * by value to a callback that adds lx to the sink */
+void baseline_init(volatile int32_t* sink);
+void baseline_parse_packet(uint8_t* packet);
@@ -0,0 +1,128 @@
+#include <string.h>
+
+#include "ps4_test.h"
+
+/* Runs chords, holds and double-taps through the report path and checks
+ * when each action fires */
+
+#define REPORT_TICKS 234  // controller clock, 16/3 us each
+#define REPORT_INTERVAL_US (REPORT_TICKS * 16 / 3)
+
+enum { CHORD = 1, HOLD, INSTANT_HOLD, DOUBLE_TAP };
+
+#define L1 0x0100   // packet[18] << 8
+#define R1 0x0200
+#define SHARE 0x1000
+#define OPTIONS 0x2000
+#define CROSS 0x0020  // packet[17]
+
+static uint8_t packet[FAKE_REPORT_SIZE];
+static uint16_t ticks = 0;
+static uint32_t report_number = 0;
+
+static uint16_t fired[16];
+static uint32_t fired_at[16];
+static uint8_t fired_count = 0;
+
+static void onAction(void* object, uint16_t action) {
+  if (fired_count < 16) {
+    fired[fired_count] = action;
+    fired_at[fired_count] = report_number;
+    fired_count++;
+  }
+}
+
+/* Sends reports with the given buttons held, 1.248ms apart */
+static void hold(uint16_t buttons, uint32_t reports) {
+  packet[17] = 0x08 | (buttons & 0xF0);
+  packet[18] = buttons >> 8;
+
+  for (uint32_t i = 0; i < reports; i++) {
+    ticks += REPORT_TICKS;
+    packet[22] = ticks & 0xFF;
+    packet[23] = ticks >> 8;
+
+    fake_time_advance(REPORT_INTERVAL_US);
+    parsePacket(packet);
+    report_number++;
+  }
+}
+
+static uint32_t reportsFor(uint32_t ms) { return ms * 1000 / REPORT_INTERVAL_US; }
+
+static void testActions() {
+  ps4_binding_t bindings[] = {
+    PS4_CHORD(CHORD, ps4_button_mask_l1 | ps4_button_mask_r1),
+    PS4_HOLD(HOLD, ps4_button_mask_options, 800),
+    PS4_HOLD(INSTANT_HOLD, ps4_button_mask_share, 0),
+    PS4_DOUBLE_TAP(DOUBLE_TAP, ps4_button_mask_cross, 300),
+  };
+
+  CHECK(ps4SetBindings(bindings, sizeof(bindings) / sizeof(bindings[0])));
+  ps4SetActionCallback(NULL, &onAction);
+
+  fake_report(packet);
+  ps4ConnectEvent(1);
+  hold(0, 2);
+
+  // A chord fires once both buttons are down
+  hold(L1, 5);
+  CHECK_EQ(fired_count, 0);
+  hold(L1 | R1, 5);
+  CHECK_EQ(fired_count, 1);
+  CHECK_EQ(fired[0], CHORD);
+  hold(0, 5);
+
+  // A hold fires once its time is up, and not when let go before
+  uint32_t start = report_number;
+  hold(OPTIONS, reportsFor(1000));
+  CHECK_EQ(fired_count, 2);
+  CHECK_EQ(fired[1], HOLD);
+  CHECK(fired_at[1] - start >= reportsFor(800) - 1);
+  CHECK(fired_at[1] - start <= reportsFor(800 + 10) + 1);
+  hold(0, 5);
+  hold(OPTIONS, reportsFor(700));
+  hold(0, reportsFor(1000));
+  CHECK_EQ(fired_count, 2);
+
+  // A hold of 0ms fires with the press, not a turn of the wheel later
+  start = report_number;
+  hold(SHARE, 1);
+  CHECK_EQ(fired_count, 3);
+  CHECK_EQ(fired[2], INSTANT_HOLD);
+  CHECK_EQ(fired_at[2], start);
+  hold(0, 5);
+
+  // A double-tap needs the second press within its time
+  hold(CROSS, 10);
+  hold(0, 10);
+  hold(CROSS, 10);
+  CHECK_EQ(fired_count, 4);
+  CHECK_EQ(fired[3], DOUBLE_TAP);
+  hold(0, reportsFor(500));
+  hold(CROSS, 10);
+  hold(0, reportsFor(400));
+  hold(CROSS, 10);
+  hold(0, 10);
+  CHECK_EQ(fired_count, 4);
+
+  ps4SetActionCallback(NULL, NULL);
+}
+
+static void testInvalidBindings() {
+  ps4_binding_t no_buttons[] = {PS4_CHORD(CHORD, 0)};
+  ps4_binding_t no_time[] = {PS4_DOUBLE_TAP(DOUBLE_TAP, ps4_button_mask_cross, 0)};
+
+  CHECK(!ps4SetBindings(no_buttons, 1));
+  CHECK(!ps4SetBindings(no_time, 1));
+  CHECK(ps4SetBindings(NULL, 0));
+}
+
+int main() {
+  ps4Init();
+
+  testActions();
+  testInvalidBindings();
+
+  return TEST_RESULT();
+}
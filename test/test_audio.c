@@ -0,0 +1,293 @@
+#include <math.h>
+#include <string.h>
+
+#include "ps4_test.h"
+
+/* Streams a two tone signal to the speaker and checks the audio reports,
+ * then compares the SBC frames bit for bit with fixtures/audio.sbc. That
+ * stream was decoded by the SBC decoder of FFmpeg, an implementation
+ * independent of this one, into fixtures/audio.pcm, which has to match the
+ * input at unity gain. Also races a write with the timer stopping, and
+ * measures the cost of encoding a report. */
+
+#define SAMPLE_RATE 32000
+#define SUBBANDS 8
+#define BLOCKS 16
+#define FRAME_SAMPLES (SUBBANDS * BLOCKS)
+#define FRAME_SIZE (8 + (BLOCKS * PS4_AUDIO_BITPOOL + 7) / 8)
+#define REPORT_SAMPLES (PS4_AUDIO_FRAMES_PER_REPORT * FRAME_SAMPLES)
+#define REPORT_PERIOD_US (REPORT_SAMPLES * 1000000LL / SAMPLE_RATE)
+#define REPORT_FRAMES_INDEX 10
+#define REPORT_SIZE (REPORT_FRAMES_INDEX + PS4_AUDIO_FRAMES_PER_REPORT * FRAME_SIZE + 4)
+
+#define SIGNAL_REPORTS 50
+#define SIGNAL_SAMPLES (SIGNAL_REPORTS * REPORT_SAMPLES)
+#define MAX_DELAY 200
+#define SETTLE_SAMPLES 1000
+#define BENCHMARK_REPORTS 2000
+
+static int16_t input[SIGNAL_SAMPLES];
+
+/* The SBC frames of the signal as sent, in order */
+static uint8_t stream[SIGNAL_REPORTS * PS4_AUDIO_FRAMES_PER_REPORT * FRAME_SIZE];
+static uint32_t stream_size = 0;
+
+static uint32_t bad_reports = 0;
+static uint32_t bad_frames = 0;
+
+/********************************************************************************/
+/*                          R E P O R T    C H E C K S */
+/********************************************************************************/
+
+static uint32_t readBits(const uint8_t* data, uint32_t* position, uint8_t count) {
+  uint32_t value = 0;
+
+  for (uint8_t i = 0; i < count; i++, (*position)++) {
+    value = value << 1 | ((data[*position / 8] >> (7 - *position % 8)) & 1);
+  }
+
+  return value;
+}
+
+/* x^8 + x^4 + x^3 + x^2 + 1 over the header and the scale factors */
+static uint8_t headerCrc(const uint8_t* frame) {
+  uint8_t crc = 0x0F;
+  uint32_t position = 8;
+
+  for (uint32_t i = 0; i < 16 + 4 * SUBBANDS; i++) {
+    if (i == 16) {
+      position = 32;  // the CRC itself is not covered
+    }
+
+    uint8_t bit = readBits(frame, &position, 1);
+    uint8_t top = crc >> 7;
+    crc = (uint8_t)(crc << 1) ^ (bit != top ? 0x1D : 0);
+  }
+
+  return crc;
+}
+
+/* Checks the header of a frame and adds it to the stream */
+static void collectFrame(const uint8_t* frame) {
+  // 32kHz, 16 blocks, mono, loudness, 8 subbands
+  if (frame[0] != 0x9C || frame[1] != 0x71 || frame[2] != PS4_AUDIO_BITPOOL || frame[3] != headerCrc(frame)) {
+    bad_frames++;
+  }
+
+  if (stream_size + FRAME_SIZE <= sizeof(stream)) {
+    memcpy(&stream[stream_size], frame, FRAME_SIZE);
+    stream_size += FRAME_SIZE;
+  }
+}
+
+/* CRC-32 of zlib, a bit at a time */
+static uint32_t reportCrc(const uint8_t* data, uint32_t length) {
+  uint32_t crc = 0xFFFFFFFF;
+  uint8_t header = 0xA2;  // DATA, output
+
+  for (uint32_t i = 0; i <= length; i++) {
+    crc ^= i == 0 ? header : data[i - 1];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc >> 1 ^ (crc & 1 ? 0xEDB88320 : 0);
+    }
+  }
+
+  return ~crc;
+}
+
+static void checkReport(const uint8_t* report, uint16_t length, uint16_t counter) {
+  uint32_t crc = reportCrc(report, REPORT_SIZE - 4);
+
+  if (length != REPORT_SIZE || report[0] != 0x17 || (report[3] | report[4] << 8) != counter ||
+      memcmp(&report[REPORT_SIZE - 4], &crc, 4) != 0) {
+    bad_reports++;
+    return;
+  }
+
+  for (int f = 0; f < PS4_AUDIO_FRAMES_PER_REPORT; f++) {
+    collectFrame(&report[REPORT_FRAMES_INDEX + f * FRAME_SIZE]);
+  }
+}
+
+/********************************************************************************/
+/*                                   T E S T S */
+/********************************************************************************/
+
+static void connect() {
+  uint8_t packet[FAKE_REPORT_SIZE];
+
+  fake_report(packet);
+  ps4ConnectEvent(1);
+  fake_time_advance(1250);
+  parsePacket(packet);  // the first report only completes the connection
+}
+
+static size_t readFixture(const char* name, void* data, size_t size) {
+  char path[512];
+
+  snprintf(path, sizeof(path), "%s/%s", PS4_FIXTURE_DIR, name);
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    printf("cannot open %s\n", path);
+    return 0;
+  }
+
+  size_t length = fread(data, 1, size, file);
+  fclose(file);
+  return length;
+}
+
+/* Signal to noise ratio of a decoded output against the input at unity
+ * gain, at the delay of the filter banks that fits best. An inverted or
+ * scaled output does not fit at any delay. */
+static double snrAtBestDelay(const int16_t* output, uint32_t* delay) {
+  double best = -1000;
+
+  for (uint32_t d = 0; d < MAX_DELAY; d++) {
+    uint32_t n = SIGNAL_SAMPLES - SETTLE_SAMPLES - MAX_DELAY;
+    double signal = 0, error = 0;
+
+    for (uint32_t i = SETTLE_SAMPLES; i < SETTLE_SAMPLES + n; i++) {
+      double difference = input[i] - output[i + d];
+      signal += (double)input[i] * input[i];
+      error += difference * difference;
+    }
+
+    double snr = 10 * log10(signal / (error > 0 ? error : 1));
+    if (snr > best) {
+      best = snr;
+      *delay = d;
+    }
+  }
+
+  return best;
+}
+
+/* The stream must be the one the fixture was decoded from. When the
+ * encoder changes on purpose, it is written out to decode it again. */
+static void checkStream() {
+  static uint8_t expected[sizeof(stream) + 1];
+  size_t expected_size = readFixture("audio.sbc", expected, sizeof(expected));
+
+  CHECK_EQ(stream_size, sizeof(stream));
+  CHECK_EQ(expected_size, stream_size);
+  if (expected_size == stream_size && memcmp(expected, stream, stream_size) == 0) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < stream_size && i < expected_size; i++) {
+    if (expected[i] != stream[i]) {
+      printf("the SBC stream differs from fixtures/audio.sbc at byte %u, frame %u\n", (unsigned)i,
+             (unsigned)(i / FRAME_SIZE));
+      break;
+    }
+  }
+
+  FILE* file = fopen("audio.sbc", "wb");
+  if (file != NULL) {
+    fwrite(stream, 1, stream_size, file);
+    fclose(file);
+    printf("wrote audio.sbc, see fixtures/decode_sbc.py\n");
+  }
+  ps4_test_failures++;
+}
+
+static void testRoundTrip() {
+  static int16_t reference[SIGNAL_SAMPLES];
+  uint32_t written = 0;
+  uint32_t sends = fake_l2cap.interrupt_sends;
+  uint16_t counter = 0;
+
+  for (uint32_t i = 0; i < SIGNAL_SAMPLES; i++) {
+    double t = (double)i / SAMPLE_RATE;
+    input[i] = (int16_t)lround(12000 * sin(2 * M_PI * 440 * t) + 6000 * sin(2 * M_PI * 3100 * t));
+  }
+
+  // Keep the ring topped up and collect each report as it goes out
+  for (uint32_t step = 0; step < SIGNAL_REPORTS * 2 && (written < SIGNAL_SAMPLES || ps4AudioQueued()); step++) {
+    written += ps4AudioWrite(&input[written], SIGNAL_SAMPLES - written);
+    fake_time_advance(REPORT_PERIOD_US);
+
+    if (fake_l2cap.interrupt_sends != sends) {
+      CHECK_EQ(fake_l2cap.interrupt_sends, sends + 1);
+      sends = fake_l2cap.interrupt_sends;
+      checkReport(fake_l2cap.last_interrupt, fake_l2cap.last_interrupt_len, counter++);
+    }
+  }
+
+  fake_time_advance(REPORT_PERIOD_US);
+  CHECK(!fake_timer_active("ps4_audio"));
+
+  CHECK_EQ(counter, SIGNAL_REPORTS);
+  CHECK_EQ(bad_reports, 0);
+  CHECK_EQ(bad_frames, 0);
+
+  // Bit for bit the stream FFmpeg decoded for the fixture
+  checkStream();
+
+  // Which decodes to the input
+  CHECK_EQ(readFixture("audio.pcm", reference, sizeof(reference)), sizeof(reference));
+  uint32_t delay = 0;
+  double snr = snrAtBestDelay(reference, &delay);
+  printf("%u reports, decoded by FFmpeg: %.1f dB SNR at a delay of %u samples\n", (unsigned)counter, snr,
+         (unsigned)delay);
+  CHECK(snr > 40);
+}
+
+static void writeWhileStopping(const char* name) {
+  static const int16_t silence[REPORT_SAMPLES];
+
+  if (strcmp(name, "ps4_audio") == 0) {
+    fake_timer_stop_hook = NULL;
+    ps4AudioWrite(silence, REPORT_SAMPLES);
+  }
+}
+
+static void testWriteWhileStopping() {
+  static const int16_t silence[REPORT_SAMPLES];
+  uint32_t sends = fake_l2cap.interrupt_sends;
+
+  ps4AudioWrite(silence, REPORT_SAMPLES);
+  fake_time_advance(REPORT_PERIOD_US);
+  CHECK_EQ(fake_l2cap.interrupt_sends, sends + 1);
+
+  // The write lands while the tick finding the ring empty stops the timer
+  fake_timer_stop_hook = &writeWhileStopping;
+  fake_time_advance(REPORT_PERIOD_US);
+  CHECK(fake_timer_stop_hook == NULL);
+  CHECK(fake_timer_active("ps4_audio"));
+
+  fake_time_advance(REPORT_PERIOD_US);
+  CHECK_EQ(fake_l2cap.interrupt_sends, sends + 2);
+  CHECK_EQ(ps4AudioQueued(), 0);
+
+  fake_time_advance(REPORT_PERIOD_US);
+  CHECK(!fake_timer_active("ps4_audio"));
+}
+
+static void testBenchmark() {
+  uint32_t sends = fake_l2cap.interrupt_sends;
+  int64_t start = fake_wall_ns();
+
+  for (uint32_t i = 0; i < BENCHMARK_REPORTS; i++) {
+    ps4AudioWrite(&input[(i % SIGNAL_REPORTS) * REPORT_SAMPLES], REPORT_SAMPLES);
+    fake_time_advance(REPORT_PERIOD_US);
+  }
+
+  int64_t ns = fake_wall_ns() - start;
+  CHECK_EQ(fake_l2cap.interrupt_sends, sends + BENCHMARK_REPORTS);
+  printf("audio report of %d SBC frames: %.2f us, %.2f us per frame\n", PS4_AUDIO_FRAMES_PER_REPORT,
+         ns / 1000.0 / BENCHMARK_REPORTS, ns / 1000.0 / BENCHMARK_REPORTS / PS4_AUDIO_FRAMES_PER_REPORT);
+}
+
+int main() {
+  ps4Init();
+
+  connect();
+
+  testRoundTrip();
+  testWriteWhileStopping();
+  testBenchmark();
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,121 @@
+#include <string.h>
+
+#include "ps4_test.h"
+
+/* Delivers batches through the report path, flushes the window left open
+ * by a disconnect, and removes subscribers from inside a delivery */
+
+#define REPORT_TICKS 234  // controller clock, 16/3 us each
+#define REPORT_INTERVAL_US (REPORT_TICKS * 16 / 3)
+
+typedef struct {
+  uint32_t batches;
+  uint32_t reports;
+  uint32_t pressed;
+  bool remove_self;
+} subscriber_t;
+
+static uint16_t ticks = 0;
+
+static void onBatch(void* object, const ps4_batch_t* batch) {
+  subscriber_t* subscriber = (subscriber_t*)object;
+
+  subscriber->batches++;
+  subscriber->reports += batch->reports;
+  subscriber->pressed |= batch->button_down.mask;
+
+  if (subscriber->remove_self) {
+    ps4RemoveBatchCallback(object, &onBatch);
+  }
+}
+
+static void feed(uint8_t* packet, uint32_t reports) {
+  for (uint32_t i = 0; i < reports; i++) {
+    ticks += REPORT_TICKS;
+    packet[22] = ticks & 0xFF;
+    packet[23] = ticks >> 8;
+
+    fake_time_advance(REPORT_INTERVAL_US);
+    parsePacket(packet);
+  }
+}
+
+static void connect(uint8_t* packet) {
+  fake_report(packet);
+  ps4ConnectEvent(1);
+  feed(packet, 1);  // the first report only completes the connection
+}
+
+static void testFlushOnDisconnect() {
+  uint8_t packet[FAKE_REPORT_SIZE];
+  subscriber_t timed = {0};
+
+  connect(packet);
+  CHECK(ps4AddBatchCallback(0, 100, &timed, &onBatch));
+
+  // A tap in a window the disconnect cuts short
+  feed(packet, 10);
+  packet[17] |= 0x20;  // cross
+  feed(packet, 1);
+  CHECK_EQ(timed.batches, 0);
+
+  ps4ConnectEvent(0);
+  CHECK_EQ(timed.batches, 1);
+  CHECK_EQ(timed.reports, 11);
+  CHECK_EQ(timed.pressed, ps4_button_mask_cross);
+
+  // Nothing is left over for the next connection
+  connect(packet);
+  CHECK_EQ(timed.batches, 1);
+  feed(packet, 100);
+  CHECK_EQ(timed.batches, 2);
+  CHECK(timed.reports > 11 + 80 && timed.reports < 11 + 100);
+
+  ps4RemoveBatchCallback(&timed, &onBatch);
+  ps4ConnectEvent(0);
+}
+
+static void testRemoveWhileDelivering() {
+  uint8_t packet[FAKE_REPORT_SIZE];
+  subscriber_t first = {0, 0, 0, true};
+  subscriber_t second = {0};
+  subscriber_t third = {0};
+
+  connect(packet);
+  CHECK(ps4AddBatchCallback(1, 0, &first, &onBatch));
+  CHECK(ps4AddBatchCallback(1, 0, &second, &onBatch));
+  CHECK(ps4AddBatchCallback(1, 0, &third, &onBatch));
+
+  // The first one goes away in its own callback; the others must not skip
+  // the report or see it twice
+  feed(packet, 1);
+  CHECK_EQ(first.batches, 1);
+  CHECK_EQ(second.batches, 1);
+  CHECK_EQ(third.batches, 1);
+
+  feed(packet, 4);
+  CHECK_EQ(first.batches, 1);
+  CHECK_EQ(second.batches, 5);
+  CHECK_EQ(third.batches, 5);
+
+  second.remove_self = true;
+  feed(packet, 1);
+  feed(packet, 1);
+  CHECK_EQ(second.batches, 6);
+  CHECK_EQ(third.batches, 7);
+
+  ps4RemoveBatchCallback(&third, &onBatch);
+  feed(packet, 1);
+  CHECK_EQ(third.batches, 7);
+
+  ps4ConnectEvent(0);
+}
+
+int main() {
+  ps4Init();
+
+  testFlushOnDisconnect();
+  testRemoveWhileDelivering();
+
+  return TEST_RESULT();
+}
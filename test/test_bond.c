@@ -0,0 +1,147 @@
+#include <string.h>
+
+#include "ps4_test.h"
+
+/* Connects and disconnects controllers over the bonding store and counts
+ * the snapshots written: one per change, none for a reconnect that
+ * changes nothing. Then reads the store back after the snapshots wrapped
+ * around the slots and after the newest one was torn, and evicts the
+ * controller unused for the longest time. */
+
+#define STORAGE_KIND_BOND 'b'
+
+static const uint8_t controllers[PS4_MAX_BONDS + 1][6] = {
+  {0x01, 0x01, 0x01, 0x01, 0x01, 0x01},
+  {0x02, 0x02, 0x02, 0x02, 0x02, 0x02},
+  {0x03, 0x03, 0x03, 0x03, 0x03, 0x03},
+  {0x04, 0x04, 0x04, 0x04, 0x04, 0x04},
+  {0x05, 0x05, 0x05, 0x05, 0x05, 0x05},
+};
+
+static void connect(uint8_t controller) {
+  memcpy(fake_l2cap.peer, controllers[controller], sizeof(fake_l2cap.peer));
+  ps4ConnectEvent(1);
+}
+
+/* Both channels closing report a disconnect */
+static void disconnect() {
+  ps4ConnectEvent(0);
+  ps4ConnectEvent(0);
+}
+
+/* As after a restart, the store is read again */
+static void restart() { ps4SetStorage(fake_storage()); }
+
+static uint32_t snapshots() { return fake_storage_writes(STORAGE_KIND_BOND); }
+
+static void checkLed(uint8_t r, uint8_t g, uint8_t b) {
+  ps4_cmd_t cmd;
+  uint8_t volume;
+
+  ps4_output_state(&cmd, &volume);
+  CHECK_EQ(cmd.r, r);
+  CHECK_EQ(cmd.g, g);
+  CHECK_EQ(cmd.b, b);
+}
+
+/* The known controllers, the most recently used first */
+static void checkOrder(const uint8_t* expected, uint8_t count) {
+  ps4_bond_t bonds[PS4_MAX_BONDS];
+
+  CHECK_EQ(ps4GetBonds(bonds, PS4_MAX_BONDS), count);
+  for (uint8_t i = 0; i < count; i++) {
+    CHECK(memcmp(bonds[i].addr, controllers[expected[i]], 6) == 0);
+  }
+}
+
+static void testSaves() {
+  fake_storage_clear();
+  restart();
+
+  // A new controller is written at once
+  connect(0);
+  CHECK_EQ(snapshots(), 1);
+
+  // Its settings once, as both channels close
+  ps4SetLed(255, 0, 0);
+  disconnect();
+  CHECK_EQ(snapshots(), 2);
+
+  // Nothing changed, nothing written
+  connect(0);
+  checkLed(255, 0, 0);
+  disconnect();
+  CHECK_EQ(snapshots(), 2);
+
+  connect(0);
+  ps4SetLed(0, 0, 255);
+  disconnect();
+  CHECK_EQ(snapshots(), 3);
+}
+
+static void testLoad() {
+  // The newest snapshot is read back
+  restart();
+  connect(0);
+  checkLed(0, 0, 255);
+  disconnect();
+
+  // Also once the snapshots wrapped around the slots
+  connect(1);
+  disconnect();
+  connect(2);
+  disconnect();
+  CHECK(snapshots() > PS4_BOND_SLOTS);
+  restart();
+  checkOrder((const uint8_t[]){2, 1, 0}, 3);
+
+  // A snapshot torn by a reset is passed over for the one before it
+  connect(0);
+  ps4SetLed(0, 255, 0);
+  disconnect();
+  checkOrder((const uint8_t[]){0, 2, 1}, 3);
+  fake_storage_tear_last();
+  restart();
+  checkOrder((const uint8_t[]){2, 1, 0}, 3);
+  connect(0);
+  checkLed(0, 0, 255);
+  disconnect();
+
+  // And writing goes on after it
+  restart();
+  checkOrder((const uint8_t[]){0, 2, 1}, 3);
+}
+
+static void testEviction() {
+  fake_storage_clear();
+  restart();
+
+  for (uint8_t i = 0; i < PS4_MAX_BONDS; i++) {
+    connect(i);
+    disconnect();
+  }
+  checkOrder((const uint8_t[]){3, 2, 1, 0}, 4);
+
+  // Used again, the first one is no longer the oldest
+  connect(0);
+  disconnect();
+  checkOrder((const uint8_t[]){0, 3, 2, 1}, 4);
+
+  // A new one takes the place of the one unused for the longest time
+  connect(4);
+  disconnect();
+  checkOrder((const uint8_t[]){4, 0, 3, 2}, 4);
+
+  restart();
+  checkOrder((const uint8_t[]){4, 0, 3, 2}, 4);
+}
+
+int main() {
+  ps4Init();
+
+  testSaves();
+  testLoad();
+  testEviction();
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,136 @@
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "PS4Controller.h"
+
+extern "C" {
+#include "ps4_test.h"
+}
+
+/* Waits on PS4Controller::waitForEvent while another thread delivers
+ * reports or disconnects, as the Bluetooth task would: checks that the
+ * wait wakes on a report and on a disconnect, times out, and returns at
+ * once when no controller is connected */
+
+#define DELIVERY_DELAY_MS 50
+
+static uint8_t packet[FAKE_REPORT_SIZE];
+static uint32_t disconnects = 0;
+
+static int64_t nowMs() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void* deliverReport(void* arg) {
+  usleep(DELIVERY_DELAY_MS * 1000);
+  fake_time_advance(1250);
+  parsePacket(packet);
+  return NULL;
+}
+
+static void* disconnect(void* arg) {
+  usleep(DELIVERY_DELAY_MS * 1000);
+  ps4ConnectEvent(0);
+  return NULL;
+}
+
+/* Waits for the next event while the thread runs, and returns how long
+ * the wait took */
+static int64_t waitWhile(void* (*run)(void*), uint32_t timeoutMs, bool* received) {
+  pthread_t thread;
+  int64_t start = nowMs();
+
+  pthread_create(&thread, NULL, run, NULL);
+  *received = PS4.waitForEvent(timeoutMs);
+  int64_t elapsed = nowMs() - start;
+  pthread_join(thread, NULL);
+
+  return elapsed;
+}
+
+static void connect() {
+  fake_report(packet);
+  ps4ConnectEvent(1);
+  fake_time_advance(1250);
+  parsePacket(packet);  // the first report only completes the connection
+}
+
+static void testNotConnected() {
+  int64_t start = nowMs();
+
+  CHECK(!PS4.isConnected());
+  CHECK(!PS4.waitForEvent(PS4Controller::WaitForever));
+  CHECK(nowMs() - start < DELIVERY_DELAY_MS);
+}
+
+static void testWakeOnReport() {
+  bool received = false;
+
+  connect();
+  CHECK(PS4.waitForConnection(0));
+
+  packet[17] |= 0x20;  // cross
+  int64_t elapsed = waitWhile(&deliverReport, PS4Controller::WaitForever, &received);
+  CHECK(received);
+  CHECK(elapsed >= DELIVERY_DELAY_MS - 5);
+  CHECK_EQ(PS4.event.button_down.mask, ps4_button_mask_cross);
+  packet[17] &= ~0x20;
+}
+
+static void testTimeout() {
+  // A report from before the call is not the next event
+  fake_time_advance(1250);
+  parsePacket(packet);
+
+  int64_t start = nowMs();
+  CHECK(!PS4.waitForEvent(100));
+  int64_t elapsed = nowMs() - start;
+  CHECK(elapsed >= 95);
+  CHECK(elapsed < 1000);
+
+  // A timeout longer than the wait for the report
+  bool received = false;
+  waitWhile(&deliverReport, 1000, &received);
+  CHECK(received);
+}
+
+static void testWakeOnDisconnect() {
+  bool received = true;
+
+  PS4.attachOnDisconnect([] { disconnects++; });
+
+  int64_t elapsed = waitWhile(&disconnect, PS4Controller::WaitForever, &received);
+  CHECK(!received);
+  CHECK(elapsed >= DELIVERY_DELAY_MS - 5);
+  CHECK(!PS4.isConnected());
+  CHECK(!PS4.waitForConnection(0));
+
+  // Both channels closing report one disconnect
+  ps4ConnectEvent(0);
+  CHECK_EQ(disconnects, 1);
+
+  // Waiting once disconnected returns at once instead of waiting for the
+  // next connection
+  testNotConnected();
+
+  // And works again after reconnecting
+  connect();
+  CHECK(PS4.waitForConnection(0));
+  waitWhile(&deliverReport, PS4Controller::WaitForever, &received);
+  CHECK(received);
+}
+
+int main() {
+  CHECK(PS4.begin());
+
+  testNotConnected();
+  testWakeOnReport();
+  testTimeout();
+  testWakeOnDisconnect();
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,162 @@
+#include <math.h>
+#include <string.h>
+
+#include "ps4_test.h"
+
+/* Step response of the One-Euro filter on a synthetic stick step with
+ * pseudo-random jitter, and the cost of filtering all channels of a
+ * report. No recorded stick data is in the tree, so the jitter is only
+ * uniform noise of NOISE counts, not that of a real potentiometer. */
+
+#define REPORT_INTERVAL_US 1250
+#define STEP_REPORTS 800
+#define STEP_AT 400
+#define STEP_VALUE 100
+#define NOISE 3
+#define BENCHMARK_REPORTS 200000
+
+typedef struct {
+  int8_t input[STEP_REPORTS];
+  int8_t output[STEP_REPORTS];
+} trace_t;
+
+/* Uniform in [-NOISE, NOISE], from a fixed seed so every run and every
+ * libc filters the same trace */
+static int jitter(uint32_t* state) {
+  *state = *state * 1664525 + 1013904223;
+  return (int)((*state >> 16) % (2 * NOISE + 1)) - NOISE;
+}
+
+/* A resting stick that is pushed to STEP_VALUE in one report */
+static void runStep(trace_t* trace) {
+  uint32_t seed = 1;
+  ps4_t ps4;
+  memset(&ps4, 0, sizeof(ps4));
+
+  ps4_filter_reset();
+
+  for (int i = 0; i < STEP_REPORTS; i++) {
+    int noise = jitter(&seed);
+    trace->input[i] = (i < STEP_AT ? 0 : STEP_VALUE) + noise;
+
+    ps4.analog.stick.lx = trace->input[i];
+    ps4.timestamp += REPORT_INTERVAL_US;
+    ps4_filter_apply(&ps4);
+    trace->output[i] = ps4.analog.stick.lx;
+  }
+}
+
+static double deviation(const int8_t* values, int count) {
+  double sum = 0, squares = 0;
+
+  for (int i = 0; i < count; i++) {
+    sum += values[i];
+    squares += values[i] * values[i];
+  }
+
+  return sqrt(squares / count - (sum / count) * (sum / count));
+}
+
+/* Reports after the step until the output reaches 90% of it */
+static int riseTime(const trace_t* trace) {
+  for (int i = STEP_AT; i < STEP_REPORTS; i++) {
+    if (trace->output[i] >= STEP_VALUE * 9 / 10) {
+      return i - STEP_AT;
+    }
+  }
+
+  return STEP_REPORTS;
+}
+
+static int peak(const trace_t* trace) {
+  int max = INT8_MIN;
+
+  for (int i = STEP_AT; i < STEP_REPORTS; i++) {
+    max = trace->output[i] > max ? trace->output[i] : max;
+  }
+
+  return max;
+}
+
+static void testPassThrough() {
+  ps4_filter_params_t off = {0, 0, 0};
+  trace_t trace;
+
+  ps4SetFilter(ps4_channel_lx, &off);
+  runStep(&trace);
+  CHECK(memcmp(trace.input, trace.output, sizeof(trace.input)) == 0);
+}
+
+static void testStepResponse() {
+  static trace_t smoothed;
+  static trace_t adaptive;
+
+  // Fixed 1 Hz low-pass: quiet at rest, but slow to follow the step
+  ps4_filter_params_t fixed = {1.0f, 0, 1.0f};
+  ps4SetFilter(ps4_channel_lx, &fixed);
+  runStep(&smoothed);
+
+  // The same, with the cutoff rising with the speed
+  ps4_filter_params_t oneEuro = {1.0f, 0.05f, 1.0f};
+  ps4SetFilter(ps4_channel_lx, &oneEuro);
+  runStep(&adaptive);
+
+  // Compare the jitter once the filter settled on the resting stick
+  double inputJitter = deviation(&smoothed.input[STEP_AT / 2], STEP_AT / 2);
+  double smoothedJitter = deviation(&smoothed.output[STEP_AT / 2], STEP_AT / 2);
+  double adaptiveJitter = deviation(&adaptive.output[STEP_AT / 2], STEP_AT / 2);
+
+  printf("jitter at rest: input %.2f, 1 Hz %.2f, One-Euro %.2f\n", inputJitter, smoothedJitter, adaptiveJitter);
+  printf("90%% rise: 1 Hz %d reports, One-Euro %d reports\n", riseTime(&smoothed), riseTime(&adaptive));
+
+  CHECK(smoothedJitter < inputJitter / 4);
+  CHECK(adaptiveJitter < inputJitter / 2);
+  CHECK(riseTime(&smoothed) > 200);
+  CHECK(riseTime(&adaptive) < 16);
+  CHECK(peak(&adaptive) <= STEP_VALUE + NOISE);
+
+  // Back at the 1 Hz filter, a reset passes the next report through as is
+  ps4SetFilter(ps4_channel_lx, &fixed);
+  ps4_filter_reset();
+  ps4_t ps4;
+  memset(&ps4, 0, sizeof(ps4));
+  ps4.analog.stick.lx = 77;
+  ps4_filter_apply(&ps4);
+  CHECK_EQ(ps4.analog.stick.lx, 77);
+
+  ps4_filter_params_t off = {0, 0, 0};
+  ps4SetFilter(ps4_channel_lx, &off);
+}
+
+static void testBenchmark() {
+  ps4_filter_params_t oneEuro = {1.0f, 0.05f, 1.0f};
+  ps4_t ps4;
+
+  for (uint8_t channel = 0; channel < PS4_CHANNEL_COUNT; channel++) {
+    ps4SetFilter(channel, &oneEuro);
+  }
+
+  memset(&ps4, 0, sizeof(ps4));
+  int64_t start = fake_wall_ns();
+
+  for (uint32_t i = 0; i < BENCHMARK_REPORTS; i++) {
+    ps4.analog.stick.lx = (int8_t)i;
+    ps4.sensor.gyroscope.x = (int16_t)(i * 7);
+    ps4.timestamp += REPORT_INTERVAL_US;
+    ps4_filter_apply(&ps4);
+  }
+
+  int64_t ns = fake_wall_ns() - start;
+  printf("ps4_filter_apply, %d channels: %lld ns per report\n", PS4_CHANNEL_COUNT,
+         (long long)(ns / BENCHMARK_REPORTS));
+}
+
+int main() {
+  ps4Init();
+
+  testPassThrough();
+  testStepResponse();
+  testBenchmark();
+
+  return TEST_RESULT();
+}
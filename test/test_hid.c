@@ -0,0 +1,178 @@
+#include <string.h>
+
+#include "ps4_test.h"
+
+/* Queues HID control transactions and answers them as the controller
+ * would: checks each reply reaches the callback of the request in flight,
+ * that an unanswered request times out and lets the next one go, that a
+ * full queue refuses more, and that a waiting fire-and-forget report is
+ * replaced by the latest one */
+
+#define TIMEOUT_US (PS4_HID_TRANSACTION_TIMEOUT_MS * 1000)
+
+typedef struct {
+  uint32_t calls;
+  ps4_hid_result_t result;
+  uint8_t data[8];
+  uint16_t length;
+} reply_t;
+
+static void onReply(void* object, ps4_hid_result_t result, const uint8_t* data, uint16_t length) {
+  reply_t* reply = object;
+
+  reply->calls++;
+  reply->result = result;
+  reply->length = length;
+  memcpy(reply->data, data, length < sizeof(reply->data) ? length : sizeof(reply->data));
+}
+
+static void handshake(ps4_hid_result_t result) {
+  const uint8_t message[] = {hid_cmd_code_handshake | result};
+
+  ps4_hid_control_data(message, sizeof(message));
+}
+
+static void checkSent(uint8_t code, uint8_t reportId) {
+  CHECK_EQ(fake_l2cap.last_hid.code, code);
+  CHECK_EQ(fake_l2cap.last_hid.identifier, reportId);
+}
+
+static void testReplies() {
+  const uint8_t data[] = {0x01, 0x02};
+  const uint8_t report[] = {hid_cmd_code_data | hid_cmd_code_type_feature, 0x02, 0xAA, 0xBB};
+  reply_t get = {0};
+  reply_t set = {0};
+
+  fake_l2cap_reset();
+  CHECK(ps4GetReport(ps4_report_type_feature, 0x02, &onReply, &get));
+  CHECK(ps4SetReport(ps4_report_type_feature, 0x13, data, sizeof(data), &onReply, &set));
+
+  // One transaction at a time
+  CHECK_EQ(fake_l2cap.hid_sends, 1);
+  checkSent(hid_cmd_code_get_report | hid_cmd_code_type_feature, 0x02);
+
+  // The report goes to the request for it, and the next one is sent
+  ps4_hid_control_data(report, sizeof(report));
+  CHECK_EQ(get.calls, 1);
+  CHECK_EQ(get.result, ps4_hid_result_success);
+  CHECK_EQ(get.length, 3);
+  CHECK_EQ(get.data[0], 0x02);
+  CHECK_EQ(get.data[2], 0xBB);
+  CHECK_EQ(set.calls, 0);
+  CHECK_EQ(fake_l2cap.hid_sends, 2);
+  checkSent(hid_cmd_code_set_report | hid_cmd_code_type_feature, 0x13);
+  CHECK_EQ(fake_l2cap.last_hid_len, sizeof(data));
+
+  // The handshake result goes to the set
+  handshake(ps4_hid_result_invalid_report_id);
+  CHECK_EQ(set.calls, 1);
+  CHECK_EQ(set.result, ps4_hid_result_invalid_report_id);
+  CHECK_EQ(set.length, 0);
+
+  // A reply with nothing in flight is dropped
+  handshake(ps4_hid_result_success);
+  CHECK_EQ(get.calls, 1);
+  CHECK_EQ(set.calls, 1);
+  CHECK(!fake_timer_active("ps4_hid"));
+}
+
+static void testTimeout() {
+  reply_t lost = {0};
+  reply_t next = {0};
+
+  fake_l2cap_reset();
+  CHECK(ps4GetReport(ps4_report_type_feature, 0x02, &onReply, &lost));
+  CHECK(ps4GetReport(ps4_report_type_feature, 0x05, &onReply, &next));
+  CHECK_EQ(fake_l2cap.hid_sends, 1);
+
+  fake_time_advance(TIMEOUT_US - 1);
+  CHECK_EQ(lost.calls, 0);
+  CHECK_EQ(fake_l2cap.hid_sends, 1);
+
+  // Unanswered, it fails and the queue moves on
+  fake_time_advance(1);
+  CHECK_EQ(lost.calls, 1);
+  CHECK_EQ(lost.result, ps4_hid_result_timeout);
+  CHECK_EQ(fake_l2cap.hid_sends, 2);
+  checkSent(hid_cmd_code_get_report | hid_cmd_code_type_feature, 0x05);
+
+  // With a timeout of its own
+  fake_time_advance(TIMEOUT_US - 1);
+  CHECK_EQ(next.calls, 0);
+  handshake(ps4_hid_result_not_ready);
+  CHECK_EQ(next.calls, 1);
+  CHECK_EQ(next.result, ps4_hid_result_not_ready);
+  fake_time_advance(TIMEOUT_US);
+  CHECK_EQ(lost.calls, 1);
+  CHECK_EQ(next.calls, 1);
+}
+
+static void testOverflow() {
+  reply_t replies[PS4_HID_QUEUE_SIZE + 1];
+
+  memset(replies, 0, sizeof(replies));
+  fake_l2cap_reset();
+
+  for (uint8_t i = 0; i < PS4_HID_QUEUE_SIZE; i++) {
+    CHECK(ps4GetReport(ps4_report_type_feature, i, &onReply, &replies[i]));
+  }
+
+  // Refused without calling back, so the caller can retry later
+  CHECK(!ps4GetReport(ps4_report_type_feature, PS4_HID_QUEUE_SIZE, &onReply, &replies[PS4_HID_QUEUE_SIZE]));
+
+  // The queued ones are answered in order
+  for (uint8_t i = 0; i < PS4_HID_QUEUE_SIZE; i++) {
+    checkSent(hid_cmd_code_get_report | hid_cmd_code_type_feature, i);
+    handshake(ps4_hid_result_success);
+    CHECK_EQ(replies[i].calls, 1);
+  }
+  CHECK_EQ(fake_l2cap.hid_sends, PS4_HID_QUEUE_SIZE);
+  CHECK_EQ(replies[PS4_HID_QUEUE_SIZE].calls, 0);
+
+  // And there is room again
+  CHECK(ps4GetReport(ps4_report_type_feature, 0x02, &onReply, &replies[0]));
+  handshake(ps4_hid_result_success);
+  CHECK_EQ(replies[0].calls, 2);
+}
+
+static void testReplace() {
+  const uint8_t first[] = {0x01};
+  const uint8_t latest[] = {0x02};
+  reply_t busy = {0};
+
+  fake_l2cap_reset();
+  CHECK(ps4GetReport(ps4_report_type_feature, 0x02, &onReply, &busy));
+
+  // Fire-and-forget reports waiting behind it keep only the latest state
+  CHECK(ps4SetReport(ps4_report_type_output, 0x11, first, sizeof(first), NULL, NULL));
+  CHECK(ps4SetReport(ps4_report_type_output, 0x11, latest, sizeof(latest), NULL, NULL));
+
+  handshake(ps4_hid_result_success);
+  CHECK_EQ(fake_l2cap.hid_sends, 2);
+  checkSent(hid_cmd_code_set_report | hid_cmd_code_type_output, 0x11);
+  CHECK_EQ(fake_l2cap.last_hid.data[0], 0x02);
+
+  handshake(ps4_hid_result_success);
+  CHECK_EQ(fake_l2cap.hid_sends, 2);
+
+  // One that is already sent is not replaced
+  CHECK(ps4SetReport(ps4_report_type_output, 0x11, first, sizeof(first), NULL, NULL));
+  CHECK(ps4SetReport(ps4_report_type_output, 0x11, latest, sizeof(latest), NULL, NULL));
+  CHECK_EQ(fake_l2cap.hid_sends, 3);
+  CHECK_EQ(fake_l2cap.last_hid.data[0], 0x01);
+  handshake(ps4_hid_result_success);
+  CHECK_EQ(fake_l2cap.hid_sends, 4);
+  CHECK_EQ(fake_l2cap.last_hid.data[0], 0x02);
+  handshake(ps4_hid_result_success);
+}
+
+int main() {
+  ps4Init();
+
+  testReplies();
+  testTimeout();
+  testOverflow();
+  testReplace();
+
+  return TEST_RESULT();
+}
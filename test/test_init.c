@@ -0,0 +1,108 @@
+#include <malloc.h>
+#include <string.h>
+
+#include "fake_bluedroid.h"
+
+/* Brings the device up through sppInit and through gapInit on a fake
+ * Bluedroid and compares the two: the stack calls each makes, the events
+ * it waits for until the device is connectable, and the host heap and
+ * time that takes. The fake takes no heap or time of its own, so these
+ * are the library's share; the memory of the SPP server and the round trip
+ * through the Bluedroid task only show on a device, in the log of
+ * ps4_gap_connectable. */
+
+#define BRING_UPS 10000
+
+typedef struct {
+  uint32_t calls;   // into Bluedroid
+  uint32_t events;  // delivered before the device was connectable
+  int64_t heap;     // bytes of host heap still taken after the bring-up
+  int64_t ns;       // per bring-up
+} bring_up_t;
+
+static bring_up_t bringUp(void (*init)()) {
+  bring_up_t result = {0};
+
+  fake_bluedroid_reset();
+  init();
+  while (!fake_bluedroid.is_connectable && fake_bluedroid.pending_events > 0) {
+    result.events += fake_bluedroid_run();
+  }
+  result.calls = fake_bluedroid.calls;
+
+  return result;
+}
+
+static bring_up_t measure(void (*init)()) {
+  bring_up_t result = bringUp(init);  // leaves nothing unallocated for later
+
+  size_t heap = mallinfo2().uordblks;
+  result = bringUp(init);
+  result.heap = (int64_t)mallinfo2().uordblks - (int64_t)heap;
+
+  int64_t start = fake_wall_ns();
+  for (uint32_t i = 0; i < BRING_UPS; i++) {
+    bringUp(init);
+  }
+  result.ns = (fake_wall_ns() - start) / BRING_UPS;
+
+  return result;
+}
+
+static void report(const char* name, const bring_up_t* bring_up) {
+  printf("%s: Bluedroid calls %u, events waited for %u, heap %lld bytes, time %lld ns\n", name,
+         (unsigned)bring_up->calls, (unsigned)bring_up->events, (long long)bring_up->heap, (long long)bring_up->ns);
+}
+
+static void testSpp() {
+  // Connectable only once the SPP server is up
+  fake_bluedroid_reset();
+  sppInit();
+  CHECK_EQ(fake_bluedroid.controller_inits, 1);
+  CHECK_EQ(fake_bluedroid.bluedroid_enables, 1);
+  CHECK_EQ(fake_bluedroid.spp_inits, 1);
+  CHECK(!fake_bluedroid.is_connectable);
+
+  CHECK_EQ(fake_bluedroid_run(), 1);
+  CHECK(fake_bluedroid.is_connectable);
+  CHECK(fake_bluedroid.device_name != NULL && strcmp(fake_bluedroid.device_name, "ESP Host") == 0);
+  CHECK_EQ(fake_bluedroid.spp_servers, 1);
+}
+
+static void testGap() {
+  // Connectable before gapInit returns, without SPP
+  fake_bluedroid_reset();
+  gapInit();
+  CHECK_EQ(fake_bluedroid.controller_inits, 1);
+  CHECK_EQ(fake_bluedroid.bluedroid_enables, 1);
+  CHECK(fake_bluedroid.is_connectable);
+  CHECK(fake_bluedroid.device_name != NULL && strcmp(fake_bluedroid.device_name, "ESP Host") == 0);
+  CHECK(fake_bluedroid.spp_cb == NULL);
+  CHECK_EQ(fake_bluedroid.spp_inits, 0);
+  CHECK_EQ(fake_bluedroid.spp_servers, 0);
+  CHECK_EQ(fake_bluedroid_run(), 0);
+}
+
+static void testCompare() {
+  bring_up_t spp = measure(&sppInit);
+  bring_up_t gap = measure(&gapInit);
+
+  CHECK_EQ(spp.events, 1);
+  CHECK_EQ(gap.events, 0);
+  CHECK_EQ(spp.calls - gap.calls, 3);
+  CHECK(gap.heap <= spp.heap);
+
+  report("sppInit", &spp);
+  report("gapInit", &gap);
+  printf("gapInit saves: Bluedroid calls %u, events waited for %u, heap %lld bytes, time %lld ns\n",
+         (unsigned)(spp.calls - gap.calls), (unsigned)(spp.events - gap.events), (long long)(spp.heap - gap.heap),
+         (long long)(spp.ns - gap.ns));
+}
+
+int main() {
+  testSpp();
+  testGap();
+  testCompare();
+
+  return TEST_RESULT();
+}
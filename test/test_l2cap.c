@@ -0,0 +1,362 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fake_stack.h"
+
+/* Runs ps4_l2cap.c on the fake stack: pages controllers with
+ * ps4StartReconnect, raises the stack events the controllers would cause
+ * and checks the channels opened and closed, the backoff between rounds
+ * and the connection statistics. Then replays the configuration exchange
+ * of a controller connecting, refusing the profile of a channel and
+ * then taking it, and refuses a controller that is not on the allow list. */
+
+#define MS 1000
+
+static const uint8_t controllers[3][6] = {
+  {0x01, 0x01, 0x01, 0x01, 0x01, 0x01},
+  {0x02, 0x02, 0x02, 0x02, 0x02, 0x02},
+  {0x03, 0x03, 0x03, 0x03, 0x03, 0x03},
+};
+
+static void connectCfm(uint16_t cid, uint16_t result) {
+  fake_stack.appl->pL2CA_ConnectCfm_Cb(cid, result);
+}
+
+static void configCfm(uint16_t cid, uint16_t result) {
+  tL2CAP_CFG_INFO cfg;
+
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.result = result;
+  fake_stack.appl->pL2CA_ConfigCfm_Cb(cid, &cfg);
+}
+
+/* The page of the last request times out */
+static void pageTimeout() {
+  connectCfm(fake_stack_last_request()->cid, L2CAP_CONN_NO_LINK);
+  fake_time_advance(0);
+}
+
+static void checkPaged(const uint8_t* addr, uint16_t psm) {
+  CHECK_EQ(fake_stack_last_request()->psm, psm);
+  CHECK(memcmp(fake_stack_last_request()->addr, addr, 6) == 0);
+}
+
+static void connectInd(const uint8_t* controller, uint16_t cid, uint16_t psm) {
+  uint8_t addr[6];
+
+  memcpy(addr, controller, sizeof(addr));
+  fake_stack.appl->pL2CA_ConnectInd_Cb(addr, cid, psm, 1);
+}
+
+/* An input report arriving on the interrupt channel */
+static void report(uint16_t cid) {
+  BT_HDR* p_buf = malloc(sizeof(BT_HDR) + FAKE_REPORT_SIZE);
+
+  memset(p_buf, 0, sizeof(BT_HDR) + FAKE_REPORT_SIZE);
+  p_buf->length = FAKE_REPORT_SIZE;
+  fake_stack.appl->pL2CA_DataInd_Cb(cid, p_buf);
+}
+
+static void testPageOrder() {
+  CHECK(ps4StartReconnect(&controllers[0][0], 3));
+  fake_time_advance(0);
+
+  // The control channel is opened first
+  CHECK_EQ(fake_stack.request_count, 1);
+  checkPaged(controllers[0], BT_PSM_HID_CONTROL);
+
+  // A controller out of range moves on to the next one at once
+  pageTimeout();
+  CHECK_EQ(fake_stack.request_count, 2);
+  checkPaged(controllers[1], BT_PSM_HID_CONTROL);
+  pageTimeout();
+  CHECK_EQ(fake_stack.request_count, 3);
+  checkPaged(controllers[2], BT_PSM_HID_CONTROL);
+
+  // After the round, the next one waits 1s
+  pageTimeout();
+  CHECK_EQ(fake_stack.request_count, 3);
+  fake_time_advance(PS4_RECONNECT_BACKOFF_MS * MS - 1);
+  CHECK_EQ(fake_stack.request_count, 3);
+  fake_time_advance(1);
+  CHECK_EQ(fake_stack.request_count, 4);
+  checkPaged(controllers[0], BT_PSM_HID_CONTROL);
+
+  // Then twice as long
+  pageTimeout();
+  pageTimeout();
+  pageTimeout();
+  CHECK_EQ(fake_stack.request_count, 6);
+  fake_time_advance(2 * PS4_RECONNECT_BACKOFF_MS * MS - 1);
+  CHECK_EQ(fake_stack.request_count, 6);
+  fake_time_advance(1);
+  CHECK_EQ(fake_stack.request_count, 7);
+  checkPaged(controllers[0], BT_PSM_HID_CONTROL);
+}
+
+static void testConnect() {
+  uint16_t control = fake_stack_last_request()->cid;
+  int64_t start = fake_now;
+
+  // The interrupt channel follows the control channel
+  connectCfm(control, L2CAP_CONN_OK);
+  CHECK_EQ(fake_stack.request_count, 8);
+  checkPaged(controllers[0], BT_PSM_HID_INTERRUPT);
+  uint16_t interrupt = fake_stack_last_request()->cid;
+  connectCfm(interrupt, L2CAP_CONN_OK);
+
+  // Connected once both channels are configured, which stops paging
+  configCfm(control, L2CAP_CFG_OK);
+  CHECK_EQ(fake_stack.data_writes, 0);
+  configCfm(interrupt, L2CAP_CFG_OK);
+  CHECK(fake_stack.data_writes > 0);
+  CHECK(!fake_timer_active("ps4_reconnect"));
+
+  // And ready with the first report
+  fake_time_advance(180 * MS);
+  CHECK(!ps4IsConnected());
+  report(interrupt);
+  CHECK(ps4IsConnected());
+
+  ps4_stats_t stats;
+  ps4GetStats(&stats);
+  CHECK_EQ(stats.reconnect_attempts, 7);
+  CHECK_EQ(stats.reconnects, 1);
+  CHECK_EQ(stats.connections, 1);
+  CHECK_EQ(stats.time_to_first_report_ms, (fake_now - start) / MS);
+  CHECK_EQ(stats.time_to_first_report_ms, 180);
+}
+
+static void testTeardown() {
+  uint16_t interrupt = fake_stack_last_request()->cid;
+
+  // Paging starts over 1s after the controller left
+  fake_stack.appl->pL2CA_DisconnectInd_Cb(interrupt, true);
+  CHECK(!ps4IsConnected());
+  CHECK_EQ(fake_stack.disconnect_rsps, 1);
+  CHECK(fake_timer_active("ps4_reconnect"));
+  fake_time_advance(PS4_RECONNECT_BACKOFF_MS * MS);
+  CHECK_EQ(fake_stack.request_count, 9);
+  checkPaged(controllers[0], BT_PSM_HID_CONTROL);
+
+  // A refused interrupt channel closes the control channel too
+  uint16_t control = fake_stack_last_request()->cid;
+  connectCfm(control, L2CAP_CONN_OK);
+  connectCfm(fake_stack_last_request()->cid, L2CAP_CONN_SECURITY_BLOCK);
+  CHECK_EQ(fake_stack.disconnect_reqs, 1);
+  CHECK_EQ(fake_stack.last_disconnect_cid, control);
+  fake_time_advance(0);
+  CHECK_EQ(fake_stack.request_count, 11);
+  checkPaged(controllers[1], BT_PSM_HID_CONTROL);
+
+  // A request the stack does not take moves on as well
+  fake_stack.refuse_requests = true;
+  pageTimeout();
+  fake_stack.refuse_requests = false;
+  CHECK_EQ(fake_stack.request_count, 11);
+  CHECK(fake_timer_active("ps4_reconnect"));
+  fake_time_advance(PS4_RECONNECT_BACKOFF_MS * MS);
+  CHECK_EQ(fake_stack.request_count, 12);
+  checkPaged(controllers[0], BT_PSM_HID_CONTROL);
+}
+
+static void testBonds() {
+  // No more pages once stopped, even when the one under way fails
+  ps4StopReconnect();
+  pageTimeout();
+  fake_time_advance(100000 * MS);
+  CHECK_EQ(fake_stack.request_count, 12);
+  CHECK(!fake_timer_active("ps4_reconnect"));
+
+  // Without a list, the controllers of the bonding store are paged
+  CHECK(ps4StartReconnect(NULL, 0));
+  fake_time_advance(0);
+  CHECK_EQ(fake_stack.request_count, 13);
+  checkPaged(controllers[0], BT_PSM_HID_CONTROL);
+  ps4StopReconnect();
+}
+
+static void testNegotiation() {
+  const ps4_channel_profile_t profile = {
+    .mtu = 185,
+    .flush_timeout_ms = 20,
+    .qos = true,
+    .service_type = 2,
+    .token_rate = 8000,
+    .peak_bandwidth = 16000,
+    .latency_us = 5000,
+  };
+  const ps4_channel_profile_t none = {0};
+  tL2CAP_CFG_INFO cfg;
+
+  ps4SetChannelProfile(ps4_hid_channel_control, &none);
+  ps4SetChannelProfile(ps4_hid_channel_interrupt, &profile);
+  fake_stack_reset();
+
+  // Without a profile the control channel asks for nothing
+  connectInd(controllers[2], 0x60, BT_PSM_HID_CONTROL);
+  CHECK_EQ(fake_stack.config_reqs, 1);
+  CHECK_EQ(fake_stack.last_config_cid, 0x60);
+  CHECK(!fake_stack.last_config.mtu_present);
+  CHECK(!fake_stack.last_config.flush_to_present);
+  CHECK(!fake_stack.last_config.qos_present);
+
+  // The controller's MTU is taken as it is
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.mtu_present = true;
+  cfg.mtu = 672;
+  fake_stack.appl->pL2CA_ConfigInd_Cb(0x60, &cfg);
+  CHECK_EQ(fake_stack.config_rsps, 1);
+  CHECK_EQ(fake_stack.last_config_rsp.result, L2CAP_CFG_OK);
+  configCfm(0x60, L2CAP_CFG_OK);
+
+  // The interrupt channel asks for its profile
+  connectInd(controllers[2], 0x61, BT_PSM_HID_INTERRUPT);
+  CHECK_EQ(fake_stack.config_reqs, 2);
+  CHECK_EQ(fake_stack.last_config_cid, 0x61);
+  CHECK(fake_stack.last_config.mtu_present);
+  CHECK_EQ(fake_stack.last_config.mtu, 185);
+  CHECK(fake_stack.last_config.flush_to_present);
+  CHECK_EQ(fake_stack.last_config.flush_to, 20);
+  CHECK(fake_stack.last_config.qos_present);
+  CHECK_EQ(fake_stack.last_config.qos.service_type, 2);
+  CHECK_EQ(fake_stack.last_config.qos.token_rate, 8000);
+  CHECK_EQ(fake_stack.last_config.qos.peak_bandwidth, 16000);
+  CHECK_EQ(fake_stack.last_config.qos.latency, 5000);
+
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.flush_to_present = true;
+  cfg.flush_to = 40;
+  fake_stack.appl->pL2CA_ConfigInd_Cb(0x61, &cfg);
+
+  // Refused once, it is asked for again without the profile
+  configCfm(0x61, L2CAP_CFG_UNACCEPTABLE_PARAMS);
+  CHECK_EQ(fake_stack.config_reqs, 3);
+  CHECK_EQ(fake_stack.last_config_cid, 0x61);
+  CHECK(!fake_stack.last_config.mtu_present);
+  CHECK(!fake_stack.last_config.flush_to_present);
+  CHECK(!fake_stack.last_config.qos_present);
+  CHECK_EQ(fake_stack.data_writes, 0);
+
+  // Refused again, it is not asked for a third time and the channel stays
+  configCfm(0x61, L2CAP_CFG_UNACCEPTABLE_PARAMS);
+  CHECK_EQ(fake_stack.config_reqs, 3);
+  CHECK(fake_stack.data_writes > 0);
+
+  ps4_stats_t stats;
+  ps4GetStats(&stats);
+  CHECK_EQ(stats.mtu[ps4_hid_channel_control], 672);
+  CHECK_EQ(stats.mtu[ps4_hid_channel_interrupt], L2CAP_DEFAULT_MTU);
+  CHECK_EQ(stats.flush_timeout_ms[ps4_hid_channel_control], L2CAP_NO_AUTOMATIC_FLUSH);
+  CHECK_EQ(stats.flush_timeout_ms[ps4_hid_channel_interrupt], 40);
+  CHECK(stats.profile_refused);
+  CHECK(stats.profile_accepted[ps4_hid_channel_control]);
+  CHECK(!stats.profile_accepted[ps4_hid_channel_interrupt]);
+
+  // Being paged is not a reconnect
+  report(0x61);
+  CHECK(ps4IsConnected());
+  ps4GetStats(&stats);
+  CHECK_EQ(stats.connections, 2);
+  CHECK_EQ(stats.reconnects, 1);
+}
+
+static void testAccepted() {
+  ps4_stats_t stats;
+
+  fake_stack.appl->pL2CA_DisconnectInd_Cb(0x61, true);
+  fake_stack_reset();
+
+  connectInd(controllers[2], 0x62, BT_PSM_HID_CONTROL);
+  configCfm(0x62, L2CAP_CFG_OK);
+  connectInd(controllers[2], 0x63, BT_PSM_HID_INTERRUPT);
+  CHECK(fake_stack.last_config.qos_present);
+
+  // Taken the first time, the profile holds
+  configCfm(0x63, L2CAP_CFG_OK);
+  CHECK_EQ(fake_stack.config_reqs, 2);
+  ps4GetStats(&stats);
+  CHECK(stats.profile_accepted[ps4_hid_channel_control]);
+  CHECK(stats.profile_accepted[ps4_hid_channel_interrupt]);
+}
+
+/* The next address from *next on whose hash is home. Hashes equal in
+ * the low 5 bits collide in an allow list of 16 slots as well as of 32 */
+static void findAddress(uint8_t addr[6], uint8_t home, uint16_t* next) {
+  do {
+    uint8_t candidate[6] = {0xA0, 0x00, 0x00, 0x00, *next >> 8, *next & 0xFF};
+    memcpy(addr, candidate, sizeof(candidate));
+    (*next)++;
+  } while (ps4_address_hash(addr, 32) != home);
+}
+
+static void testAllowList() {
+  uint8_t chain[5][6];
+  uint16_t next = 0;
+
+  // Three addresses probing from the same slot, one from the slot after
+  // it, which probes past them, and one at home at the end of the chain
+  findAddress(chain[0], 0, &next);
+  findAddress(chain[1], 0, &next);
+  findAddress(chain[2], 0, &next);
+  findAddress(chain[3], 1, &next);
+  findAddress(chain[4], 4, &next);
+
+  ps4ClearAllowList();
+  for (uint8_t i = 0; i < 5; i++) {
+    CHECK(ps4AllowController(chain[i]));
+  }
+
+  // Removed from the middle, the ones after it are still found, and the
+  // one at home is not moved out of reach
+  ps4DisallowController(chain[1]);
+  CHECK(!ps4_allow_check(chain[1]));
+  CHECK(ps4_allow_check(chain[0]));
+  CHECK(ps4_allow_check(chain[2]));
+  CHECK(ps4_allow_check(chain[3]));
+  CHECK(ps4_allow_check(chain[4]));
+
+  // And added again, it is found
+  CHECK(ps4AllowController(chain[1]));
+  CHECK(ps4_allow_check(chain[1]));
+
+  // A controller not on the list is refused before anything is sent
+  ps4_stats_t stats;
+  ps4GetStats(&stats);
+  uint32_t rejected = stats.rejected_connections;
+  fake_stack_reset();
+  connectInd(controllers[0], 0x70, BT_PSM_HID_CONTROL);
+  CHECK_EQ(fake_stack.connect_rsps, 1);
+  CHECK_EQ(fake_stack.last_connect_rsp_result, L2CAP_CONN_SECURITY_BLOCK);
+  CHECK_EQ(fake_stack.config_reqs, 0);
+  ps4GetStats(&stats);
+  CHECK_EQ(stats.rejected_connections, rejected + 1);
+
+  // One on it is accepted
+  connectInd(chain[3], 0x70, BT_PSM_HID_CONTROL);
+  CHECK_EQ(fake_stack.last_connect_rsp_result, L2CAP_CONN_OK);
+  CHECK_EQ(fake_stack.config_reqs, 1);
+  ps4GetStats(&stats);
+  CHECK_EQ(stats.rejected_connections, rejected + 1);
+
+  // And with the list empty again, every one is
+  ps4ClearAllowList();
+  connectInd(controllers[0], 0x72, BT_PSM_HID_CONTROL);
+  CHECK_EQ(fake_stack.last_connect_rsp_result, L2CAP_CONN_OK);
+  CHECK_EQ(fake_stack.config_reqs, 2);
+}
+
+int main() {
+  ps4SetStorage(fake_storage());
+  ps4Init();
+
+  testPageOrder();
+  testConnect();
+  testTeardown();
+  testBonds();
+  testNegotiation();
+  testAccepted();
+  testAllowList();
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,106 @@
+#include <string.h>
+
+#include "ps4_test.h"
+
+/* Runs the lightbar modes on the simulated timer and checks the colors
+ * sent, in particular that cycling through the hues keeps the gradient of
+ * the level and battery modes */
+
+static uint32_t acknowledged = 0;
+
+/* The controller acknowledges each output report, which lets the next
+ * one go out */
+static void acknowledge() {
+  static const uint8_t handshake[] = {hid_cmd_code_handshake};
+
+  while (fake_l2cap.hid_sends != acknowledged) {
+    acknowledged = fake_l2cap.hid_sends;
+    ps4_hid_control_data(handshake, sizeof(handshake));
+  }
+}
+
+static void advance(uint32_t ms) {
+  for (uint32_t i = 0; i < ms / PS4_LIGHTBAR_TICK_MS; i++) {
+    fake_time_advance(PS4_LIGHTBAR_TICK_MS * 1000);
+    acknowledge();
+  }
+}
+
+static void checkColor(uint8_t r, uint8_t g, uint8_t b) {
+  acknowledge();
+  CHECK_EQ(fake_l2cap.last_hid.data[ps4_control_packet_index_red], r);
+  CHECK_EQ(fake_l2cap.last_hid.data[ps4_control_packet_index_green], g);
+  CHECK_EQ(fake_l2cap.last_hid.data[ps4_control_packet_index_blue], b);
+}
+
+static void connect(uint8_t* packet) {
+  fake_report(packet);
+  ps4ConnectEvent(1);
+  fake_time_advance(1250);
+  parsePacket(packet);  // the first report only completes the connection
+  acknowledge();
+}
+
+static void testGradientSurvivesCycle() {
+  uint8_t packet[FAKE_REPORT_SIZE];
+  const uint8_t blue[] = {0, 0, 255};
+  const uint8_t white[] = {255, 255, 255};
+
+  connect(packet);
+
+  ps4LightbarSetGradient(blue, white);
+  ps4LightbarLevel(0);
+  checkColor(0, 0, 255);
+  ps4LightbarLevel(255);
+  checkColor(255, 255, 255);
+
+  // A third of the way around the wheel is green
+  ps4LightbarCycle(3000);
+  advance(1000);
+  checkColor(0, 255, 0);
+  CHECK(fake_timer_active("ps4_lightbar"));
+
+  // Back on the gradient, which the cycle must not have replaced
+  ps4LightbarLevel(0);
+  CHECK(!fake_timer_active("ps4_lightbar"));
+  checkColor(0, 0, 255);
+  ps4LightbarLevel(255);
+  checkColor(255, 255, 255);
+
+  ps4LightbarCycle(3000);
+  advance(500);
+  ps4LightbarBattery();
+  packet[42] = 10;  // battery full
+  fake_time_advance(1250);
+  parsePacket(packet);
+  checkColor(255, 255, 255);
+
+  ps4LightbarStop();
+}
+
+static void testBreathe() {
+  uint8_t peak = 0;
+  uint8_t low = 255;
+
+  ps4LightbarBreathe(255, 0, 0, 1000);
+  for (uint32_t ms = 0; ms < 1000; ms += PS4_LIGHTBAR_TICK_MS) {
+    advance(PS4_LIGHTBAR_TICK_MS);
+    uint8_t red = fake_l2cap.last_hid.data[ps4_control_packet_index_red];
+    peak = red > peak ? red : peak;
+    low = red < low ? red : low;
+  }
+
+  CHECK_EQ(peak, 255);
+  CHECK(low <= 1);
+  ps4LightbarStop();
+  CHECK(!fake_timer_active("ps4_lightbar"));
+}
+
+int main() {
+  ps4Init();
+
+  testGradientSurvivesCycle();
+  testBreathe();
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,111 @@
+#include <string.h>
+
+#include "ps4_test.h"
+
+/* Parses reports through the v2 callbacks, which get pointers to the
+ * library-owned record, and compares the cost per report with the v1
+ * callbacks, which get their own copies, and with the report path from
+ * before the v2 callbacks */
+
+#define BENCHMARK_REPORTS 200000
+
+static const ps4_t* last_ps4 = NULL;
+static ps4_event_t last_event;
+static uint32_t v2_calls = 0;
+static uint32_t v1_calls = 0;
+static volatile int32_t sink = 0;
+
+static void eventV2(const ps4_t* ps4, const ps4_event_t* event) {
+  last_ps4 = ps4;
+  last_event = *event;
+  v2_calls++;
+}
+
+static void benchmarkV2(const ps4_t* ps4, const ps4_event_t* event) { sink += ps4->analog.stick.lx; }
+
+static void benchmarkV1(ps4_t ps4, ps4_event_t event) {
+  sink += ps4.analog.stick.lx;
+  v1_calls++;
+}
+
+static void feed(uint8_t* packet) {
+  fake_time_advance(1250);
+  parsePacket(packet);
+}
+
+static void testEvents() {
+  uint8_t packet[FAKE_REPORT_SIZE];
+  fake_report(packet);
+
+  ps4SetEventCallbackV2(&eventV2);
+  ps4ConnectEvent(1);
+  feed(packet);  // the first report only completes the connection
+  CHECK_EQ(v2_calls, 0);
+
+  packet[17] |= 0x20;  // cross
+  packet[13] = 0xFF;   // lx fully right
+  feed(packet);
+  CHECK_EQ(v2_calls, 1);
+  CHECK(last_ps4 != NULL);
+  CHECK_EQ(last_ps4->analog.stick.lx, 127);
+  CHECK_EQ(last_ps4->button.mask, ps4_button_mask_cross);
+  CHECK_EQ(last_event.button_down.mask, ps4_button_mask_cross);
+  CHECK_EQ(last_event.button_up.mask, 0);
+
+  const ps4_t* record = last_ps4;
+  packet[17] &= ~0x20;
+  feed(packet);
+  CHECK(last_ps4 == record);  // the same record every report, nothing copied
+  CHECK_EQ(last_event.button_down.mask, 0);
+  CHECK_EQ(last_event.button_up.mask, ps4_button_mask_cross);
+
+  ps4SetEventCallbackV2(NULL);
+}
+
+static int64_t benchmark(void (*parse)(uint8_t*), uint8_t* packet) {
+  int64_t start = fake_wall_ns();
+
+  for (uint32_t i = 0; i < BENCHMARK_REPORTS; i++) {
+    packet[13] = (uint8_t)i;
+    fake_now += 1250;
+    parse(packet);
+  }
+
+  return (fake_wall_ns() - start) / (BENCHMARK_REPORTS / 1000);
+}
+
+static void testBenchmark() {
+  uint8_t packet[FAKE_REPORT_SIZE];
+  fake_report(packet);
+
+  baseline_init(&sink);
+  int32_t before = sink;
+  int64_t baseline_ps = benchmark(&baseline_parse_packet, packet);
+  CHECK(sink != before);
+
+  ps4SetEventCallbackV2(&benchmarkV2);
+  int64_t v2_ps = benchmark(&parsePacket, packet);
+  ps4SetEventCallbackV2(NULL);
+
+  ps4SetEventCallback(&benchmarkV1);
+  int64_t v1_ps = benchmark(&parsePacket, packet);
+  ps4SetEventCallback(NULL);
+
+  CHECK_EQ(v1_calls, BENCHMARK_REPORTS);
+
+  printf("baseline parsePacket: %lld.%03lld us per report\n", (long long)baseline_ps / 1000000,
+         (long long)baseline_ps / 1000 % 1000);
+  printf("parsePacket with a v2 callback: %lld.%03lld us per report\n", (long long)v2_ps / 1000000,
+         (long long)v2_ps / 1000 % 1000);
+  printf("parsePacket with a v1 callback: %lld.%03lld us per report\n", (long long)v1_ps / 1000000,
+         (long long)v1_ps / 1000 % 1000);
+}
+
+int main() {
+  ps4Init();
+
+  testEvents();
+  testBenchmark();
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ps4_test.h"
+
+/* Feeds a gyroscope channel a step, a ramp and a reversal, and after
+ * every report checks the prediction against the damped curve: it grows
+ * as h * (2 - h / H) up to the horizon H and stays there, so it never
+ * goes further than the prediction at the horizon. On a steady ramp that
+ * is half the distance travelled in the horizon. */
+
+#define INTERVAL_US 1250
+#define HORIZON_US PS4_PREDICT_MAX_HORIZON_US
+#define STEP 1000
+#define RAMP 40  // per report
+
+static ps4_t report;
+static uint32_t reports = 0;
+
+static int32_t predictAt(int64_t horizon) {
+  ps4_t predicted;
+
+  CHECK(ps4Predict(horizon, &predicted));
+  return predicted.sensor.gyroscope.x;
+}
+
+/* The prediction at each horizon against the damped curve through the
+ * one at the horizon, allowing a unit for the rounding of each */
+static int32_t checkDamped() {
+  int32_t now = predictAt(0);
+  int32_t reach = predictAt(HORIZON_US) - now;
+
+  for (int64_t horizon = 0; horizon <= 4 * HORIZON_US; horizon += HORIZON_US / 8) {
+    double h = horizon < HORIZON_US ? (double)horizon / HORIZON_US : 1.0;
+    int32_t displacement = predictAt(horizon) - now;
+
+    CHECK(abs(displacement) <= abs(reach));
+    CHECK(abs(displacement - (int32_t)(reach * h * (2 - h))) <= 1);
+  }
+
+  return reach;
+}
+
+static void deliver(int32_t value) {
+  report.sensor.gyroscope.x = value;
+  report.timestamp += INTERVAL_US;
+  ps4_predict_update(&report);
+  reports++;
+}
+
+static void testDisabled() {
+  ps4_t predicted;
+
+  memset(&report, 0, sizeof(report));
+  ps4SetPrediction(false);
+  deliver(0);
+  CHECK(!ps4Predict(0, &predicted));
+
+  // Nothing to predict from until the first report
+  ps4SetPrediction(true);
+  CHECK(!ps4Predict(0, &predicted));
+  deliver(0);
+  CHECK(ps4Predict(0, &predicted));
+}
+
+static void testStep() {
+  int32_t max_reach = 0;
+
+  for (int i = 0; i < 100; i++) {
+    deliver(0);
+    CHECK_EQ(checkDamped(), 0);
+  }
+
+  for (int i = 0; i < 200; i++) {
+    deliver(STEP);
+    int32_t reach = checkDamped();
+    max_reach = reach > max_reach ? reach : max_reach;
+  }
+
+  // Settled on the new value
+  CHECK(abs(predictAt(0) - STEP) <= 1);
+  CHECK(abs(predictAt(HORIZON_US) - STEP) <= 1);
+  printf("furthest reach after the step: %d\n", (int)max_reach);
+}
+
+static void testReversal() {
+  int32_t value = STEP;
+  int32_t reach = 0;
+
+  // On a steady ramp the prediction reaches half the distance the ramp
+  // covers in the horizon
+  for (int i = 0; i < 200; i++) {
+    value += RAMP;
+    deliver(value);
+    reach = checkDamped();
+  }
+  int32_t expected = RAMP * HORIZON_US / INTERVAL_US / 2;
+  CHECK(abs(reach - expected) <= 2);
+  CHECK(abs(predictAt(0) - value) <= 2);
+
+  // Turning around, it follows within the same bound
+  for (int i = 0; i < 200; i++) {
+    value -= RAMP;
+    deliver(value);
+    reach = checkDamped();
+  }
+  CHECK(abs(reach + expected) <= 2);
+
+  // And a reset forgets the speed
+  ps4_predict_reset();
+  deliver(value);
+  CHECK_EQ(checkDamped(), 0);
+  CHECK_EQ(predictAt(0), value);
+}
+
+int main() {
+  ps4Init();
+
+  testDisabled();
+  testStep();
+  testReversal();
+
+  return TEST_RESULT();
+}
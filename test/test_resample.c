@@ -0,0 +1,149 @@
+#include <string.h>
+
+#include "ps4_test.h"
+
+/* Resamples a ramp on the left stick after the application stopped
+ * polling for a while, and checks that the cursor skips to the kept
+ * reports and never interpolates from a report after the sample time.
+ * Then stops cursors more than once. */
+
+#define REPORT_TICKS 234  // controller clock, 16/3 us each
+#define REPORT_INTERVAL_US (REPORT_TICKS * 16 / 3)
+#define REPORTS 800  // a second of reports while nobody polls
+#define RATE 1000
+#define DELAY_US 4000
+
+typedef struct {
+  int64_t time;
+  int8_t lx;
+} report_t;
+
+static report_t reports[REPORTS];
+static uint32_t report_count = 0;
+static uint16_t ticks = 0;
+
+static void recordReport(const ps4_t* ps4, const ps4_event_t* event) {
+  if (report_count < REPORTS) {
+    reports[report_count].time = ps4_report_time();
+    reports[report_count].lx = ps4->analog.stick.lx;
+    report_count++;
+  }
+}
+
+static void feed(uint8_t* packet, uint8_t lx) {
+  ticks += REPORT_TICKS;
+  packet[13] = lx;
+  packet[22] = ticks & 0xFF;
+  packet[23] = ticks >> 8;
+
+  fake_time_advance(REPORT_INTERVAL_US);
+  parsePacket(packet);
+}
+
+/* The reports around a sample time, which the sample must lie between */
+static void checkSample(const ps4_resample_t* sample) {
+  uint32_t i = 0;
+  while (i + 1 < report_count && reports[i + 1].time <= sample->time) {
+    i++;
+  }
+
+  CHECK(reports[i].time <= sample->time);
+
+  int8_t low = reports[i].lx;
+  int8_t high = i + 1 < report_count ? reports[i + 1].lx : low;
+  if (high < low) {
+    int8_t swap = low;
+    low = high;
+    high = swap;
+  }
+  CHECK(sample->state.analog.stick.lx >= low);
+  CHECK(sample->state.analog.stick.lx <= high);
+}
+
+static void testStall() {
+  uint8_t packet[FAKE_REPORT_SIZE];
+  ps4_resampler_t cursor;
+  ps4_resample_t sample;
+  uint32_t samples = 0;
+  uint32_t presses = 0;
+
+  fake_report(packet);
+  ps4SetEventCallbackV2(&recordReport);
+  ps4ConnectEvent(1);
+  feed(packet, 0x80);  // the first report only completes the connection
+
+  ps4ResamplerInit(&cursor, RATE, DELAY_US);
+  CHECK(!ps4ResamplerNext(&cursor, &sample));
+
+  // A second of ramps with one press of cross near the end, while the
+  // application is busy elsewhere
+  report_count = 0;
+  for (uint32_t i = 0; i < REPORTS; i++) {
+    packet[17] = i == REPORTS - 8 ? 0x28 : 0x08;
+    feed(packet, 0x90 + i % 64);
+  }
+
+  while (ps4ResamplerNext(&cursor, &sample)) {
+    checkSample(&sample);
+    presses += sample.presses[__builtin_ctz(ps4_button_mask_cross)];
+    samples++;
+  }
+
+  // Only the samples the kept reports cover, not one per period of the
+  // second that went by
+  int64_t covered = fake_now - DELAY_US - reports[REPORTS - PS4_RESAMPLE_HISTORY].time;
+  printf("%u samples after %d ms without polling\n", (unsigned)samples,
+         REPORTS * REPORT_INTERVAL_US / 1000);
+  CHECK(samples <= covered / (1000000 / RATE) + 1);
+  CHECK(samples >= covered / (1000000 / RATE) - 1);
+  CHECK_EQ(presses, 1);
+
+  // Once stopped, the reports are no longer kept
+  ps4ResamplerDeinit(&cursor);
+  feed(packet, 0x80);
+  ps4ResamplerInit(&cursor, RATE, 0);
+  fake_time_advance(1000);
+  CHECK(!ps4ResamplerNext(&cursor, &sample));
+  ps4ResamplerDeinit(&cursor);
+
+  ps4SetEventCallbackV2(NULL);
+}
+
+static void testRepeatedDeinit() {
+  uint8_t packet[FAKE_REPORT_SIZE];
+  ps4_resampler_t first;
+  ps4_resampler_t second;
+  ps4_resample_t sample;
+
+  fake_report(packet);
+  ps4ResamplerInit(&first, RATE, 0);
+  ps4ResamplerInit(&second, RATE, 0);
+
+  // Stopping a cursor twice does not stop the other one
+  ps4ResamplerDeinit(&first);
+  ps4ResamplerDeinit(&first);
+  feed(packet, 0x80);
+  fake_time_advance(1000);
+  CHECK(ps4ResamplerNext(&second, &sample));
+  CHECK(!ps4ResamplerNext(&first, &sample));
+
+  ps4ResamplerDeinit(&second);
+  ps4ResamplerDeinit(&second);
+  CHECK(!ps4ResamplerNext(&second, &sample));
+
+  // And the count of started cursors is right again
+  ps4ResamplerInit(&first, RATE, 0);
+  feed(packet, 0x80);
+  fake_time_advance(1000);
+  CHECK(ps4ResamplerNext(&first, &sample));
+  ps4ResamplerDeinit(&first);
+}
+
+int main() {
+  ps4Init();
+
+  testStall();
+  testRepeatedDeinit();
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,137 @@
+#include <string.h>
+
+#include "ps4_test.h"
+
+/* Plays rumble tracks on the simulated timer and counts the output
+ * reports sent, which should only be the ticks changing the motors */
+
+#define TICK_US (PS4_RUMBLE_TICK_MS * 1000)
+
+typedef struct {
+  uint32_t ticks;
+  uint32_t changes;  // ticks after which the motor bytes sent differ
+  uint8_t max_small;
+  uint8_t max_large;
+} playback_t;
+
+static uint32_t acknowledged = 0;
+
+/* The controller acknowledges each output report, which lets the next
+ * one go out */
+static void acknowledge() {
+  static const uint8_t handshake[] = {hid_cmd_code_handshake};
+
+  while (fake_l2cap.hid_sends != acknowledged) {
+    acknowledged = fake_l2cap.hid_sends;
+    ps4_hid_control_data(handshake, sizeof(handshake));
+  }
+}
+
+static void resetSends() {
+  fake_l2cap_reset();
+  acknowledged = 0;
+}
+
+static void connect() {
+  uint8_t packet[FAKE_REPORT_SIZE];
+
+  fake_report(packet);
+  ps4ConnectEvent(1);
+  fake_time_advance(1250);
+  parsePacket(packet);  // the first report only completes the connection
+
+  // Let the reports of the connection setup go out
+  acknowledge();
+}
+
+/* Runs the timer tick by tick until the mixing stops */
+static void play(playback_t* playback) {
+  uint8_t small = fake_l2cap.last_hid.data[ps4_control_packet_index_small_rumble];
+  uint8_t large = fake_l2cap.last_hid.data[ps4_control_packet_index_large_rumble];
+
+  memset(playback, 0, sizeof(*playback));
+
+  while (fake_timer_active("ps4_rumble") && playback->ticks < 1000) {
+    fake_time_advance(TICK_US);
+    acknowledge();
+    playback->ticks++;
+
+    uint8_t next_small = fake_l2cap.last_hid.data[ps4_control_packet_index_small_rumble];
+    uint8_t next_large = fake_l2cap.last_hid.data[ps4_control_packet_index_large_rumble];
+    if (next_small != small || next_large != large) {
+      playback->changes++;
+    }
+    small = next_small;
+    large = next_large;
+
+    playback->max_small = small > playback->max_small ? small : playback->max_small;
+    playback->max_large = large > playback->max_large ? large : playback->max_large;
+  }
+}
+
+static void testRamp() {
+  playback_t playback;
+
+  resetSends();
+  CHECK(ps4RumblePlay(&ps4_rumble_ramp_up, 255) >= 0);
+  play(&playback);
+
+  // One report per quantization step of the ramp, not one per tick
+  printf("1s ramp: %u reports over %u ticks\n", (unsigned)fake_l2cap.hid_sends, (unsigned)playback.ticks);
+  CHECK_EQ(fake_l2cap.hid_sends, playback.changes);
+  CHECK(playback.ticks >= 100);
+  CHECK(fake_l2cap.hid_sends <= (256 >> PS4_RUMBLE_QUANTIZE_BITS) + 1);
+  CHECK(fake_l2cap.hid_sends < playback.ticks);
+  CHECK_EQ(playback.max_small, 255);
+  CHECK_EQ(playback.max_large, 255);
+  CHECK(!fake_timer_active("ps4_rumble"));
+}
+
+static void testConstant() {
+  playback_t playback;
+
+  // A click holds the motors for 30ms: one report to start, one to stop
+  resetSends();
+  CHECK(ps4RumblePlay(&ps4_rumble_click, 255) >= 0);
+  play(&playback);
+  CHECK_EQ(fake_l2cap.hid_sends, 2);
+  CHECK_EQ(fake_l2cap.last_hid.data[ps4_control_packet_index_large_rumble], 0);
+}
+
+static void testMix() {
+  playback_t playback;
+
+  // Two ramps at half strength add up to about one at full strength
+  resetSends();
+  CHECK(ps4RumblePlay(&ps4_rumble_ramp_down, 128) >= 0);
+  CHECK(ps4RumblePlay(&ps4_rumble_ramp_down, 128) >= 0);
+  play(&playback);
+  CHECK_EQ(fake_l2cap.hid_sends, playback.changes);
+  CHECK(playback.max_small >= 252);
+
+  // Stopped voices end the mixing
+  resetSends();
+  int8_t voice = ps4RumblePlay(&ps4_rumble_engine, 255);
+  CHECK(voice >= 0);
+  for (uint32_t i = 0; i < 100; i++) {
+    fake_time_advance(TICK_US);
+    acknowledge();
+  }
+  CHECK(fake_timer_active("ps4_rumble"));
+  ps4RumbleStop(voice);
+  play(&playback);
+  CHECK(playback.ticks <= 1);
+  CHECK_EQ(fake_l2cap.last_hid.data[ps4_control_packet_index_small_rumble], 0);
+}
+
+int main() {
+  ps4Init();
+
+  connect();
+
+  testRamp();
+  testConstant();
+  testMix();
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,213 @@
+#include <string.h>
+
+#include "ps4_test.h"
+
+/* Feeds synthetic touchpad frames through the report path: checks the
+ * decoded contact table, then the gestures recognized from taps, swipes,
+ * scrolls, pinches and a long press. The frames are generated here with
+ * straight, evenly spaced finger paths; no frames recorded from a
+ * controller are in the tree. */
+
+#define FRAME_TICKS 938  // controller clock, 16/3 us each
+#define FRAME_INTERVAL_US (FRAME_TICKS * 16 / 3)
+
+typedef struct {
+  uint8_t id;
+  bool down;
+  uint16_t x;
+  uint16_t y;
+} finger_t;
+
+#define UP(id) ((finger_t){(id), false, 0, 0})
+#define DOWN(id, x, y) ((finger_t){(id), true, (x), (y)})
+
+static uint8_t packet[FAKE_REPORT_SIZE];
+static uint16_t ticks = 0;
+static uint8_t counter = 0;
+
+static ps4_touchpad_t last_touchpad;
+static uint32_t touchpad_calls = 0;
+
+static ps4_gesture_t gestures[64];
+static uint8_t gesture_count = 0;
+
+static void onTouchpad(void* object, const ps4_touchpad_t* touchpad) {
+  last_touchpad = *touchpad;
+  touchpad_calls++;
+}
+
+static void onGesture(void* object, const ps4_gesture_t* gesture) {
+  if (gesture_count < 64) {
+    gestures[gesture_count++] = *gesture;
+  }
+}
+
+static void writeFinger(uint8_t* finger, finger_t f) {
+  finger[0] = f.id | (f.down ? 0 : 0x80);
+  finger[1] = f.x & 0xFF;
+  finger[2] = ((f.x >> 8) & 0x0F) | ((f.y & 0x0F) << 4);
+  finger[3] = f.y >> 4;
+}
+
+/* Appends a touch frame to the report being built */
+static void addFrame(finger_t first, finger_t second) {
+  uint8_t* frame = &packet[46 + packet[45] * 9];
+
+  frame[0] = ++counter;
+  writeFinger(&frame[1], first);
+  writeFinger(&frame[5], second);
+  packet[45]++;
+}
+
+static void send() {
+  ticks += FRAME_TICKS;
+  packet[22] = ticks & 0xFF;
+  packet[23] = ticks >> 8;
+
+  fake_time_advance(FRAME_INTERVAL_US);
+  parsePacket(packet);
+  packet[45] = 0;
+}
+
+/* One report carrying one new frame */
+static void frame(finger_t first, finger_t second) {
+  addFrame(first, second);
+  send();
+}
+
+static void connect() {
+  fake_report(packet);
+  ps4ConnectEvent(1);
+  send();  // the first report only completes the connection
+  gesture_count = 0;
+}
+
+static void testContacts() {
+  ps4SetTouchpadCallback(NULL, &onTouchpad);
+  connect();
+
+  frame(DOWN(5, 100, 200), UP(0));
+  CHECK_EQ(touchpad_calls, 1);
+  CHECK(last_touchpad.contact[0].active);
+  CHECK(last_touchpad.contact[0].began);
+  CHECK_EQ(last_touchpad.contact[0].id, 5);
+  CHECK_EQ(last_touchpad.contact[0].x, 100);
+  CHECK_EQ(last_touchpad.contact[0].y, 200);
+  CHECK(!last_touchpad.contact[1].active);
+
+  // A report repeating the last frame is skipped
+  packet[45] = 1;
+  send();
+  CHECK_EQ(touchpad_calls, 1);
+
+  // Two new frames in one report: the second finger keeps its own slot
+  addFrame(DOWN(5, 110, 200), DOWN(6, 1900, 900));
+  addFrame(DOWN(5, 120, 200), DOWN(6, 1890, 900));
+  send();
+  CHECK_EQ(touchpad_calls, 2);
+  CHECK_EQ(last_touchpad.frames, 2);
+  CHECK_EQ(last_touchpad.contact[0].x, 120);
+  CHECK(!last_touchpad.contact[0].began);
+  CHECK(last_touchpad.contact[0].vx > 0);
+  CHECK_EQ(last_touchpad.contact[1].id, 6);
+  CHECK_EQ(last_touchpad.contact[1].x, 1890);
+  CHECK_EQ(last_touchpad.contact[1].y, 900);
+  CHECK(last_touchpad.contact[1].began);
+
+  // The first finger is lifted, the second one stays in its slot
+  frame(UP(5), DOWN(6, 1880, 900));
+  CHECK(!last_touchpad.contact[0].active);
+  CHECK(last_touchpad.contact[0].ended);
+  CHECK_EQ(last_touchpad.contact[0].x, 120);
+  CHECK(last_touchpad.contact[1].active);
+  CHECK_EQ(last_touchpad.contact[1].x, 1880);
+
+  frame(UP(5), UP(6));
+  CHECK(!last_touchpad.contact[1].active);
+  CHECK(last_touchpad.contact[1].ended);
+
+  ps4SetTouchpadCallback(NULL, NULL);
+}
+
+/* Checks that the gestures recognized are one start, updates and one end
+ * of the given type */
+static void checkGesture(uint8_t type) {
+  CHECK(gesture_count >= 2);
+  if (gesture_count < 2) {
+    return;
+  }
+
+  CHECK_EQ(gestures[0].type, type);
+  CHECK_EQ(gestures[0].phase, ps4_gesture_phase_start);
+  for (uint8_t i = 1; i + 1 < gesture_count; i++) {
+    CHECK_EQ(gestures[i].type, type);
+    CHECK_EQ(gestures[i].phase, ps4_gesture_phase_update);
+  }
+  CHECK_EQ(gestures[gesture_count - 1].type, type);
+  CHECK_EQ(gestures[gesture_count - 1].phase, ps4_gesture_phase_end);
+}
+
+static void testGestures() {
+  ps4SetGestureCallback(NULL, &onGesture);
+  connect();
+
+  // Tap: lifted quickly, with the jitter of a resting finger
+  for (uint16_t i = 0; i < 10; i++) {
+    frame(DOWN(1, 500 + i % 2, 400), UP(0));
+  }
+  frame(UP(1), UP(0));
+  CHECK_EQ(gesture_count, 2);
+  checkGesture(ps4_gesture_tap);
+  CHECK(gestures[0].x >= 500 && gestures[0].x <= 501);
+  gesture_count = 0;
+
+  // Swipe to the right at 15 units per frame
+  for (uint16_t i = 0; i < 20; i++) {
+    frame(DOWN(2, 500 + i * 15, 400), UP(0));
+  }
+  frame(UP(2), UP(0));
+  checkGesture(ps4_gesture_swipe);
+  CHECK_EQ(gestures[gesture_count - 1].dx, 19 * 15);
+  CHECK_EQ(gestures[gesture_count - 1].dy, 0);
+  CHECK(gestures[gesture_count - 1].vx > 2500 && gestures[gesture_count - 1].vx < 3500);
+  gesture_count = 0;
+
+  // Scroll: two fingers moving down together
+  for (uint16_t i = 0; i < 20; i++) {
+    frame(DOWN(3, 500, 300 + i * 8), DOWN(4, 800, 300 + i * 8));
+  }
+  frame(UP(3), UP(4));
+  checkGesture(ps4_gesture_scroll);
+  CHECK_EQ(gestures[gesture_count - 1].x, 650);
+  CHECK_EQ(gestures[gesture_count - 1].dy, 19 * 8);
+  CHECK_EQ(gestures[gesture_count - 1].spread, 0);
+  gesture_count = 0;
+
+  // Pinch: two fingers moving apart around the same middle
+  for (uint16_t i = 0; i < 20; i++) {
+    frame(DOWN(5, 900 - i * 10, 400), DOWN(6, 1000 + i * 10, 400));
+  }
+  frame(UP(5), UP(6));
+  checkGesture(ps4_gesture_pinch);
+  CHECK_EQ(gestures[gesture_count - 1].x, 950);
+  CHECK_EQ(gestures[gesture_count - 1].spread, 19 * 20);
+  gesture_count = 0;
+
+  // A long press is neither a tap nor a swipe
+  for (uint16_t i = 0; i < 60; i++) {
+    frame(DOWN(7, 500, 400), UP(0));
+  }
+  frame(UP(7), UP(0));
+  CHECK_EQ(gesture_count, 0);
+
+  ps4SetGestureCallback(NULL, NULL);
+}
+
+int main() {
+  ps4Init();
+
+  testContacts();
+  testGestures();
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ps4_test.h"
+
+/* Compares the window aggregates after every report with a brute-force
+ * scan over all reports so far, for randomly timed reports with random
+ * sticks, triggers, sensors and buttons */
+
+#define REPORTS 20000
+#define SHORT_WINDOW_MS 100
+#define LONG_WINDOW_MS 1000  // longer than PS4_WINDOW_LENGTH reports
+
+typedef struct {
+  uint32_t time;
+  int32_t values[PS4_CHANNEL_COUNT];
+  uint32_t buttons;
+} report_t;
+
+static report_t reports[REPORTS];
+static uint32_t report_count = 0;
+static uint32_t mismatches = 0;
+
+static void recordReport(const ps4_t* ps4, const ps4_event_t* event) {
+  report_t* report = &reports[report_count++];
+
+  report->time = (uint32_t)ps4_report_time();
+  report->buttons = ps4->button.mask;
+  ps4_channels_read(ps4, report->values);
+}
+
+static void checkWindow(uint8_t window, uint32_t duration_ms) {
+  const report_t* newest = &reports[report_count - 1];
+  uint32_t duration = duration_ms * 1000;
+  int64_t sum[PS4_CHANNEL_COUNT] = {0};
+  int32_t min[PS4_CHANNEL_COUNT], max[PS4_CHANNEL_COUNT];
+  uint32_t buttons = 0;
+  uint16_t count = 0;
+
+  for (uint8_t c = 0; c < PS4_CHANNEL_COUNT; c++) {
+    min[c] = INT32_MAX;
+    max[c] = INT32_MIN;
+  }
+
+  // The newest report is always in, older ones while within the duration
+  // and the record ring
+  for (uint32_t k = report_count; k-- > 0;) {
+    if (k < report_count - 1 && newest->time - reports[k].time >= duration) {
+      break;
+    }
+
+    if (count < PS4_WINDOW_LENGTH) {
+      for (uint8_t c = 0; c < PS4_CHANNEL_COUNT; c++) {
+        sum[c] += reports[k].values[c];
+        min[c] = reports[k].values[c] < min[c] ? reports[k].values[c] : min[c];
+        max[c] = reports[k].values[c] > max[c] ? reports[k].values[c] : max[c];
+      }
+      count++;
+    }
+
+    buttons |= reports[k].buttons;
+  }
+
+  bool is_match = ps4WindowCount(window) == count && ps4WindowButtons(window) == buttons;
+  for (uint8_t c = 0; c < PS4_CHANNEL_COUNT; c++) {
+    is_match = is_match && ps4WindowMin(window, c) == min[c] && ps4WindowMax(window, c) == max[c] &&
+               ps4WindowAverage(window, c) == (int16_t)(sum[c] / count);
+  }
+
+  if (!is_match && mismatches++ < 4) {
+    printf("window %u differs after report %u\n", (unsigned)window, (unsigned)report_count);
+  }
+}
+
+static void testRandomReports() {
+  uint8_t packet[FAKE_REPORT_SIZE];
+  uint16_t ticks = 0;
+
+  srand(1);
+  fake_report(packet);
+  ps4SetEventCallbackV2(&recordReport);
+  ps4ConnectEvent(1);
+  parsePacket(packet);  // the first report only completes the connection
+
+  CHECK(ps4SetWindow(0, SHORT_WINDOW_MS));
+  CHECK(ps4SetWindow(1, LONG_WINDOW_MS));
+
+  for (uint32_t n = 0; n < REPORTS; n++) {
+    // 0.8 to 1.7ms apart
+    uint16_t elapsed = 150 + rand() % 170;
+    ticks += elapsed;
+    packet[22] = ticks & 0xFF;
+    packet[23] = ticks >> 8;
+
+    for (uint8_t i = 13; i <= 16; i++) {
+      packet[i] = rand();
+    }
+    packet[17] = rand() % 50 == 0 ? 0x28 : 0x08;  // cross now and then
+    packet[20] = rand();
+    packet[21] = rand();
+    for (uint8_t i = 25; i < 37; i++) {
+      packet[i] = rand();
+    }
+
+    fake_time_advance(elapsed * 16 / 3);
+    parsePacket(packet);
+
+    checkWindow(0, SHORT_WINDOW_MS);
+    checkWindow(1, LONG_WINDOW_MS);
+  }
+
+  CHECK_EQ(report_count, REPORTS);
+  CHECK_EQ(mismatches, 0);
+
+  ps4SetWindow(0, 0);
+  ps4SetWindow(1, 0);
+  ps4SetEventCallbackV2(NULL);
+}
+
+int main() {
+  ps4Init();
+
+  testRandomReports();
+
+  return TEST_RESULT();
+}